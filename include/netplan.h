@@ -61,6 +61,12 @@ netplan_state_write_yaml(
         const char* rootdir,
         GError** error);
 
+NETPLAN_PUBLIC gboolean
+netplan_state_dump_yaml(
+        const NetplanState* np_state,
+        int output_fd,
+        GError** error);
+
 NETPLAN_PUBLIC gboolean
 netplan_netdef_write_yaml(
         const NetplanState* np_state,
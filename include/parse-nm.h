@@ -25,6 +25,9 @@
 NETPLAN_PUBLIC gboolean
 netplan_parser_load_keyfile(NetplanParser* npp, const char* filename, GError** error);
 
+NETPLAN_PUBLIC gboolean
+netplan_parser_load_keyfile_dir(NetplanParser* npp, const char* dirname, guint jobs, GError** error);
+
 /********** Old API below this ***********/
 
 NETPLAN_PUBLIC gboolean
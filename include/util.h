@@ -26,8 +26,45 @@ netplan_delete_connection(const char* id, const char* rootdir);
 NETPLAN_PUBLIC gboolean
 netplan_generate(const char* rootdir);
 
+NETPLAN_PUBLIC gboolean
+netplan_util_set_yaml(const NetplanState* np_state, const char* key_path, const char* value,
+                      const char* origin_hint, const char* rootdir, GError** error);
+
+typedef struct netplan_config_tree NetplanConfigTree;
+
+NETPLAN_PUBLIC NetplanConfigTree*
+netplan_config_tree_new(const char* rootdir, GError** error);
+
+NETPLAN_PUBLIC const char*
+netplan_config_tree_get(NetplanConfigTree* tree, const char* key_path);
+
+NETPLAN_PUBLIC void
+netplan_config_tree_free(NetplanConfigTree* tree);
+
 NETPLAN_PUBLIC gchar*
 netplan_get_id_from_nm_filename(const char* filename, const char* ssid);
 
 NETPLAN_PUBLIC gchar*
 netplan_get_filename_by_id(const char* netdef_id, const char* rootdir);
+
+typedef struct netplan_state_iterator NetplanStateIterator;
+
+NETPLAN_PUBLIC NetplanStateIterator*
+netplan_state_iterator_new(const NetplanState* np_state, const char* devtype);
+
+NETPLAN_PUBLIC NetplanNetDefinition*
+netplan_state_iterator_next(NetplanStateIterator* iter);
+
+NETPLAN_PUBLIC void
+netplan_state_iterator_free(NetplanStateIterator* iter);
+
+typedef struct netplan_match_engine NetplanMatchEngine;
+
+NETPLAN_PUBLIC NetplanMatchEngine*
+netplan_match_engine_new(const NetplanState* np_state, const char* sysfs_dir);
+
+NETPLAN_PUBLIC const char*
+netplan_match_engine_map(NetplanMatchEngine* engine, const char* const* interfaces);
+
+NETPLAN_PUBLIC void
+netplan_match_engine_free(NetplanMatchEngine* engine);
@@ -23,9 +23,9 @@ import logging
 import os
 import sys
 import glob
+import fnmatch
 import subprocess
 import shutil
-import netifaces
 import time
 
 import netplan.cli.utils as utils
@@ -60,6 +60,7 @@ class NetplanApply(utils.NetplanCommand):
         self.parse_args()
         self.run_command()
 
+    @utils.profiled('apply')
     def command_apply(self, run_generate=True, sync=False, exit_on_error=True, state_dir=None):  # pragma: nocover
         config_manager = ConfigManager()
         if state_dir:
@@ -68,7 +69,7 @@ class NetplanApply(utils.NetplanCommand):
         # For certain use-cases, we might want to only apply specific configuration.
         # If we only need SR-IOV configuration, do that and exit early.
         if self.sriov_only:
-            NetplanApply.process_sriov_config(config_manager, exit_on_error)
+            NetplanApply.process_sriov_config(config_manager, exit_on_error, utils.DeviceInventory())
             return
         # If we only need OpenVSwitch cleanup, do that and exit early.
         elif self.only_ovs_cleanup:
@@ -114,23 +115,33 @@ class NetplanApply(utils.NetplanCommand):
             old_ovs_glob.remove(ovs_cleanup_service)
         old_files_ovs = bool(old_ovs_glob)
         old_nm_glob = glob.glob('/run/NetworkManager/system-connections/netplan-*')
-        nm_ifaces = utils.nm_interfaces(old_nm_glob, netifaces.interfaces())
+        # One snapshot of the network devices, refreshed whenever they might have changed
+        inventory = utils.DeviceInventory()
+        old_devices = inventory.interfaces
+        # remember the interfaces of each NM connection profile, as removed
+        # profiles cannot be read anymore after generating the new config
+        old_nm_ifaces = {f: utils.nm_interfaces([f], old_devices) for f in old_nm_glob}
+        nm_ifaces = set().union(*old_nm_ifaces.values())
         old_files_nm = bool(old_nm_glob)
 
         generator_call = []
         generate_out = None
-        if 'NETPLAN_PROFILE' in os.environ:
+        # NETPLAN_PROFILE=json is phase timing, other values mean valgrind
+        if os.environ.get('NETPLAN_PROFILE', 'json') != 'json':
             generator_call.extend(['valgrind', '--leak-check=full'])
             generate_out = subprocess.STDOUT
 
         generator_call.append(utils.get_generator_path())
-        if run_generate and subprocess.call(generator_call, stderr=generate_out) != 0:
-            if exit_on_error:
-                sys.exit(os.EX_CONFIG)
-            else:
-                raise ConfigurationError("the configuration could not be generated")
+        with utils.profile.span('generate'):
+            if run_generate and subprocess.call(generator_call, stderr=generate_out) != 0:
+                if exit_on_error:
+                    sys.exit(os.EX_CONFIG)
+                else:
+                    raise ConfigurationError("the configuration could not be generated")
 
-        devices = netifaces.interfaces()
+        inventory.refresh()
+        devices = inventory.interfaces
+        utils.profile.count('devices', len(devices))
 
         # Re-start service when
         # 1. We have configuration files for it
@@ -156,20 +167,49 @@ class NetplanApply(utils.NetplanCommand):
         if not restart_nm and old_files_nm:
             restart_nm = True
 
+        # If 'netplan generate' knows which of its outputs changed since the
+        # last successful apply (a failed apply keeps its changes pending), only
+        # (re-)configure what actually differs. If nothing changed, 'netplan
+        # apply' is asked to repair the runtime state (e.g. interfaces changed
+        # by hand), so everything is (re-)configured, as if the change set was
+        # unknown.
+        changes = utils.netplan_generate_changes() or None
+        nm_flush_ifaces = utils.nm_interfaces(restart_nm_glob, devices)
+        networkd_ifaces = None  # i.e. all networkd managed interfaces
+        wpa_units = None  # i.e. all netplan-wpa-* units
+        ovs_units = None  # i.e. all netplan-ovs-* units
+        udev_changed = True
+        if changes is not None:
+            logging.debug('netplan generated changes: %s', changes)
+            restart_networkd = any(f.startswith(('/run/systemd/network/', '/run/systemd/system/')) for f in changes)
+            restart_nm = any(f.startswith('/run/NetworkManager/') for f in changes)
+            udev_changed = any(f.endswith(('.link', '.rules')) for f in changes)
+            networkd_ifaces = NetplanApply.changed_networkd_interfaces(changes, devices)
+            wpa_units = NetplanApply.changed_units(changes, 'netplan-wpa-*.service')
+            ovs_units = NetplanApply.changed_units(changes, 'netplan-ovs-*.service')
+            changed_nm_ifaces = NetplanApply.changed_nm_interfaces(changes, old_nm_ifaces, devices)
+            if changed_nm_ifaces is not None:
+                nm_ifaces = changed_nm_ifaces
+                nm_flush_ifaces = nm_flush_ifaces.intersection(changed_nm_ifaces)
+
         # stop backends
         if restart_networkd:
             logging.debug('netplan generated networkd configuration changed, reloading networkd')
             # Running 'systemctl daemon-reload' will re-run the netplan systemd generator,
             # so let's make sure we only run it iff we're willing to run 'netplan generate'
-            if run_generate:
+            if run_generate and (changes is None or any(f.startswith('/run/systemd/system/') for f in changes)):
                 utils.systemctl_daemon_reload()
             # Clean up any old netplan related OVS ports/bonds/bridges, if applicable
-            NetplanApply.process_ovs_cleanup(config_manager, old_files_ovs, restart_ovs, exit_on_error)
-            wpa_services = ['netplan-wpa-*.service']
-            # Historically (up to v0.98) we had netplan-wpa@*.service files, in case of an
-            # upgraded system, we need to make sure to stop those.
-            if utils.systemctl_is_active('netplan-wpa@*.service'):
-                wpa_services.insert(0, 'netplan-wpa@*.service')
+            if ovs_units is None or ovs_units:
+                NetplanApply.process_ovs_cleanup(config_manager, old_files_ovs, restart_ovs, exit_on_error)
+            if wpa_units is None:
+                wpa_services = ['netplan-wpa-*.service']
+                # Historically (up to v0.98) we had netplan-wpa@*.service files, in case of an
+                # upgraded system, we need to make sure to stop those.
+                if utils.systemctl_is_active('netplan-wpa@*.service'):
+                    wpa_services.insert(0, 'netplan-wpa@*.service')
+            else:
+                wpa_services = wpa_units
             utils.systemctl('stop', wpa_services, sync=sync)
         else:
             logging.debug('no netplan generated networkd configuration exists')
@@ -192,12 +232,14 @@ class NetplanApply(utils.NetplanCommand):
             logging.debug('no netplan generated NM configuration exists')
 
         # Refresh devices now; restarting a backend might have made something appear.
-        devices = netifaces.interfaces()
+        inventory.refresh()
+        devices = inventory.interfaces
 
         # evaluate config for extra steps we need to take (like renaming)
         # for now, only applies to non-virtual (real) devices.
-        config_manager.parse()
-        changes = NetplanApply.process_link_changes(devices, config_manager)
+        with utils.profile.span('link_changes'):
+            config_manager.parse()
+            changes = NetplanApply.process_link_changes(devices, config_manager, inventory)
         # delete virtual interfaces that have been defined in a previous state
         # but are not configured anymore in the current YAML
         if self.state:
@@ -212,8 +254,9 @@ class NetplanApply(utils.NetplanCommand):
         # the interface name, if it was already renamed once (e.g. during boot),
         # because of the NamePolicy=keep default:
         # https://www.freedesktop.org/software/systemd/man/systemd.net-naming-scheme.html
-        devices = netifaces.interfaces()
-        for device in devices:
+        inventory.refresh()
+        devices = inventory.interfaces
+        for device in (devices if udev_changed else []):
             logging.debug('netplan triggering .link rules for %s', device)
             try:
                 subprocess.check_call(['udevadm', 'test-builtin',
@@ -224,54 +267,114 @@ class NetplanApply(utils.NetplanCommand):
             except subprocess.CalledProcessError:
                 logging.debug('Ignoring device without syspath: %s', device)
 
-        # apply some more changes manually
+        # apply some more changes manually, all in one batch
+        link_cmds = []
         for iface, settings in changes.items():
             # rename non-critical network interfaces
             if settings.get('name'):
                 # bring down the interface, using its current (matched) interface name
-                subprocess.check_call(['ip', 'link', 'set', 'dev', iface, 'down'],
-                                      stdout=subprocess.DEVNULL,
-                                      stderr=subprocess.DEVNULL)
+                link_cmds.append('link set dev {} down'.format(iface))
                 # rename the interface to the name given via 'set-name'
-                subprocess.check_call(['ip', 'link', 'set',
-                                       'dev', iface,
-                                       'name', settings.get('name')],
-                                      stdout=subprocess.DEVNULL,
-                                      stderr=subprocess.DEVNULL)
+                link_cmds.append('link set dev {} name {}'.format(iface, settings.get('name')))
+        utils.profile.count('renamed_links', len(link_cmds) // 2)
+        utils.ip_batch(link_cmds)
 
         subprocess.check_call(['udevadm', 'settle'])
 
         # apply any SR-IOV related changes, if applicable
-        NetplanApply.process_sriov_config(config_manager, exit_on_error)
+        inventory.refresh()
+        NetplanApply.process_sriov_config(config_manager, exit_on_error, inventory)
 
         # (re)start backends
-        if restart_networkd:
-            netplan_wpa = [os.path.basename(f) for f in glob.glob('/run/systemd/system/*.wants/netplan-wpa-*.service')]
-            # exclude the special 'netplan-ovs-cleanup.service' unit
-            netplan_ovs = [os.path.basename(f) for f in glob.glob('/run/systemd/system/*.wants/netplan-ovs-*.service')
-                           if not f.endswith('/' + OVS_CLEANUP_SERVICE)]
-            # Run 'systemctl start' command synchronously, to avoid race conditions
-            # with 'oneshot' systemd service units, e.g. netplan-ovs-*.service.
-            utils.networkctl_reconfigure(utils.networkd_interfaces())
-            # 1st: execute OVS cleanup, to avoid races while applying OVS config
-            utils.systemctl('start', [OVS_CLEANUP_SERVICE], sync=True)
-            # 2nd: start all other services
-            utils.systemctl('start', netplan_wpa + netplan_ovs, sync=True)
-        if restart_nm:
-            # Flush all IP addresses of NM managed interfaces, to avoid NM creating
-            # new, non netplan-* connection profiles, using the existing IPs.
-            for iface in utils.nm_interfaces(restart_nm_glob, devices):
-                utils.ip_addr_flush(iface)
-            utils.systemctl_network_manager('start', sync=sync)
-            if sync:
-                # wait up to 2 sec for 'STATE=connected (site/local-only)' or
-                # 'STATE=connected' to appear in 'nmcli general' STATE
-                env = dict(os.environ, LC_ALL='C')
-                cmd = ['nmcli', 'general', 'status']
-                for _ in range(20):
-                    if b'\nconnected' in subprocess.check_output(cmd, env=env):
-                        break
-                    time.sleep(0.1)
+        with utils.profile.span('start_backends'):
+            if restart_networkd:
+                netplan_wpa = [os.path.basename(f) for f in glob.glob('/run/systemd/system/*.wants/netplan-wpa-*.service')]
+                # exclude the special 'netplan-ovs-cleanup.service' unit
+                netplan_ovs = [os.path.basename(f) for f in glob.glob('/run/systemd/system/*.wants/netplan-ovs-*.service')
+                               if not f.endswith('/' + OVS_CLEANUP_SERVICE)]
+                if wpa_units is not None:
+                    netplan_wpa = [unit for unit in netplan_wpa if unit in wpa_units]
+                if ovs_units is not None:
+                    netplan_ovs = [unit for unit in netplan_ovs if unit in ovs_units]
+                # Run 'systemctl start' command synchronously, to avoid race conditions
+                # with 'oneshot' systemd service units, e.g. netplan-ovs-*.service.
+                utils.networkctl_reconfigure([iface for iface in utils.networkd_interfaces()
+                                              if networkd_ifaces is None or iface in networkd_ifaces])
+                # 1st: execute OVS cleanup, to avoid races while applying OVS config
+                if ovs_units is None or ovs_units:
+                    utils.systemctl('start', [OVS_CLEANUP_SERVICE], sync=True)
+                # 2nd: start all other services
+                utils.systemctl('start', netplan_wpa + netplan_ovs, sync=True)
+            if restart_nm:
+                # Flush all IP addresses of NM managed interfaces, to avoid NM creating
+                # new, non netplan-* connection profiles, using the existing IPs.
+                utils.ip_batch(['addr flush {}'.format(iface) for iface in nm_flush_ifaces])
+                utils.systemctl_network_manager('start', sync=sync)
+                if sync:
+                    # wait up to 2 sec for 'STATE=connected (site/local-only)' or
+                    # 'STATE=connected' to appear in 'nmcli general' STATE
+                    env = dict(os.environ, LC_ALL='C')
+                    cmd = ['nmcli', 'general', 'status']
+                    for _ in range(20):
+                        if b'\nconnected' in subprocess.check_output(cmd, env=env):
+                            break
+                        time.sleep(0.1)
+
+        # the generated configuration has been applied
+        utils.netplan_clear_generate_changes()
+
+    @staticmethod
+    def changed_networkd_interfaces(changes, devices):
+        """
+        Calculate the interfaces affected by the networkd configuration in the
+        'netplan generate' change set. Returns None if they cannot be told, i.e.
+        if all networkd interfaces need to be reconfigured.
+        """
+        interfaces = set()
+        for path, (change, netdef_id) in changes.items():
+            if not path.startswith('/run/systemd/network/'):
+                continue
+            names = None
+            if path.endswith('.network') and change != 'removed':
+                names = utils.networkd_match_names(path)
+            elif netdef_id in devices:
+                # netdef IDs equal the interface name for virtual links and
+                # for physical interfaces matched by name
+                names = {netdef_id}
+            elif not path.endswith('.network'):
+                continue  # .link files are handled by udev, .netdev files by networkd
+            if names is None:
+                return None
+            interfaces.update(names)
+        return interfaces
+
+    @staticmethod
+    def changed_nm_interfaces(changes, old_nm_ifaces, devices):
+        """
+        Calculate the interfaces affected by the NetworkManager connection
+        profiles in the 'netplan generate' change set. Returns None if all NM
+        interfaces might be affected, e.g. by global NM configuration.
+        """
+        interfaces = set()
+        for path, (change, _) in changes.items():
+            if not path.startswith('/run/NetworkManager/'):
+                continue
+            if not path.startswith('/run/NetworkManager/system-connections/'):
+                return None
+            interfaces.update(old_nm_ifaces.get(path, set()))
+            if change != 'removed':
+                interfaces.update(utils.nm_interfaces([path], devices))
+        return interfaces
+
+    @staticmethod
+    def changed_units(changes, pattern):
+        """
+        Return the systemd units matching pattern in the 'netplan generate'
+        change set (excluding the special 'netplan-ovs-cleanup.service').
+        """
+        units = {os.path.basename(path) for path in changes if path.startswith('/run/systemd/system/')}
+        units.discard(OVS_CLEANUP_SERVICE)
+        return sorted(fnmatch.filter(units, pattern))
 
     @staticmethod
     def is_composite_member(composites, phy):
@@ -317,15 +420,19 @@ class NetplanApply(utils.NetplanCommand):
         return dropped_interfaces
 
     @staticmethod
-    def process_link_changes(interfaces, config_manager):  # pragma: nocover (covered in autopkgtest)
+    def process_link_changes(interfaces, config_manager, inventory=None):  # pragma: nocover (covered in autopkgtest)
         """
         Go through the pending changes and pick what needs special handling.
         Only applies to non-critical interfaces which can be safely updated.
+        If given, the MAC addresses and drivers are taken from the
+        utils.DeviceInventory the interfaces have been listed from.
         """
 
         changes = {}
         phys = dict(config_manager.physical_interfaces)
         composite_interfaces = [config_manager.bridges, config_manager.bonds]
+        # Match all interfaces against all netdefs at once, if libnetplan can
+        mapping = utils.netplan_get_interface_mapping(interfaces, config_manager.prefix)
 
         # Find physical interfaces which need a rename
         # But do not rename virtual interfaces
@@ -344,7 +451,11 @@ class NetplanApply(utils.NetplanCommand):
                 # may be the same for all interface members.
                 continue
             # Find current name of the interface, according to match conditions and globs (name, mac, driver)
-            current_iface_name = utils.find_matching_iface(interfaces, match)
+            if mapping is not None:
+                matches = mapping.get(phy, [])
+                current_iface_name = matches[0] if len(matches) == 1 else None
+            else:
+                current_iface_name = utils.find_matching_iface(interfaces, match, inventory)
             if not current_iface_name:
                 logging.warning('Cannot find unique matching interface for {}: {}'.format(phy, match))
                 continue
@@ -365,9 +476,9 @@ class NetplanApply(utils.NetplanCommand):
         return changes
 
     @staticmethod
-    def process_sriov_config(config_manager, exit_on_error=True):  # pragma: nocover (covered in autopkgtest)
+    def process_sriov_config(config_manager, exit_on_error=True, inventory=None):  # pragma: nocover (covered in autopkgtest)
         try:
-            apply_sriov_config(config_manager)
+            apply_sriov_config(config_manager, inventory)
         except (ConfigurationError, RuntimeError) as e:
             logging.error(str(e))
             if exit_on_error:
@@ -39,6 +39,10 @@ class NetplanGenerate(utils.NetplanCommand):
                                  help='Search for and generate configuration files in this root directory instead of /')
         self.parser.add_argument('--mapping',
                                  help='Display the netplan device ID/backend/interface name mapping and exit.')
+        self.parser.add_argument('--jobs', '-j', type=int,
+                                 help='Render the configuration of up to JOBS network definitions in parallel.')
+        self.parser.add_argument('--validate', nargs='*', metavar='CONFIG',
+                                 help='Only validate each given root directory or YAML file as a separate configuration.')
 
         self.func = self.command_generate
 
@@ -80,6 +84,10 @@ class NetplanGenerate(utils.NetplanCommand):
             argv += ['--root-dir', self.root_dir]
         if self.mapping:
             argv += ['--mapping', self.mapping]
+        if self.jobs:
+            argv += ['--jobs', str(self.jobs)]
+        if self.validate is not None:
+            argv += ['--validate'] + self.validate
         logging.debug('command generate: running %s', argv)
         # FIXME: os.execv(argv[0], argv) would be better but fails coverage
         sys.exit(subprocess.call(argv))
@@ -17,11 +17,10 @@
 
 '''netplan get command line'''
 
-import yaml
-import re
+import logging
+import sys
 
 import netplan.cli.utils as utils
-from netplan.configmanager import ConfigManager
 
 
 class NetplanGet(utils.NetplanCommand):
@@ -32,7 +31,8 @@ class NetplanGet(utils.NetplanCommand):
                          leaf=True)
 
     def run(self):
-        self.parser.add_argument('key', type=str, nargs='?', default='all', help='The nested key in dotted format')
+        self.parser.add_argument('key', type=str, nargs='*', default=['all'],
+                                 help='The nested key(s) in dotted format')
         self.parser.add_argument('--root-dir', default='/',
                                  help='Read configuration files from this root directory instead of /')
 
@@ -42,26 +42,11 @@ class NetplanGet(utils.NetplanCommand):
         self.run_command()
 
     def command_get(self):
-        config_manager = ConfigManager(prefix=self.root_dir)
-        config_manager.parse()
-        tree = config_manager.tree
-
-        if self.key != 'all':
-            # The 'network.' prefix is optional for netsted keys, its always assumed to be there
-            if not self.key.startswith('network.') and not self.key == 'network':
-                self.key = 'network.' + self.key
-            # Split at '.' but not at '\.' via negative lookbehind expression
-            for k in re.split(r'(?<!\\)\.', self.key):
-                k = k.replace('\\.', '.')  # Unescape interface-ids, containing dots
-                if k in tree.keys():
-                    tree = tree[k]
-                    if not isinstance(tree, dict):
-                        break
-                else:
-                    tree = None
-                    break
-
-        out = yaml.dump(tree, default_flow_style=False)[:-1]  # Remove trailing '\n'
-        if not isinstance(tree, dict) and not isinstance(tree, list):
-            out = out[:-4]  # Remove yaml.dump's '\n...' on primitive values
-        print(out)
+        # The YAML files are merged once by libnetplan, which answers all keys
+        try:
+            values = utils.netplan_get(self.key, self.root_dir)
+        except utils.LibNetplanException as e:
+            logging.error(e)
+            sys.exit(1)
+        for value in values:
+            print(value, end='')
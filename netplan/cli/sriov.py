@@ -20,6 +20,7 @@ import os
 import subprocess
 
 from collections import defaultdict
+from concurrent.futures import ThreadPoolExecutor
 
 import netplan.cli.utils as utils
 from netplan.configmanager import ConfigurationError
@@ -27,7 +28,7 @@ from netplan.configmanager import ConfigurationError
 import netifaces
 
 
-def _get_target_interface(interfaces, config_manager, pf_link, pfs):
+def _get_target_interface(interfaces, config_manager, pf_link, pfs, mapping=None, inventory=None):
     if pf_link not in pfs:
         # handle the match: syntax, get the actual device name
         pf_dev = config_manager.ethernets[pf_link]
@@ -40,6 +41,14 @@ def _get_target_interface(interfaces, config_manager, pf_link, pfs):
                 # assume that, if found, the interface has already been
                 # renamed - use the new name
                 pfs[pf_link] = set_name
+            elif mapping is not None:
+                # no set-name (or interfaces not yet renamed), use what the
+                # match engine found for this PF
+                matches = mapping.get(pf_link, [])
+                if len(matches) > 1:
+                    raise ConfigurationError('matched more than one interface for a PF device: %s' % pf_link)
+                if matches:
+                    pfs[pf_link] = matches[0]
             else:
                 # no set-name (or interfaces not yet renamed) so we need to do
                 # the matching ourselves
@@ -49,8 +58,8 @@ def _get_target_interface(interfaces, config_manager, pf_link, pfs):
 
                 for interface in interfaces:
                     if ((by_name and not utils.is_interface_matching_name(interface, by_name)) or
-                            (by_mac and not utils.is_interface_matching_macaddress(interface, by_mac)) or
-                            (by_driver and not utils.is_interface_matching_driver_name(interface, by_driver))):
+                            (by_mac and not utils.is_interface_matching_macaddress(interface, by_mac, inventory)) or
+                            (by_driver and not utils.is_interface_matching_driver_name(interface, by_driver, inventory))):
                         continue
                     # we have a matching PF
                     # store the matching interface in the dictionary of
@@ -67,11 +76,15 @@ def _get_target_interface(interfaces, config_manager, pf_link, pfs):
 
 
 def get_vf_count_and_functions(interfaces, config_manager,
-                               vf_counts, vfs, pfs):
+                               vf_counts, vfs, pfs, mapping=None, inventory=None):
     """
     Go through the list of netplan ethernet devices and identify which are
     PFs and VFs, matching the former with actual networking interfaces.
     Count how many VFs each PF will need.
+    If given, mapping is the netdef ID -> matched interfaces dict of the
+    match engine (see utils.netplan_get_interface_mapping()), used instead of
+    matching the PFs against each interface here. Otherwise, the MAC addresses
+    and drivers are taken from the utils.DeviceInventory, if given.
     """
     explicit_counts = {}
     for ethernet, settings in config_manager.ethernets.items():
@@ -84,14 +97,14 @@ def get_vf_count_and_functions(interfaces, config_manager,
         # allocated for a PF
         explicit_num = settings.get('virtual-function-count')
         if explicit_num:
-            pf = _get_target_interface(interfaces, config_manager, ethernet, pfs)
+            pf = _get_target_interface(interfaces, config_manager, ethernet, pfs, mapping, inventory)
             if pf:
                 explicit_counts[pf] = explicit_num
             continue
 
         pf_link = settings.get('link')
         if pf_link and pf_link in config_manager.ethernets:
-            _get_target_interface(interfaces, config_manager, pf_link, pfs)
+            _get_target_interface(interfaces, config_manager, pf_link, pfs, mapping, inventory)
 
             if pf_link in pfs:
                 vf_counts[pfs[pf_link]] += 1
@@ -191,14 +204,13 @@ def perform_hardware_specific_quirks(pf):
         pass
 
 
-def apply_vlan_filter_for_vf(pf, vf, vlan_name, vlan_id, prefix='/'):
+def get_vf_index(pf, vf, vlan_name, prefix='/'):
     """
-    Apply the hardware VLAN filtering for the selected VF.
+    Find the index of the selected VF among the VFs of its PF.
     """
 
-    # this is more complicated, because to do this, we actually need to have
-    # the vf index - just knowing the vf interface name is not enough
-    vf_index = None
+    # to set up a VLAN filter, we actually need to have the vf index - just
+    # knowing the vf interface name is not enough
     # the prefix argument is here only for unit testing purposes
     vf_devdir = os.path.join(prefix, 'sys/class/net', vf, 'device')
     vf_dev_id = os.path.basename(os.readlink(vf_devdir))
@@ -208,35 +220,64 @@ def apply_vlan_filter_for_vf(pf, vf, vlan_name, vlan_id, prefix='/'):
             dev_path = os.path.join(pf_devdir, f)
             dev_id = os.path.basename(os.readlink(dev_path))
             if dev_id == vf_dev_id:
-                vf_index = f[6:]
-                break
+                return f[6:]
+
+    raise RuntimeError(
+        'could not determine the VF index for %s while configuring vlan %s' % (vf, vlan_name))
 
-    if not vf_index:
-        raise RuntimeError(
-            'could not determine the VF index for %s while configuring vlan %s' % (vf, vlan_name))
 
-    # now, create the VLAN filter
-    # TODO: would be best if we did this directl via python, without calling
+def apply_vlan_filters_for_vfs(filters, prefix='/'):
+    """
+    Apply the hardware VLAN filtering for the selected VFs, given as a list
+    of (pf, vf, vlan_name, vlan_id) tuples, in a single iproute2 batch.
+    """
+    commands = []
+    vlan_names = {}
+    for pf, vf, vlan_name, vlan_id in filters:
+        vf_index = get_vf_index(pf, vf, vlan_name, prefix)
+        command = 'link set dev %s vf %s vlan %s' % (pf, vf_index, vlan_id)
+        commands.append(command)
+        vlan_names[command] = vlan_name
+
+    # TODO: would be best if we did this directly via python, without calling
     #  the iproute tooling
     try:
-        subprocess.check_call(['ip', 'link', 'set',
-                               'dev', pf,
-                               'vf', vf_index,
-                               'vlan', str(vlan_id)],
-                              stdout=subprocess.DEVNULL,
-                              stderr=subprocess.DEVNULL)
-    except subprocess.CalledProcessError:
+        # a failing filter must not keep the other ones from being set up
+        utils.ip_batch(commands, force=True)
+    except subprocess.CalledProcessError as e:
+        failed = utils.ip_batch_failed_commands(commands, e) or commands
         raise RuntimeError(
-            'failed setting SR-IOV VLAN filter for vlan %s (ip link set command failed)' % vlan_name)
+            'failed setting SR-IOV VLAN filters for vlans %s (ip link set command failed: %s)' %
+            (', '.join(vlan_names[command] for command in failed), (e.stderr or '').strip()))
 
 
-def apply_sriov_config(config_manager):
+def _provision_pf(pf, vf_count):
+    """
+    Set up the required number of VFs for the selected PF, returning whether
+    its VF count changed.
+    """
+    if not set_numvfs_for_pf(pf, vf_count):
+        return False
+    # some cards need special treatment when we want to change the
+    # number of enabled VFs
+    perform_hardware_specific_quirks(pf)
+    return True
+
+
+def apply_sriov_config(config_manager, inventory=None):
     """
     Go through all interfaces, identify which ones are SR-IOV VFs, create
     them and perform all other necessary setup.
+    If given, the devices are taken from the utils.DeviceInventory and
+    matched against the PFs by the match engine of libnetplan.
     """
     config_manager.parse()
-    interfaces = netifaces.interfaces()
+    mapping = None
+    if inventory:
+        interfaces = inventory.interfaces
+        mapping = utils.netplan_get_interface_mapping(interfaces, config_manager.prefix)
+    else:
+        interfaces = netifaces.interfaces()
 
     # for sr-iov devices, we identify VFs by them having a link: field
     # pointing to an PF. So let's browse through all ethernet devices,
@@ -249,28 +290,30 @@ def apply_sriov_config(config_manager):
     pfs = {}
 
     get_vf_count_and_functions(
-        interfaces, config_manager, vf_counts, vfs, pfs)
+        interfaces, config_manager, vf_counts, vfs, pfs, mapping=mapping, inventory=inventory)
 
-    # setup the required number of VFs per PF
+    # setup the required number of VFs per PF, all PFs at the same time, as
+    # the kernel takes a while to create the VFs of each of them
     # at the same time store which PFs got changed in case the NICs
     # require some special quirks for the VF number to change
-    vf_count_changed = []
+    vf_count_changed = False
     if vf_counts:
-        for pf, vf_count in vf_counts.items():
-            if not set_numvfs_for_pf(pf, vf_count):
-                continue
-
-            vf_count_changed.append(pf)
+        with ThreadPoolExecutor(max_workers=len(vf_counts)) as executor:
+            futures = [executor.submit(_provision_pf, pf, vf_count) for pf, vf_count in vf_counts.items()]
+        # raise the error of the first failed PF, if any
+        vf_count_changed = any([future.result() for future in futures])
 
     if vf_count_changed:
-        # some cards need special treatment when we want to change the
-        # number of enabled VFs
-        for pf in vf_count_changed:
-            perform_hardware_specific_quirks(pf)
+        # wait once for udev to process (and rename) all the new VFs
+        subprocess.check_call(['udevadm', 'settle'])
 
         # also, since the VF number changed, the interfaces list also
         # changed, so we need to refresh it
-        interfaces = netifaces.interfaces()
+        if inventory:
+            inventory.refresh()
+            interfaces = inventory.interfaces
+        else:
+            interfaces = netifaces.interfaces()
 
     # now in theory we should have all the new VFs set up and existing;
     # this is needed because we will have to now match the defined VF
@@ -299,6 +342,7 @@ def apply_sriov_config(config_manager):
                 vfs[vf] = vf
 
     filtered_vlans_set = set()
+    vlan_filters = []
     for vlan, settings in config_manager.vlans.items():
         # there is a special sriov vlan renderer that one can use to mark
         # a selected vlan to be done in hardware (VLAN filtering)
@@ -329,6 +373,9 @@ def apply_sriov_config(config_manager):
                 raise ConfigurationError(
                     'interface %s for netplan device %s (%s) already has an SR-IOV vlan defined' % (vf, link, vlan))
 
-            # TODO: make sure that we don't apply the filter twice
-            apply_vlan_filter_for_vf(pf, vf, vlan, vlan_id)
+            vlan_filters.append((pf, vf, vlan, vlan_id))
             filtered_vlans_set.add(vf)
+
+    # set up all the VLAN filters at once
+    if vlan_filters:
+        apply_vlan_filters_for_vfs(vlan_filters)
@@ -20,16 +20,24 @@
 import sys
 import os
 import logging
+import contextlib
+import functools
+import json
+import time
+import uuid
 import fnmatch
 import argparse
 import subprocess
 import netifaces
 import re
+import socket
+import struct
 import ctypes
 import ctypes.util
 
 NM_SERVICE_NAME = 'NetworkManager.service'
 NM_SNAP_SERVICE_NAME = 'snap.network-manager.networkmanager.service'
+GENERATE_CHANGES = os.path.join('run', 'netplan', 'generate.changes')
 
 
 class LibNetplanException(Exception):
@@ -41,23 +49,41 @@ class _GError(ctypes.Structure):
 
 
 lib = ctypes.CDLL(ctypes.util.find_library('netplan'))
-lib.netplan_parse_yaml.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.POINTER(_GError))]
+lib.netplan_util_set_yaml.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p,
+                                      ctypes.POINTER(ctypes.POINTER(_GError))]
+lib.netplan_util_set_yaml.restype = ctypes.c_int
+lib.netplan_config_tree_new.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.POINTER(_GError))]
+lib.netplan_config_tree_new.restype = ctypes.c_void_p
+lib.netplan_config_tree_get.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+lib.netplan_config_tree_get.restype = ctypes.c_char_p
+lib.netplan_config_tree_free.argtypes = [ctypes.c_void_p]
+lib.netplan_config_tree_free.restype = None
 lib.netplan_get_filename_by_id.restype = ctypes.c_char_p
 lib.process_yaml_hierarchy.argtypes = [ctypes.c_char_p]
 lib.process_yaml_hierarchy.restype = ctypes.c_int
+if hasattr(lib, 'process_yaml_snapshot'):
+    lib.process_yaml_snapshot.argtypes = [ctypes.c_char_p]
+    lib.process_yaml_snapshot.restype = ctypes.c_int
 
 
-def netplan_parse(path):
-    # Clear old NetplanNetDefinitions from libnetplan memory
-    lib.netplan_clear_netdefs()
+def netplan_set(key, value, origin_hint=None, rootdir='/'):
+    '''Merge the YAML value of the dotted key into the YAML files in rootdir'''
     err = ctypes.POINTER(_GError)()
-    ret = bool(lib.netplan_parse_yaml(path.encode(), ctypes.byref(err)))
-    if not ret:
-        raise Exception(err.contents.message.decode('utf-8'))
-    lib.netplan_finish_parse(ctypes.byref(err))
-    if err:
-        raise Exception(err.contents.message.decode('utf-8'))
-    return True
+    hint = origin_hint.encode() if origin_hint is not None else None
+    if not lib.netplan_util_set_yaml(None, key.encode(), value.encode(), hint, rootdir.encode(), ctypes.byref(err)):
+        raise LibNetplanException(err.contents.message.decode('utf-8'))
+
+
+def netplan_get(keys, rootdir='/'):
+    '''Return the merged YAML of each of the dotted keys (or 'all') in rootdir'''
+    err = ctypes.POINTER(_GError)()
+    tree = lib.netplan_config_tree_new(rootdir.encode(), ctypes.byref(err))
+    if not tree:
+        raise LibNetplanException(err.contents.message.decode('utf-8'))
+    try:
+        return [lib.netplan_config_tree_get(tree, key.encode()).decode('utf-8') for key in keys]
+    finally:
+        lib.netplan_config_tree_free(tree)
 
 
 def netplan_get_filename_by_id(netdef_id, rootdir):
@@ -109,17 +135,56 @@ class _NetdefIdIterator:
         return next_value
 
 
-def netplan_get_ids_for_devtype(devtype, rootdir):
+def _netplan_load_global_state(rootdir):
     err = ctypes.POINTER(_GError)()
     lib.netplan_clear_netdefs()
-    lib.process_yaml_hierarchy(rootdir.encode('utf-8'))
+    # Re-use the state validated by 'netplan generate', if it is up to date
+    if hasattr(lib, 'process_yaml_snapshot'):
+        lib.process_yaml_snapshot(rootdir.encode('utf-8'))
+    else:  # pragma: nocover (older libnetplan)
+        lib.process_yaml_hierarchy(rootdir.encode('utf-8'))
     lib.netplan_finish_parse(ctypes.byref(err))
     if err:  # pragma: nocover (this is a "break in case of emergency" thing)
         raise Exception(err.contents.message.decode('utf-8'))
+
+
+def netplan_get_ids_for_devtype(devtype, rootdir):
+    _netplan_load_global_state(rootdir)
     nds = list(_NetdefIdIterator(devtype))
     return [lib._netplan_netdef_id(nd).decode('utf-8') for nd in nds]
 
 
+def netplan_get_interface_mapping(interfaces, rootdir='/', sysfs_dir=None):
+    '''
+    Match the given interfaces against the netdefs of the YAML hierarchy in
+    rootdir, by name (globs supported) or ID, MAC address and driver.
+    Returns a dict of netdef ID -> list of matched interfaces, or None if
+    libnetplan does not provide the match engine.
+    '''
+    if not hasattr(lib, '_netplan_match_engine_new_global'):  # pragma: nocover (older libnetplan)
+        return None
+    lib._netplan_match_engine_new_global.argtypes = [ctypes.c_char_p]
+    lib._netplan_match_engine_new_global.restype = ctypes.c_void_p
+    lib.netplan_match_engine_map.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_char_p)]
+    lib.netplan_match_engine_map.restype = ctypes.c_char_p
+    lib.netplan_match_engine_free.argtypes = [ctypes.c_void_p]
+    lib.netplan_match_engine_free.restype = None
+
+    _netplan_load_global_state(rootdir)
+    engine = lib._netplan_match_engine_new_global(sysfs_dir.encode('utf-8') if sysfs_dir else None)
+    try:
+        names = (ctypes.c_char_p * (len(interfaces) + 1))(*[i.encode('utf-8') for i in interfaces], None)
+        res = lib.netplan_match_engine_map(engine, names).decode('utf-8')
+    finally:
+        lib.netplan_match_engine_free(engine)
+
+    mapping = {}
+    for line in res.splitlines():
+        iface, netdef_id = line.split('\t')
+        mapping.setdefault(netdef_id, []).append(iface)
+    return mapping
+
+
 def get_generator_path():
     return os.environ.get('NETPLAN_GENERATE_PATH', '/lib/netplan/generate')
 
@@ -197,6 +262,48 @@ def networkctl_reconfigure(interfaces):
         subprocess.check_call(['networkctl', 'reconfigure'] + list(interfaces))
 
 
+def networkd_match_names(path):
+    '''Return the interface names matched by a networkd .network file, or None
+    if they cannot be told (e.g. when matching by MAC address or globbing)'''
+    names = set()
+    section = None
+    with open(path, 'r') as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith('['):
+                section = line
+            elif section == '[Match]' and line.startswith('Name='):
+                names.update(line[len('Name='):].split())
+    if not names or any(c in name for name in names for c in '*?['):
+        return None
+    return names
+
+
+def netplan_generate_changes(rootdir='/'):
+    '''Return the outputs of 'netplan generate' which were added, changed or
+    removed since the last 'netplan apply', as a dict of path -> (change, netdef ID),
+    or None if the previous output is unknown (i.e. anything might have changed)'''
+    changes = {}
+    try:
+        with open(os.path.join(rootdir, GENERATE_CHANGES), 'r') as f:
+            for line in f:
+                # <added|changed|removed> <netdef ID> <path>
+                fields = line.rstrip('\n').split(' ', 2)
+                if len(fields) == 3:
+                    changes[fields[2]] = (fields[0], None if fields[1] == '-' else fields[1])
+    except FileNotFoundError:
+        return None
+    return changes
+
+
+def netplan_clear_generate_changes(rootdir='/'):
+    '''Mark the change set of 'netplan generate' as applied'''
+    try:
+        os.unlink(os.path.join(rootdir, GENERATE_CHANGES))
+    except FileNotFoundError:
+        pass
+
+
 def systemctl_is_active(unit_pattern):
     '''Return True if at least one matching unit is running'''
     if subprocess.call(['systemctl', '--quiet', 'is-active', unit_pattern]) == 0:
@@ -214,6 +321,209 @@ def ip_addr_flush(iface):
     subprocess.check_call(['ip', 'addr', 'flush', iface], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
 
 
+def ip_batch(commands, force=False):
+    '''Run several iproute2 commands (without the leading 'ip') in one process.
+    Unless force is set, the batch stops at the first failing command. Raises
+    CalledProcessError, carrying the error output of iproute2, if any failed.'''
+    if not commands:
+        return
+    subprocess.run(['ip'] + (['-force'] if force else []) + ['-batch', '-'],
+                   input=''.join(cmd + '\n' for cmd in commands),
+                   universal_newlines=True, check=True,
+                   stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+
+
+def ip_batch_failed_commands(commands, error):
+    '''Return the commands of an ip_batch() which failed with error, as told by
+    the "Command failed -:<line>" messages of iproute2'''
+    lines = re.findall(r'^Command failed -:(\d+)$', error.stderr or '', re.MULTILINE)
+    return [commands[int(line) - 1] for line in lines if 0 < int(line) <= len(commands)]
+
+
+# rtnetlink constants, see linux/netlink.h, linux/rtnetlink.h and linux/if_link.h
+NLMSG_ERROR = 2
+NLMSG_DONE = 3
+NLM_F_REQUEST = 0x1
+NLM_F_DUMP = 0x300
+RTM_NEWLINK = 16
+RTM_GETLINK = 18
+IFLA_ADDRESS = 1
+IFLA_IFNAME = 3
+IFLA_OPERSTATE = 16
+_NLMSGHDR = struct.Struct('=IHHII')
+_IFINFOMSG = struct.Struct('=BxHiII')
+_RTATTR = struct.Struct('=HH')
+
+
+def _nl_align(length):
+    return (length + 3) & ~3
+
+
+def _parse_netlink_links(data, links):
+    '''
+    Parse the RTM_NEWLINK messages of a netlink dump reply into links, a dict
+    of interface name -> {'index', 'address', 'operstate'}.
+    Returns True once the end of the dump has been reached.
+    '''
+    offset = 0
+    while offset + _NLMSGHDR.size <= len(data):
+        length, msg_type, _, _, _ = _NLMSGHDR.unpack_from(data, offset)
+        if length < _NLMSGHDR.size:
+            break
+        if msg_type == NLMSG_DONE:
+            return True
+        if msg_type == NLMSG_ERROR:
+            errno = -struct.unpack_from('=i', data, offset + _NLMSGHDR.size)[0]
+            raise OSError(errno, os.strerror(errno))
+        if msg_type == RTM_NEWLINK:
+            _, _, index, _, _ = _IFINFOMSG.unpack_from(data, offset + _NLMSGHDR.size)
+            link = {'index': index, 'address': '', 'operstate': None}
+            name = None
+            attr = offset + _NLMSGHDR.size + _IFINFOMSG.size
+            while attr + _RTATTR.size <= offset + length:
+                rta_len, rta_type = _RTATTR.unpack_from(data, attr)
+                if rta_len < _RTATTR.size:
+                    break
+                payload = data[attr + _RTATTR.size:attr + rta_len]
+                if rta_type == IFLA_IFNAME:
+                    name = payload.rstrip(b'\0').decode('utf-8')
+                elif rta_type == IFLA_ADDRESS:
+                    link['address'] = ':'.join('%02x' % b for b in payload)
+                elif rta_type == IFLA_OPERSTATE:
+                    link['operstate'] = payload[0]
+                attr += _nl_align(rta_len)
+            if name:
+                links[name] = link
+        offset += _nl_align(length)
+    return False
+
+
+def _netlink_dump_links():  # pragma: nocover (covered in autopkgtest)
+    links = {}
+    with socket.socket(socket.AF_NETLINK, socket.SOCK_RAW, socket.NETLINK_ROUTE) as sock:
+        sock.bind((0, 0))
+        ifinfomsg = _IFINFOMSG.pack(socket.AF_UNSPEC, 0, 0, 0, 0)
+        sock.send(_NLMSGHDR.pack(_NLMSGHDR.size + len(ifinfomsg), RTM_GETLINK,
+                                 NLM_F_REQUEST | NLM_F_DUMP, 1, 0) + ifinfomsg)
+        while not _parse_netlink_links(sock.recv(65536), links):
+            pass
+    return links
+
+
+class DeviceInventory:
+    '''
+    Snapshot of the network devices of the system, taken with a single
+    RTM_GETLINK netlink dump (falling back to netifaces). The drivers are
+    read from sysfs in one walk, the first time one of them is needed.
+    Call refresh() when devices might have appeared or been renamed.
+    '''
+
+    def __init__(self, sysfs_dir='/sys/class/net'):
+        self.sysfs_dir = sysfs_dir
+        self.refresh()
+
+    def refresh(self):
+        try:
+            self._links = _netlink_dump_links()
+        except OSError as e:  # pragma: nocover (netlink is available on any real system)
+            logging.debug('Cannot dump links via netlink, falling back to netifaces: %s', e)
+            self._links = {iface: {'index': None, 'address': None, 'operstate': None}
+                           for iface in netifaces.interfaces()}
+        self._drivers = None
+
+    @property
+    def interfaces(self):
+        return list(self._links)
+
+    def macaddress(self, interface):
+        link = self._links.get(interface)
+        if link is None:
+            return ''
+        if link['address'] is None:  # pragma: nocover (netifaces fallback)
+            link['address'] = get_interface_macaddress(interface)
+        return link['address']
+
+    def driver_name(self, interface):
+        if self._drivers is None:
+            self._drivers = {}
+            for iface in self._links:
+                target = os.path.join(self.sysfs_dir, iface, 'device', 'driver')
+                if os.path.islink(target):
+                    self._drivers[iface] = os.path.basename(os.readlink(target))
+        return self._drivers.get(interface)
+
+
+class Profile:
+    '''
+    Phase timing, enabled via NETPLAN_PROFILE=json. Records the same spans
+    and counters as libnetplan (see src/profile.c): whenever the outermost
+    span ends, everything recorded since is printed to stderr as one line of
+    JSON, along with the trace ID that is passed on to child processes via
+    $NETPLAN_TRACE_ID.
+    '''
+
+    def __init__(self):
+        self._open = 0
+        self._spans = []
+        self._counters = {}
+        self._owns_trace = False
+
+    @staticmethod
+    def enabled():
+        return os.environ.get('NETPLAN_PROFILE') == 'json'
+
+    @contextlib.contextmanager
+    def span(self, name):
+        if not self.enabled():
+            yield
+            return
+        if self._open == 0 and 'NETPLAN_TRACE_ID' not in os.environ:
+            os.environ['NETPLAN_TRACE_ID'] = str(uuid.uuid4())
+            self._owns_trace = True
+        self._open += 1
+        span = {'name': name, 'start': time.time_ns() // 1000}
+        self._spans.append(span)
+        wall = time.monotonic_ns()
+        cpu = time.thread_time_ns()
+        try:
+            yield
+        finally:
+            span['wall_us'] = (time.monotonic_ns() - wall) // 1000
+            span['cpu_us'] = (time.thread_time_ns() - cpu) // 1000
+            self._open -= 1
+            if self._open == 0:
+                self._flush()
+
+    def count(self, counter, n=1):
+        if self.enabled():
+            self._counters[counter] = self._counters.get(counter, 0) + n
+
+    def _flush(self):
+        record = {'process': 'netplan', 'pid': os.getpid(), 'trace': os.environ.get('NETPLAN_TRACE_ID', ''),
+                  'spans': self._spans, 'counters': dict(sorted(self._counters.items()))}
+        sys.stderr.write(json.dumps(record) + '\n')
+        sys.stderr.flush()
+        self._spans = []
+        self._counters = {}
+        if self._owns_trace:
+            del os.environ['NETPLAN_TRACE_ID']
+            self._owns_trace = False
+
+
+profile = Profile()
+
+
+def profiled(name):
+    '''Decorator running the whole function in a profile span'''
+    def decorator(func):
+        @functools.wraps(func)
+        def wrapper(*args, **kwargs):
+            with profile.span(name):
+                return func(*args, **kwargs)
+        return wrapper
+    return decorator
+
+
 def get_interface_driver_name(interface, only_down=False):  # pragma: nocover (covered in autopkgtest)
     devdir = os.path.join('/sys/class/net', interface)
     if only_down:
@@ -248,19 +558,30 @@ def is_interface_matching_name(interface, match_name):
     return fnmatch.fnmatchcase(interface, match_name)
 
 
-def is_interface_matching_driver_name(interface, match_driver):
-    driver_name = get_interface_driver_name(interface)
+def is_interface_matching_driver_name(interface, match_driver, inventory=None):
+    if inventory:
+        driver_name = inventory.driver_name(interface) or ''
+    else:
+        driver_name = get_interface_driver_name(interface)
     # globs are supported
     return fnmatch.fnmatchcase(driver_name, match_driver)
 
 
-def is_interface_matching_macaddress(interface, match_mac):
-    macaddress = get_interface_macaddress(interface)
+def is_interface_matching_macaddress(interface, match_mac, inventory=None):
+    if inventory:
+        macaddress = inventory.macaddress(interface)
+    else:
+        macaddress = get_interface_macaddress(interface)
     # exact, case insensitive match. globs are not supported
     return match_mac.lower() == macaddress.lower()
 
 
-def find_matching_iface(interfaces, match):
+def find_matching_iface(interfaces, match, inventory=None):
+    '''
+    Find the unique interface matching the match stanza. The MAC addresses
+    and drivers are taken from the utils.DeviceInventory, if given, rather
+    than reading them for each interface.
+    '''
     assert isinstance(match, dict)
 
     # Filter for match.name glob, fallback to '*'
@@ -269,11 +590,13 @@ def find_matching_iface(interfaces, match):
 
     # Filter for match.macaddress (exact match)
     if len(matches) > 1 and match.get('macaddress'):
-        matches = list(filter(lambda iface: is_interface_matching_macaddress(iface, match.get('macaddress')), matches))
+        matches = list(filter(lambda iface: is_interface_matching_macaddress(iface, match.get('macaddress'), inventory),
+                              matches))
 
     # Filter for match.driver glob
     if len(matches) > 1 and match.get('driver'):
-        matches = list(filter(lambda iface: is_interface_matching_driver_name(iface, match.get('driver')), matches))
+        matches = list(filter(lambda iface: is_interface_matching_driver_name(iface, match.get('driver'), inventory),
+                              matches))
 
     # Return current name of unique matched interface, if available
     if len(matches) != 1:
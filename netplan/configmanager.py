@@ -36,6 +36,8 @@ class ConfigManager(object):
         self.extra_files = extra_files
         self.config = {}
         self.new_interfaces = set()
+        # (path, mtime, size) of the files of the last parse()
+        self._parsed_stamp = None
 
     @property
     def network(self):
@@ -157,6 +159,17 @@ class ConfigManager(object):
 
         files = [names_to_paths[name] for name in sorted(names_to_paths.keys())]
 
+        # The config is parsed by several stages of a single 'netplan apply',
+        # only parse it again if any of the files changed in the meantime
+        stamp = []
+        for yaml_file in files:
+            st = os.stat(yaml_file)
+            stamp.append((yaml_file, st.st_mtime_ns, st.st_size))
+        if not extra_config and stamp == self._parsed_stamp:
+            logging.debug('Config unchanged since it was last parsed')
+            return
+        self._parsed_stamp = None
+
         self.config['network'] = {
             'ovs_ports': {},
             'openvswitch': {},
@@ -176,6 +189,8 @@ class ConfigManager(object):
 
         for yaml_file in extra_config:
             self.new_interfaces |= self._merge_yaml_config(yaml_file)
+        if not extra_config:
+            self._parsed_stamp = stamp
 
         logging.debug("Merged config:\n{}".format(yaml.dump(self.tree, default_flow_style=False)))
 
@@ -107,6 +107,7 @@ make check
 %{_mandir}/man5/%{name}.5*
 %{_mandir}/man8/%{name}*.8*
 %dir %{_sysconfdir}/%{name}
+%dir %attr(0700,root,root) %{_localstatedir}/cache/%{name}
 %{_prefix}/lib/%{name}/
 %{_datadir}/bash-completion/completions/%{name}
 
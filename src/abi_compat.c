@@ -262,6 +262,25 @@ process_yaml_hierarchy(const char* rootdir)
 }
 // LCOV_EXCL_STOP
 
+/**
+ * Same as process_yaml_hierarchy(), but load the state snapshot written by
+ * "netplan generate" instead, if it is still up to date.
+ */
+gboolean
+process_yaml_snapshot(const char* rootdir)
+{
+    GError* error = NULL;
+    if (netplan_parser_load_snapshot(&global_parser, rootdir, &error))
+        return TRUE;
+    if (error) {
+        // LCOV_EXCL_START
+        g_fprintf(stderr, "%s\n", error->message);
+        exit(1);
+        // LCOV_EXCL_STOP
+    }
+    return process_yaml_hierarchy(rootdir);
+}
+
 /**
  * Helper function for testing only
  */
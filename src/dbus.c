@@ -3,8 +3,13 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <glob.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -15,6 +20,9 @@
 #include <systemd/sd-event.h>
 
 #include "_features.h"
+#include "netplan.h"
+#include "parse.h"
+#include "util.h"
 #include "util-internal.h"
 
 typedef struct {
@@ -30,8 +38,50 @@ typedef struct {
     char *handler_id; /* copy of pending config ID, during io.netplan.Netplan.Config.Try() */
     char *config_dirty; /* Currently pending Set() config object id */
     GHashTable *config_data; /* data of to the /io/netplan/Netplan/config/<ID> objects */
+    GHashTable *state_cache; /* rootdir -> NetplanStateCache */
+    int inotify_fd;
+    sd_event_source *inotify_es;
+    GHashTable *watches; /* inotify watch descriptor -> NetplanStateCache */
+    GQueue *jobs; /* pending calls, which change the configuration (NetplanJob) */
+    struct netplan_job *job; /* the call currently being served, until it is replied to */
 } NetplanData;
 
+/* A call changing the configuration. Those are served one after the other,
+ * without blocking the mainloop while waiting for child processes */
+typedef struct netplan_job {
+    sd_bus_message *m;
+    sd_bus_message_handler_t handler;
+    gboolean pending; /* waiting for a child process or stamp file, replied to afterwards */
+    gboolean try_signalled; /* waiting for the signalled 'netplan try' child to exit */
+    const char *what; /* netplan command of the child process */
+    sd_event_source *child_es;
+    int out_fd; /* stdout and stderr of the child process */
+    int err_fd;
+    /* called once the child process exited, before replying */
+    void (*done)(NetplanData *d, struct netplan_job *job, sd_bus_error *error);
+    char *config_id; /* config state to be cleaned up by done() */
+    GSList *spans; /* profile spans, which end once the job is done */
+    sd_event_source *poll_es; /* polling for the 'netplan try' stamp file */
+    char *stamp;
+    guint polls;
+} NetplanJob;
+
+typedef struct {
+    NetplanData *d;
+    char *rootdir;
+    int wd[3]; /* inotify watches of the NETPLAN_SUBDIRS, or -1 */
+    gboolean watched; /* changes are tracked via inotify, rather than via stamp */
+    gboolean dirty; /* np_state needs to be parsed again */
+    char *stamp; /* identifies the YAML files np_state has been parsed from */
+    NetplanDocumentCache *documents; /* YAML documents of the unchanged files */
+    NetplanState *np_state;
+    char *yaml; /* np_state, serialized */
+    NetplanConfigTree *tree; /* yaml, for key path queries, loaded on demand */
+} NetplanStateCache;
+
+#define NETPLAN_INOTIFY_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB \
+                              | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
 static const char* NETPLAN_SUBDIRS[3] = {"etc", "run", "lib"};
 static const char* NETPLAN_GLOBAL_CONFIG = "BACKUP";
 static char* NETPLAN_ROOT = "/"; /* Can be modified for testing netplan-dbus */
@@ -89,8 +139,6 @@ terminate_try_child_process(int status, NetplanData *d, const char *config_id)
 static int
 _try_accept(bool accept, sd_bus_message *m, NetplanData *d, sd_bus_error *ret_error)
 {
-    g_autoptr(GError) error = NULL;
-    int status = -1;
     int signal = SIGUSR1;
     if (!accept) signal = SIGINT;
 
@@ -106,69 +154,409 @@ _try_accept(bool accept, sd_bus_message *m, NetplanData *d, sd_bus_error *ret_er
      * interrupted by another exception/signal */
 
     /* Send confirm (SIGUSR1) or cancel (SIGINT) signal to 'netplan try' process.
-     * Wait for the child process to stop, synchronously.
-     * Check return code/errors. */
+     * The child process might take a while to stop, e.g. to revert the
+     * configuration and restart the backends, so the current job is replied
+     * to by netplan_try_cancelled_cb(), once it exited. */
     kill(d->try_pid, signal);
-    waitpid(d->try_pid, &status, 0);
-    #if GLIB_CHECK_VERSION (2, 70, 0)
-    g_spawn_check_wait_status(status, &error);
-    #else
-    g_spawn_check_exit_status(status, &error);
-    #endif
-    if (error != NULL)
-        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "netplan try failed: %s", error->message); // LCOV_EXCL_LINE
-
-    terminate_try_child_process(status, d, d->config_id);
-    return sd_bus_reply_method_return(m, "b", true);
+    d->job->what = "try";
+    d->job->try_signalled = TRUE;
+    d->job->pending = TRUE;
+    return 0;
+}
+
+/* Whether @a and @b are the same file, or regular files of the same mode and contents */
+static gboolean
+_same_yaml_file(const char *a, const char *b)
+{
+    g_autofree gchar *a_contents = NULL;
+    g_autofree gchar *b_contents = NULL;
+    gsize a_len = 0;
+    gsize b_len = 0;
+    struct stat a_st;
+    struct stat b_st;
+
+    if (lstat(a, &a_st) < 0 || lstat(b, &b_st) < 0)
+        return FALSE;
+    if (a_st.st_dev == b_st.st_dev && a_st.st_ino == b_st.st_ino)
+        return TRUE;
+    if (!S_ISREG(a_st.st_mode) || a_st.st_mode != b_st.st_mode || a_st.st_size != b_st.st_size)
+        return FALSE;
+    if (   !g_file_get_contents(a, &a_contents, &a_len, NULL)
+        || !g_file_get_contents(b, &b_contents, &b_len, NULL))
+        return FALSE; // LCOV_EXCL_LINE
+    return a_len == b_len && !memcmp(a_contents, b_contents, a_len);
+}
+
+/* Replace @dst by a hardlink to @src, if @hardlink and possible (i.e. on the
+ * same file system), or by a copy of it */
+static gboolean
+_share_yaml_file(const char *src, const char *dst, gboolean hardlink, GError **error)
+{
+    g_autofree gchar *tmp = g_strconcat(dst, ".tmp", NULL);
+
+    safe_mkdir_p_dir(dst);
+    unlink(tmp);
+    if (!hardlink || link(src, tmp) < 0) {
+        g_autoptr(GFile) source = g_file_new_for_path(src);
+        g_autoptr(GFile) dest = g_file_new_for_path(tmp);
+        if (!g_file_copy(source, dest, G_FILE_COPY_OVERWRITE
+                                      |G_FILE_COPY_NOFOLLOW_SYMLINKS
+                                      |G_FILE_COPY_ALL_METADATA,
+                         NULL, NULL, NULL, error))
+            return FALSE; // LCOV_EXCL_LINE
+    }
+    if (rename(tmp, dst) < 0) {
+        // LCOV_EXCL_START
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "%s", g_strerror(errno));
+        unlink(tmp);
+        return FALSE;
+        // LCOV_EXCL_STOP
+    }
+    return TRUE;
 }
 
+/* Make the *.yaml files of "/DST_ROOT/{etc,run,lib}/netplan/" the same as the
+ * ones of "/SRC_ROOT/{etc,run,lib}/netplan/". Only the files which differ are
+ * replaced or removed. If a file of @src_root is the same as the one in
+ * @ref_root, the latter is shared via a hardlink, where possible. This is only
+ * safe between the config state directories in /run/netplan, which are only
+ * written by netplan, always replacing files rather than modifying them in
+ * place (like netplan_util_set_yaml() does), so @ref_root and @dst_root must
+ * both be such directories. Files of the main rootdir, which e.g. an editor
+ * might modify in place, are always copied. */
 static int
-_copy_yaml_state(char *src_root, char *dst_root, sd_bus_error *ret_error)
+_sync_yaml_state(const char *src_root, const char *dst_root, const char *ref_root, sd_bus_error *ret_error)
 {
-    glob_t gl;
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:sync_yaml_state");
     g_autoptr(GError) err = NULL;
-    int r = find_yaml_glob(src_root, &gl);
+    gchar *path = NULL;
+    gchar *ref_path = NULL;
+    glob_t gl;
+    size_t len = strlen(dst_root);
+    guint changed = 0;
+    int r = find_yaml_glob(dst_root, &gl);
     if (!!r)
         // LCOV_EXCL_START
         return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
                                  "Failed glob for YAML files\n");
         // LCOV_EXCL_STOP
 
-    /* Copy all *.yaml files from "/SRC_ROOT/{etc,run,lib}/netplan/" to
-     * "/DST_ROOT/{etc,run,lib}/netplan/" */
-    GFile *source = NULL;
-    GFile *dest = NULL;
-    gchar *dest_path = NULL;
-    size_t len = strlen(src_root);
+    /* Remove the files, which do not exist in SRC_ROOT */
     for (size_t i = 0; i < gl.gl_pathc; ++i) {
-        dest_path = g_strjoin(NULL, dst_root, (gl.gl_pathv[i])+len, NULL);
-        source = g_file_new_for_path(gl.gl_pathv[i]);
-        dest = g_file_new_for_path(dest_path);
-        g_file_copy(source, dest, G_FILE_COPY_OVERWRITE
-                                 |G_FILE_COPY_NOFOLLOW_SYMLINKS
-                                 |G_FILE_COPY_ALL_METADATA,
-                    NULL, NULL, NULL, &err);
-        if (err != NULL) {
-            // LCOV_EXCL_START
-            r = sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
-                                  "Failed to copy file %s -> %s: %s\n",
-                                  g_file_get_path(source), g_file_get_path(dest),
-                                  err->message);
-            g_object_unref(source);
-            g_object_unref(dest);
-            g_free(dest_path);
-            globfree(&gl);
-            return r;
-            // LCOV_EXCL_STOP
+        path = g_strjoin(NULL, src_root, (gl.gl_pathv[i])+len, NULL);
+        if (!g_file_test(path, G_FILE_TEST_EXISTS) && !g_file_test(path, G_FILE_TEST_IS_SYMLINK))
+            unlink(gl.gl_pathv[i]);
+        g_free(path);
+    }
+    globfree(&gl);
+
+    r = find_yaml_glob(src_root, &gl);
+    if (!!r)
+        // LCOV_EXCL_START
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                                 "Failed glob for YAML files\n");
+        // LCOV_EXCL_STOP
+
+    /* Replace the files, which differ */
+    len = strlen(src_root);
+    for (size_t i = 0; i < gl.gl_pathc && !err; ++i) {
+        const char *source = gl.gl_pathv[i];
+        path = g_strjoin(NULL, dst_root, source+len, NULL);
+        ref_path = ref_root ? g_strjoin(NULL, ref_root, source+len, NULL) : NULL;
+        if (!_same_yaml_file(source, path)) {
+            gboolean hardlink = ref_path && _same_yaml_file(source, ref_path);
+            if (hardlink)
+                source = ref_path;
+            if (_share_yaml_file(source, path, hardlink, &err))
+                changed++;
+            else
+                // LCOV_EXCL_START
+                r = sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                                      "Failed to copy file %s -> %s: %s\n",
+                                      gl.gl_pathv[i], path, err->message);
+                // LCOV_EXCL_STOP
         }
-        g_object_unref(source);
-        g_object_unref(dest);
-        g_free(dest_path);
+        g_free(ref_path);
+        g_free(path);
     }
     globfree(&gl);
+    netplan_profile_count("yaml_files_synced", changed);
     return r;
 }
 
+static void
+_state_cache_unwatch(NetplanStateCache *cache)
+{
+    for (int i = 0; i < 3; i++) {
+        if (cache->wd[i] >= 0) {
+            g_hash_table_remove(cache->d->watches, GINT_TO_POINTER(cache->wd[i]));
+            inotify_rm_watch(cache->d->inotify_fd, cache->wd[i]);
+            cache->wd[i] = -1;
+        }
+    }
+    cache->watched = FALSE;
+    netplan_document_cache_invalidate(cache->documents, NULL);
+}
+
+static void
+_state_cache_free(gpointer data)
+{
+    NetplanStateCache *cache = data;
+    _state_cache_unwatch(cache);
+    netplan_document_cache_free(cache->documents);
+    g_free(cache->rootdir);
+    g_free(cache->stamp);
+    if (cache->np_state)
+        netplan_state_clear(&cache->np_state);
+    g_free(cache->yaml);
+    netplan_config_tree_free(cache->tree);
+    g_free(cache);
+}
+
+static NetplanStateCache*
+_state_cache_new(NetplanData *d, const char *rootdir)
+{
+    NetplanStateCache *cache = g_new0(NetplanStateCache, 1);
+
+    cache->d = d;
+    cache->rootdir = g_strdup(rootdir);
+    cache->documents = netplan_document_cache_new();
+    cache->dirty = TRUE;
+    cache->watched = d->inotify_fd >= 0;
+    for (int i = 0; i < 3; i++) {
+        g_autofree gchar *dir = g_strdup_printf("%s/%s/netplan", rootdir, NETPLAN_SUBDIRS[i]);
+        cache->wd[i] = -1;
+        if (!cache->watched)
+            continue;
+        cache->wd[i] = inotify_add_watch(d->inotify_fd, dir, NETPLAN_INOTIFY_MASK);
+        /* Already watched directories would need to be shared with another cache */
+        if (cache->wd[i] < 0 || g_hash_table_contains(d->watches, GINT_TO_POINTER(cache->wd[i]))) {
+            cache->wd[i] = -1;
+            cache->watched = FALSE;
+        } else
+            g_hash_table_insert(d->watches, GINT_TO_POINTER(cache->wd[i]), cache);
+    }
+    /* Fall back to comparing stamps, e.g. if a directory does not exist */
+    if (!cache->watched)
+        _state_cache_unwatch(cache);
+    g_hash_table_insert(d->state_cache, g_strdup(rootdir), cache);
+    return cache;
+}
+
+/* Mark the states, whose YAML files changed, as dirty and drop the changed
+ * files from their document caches. */
+static void
+_process_inotify_events(NetplanData *d)
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev = NULL;
+    NetplanStateCache *cache = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    ssize_t len;
+
+    if (d->inotify_fd < 0)
+        return; // LCOV_EXCL_LINE
+
+    while ((len = read(d->inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *) p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // LCOV_EXCL_START
+                /* Events got lost, none of the states can be trusted anymore */
+                g_hash_table_iter_init(&iter, d->state_cache);
+                while (g_hash_table_iter_next(&iter, NULL, &value)) {
+                    cache = value;
+                    cache->dirty = TRUE;
+                    netplan_document_cache_invalidate(cache->documents, NULL);
+                }
+                continue;
+                // LCOV_EXCL_STOP
+            }
+
+            cache = g_hash_table_lookup(d->watches, GINT_TO_POINTER(ev->wd));
+            if (!cache)
+                continue;
+            /* Only the *.yaml files make up the state, e.g. not the outputs
+             * of 'netplan generate' in /run/netplan/, like its snapshot */
+            if (ev->len > 0 && !g_str_has_suffix(ev->name, ".yaml"))
+                continue;
+            cache->dirty = TRUE;
+            if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                /* The directory itself went away */
+                _state_cache_unwatch(cache);
+                continue;
+            }
+            for (int i = 0; ev->len > 0 && i < 3; i++) {
+                if (cache->wd[i] == ev->wd) {
+                    g_autofree gchar *path = g_strdup_printf("%s/%s/netplan/%s", cache->rootdir,
+                                                             NETPLAN_SUBDIRS[i], ev->name);
+                    netplan_document_cache_invalidate(cache->documents, path);
+                }
+            }
+        }
+    }
+}
+
+static int
+_inotify_cb(sd_event_source *es, int fd, uint32_t revents, void *userdata)
+{
+    _process_inotify_events(userdata);
+    return 0;
+}
+
+/* Describe the current set of YAML files in @rootdir, along with their
+ * modification times, sizes and inodes, to find out if a cached state is
+ * still up to date. */
+static char*
+_yaml_state_stamp(const char *rootdir)
+{
+    glob_t gl;
+    GString *stamp = g_string_new(NULL);
+
+    if (find_yaml_glob(rootdir, &gl) != 0)
+        return g_string_free(stamp, FALSE); // LCOV_EXCL_LINE
+    for (size_t i = 0; i < gl.gl_pathc; ++i) {
+        GFile *file = g_file_new_for_path(gl.gl_pathv[i]);
+        GFileInfo *info = g_file_query_info(file,
+                                            G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+                                            G_FILE_ATTRIBUTE_TIME_CHANGED ","
+                                            G_FILE_ATTRIBUTE_TIME_CHANGED_USEC ","
+                                            G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                                            G_FILE_ATTRIBUTE_UNIX_INODE,
+                                            G_FILE_QUERY_INFO_NONE, NULL, NULL);
+        g_string_append(stamp, gl.gl_pathv[i]);
+        if (info) {
+            g_string_append_printf(stamp, " %" G_GUINT64_FORMAT ".%u %" G_GUINT64_FORMAT ".%u %" G_GOFFSET_FORMAT " %" G_GUINT64_FORMAT,
+                                   g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED),
+                                   g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC),
+                                   g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_CHANGED),
+                                   g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_CHANGED_USEC),
+                                   g_file_info_get_size(info),
+                                   g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_UNIX_INODE));
+            g_object_unref(info);
+        }
+        g_string_append_c(stamp, '\n');
+        g_object_unref(file);
+    }
+    globfree(&gl);
+    return g_string_free(stamp, FALSE);
+}
+
+static char*
+_serialize_state(const NetplanState *np_state, GError **error)
+{
+    FILE *f = tmpfile();
+    char *yaml = NULL;
+    long len = 0;
+
+    if (!f) {
+        // LCOV_EXCL_START
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "cannot create temporary file: %m");
+        return NULL;
+        // LCOV_EXCL_STOP
+    }
+    if (netplan_state_dump_yaml(np_state, fileno(f), error)) {
+        fseek(f, 0, SEEK_END);
+        len = ftell(f);
+        rewind(f);
+        yaml = g_malloc0(len + 1);
+        if (fread(yaml, 1, len, f) != (size_t) len) {
+            // LCOV_EXCL_START
+            g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_IO, "cannot read serialized YAML");
+            g_clear_pointer(&yaml, g_free);
+            // LCOV_EXCL_STOP
+        }
+    }
+    fclose(f);
+    return yaml;
+}
+
+/**
+ * Return the parsed and serialized state of the YAML hierarchy in @rootdir.
+ * The state is kept around in between calls and only parsed again if any of
+ * the files in {lib,etc,run}/netplan/ changed. Changes are tracked via inotify
+ * and only the changed files are read again, the YAML documents of all other
+ * files are re-used and merged in the same order as before.
+ * Besides the queries (Get, GetKeys), it serves Generate and Apply, whose
+ * 'netplan generate' runs load it from the state snapshot.
+ */
+static const NetplanStateCache*
+_get_state(NetplanData *d, const char *rootdir, GError **error)
+{
+    g_autofree char *stamp = NULL;
+    NetplanStateCache *cache = NULL;
+    NetplanParser *npp = NULL;
+    NetplanState *np_state = NULL;
+    char *yaml = NULL;
+    gboolean ret;
+
+    /* Pick up all changes made so far, even if the event loop did not get to
+     * them, yet */
+    _process_inotify_events(d);
+    cache = g_hash_table_lookup(d->state_cache, rootdir);
+    if (!cache)
+        cache = _state_cache_new(d, rootdir);
+    if (!cache->watched) {
+        stamp = _yaml_state_stamp(rootdir);
+        if (g_strcmp0(cache->stamp, stamp))
+            cache->dirty = TRUE;
+    }
+    if (!cache->dirty)
+        return cache;
+
+    npp = netplan_parser_new();
+    np_state = netplan_state_new();
+    if (cache->watched)
+        ret = netplan_parser_load_yaml_hierarchy_cached(npp, rootdir, cache->documents, error);
+    else
+        ret = netplan_parser_load_yaml_hierarchy(npp, rootdir, error);
+    if (   !ret
+        || !netplan_state_import_parser_results(np_state, npp, error)
+        || !(yaml = _serialize_state(np_state, error))) {
+        netplan_parser_clear(&npp);
+        netplan_state_clear(&np_state);
+        return NULL;
+    }
+    netplan_parser_clear(&npp);
+
+    if (cache->np_state)
+        netplan_state_clear(&cache->np_state);
+    g_free(cache->yaml);
+    g_free(cache->stamp);
+    g_clear_pointer(&cache->tree, netplan_config_tree_free);
+    cache->np_state = np_state;
+    cache->yaml = yaml;
+    cache->stamp = g_steal_pointer(&stamp);
+    cache->dirty = FALSE;
+    return cache;
+}
+
+/* Hand the resident state of the main rootdir to the 'netplan generate' run by
+ * Generate() and Apply(), as the state snapshot it loads instead of parsing
+ * the YAML hierarchy, as long as none of the files changed since */
+static void
+_write_state_snapshot(NetplanData *d)
+{
+    g_autoptr(GError) err = NULL;
+    g_autofree char *stamp = NULL;
+    const NetplanStateCache *cache = _get_state(d, NETPLAN_ROOT, &err);
+
+    if (!cache || !netplan_state_write_snapshot(cache->np_state, NETPLAN_ROOT, &err)) {
+        /* 'netplan generate' will report any errors of the configuration */
+        g_debug("cannot write the state snapshot: %s", err ? err->message : "no state");
+        return;
+    }
+    /* The snapshot is stamped with the files as they are now, which must still
+     * be the ones the state has been parsed from */
+    _process_inotify_events(d);
+    if (!cache->watched)
+        stamp = _yaml_state_stamp(NETPLAN_ROOT);
+    if (cache->dirty || (stamp && g_strcmp0(cache->stamp, stamp)))
+        netplan_state_remove_snapshot(NETPLAN_ROOT); // LCOV_EXCL_LINE
+}
+
 static bool
 _clear_tmp_state(const char *config_id, NetplanData *d)
 {
@@ -188,6 +576,7 @@ _clear_tmp_state(const char *config_id, NetplanData *d)
         g_free(subdir);
     }
     rmdir(rootdir);
+    g_hash_table_remove(d->state_cache, rootdir);
 
     /* No cleanup of DBus object needed, if config_id points to NETPLAN_GLOBAL_CONFIG (backup) */
     if (config_id != NETPLAN_GLOBAL_CONFIG) {
@@ -204,10 +593,11 @@ _clear_tmp_state(const char *config_id, NetplanData *d)
 }
 
 static int
-_backup_global_state(sd_bus_error *ret_error)
+_backup_global_state(const char *config_id, sd_bus_error *ret_error)
 {
     int r = 0;
     g_autofree gchar *path = NULL;
+    g_autofree gchar *state_dir = NULL;
     path = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, NETPLAN_GLOBAL_CONFIG);
     /* Create {etc,run,lib} subdirs with owner r/w permissions */
     char *subdir = NULL;
@@ -222,8 +612,187 @@ _backup_global_state(sd_bus_error *ret_error)
         g_free(subdir);
     }
 
-    /* Copy main *.yaml files from /{etc,run,lib}/netplan/ to GLOBAL backup dir */
-    _copy_yaml_state(NETPLAN_ROOT, path, ret_error);
+    /* Copy main *.yaml files from /{etc,run,lib}/netplan/ to GLOBAL backup dir,
+     * sharing the files that the config state did not change with it */
+    state_dir = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, config_id);
+    return _sync_yaml_state(NETPLAN_ROOT, path, state_dir, ret_error);
+}
+
+/* Undo a failed _backup_global_state() and, if @restore is set, a partial sync
+ * of a config state into the main rootdir, by copying the backup back. */
+static void
+_abort_global_state(NetplanData *d, gboolean restore)
+{
+    g_autofree gchar *path = NULL;
+    path = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, NETPLAN_GLOBAL_CONFIG);
+    if (restore)
+        _sync_yaml_state(path, NETPLAN_ROOT, NULL, NULL);
+    _clear_tmp_state(NETPLAN_GLOBAL_CONFIG, d);
+}
+
+/**
+ * Queue of the calls changing the configuration
+ */
+
+static void
+_job_free(NetplanJob *job)
+{
+    sd_event_source_unref(job->child_es);
+    sd_event_source_unref(job->poll_es);
+    if (job->out_fd >= 0)
+        close(job->out_fd);
+    if (job->err_fd >= 0)
+        close(job->err_fd);
+    sd_bus_message_unref(job->m);
+    g_free(job->config_id);
+    g_free(job->stamp);
+    g_slist_free_full(job->spans, (GDestroyNotify) netplan_profile_end);
+    g_free(job);
+}
+
+/* Let the current job own @span, if it is pending, so that the span covers
+ * the whole call, rather than only the start of its child process */
+static void
+_job_keep_span(NetplanData *d, NetplanProfileSpan **span)
+{
+    if (*span && d->job && d->job->pending)
+        d->job->spans = g_slist_prepend(d->job->spans, g_steal_pointer(span));
+}
+
+/* Send the error reply of the current job, if any, and release it */
+static void
+_job_finish(NetplanData *d, int r, sd_bus_error *error)
+{
+    NetplanJob *job = d->job;
+
+    if (error && sd_bus_error_is_set(error))
+        sd_bus_reply_method_error(job->m, error);
+    else if (r < 0)
+        sd_bus_reply_method_errno(job->m, r, NULL); // LCOV_EXCL_LINE
+    d->job = NULL;
+    _job_free(job);
+}
+
+/* Serve the queued jobs, until one of them needs to wait for a child process */
+static void
+_run_jobs(NetplanData *d)
+{
+    while (!d->job && !g_queue_is_empty(d->jobs)) {
+        sd_bus_error error = SD_BUS_ERROR_NULL;
+        int r = 0;
+
+        d->job = g_queue_pop_head(d->jobs);
+        r = d->job->handler(d->job->m, d, &error);
+        if (!d->job->pending)
+            _job_finish(d, r, &error);
+        sd_bus_error_free(&error);
+    }
+}
+
+/* Serve the call @m via @handler, after all calls queued before it */
+static int
+_queue_job(sd_bus_message *m, NetplanData *d, sd_bus_message_handler_t handler)
+{
+    NetplanJob *job = g_new0(NetplanJob, 1);
+
+    job->m = sd_bus_message_ref(m);
+    job->handler = handler;
+    job->out_fd = -1;
+    job->err_fd = -1;
+    if (d->job)
+        netplan_profile_count("dbus_calls_queued", 1);
+    g_queue_push_tail(d->jobs, job);
+    _run_jobs(d);
+    /* replied to by _run_jobs(), or once the job is done */
+    return 1;
+}
+
+/* An unlinked temporary file, to keep the output of a child process */
+static int
+_job_output_fd(void)
+{
+    g_autofree gchar *path = NULL;
+    int fd = g_file_open_tmp("netplan-dbus-XXXXXX", &path, NULL);
+
+    if (fd >= 0)
+        unlink(path);
+    return fd;
+}
+
+static gchar*
+_job_read_output(int fd)
+{
+    GString *s = g_string_new(NULL);
+    char buf[4096];
+    ssize_t n = 0;
+
+    if (fd >= 0 && lseek(fd, 0, SEEK_SET) == 0) {
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            g_string_append_len(s, buf, n);
+    }
+    return g_string_free(s, FALSE);
+}
+
+/* Reply to the current job, whose child process exited as described by @si,
+ * and serve the next ones */
+static void
+_job_exited(NetplanData *d, const siginfo_t *si)
+{
+    NetplanJob *job = d->job;
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+
+    if (si->si_code != CLD_EXITED || si->si_status != 0) {
+        g_autofree gchar *out = _job_read_output(job->out_fd);
+        g_autofree gchar *err = _job_read_output(job->err_fd);
+        sd_bus_error_setf(&error, SD_BUS_ERROR_FAILED, "netplan %s failed: %s %d\nstdout: '%s'\nstderr: '%s'",
+                          job->what, si->si_code == CLD_EXITED ? "Child process exited with code" :
+                          "Child process killed by signal", si->si_status, out, err);
+    }
+
+    if (job->done)
+        job->done(d, job, &error);
+    if (!sd_bus_error_is_set(&error))
+        sd_bus_reply_method_return(job->m, "b", true);
+    _job_finish(d, 0, &error);
+    sd_bus_error_free(&error);
+    _run_jobs(d);
+}
+
+static int
+_job_child_cb(sd_event_source *es, const siginfo_t *si, void *userdata)
+{
+    _job_exited(userdata, si);
+    return 0;
+}
+
+/* Run 'netplan @what' for the current job, which is replied to once it exited */
+static int
+_spawn_job(NetplanData *d, gchar **argv, const char *what, sd_bus_error *ret_error)
+{
+    NetplanJob *job = d->job;
+    g_autoptr(GError) err = NULL;
+    g_auto(GStrv) envp = netplan_profile_child_environ();
+    GPid pid = -1;
+    int r = 0;
+
+    job->out_fd = _job_output_fd();
+    job->err_fd = _job_output_fd();
+    g_spawn_async_with_fds("/", argv, envp, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid,
+                           -1, job->out_fd, job->err_fd, &err);
+    if (err != NULL)
+        // LCOV_EXCL_START
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                                 "cannot run netplan %s: %s", what, err->message);
+        // LCOV_EXCL_STOP
+
+    r = sd_event_add_child(sd_bus_get_event(d->bus), &job->child_es, pid, WEXITED, _job_child_cb, d);
+    if (r < 0)
+        // LCOV_EXCL_START
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                                 "cannot watch 'netplan %s' child: %s", what, strerror(-r));
+        // LCOV_EXCL_STOP
+    job->what = what;
+    job->pending = TRUE;
     return 0;
 }
 
@@ -232,82 +801,67 @@ _backup_global_state(sd_bus_error *ret_error)
  */
 
 static int
-method_apply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+_run_apply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
-    g_autoptr(GError) err = NULL;
-    g_autofree gchar *stdout = NULL;
-    g_autofree gchar *stderr = NULL;
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Apply");
     g_autofree gchar *state = NULL;
-    gint exit_status = 0;
     NetplanData *d = userdata;
+    int r = 0;
 
     /* Accept the current 'netplan try', if active.
      * Otherwise execute 'netplan apply' directly. */
-    if (d->try_pid > 0)
-        return _try_accept(TRUE, m, userdata, ret_error);
+    if (d->try_pid > 0) {
+        r = _try_accept(TRUE, m, userdata, ret_error);
+        _job_keep_span(d, &span);
+        return r;
+    }
     if (d->config_id)
         state = g_strdup_printf("--state=%s/run/netplan/config-%s", NETPLAN_ROOT, NETPLAN_GLOBAL_CONFIG);
     gchar *argv[] = {SBINDIR "/" "netplan", "apply", state, NULL};
+    _write_state_snapshot(d);
 
     // for tests only: allow changing what netplan to run
     if (getenv("DBUS_TEST_NETPLAN_CMD") != 0)
        argv[0] = getenv("DBUS_TEST_NETPLAN_CMD");
 
-    g_spawn_sync("/", argv, NULL, 0, NULL, NULL, &stdout, &stderr, &exit_status, &err);
-    // LCOV_EXCL_START
-    if (err != NULL)
-        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
-                                 "cannot run netplan apply: %s", err->message);
-    #if GLIB_CHECK_VERSION (2, 70, 0)
-    g_spawn_check_wait_status(exit_status, &err);
-    #else
-    g_spawn_check_exit_status(exit_status, &err);
-    #endif
-    if (err != NULL)
-       return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
-                                "netplan apply failed: %s\nstdout: '%s'\nstderr: '%s'",
-                                err->message, stdout, stderr);
-    // LCOV_EXCL_STOP
-
-    return sd_bus_reply_method_return(m, "b", true);
+    r = _spawn_job(d, argv, "apply", ret_error);
+    _job_keep_span(d, &span);
+    return r;
 }
 
 static int
-method_generate(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+method_apply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
-    g_autoptr(GError) err = NULL;
-    g_autofree gchar *stdout = NULL;
-    g_autofree gchar *stderr = NULL;
-    gint exit_status = 0;
+    return _queue_job(m, userdata, _run_apply);
+}
 
+static int
+_run_generate(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Generate");
     gchar *argv[] = {SBINDIR "/" "netplan", "generate", NULL};
+    int r = 0;
 
     // for tests only: allow changing what netplan to run
     if (getenv("DBUS_TEST_NETPLAN_CMD") != 0)
        argv[0] = getenv("DBUS_TEST_NETPLAN_CMD");
 
-    g_spawn_sync("/", argv, NULL, 0, NULL, NULL, &stdout, &stderr, &exit_status, &err);
-    // LCOV_EXCL_START
-    if (err != NULL)
-        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
-                                 "cannot run netplan generate: %s", err->message);
-    #if GLIB_CHECK_VERSION (2, 70, 0)
-    g_spawn_check_wait_status(exit_status, &err);
-    #else
-    g_spawn_check_exit_status(exit_status, &err);
-    #endif
-    if (err != NULL)
-       return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
-                                "netplan generate failed: %s\nstdout: '%s'\nstderr: '%s'",
-                                err->message, stdout, stderr);
-    // LCOV_EXCL_STOP
+    _write_state_snapshot(userdata);
+    r = _spawn_job(userdata, argv, "generate", ret_error);
+    _job_keep_span(userdata, &span);
+    return r;
+}
 
-    return sd_bus_reply_method_return(m, "b", true);
+static int
+method_generate(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+    return _queue_job(m, userdata, _run_generate);
 }
 
 static int
 method_info(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Info");
     sd_bus_message *reply = NULL;
     gint exit_status = 0;
 
@@ -353,82 +907,104 @@ method_info(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 static int
 method_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Get");
     NetplanData *d = userdata;
     g_autoptr(GError) err = NULL;
-    g_autofree gchar *stdout = NULL;
-    g_autofree gchar *stderr = NULL;
     g_autofree gchar *root_dir = NULL;
-    gint exit_status = 0;
+    const NetplanStateCache *cache = NULL;
 
     if (d->config_id)
-        root_dir = g_strdup_printf("--root-dir=%s/run/netplan/config-%s", NETPLAN_ROOT, d->config_id);
-    gchar *argv[] = {SBINDIR "/" "netplan", "get", "all", root_dir, NULL};
+        root_dir = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, d->config_id);
+    else
+        root_dir = g_strdup(NETPLAN_ROOT);
 
-    // for tests only: allow changing what netplan to run
-    if (getenv("DBUS_TEST_NETPLAN_CMD") != 0)
-       argv[0] = getenv("DBUS_TEST_NETPLAN_CMD");
+    /* Serve the request from the resident state, instead of spawning 'netplan get' */
+    cache = _get_state(d, root_dir, &err);
+    if (!cache)
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "netplan get failed: %s", err->message);
 
-    g_spawn_sync("/", argv, NULL, 0, NULL, NULL, &stdout, &stderr, &exit_status, &err);
-    if (err != NULL)
-        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "cannot run netplan get: %s", err->message); // LCOV_EXCL_LINE
+    return sd_bus_reply_method_return(m, "s", cache->yaml);
+}
 
-    #if GLIB_CHECK_VERSION (2, 70, 0)
-    g_spawn_check_wait_status(exit_status, &err);
-    #else
-    g_spawn_check_exit_status(exit_status, &err);
-    #endif
-    if (err != NULL)
-       return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "netplan get failed: %s\nstdout: '%s'\nstderr: '%s'", err->message, stdout, stderr); // LCOV_EXCL_LINE
+static int
+method_get_keys(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:GetKeys");
+    NetplanData *d = userdata;
+    g_autoptr(GError) err = NULL;
+    g_autofree gchar *root_dir = NULL;
+    g_auto(GStrv) keys = NULL;
+    g_autoptr(GPtrArray) values = g_ptr_array_new_with_free_func(g_free);
+    NetplanStateCache *cache = NULL;
+    sd_bus_message *reply = NULL;
+    int r = 0;
+
+    if (sd_bus_message_read_strv(m, &keys) < 0)
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "cannot extract keys"); // LCOV_EXCL_LINE
+
+    if (d->config_id)
+        root_dir = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, d->config_id);
+    else
+        root_dir = g_strdup(NETPLAN_ROOT);
+
+    /* Answer all keys from the tree of the resident state */
+    cache = (NetplanStateCache*) _get_state(d, root_dir, &err);
+    if (cache && !cache->tree)
+        cache->tree = netplan_config_tree_new_from_yaml(cache->yaml, &err);
+    if (!cache || !cache->tree)
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "netplan get failed: %s", err->message);
+    for (gchar **key = keys; key && *key; ++key) {
+        const char *value = netplan_config_tree_get(cache->tree, *key);
+        if (!value)
+            return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "netplan get failed: %s", *key); // LCOV_EXCL_LINE
+        g_ptr_array_add(values, g_strdup(value));
+    }
+    g_ptr_array_add(values, NULL);
 
-    return sd_bus_reply_method_return(m, "s", stdout);
+    r = sd_bus_message_new_method_return(m, &reply);
+    if (r < 0)
+       return r; // LCOV_EXCL_LINE
+    r = sd_bus_message_append_strv(reply, (char**) values->pdata);
+    if (r >= 0)
+        r = sd_bus_send(NULL, reply, NULL);
+    sd_bus_message_unref(reply);
+    return r;
 }
 
 static int
 method_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Set");
     NetplanData *d = userdata;
     g_autoptr(GError) err = NULL;
-    g_autofree gchar *stdout = NULL;
-    g_autofree gchar *stderr = NULL;
-    g_autofree gchar *origin = NULL;
     g_autofree gchar *root_dir = NULL;
-    gint exit_status = 0;
-    char *args[2] = {NULL, NULL};
+    g_autofree gchar *key = NULL;
+    const NetplanStateCache *cache = NULL;
     char *config_delta = NULL;
     char *origin_hint = NULL;
-    guint cur_arg = 0;
+    char *value = NULL;
 
     if (sd_bus_message_read(m, "ss", &config_delta, &origin_hint) < 0)
         return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "cannot extract config_delta or origin_hint"); // LCOV_EXCL_LINE
 
-    if (!!strcmp(origin_hint, "")) {
-        origin = g_strdup_printf("--origin-hint=%s", origin_hint);
-        args[cur_arg] = origin;
-        cur_arg++;
-    }
-
-    if (d->config_id) {
-        root_dir = g_strdup_printf("--root-dir=%s/run/netplan/config-%s", NETPLAN_ROOT, d->config_id);
-        args[cur_arg] = root_dir;
-        cur_arg++;
-    }
-    gchar *argv[] = {SBINDIR "/" "netplan", "set", config_delta, args[0], args[1], NULL};
+    value = strchr(config_delta, '=');
+    if (!value)
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "netplan set failed: Invalid value specified");
+    key = g_strndup(config_delta, value - config_delta);
 
-    // for tests only: allow changing what netplan to run
-    if (getenv("DBUS_TEST_NETPLAN_CMD") != 0)
-       argv[0] = getenv("DBUS_TEST_NETPLAN_CMD");
-
-    g_spawn_sync("/", argv, NULL, 0, NULL, NULL, &stdout, &stderr, &exit_status, &err);
-    if (err != NULL)
-        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "cannot run netplan set %s: %s", config_delta, err->message); // LCOV_EXCL_LINE
+    if (d->config_id)
+        root_dir = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, d->config_id);
+    else
+        root_dir = g_strdup(NETPLAN_ROOT);
 
-    #if GLIB_CHECK_VERSION (2, 70, 0)
-    g_spawn_check_wait_status(exit_status, &err);
-    #else
-    g_spawn_check_exit_status(exit_status, &err);
-    #endif
-    if (err != NULL)
-       return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "netplan set failed: %s\nstdout: '%s'\nstderr: '%s'", err->message, stdout, stderr); // LCOV_EXCL_LINE
+    /* Merge the delta in-process, instead of spawning 'netplan set'. The
+     * resident state tells which file each definition is defined in, if the
+     * current configuration is valid */
+    if (!g_strcmp0(origin_hint, ""))
+        cache = _get_state(d, root_dir, NULL);
+    if (!netplan_util_set_yaml(cache ? cache->np_state : NULL, key, value + 1,
+                               g_strcmp0(origin_hint, "") ? origin_hint : NULL, root_dir, &err))
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "netplan set failed: %s", err->message);
 
     return sd_bus_reply_method_return(m, "b", true);
 }
@@ -439,12 +1015,18 @@ netplan_try_cancelled_cb(sd_event_source *es, const siginfo_t *si, void* userdat
     NetplanData *d = userdata;
     g_autofree gchar *state_dir = NULL;
     int r = 0;
+
+    /* The child exited, as it was accepted or rejected by the current job */
+    if (d->job && d->job->try_signalled) {
+        terminate_try_child_process(si->si_status, d, d->job->config_id);
+        _job_exited(d, si);
+        return 0;
+    }
+
     if (d->handler_id) {
-        /* Delete GLOBAL state */
-        unlink_glob(NETPLAN_ROOT, "/{etc,run,lib}/netplan/*.yaml");
-        /* Restore GLOBAL backup config state to main rootdir */
+        /* Restore the files of the GLOBAL backup config state, which differ, to main rootdir */
         state_dir = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, NETPLAN_GLOBAL_CONFIG);
-        _copy_yaml_state(state_dir, NETPLAN_ROOT, NULL);
+        _sync_yaml_state(state_dir, NETPLAN_ROOT, NULL, NULL);
 
         /* Un-invalidate all other current config objects */
         if (!g_strcmp0(d->handler_id, d->config_dirty))
@@ -462,18 +1044,46 @@ netplan_try_cancelled_cb(sd_event_source *es, const siginfo_t *si, void* userdat
     return r;
 }
 
+/* Reply to the Try() call once the 'netplan try' child is ready for
+ * signals, or after the timeout */
+static int
+_try_poll_cb(sd_event_source *es, uint64_t usec, void *userdata)
+{
+    NetplanData *d = userdata;
+    NetplanJob *job = d->job;
+    struct stat buf;
+    gboolean ready = stat(job->stamp, &buf) == 0;
+    uint64_t now = 0;
+
+    if (!ready && job->polls > 0) {
+        job->polls--;
+        sd_event_now(sd_event_source_get_event(es), CLOCK_MONOTONIC, &now);
+        sd_event_source_set_time(es, now + 10 * 1000);
+        sd_event_source_set_enabled(es, SD_EVENT_ONESHOT);
+        return 0;
+    }
+    if (!ready)
+        g_debug("cannot find %s stamp file", job->stamp);
+    sd_bus_reply_method_return(job->m, "b", ready);
+    _job_finish(d, 0, NULL);
+    _run_jobs(d);
+    return 0;
+}
+
 static int
 method_try(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Try");
     g_autoptr(GError) err = NULL;
     g_autofree gchar *timeout = NULL;
     g_autofree gchar *state = NULL;
     g_autofree gchar *netplan_try_stamp = NULL;
-    struct stat buf;
+    g_auto(GStrv) envp = netplan_profile_child_environ();
     gint child_stdin = -1; /* child process needs an input to function correctly */
     guint seconds = 0;
     int r = -1;
     NetplanData *d = userdata;
+    NetplanJob *job = d->job;
 
     if (sd_bus_message_read_basic (m, 'u', &seconds) < 0)
         return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED, "cannot extract timeout_seconds"); // LCOV_EXCL_LINE
@@ -491,7 +1101,7 @@ method_try(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
     netplan_try_stamp = g_build_path("/", NETPLAN_ROOT, "run", "netplan", "netplan-try.ready", NULL);
     unlink(netplan_try_stamp);
     /* Launch 'netplan try' child process, lock 'try_pid' to real PID */
-    g_spawn_async_with_pipes("/", argv, NULL,
+    g_spawn_async_with_pipes("/", argv, envp,
                              G_SPAWN_DO_NOT_REAP_CHILD|G_SPAWN_STDOUT_TO_DEV_NULL,
                              NULL, NULL, &d->try_pid, &child_stdin, NULL, NULL, &err);
     if (err)
@@ -511,73 +1121,118 @@ method_try(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
                                  "cannot watch 'netplan try' child: %s", strerror(-r));
         // LCOV_EXCL_STOP
 
-    /* wait for the /run/netplan/netplan-try.ready stamp file to appear */
-    guint poll_timeout = 500;
+    /* wait for the /run/netplan/netplan-try.ready stamp file to appear,
+     * checking for it every 10 ms from the mainloop */
+    job->polls = 500;
     if (seconds > 0 && seconds < 5)
-        poll_timeout = seconds * 100;
-    /* Timeout after up to 5 sec of waiting for the stamp file */
-    for (int i = 0; i < poll_timeout; i++) {
-        if (stat(netplan_try_stamp, &buf) == 0)
-            break;
-        usleep(1000 * 10);
-    }
-    if (stat(netplan_try_stamp, &buf) != 0) {
-       g_debug("cannot find %s stamp file", netplan_try_stamp);
-       return sd_bus_reply_method_return(m, "b", false);
-    }
-
-    return sd_bus_reply_method_return(m, "b", true);
+        job->polls = seconds * 100;
+    job->stamp = g_steal_pointer(&netplan_try_stamp);
+    r = sd_event_add_time(sd_bus_get_event(d->bus), &job->poll_es, CLOCK_MONOTONIC, 0, 0, _try_poll_cb, d);
+    if (r < 0)
+        // LCOV_EXCL_START
+        return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                                 "cannot wait for 'netplan try': %s", strerror(-r));
+        // LCOV_EXCL_STOP
+    job->pending = TRUE;
+    _job_keep_span(d, &span);
+    return 0;
 }
 
 /**
  * io.netplan.Netplan.Config methods
  */
 
+/* The config object of a queued call might have been applied or cancelled
+ * in the meantime */
+static gboolean
+_config_exists(NetplanData *d, sd_bus_message *m, sd_bus_error *ret_error)
+{
+    /* trim 27 chars (i.e. "/io/netplan/Netplan/config/") from path to get the config ID */
+    if (g_hash_table_contains(d->config_data, sd_bus_message_get_path(m) + 27))
+        return TRUE;
+    sd_bus_error_setf(ret_error, SD_BUS_ERROR_UNKNOWN_OBJECT, "Unknown object '%s'.", sd_bus_message_get_path(m));
+    return FALSE;
+}
+
+static void
+_config_apply_done(NetplanData *d, NetplanJob *job, sd_bus_error *error)
+{
+    /* Clear GLOBAL backup and config state */
+    _clear_tmp_state(NETPLAN_GLOBAL_CONFIG, d);
+    _clear_tmp_state(job->config_id, d);
+
+    /* unlock handler ID */
+    g_free(d->handler_id);
+    d->handler_id = NULL;
+}
+
 /* netplan-feature: dbus-config */
 static int
-method_config_apply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+_run_config_apply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Config.Apply");
     NetplanData *d = userdata;
     g_autofree gchar *state_dir = NULL;
     int r = 0;
+    if (!_config_exists(d, m, ret_error))
+        return -ENOENT;
     /* trim 27 chars (i.e. "/io/netplan/Netplan/config/") from path to get the config ID */
     d->config_id = sd_bus_message_get_path(m) + 27;
     NetplanConfigData *cd = g_hash_table_lookup(d->config_data, d->config_id);
     if (cd->invalidated)
         return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
                                  "This config was invalidated by another config object\n");
-    /* Invalidate all other current config objects */
-    g_hash_table_foreach(d->config_data, invalidate_other_config, (void*)d->config_id);
-    d->config_dirty = g_strdup(d->config_id);
-
     if (d->try_pid < 0) {
-        r = _backup_global_state(ret_error);
-        if (r < 0)
-            return r; // LCOV_EXCL_LINE
+        r = _backup_global_state(d->config_id, ret_error);
+        // LCOV_EXCL_START
+        if (r < 0) {
+            _abort_global_state(d, FALSE);
+            d->config_id = NULL;
+            return r;
+        }
+        // LCOV_EXCL_STOP
 
-        /* Delete GLOBAL state */
-        unlink_glob(NETPLAN_ROOT, "/{etc,run,lib}/netplan/*.yaml");
-        /* Copy current config state to GLOBAL */
+        /* Move the files the current config state changed into the GLOBAL state */
         state_dir = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, d->config_id);
-        _copy_yaml_state(state_dir, NETPLAN_ROOT, ret_error);
+        r = _sync_yaml_state(state_dir, NETPLAN_ROOT, NULL, ret_error);
+        // LCOV_EXCL_START
+        if (r < 0) {
+            _abort_global_state(d, TRUE);
+            d->config_id = NULL;
+            return r;
+        }
+        // LCOV_EXCL_STOP
         d->handler_id = g_strdup(d->config_id);
     }
 
-    r = method_apply(m, d, ret_error);
-    /* Clear GLOBAL backup and config state */
-    _clear_tmp_state(NETPLAN_GLOBAL_CONFIG, d);
-    _clear_tmp_state(d->config_id, d);
+    /* Invalidate all other current config objects */
+    g_hash_table_foreach(d->config_data, invalidate_other_config, (void*)d->config_id);
+    d->config_dirty = g_strdup(d->config_id);
+
+    r = _run_apply(m, d, ret_error);
+    /* Clean up once 'netplan apply' exited, or right away */
+    d->job->config_id = g_strdup(d->config_id);
+    if (d->job->pending)
+        d->job->done = _config_apply_done;
+    else
+        _config_apply_done(d, d->job, ret_error);
+    _job_keep_span(d, &span);
 
-    /* unlock current config ID and handler ID */
+    /* unlock current config ID */
     d->config_id = NULL;
-    g_free(d->handler_id);
-    d->handler_id = NULL;
     return r;
 }
 
+static int
+method_config_apply(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+    return _queue_job(m, userdata, _run_config_apply);
+}
+
 static int
 method_config_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Config.Get");
     NetplanData *d = userdata;
     /* trim 27 chars (i.e. "/io/netplan/Netplan/config/") from path to get the config ID */
     d->config_id = sd_bus_message_get_path(m) + 27;
@@ -587,12 +1242,29 @@ method_config_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
     return r;
 }
 
+/* netplan-feature: dbus-config-get-keys */
 static int
-method_config_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+method_config_get_keys(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Config.GetKeys");
     NetplanData *d = userdata;
     /* trim 27 chars (i.e. "/io/netplan/Netplan/config/") from path to get the config ID */
     d->config_id = sd_bus_message_get_path(m) + 27;
+    int r = method_get_keys(m, userdata, ret_error);
+    /* Reset config_id for next method call */
+    d->config_id = NULL;
+    return r;
+}
+
+static int
+_run_config_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Config.Set");
+    NetplanData *d = userdata;
+    if (!_config_exists(d, m, ret_error))
+        return -ENOENT;
+    /* trim 27 chars (i.e. "/io/netplan/Netplan/config/") from path to get the config ID */
+    d->config_id = sd_bus_message_get_path(m) + 27;
     NetplanConfigData *cd = g_hash_table_lookup(d->config_data, d->config_id);
     if (cd->invalidated)
         return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
@@ -607,11 +1279,20 @@ method_config_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 }
 
 static int
-method_config_try(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+method_config_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+    return _queue_job(m, userdata, _run_config_set);
+}
+
+static int
+_run_config_try(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Config.Try");
     NetplanData *d = userdata;
     g_autofree gchar *state_dir = NULL;
     const char *config_id = sd_bus_message_get_path(m) + 27;
+    if (!_config_exists(d, m, ret_error))
+        return -ENOENT;
     if (d->try_pid > 0)
         return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
                                  "Another Try() is currently in progress: PID %d\n", d->try_pid);
@@ -625,29 +1306,71 @@ method_config_try(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
     d->try_pid = G_MAXINT;
     d->config_id = config_id;
 
-    r = _backup_global_state(ret_error);
-    if (r < 0)
-        return r; // LCOV_EXCL_LINE
-
-    /* Clear main *.yaml files */
-    unlink_glob(NETPLAN_ROOT, "/{etc,run,lib}/netplan/*.yaml");
+    r = _backup_global_state(d->config_id, ret_error);
+    // LCOV_EXCL_START
+    if (r < 0) {
+        _abort_global_state(d, FALSE);
+        d->try_pid = -1;
+        d->config_id = NULL;
+        return r;
+    }
+    // LCOV_EXCL_STOP
 
-    /* Copy current config *.yaml state to main rootdir (i.e. /etc/netplan/) */
+    /* Move the *.yaml files the current config state changed into main rootdir (i.e. /etc/netplan/) */
     state_dir = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, d->config_id);
-    _copy_yaml_state(state_dir, NETPLAN_ROOT, ret_error);
+    r = _sync_yaml_state(state_dir, NETPLAN_ROOT, NULL, ret_error);
+    // LCOV_EXCL_START
+    if (r < 0) {
+        _abort_global_state(d, TRUE);
+        d->try_pid = -1;
+        d->config_id = NULL;
+        return r;
+    }
+    // LCOV_EXCL_STOP
 
     /* Exec try */
     r = method_try(m, userdata, ret_error);
+    _job_keep_span(d, &span);
     d->config_id = NULL;
     return r;
 }
 
 static int
-method_config_cancel(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+method_config_try(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+    return _queue_job(m, userdata, _run_config_try);
+}
+
+static void
+_config_cancel_done(NetplanData *d, NetplanJob *job, sd_bus_error *error)
 {
-    NetplanData *d = userdata;
     g_autofree gchar *state_dir = NULL;
+
+    if (d->handler_id && !g_strcmp0(job->config_id, d->handler_id)) {
+        /* Restore the files of the GLOBAL backup config state, which differ, to main rootdir */
+        state_dir = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, NETPLAN_GLOBAL_CONFIG);
+        _sync_yaml_state(state_dir, NETPLAN_ROOT, NULL, error);
+
+        /* Clear GLOBAL backup and config state */
+        _clear_tmp_state(NETPLAN_GLOBAL_CONFIG, d);
+
+        /* Clear pending Try() handler ID */
+        g_free(d->handler_id);
+        d->handler_id = NULL;
+    }
+
+    /* Clear tmp state */
+    _clear_tmp_state(job->config_id, d);
+}
+
+static int
+_run_config_cancel(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Config.Cancel");
+    NetplanData *d = userdata;
     int r = 0;
+    if (!_config_exists(d, m, ret_error))
+        return -ENOENT;
     /* trim 27 chars (i.e. "/io/netplan/Netplan/config/") from path to get the config ID */
     d->config_id = sd_bus_message_get_path(m) + 27;
     if (!g_strcmp0(d->config_id, d->config_dirty))
@@ -655,36 +1378,33 @@ method_config_cancel(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
          g_hash_table_foreach(d->config_data, invalidate_other_config, NULL);
 
     /* Cancel the current 'netplan try' process */
+    d->job->config_id = g_strdup(d->config_id);
     if (d->try_pid > 0)
         r = _try_accept(FALSE, m, d, ret_error);
     else
         r = sd_bus_reply_method_return(m, "b", true);
 
-    if (d->handler_id && !g_strcmp0(d->config_id, d->handler_id)) {
-        /* Delete GLOBAL state */
-        unlink_glob(NETPLAN_ROOT, "/{etc,run,lib}/netplan/*.yaml");
-        /* Restore GLOBAL backup config state to main rootdir */
-        state_dir = g_strdup_printf("%s/run/netplan/config-%s", NETPLAN_ROOT, NETPLAN_GLOBAL_CONFIG);
-        _copy_yaml_state(state_dir, NETPLAN_ROOT, ret_error);
-
-        /* Clear GLOBAL backup and config state */
-        _clear_tmp_state(NETPLAN_GLOBAL_CONFIG, d);
-
-        /* Clear pending Try() handler ID */
-        g_free(d->handler_id);
-        d->handler_id = NULL;
-    }
-
-    /* Clear tmp state */
-    _clear_tmp_state(d->config_id, d);
+    /* Clean up once 'netplan try' exited, or right away */
+    if (d->job->pending)
+        d->job->done = _config_cancel_done;
+    else
+        _config_cancel_done(d, d->job, ret_error);
+    _job_keep_span(d, &span);
     d->config_id = NULL;
     return r;
 }
 
+static int
+method_config_cancel(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
+{
+    return _queue_job(m, userdata, _run_config_cancel);
+}
+
 static const sd_bus_vtable config_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_METHOD("Apply", "", "b", method_config_apply, 0),
     SD_BUS_METHOD("Get", "", "s", method_config_get, 0),
+    SD_BUS_METHOD("GetKeys", "as", "as", method_config_get_keys, 0),
     SD_BUS_METHOD("Set", "ss", "b", method_config_set, 0),
     SD_BUS_METHOD("Try", "u", "b", method_config_try, 0),
     SD_BUS_METHOD("Cancel", "", "b", method_config_cancel, 0),
@@ -698,6 +1418,7 @@ static const sd_bus_vtable config_vtable[] = {
 static int
 method_config(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
 {
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("dbus:Config");
     NetplanData *d = userdata;
     sd_bus_slot *slot = NULL;
     g_autoptr(GError) err = NULL;
@@ -748,8 +1469,15 @@ method_config(sd_bus_message *m, void *userdata, sd_bus_error *ret_error)
         g_free(subdir);
     }
 
-    /* Copy all *.yaml files from /{etc,run,lib}/netplan/ to temp dir */
-    _copy_yaml_state(NETPLAN_ROOT, path, ret_error);
+    /* Copy all *.yaml files from /{etc,run,lib}/netplan/ to the temp dir. They
+     * cannot be shared, as they might be modified in place, see _sync_yaml_state() */
+    r = _sync_yaml_state(NETPLAN_ROOT, path, NULL, ret_error);
+    if (r < 0) {
+        // LCOV_EXCL_START
+        _clear_tmp_state(id, d);
+        return r;
+        // LCOV_EXCL_STOP
+    }
 
     return sd_bus_reply_method_return(m, "o", obj_path);
 }
@@ -785,6 +1513,8 @@ main(int argc, char *argv[])
     sigset_t mask;
     int r;
 
+    g_set_prgname("netplan-dbus");
+
     // for tests only: allow changing which rootdir to use to copy files around
     if (getenv("DBUS_TEST_NETPLAN_ROOT") != 0)
         NETPLAN_ROOT = getenv("DBUS_TEST_NETPLAN_ROOT");
@@ -814,6 +1544,18 @@ main(int argc, char *argv[])
     data->config_dirty = NULL;
     /* TODO: define a proper free/cleanup function for sd_bus_slot_unref() */
     data->config_data = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    data->state_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _state_cache_free);
+    data->watches = g_hash_table_new(g_direct_hash, g_direct_equal);
+    data->jobs = g_queue_new();
+
+    /* Watch the YAML files of the cached states */
+    data->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (data->inotify_fd < 0)
+        fprintf(stderr, "Cannot watch YAML files, checking their timestamps instead: %s\n", strerror(errno)); // LCOV_EXCL_LINE
+    else
+        /* Any pending events are also picked up before using a cached state,
+         * this just keeps the event queue from overflowing */
+        sd_event_add_io(event, &data->inotify_es, data->inotify_fd, EPOLLIN, _inotify_cb, data);
 
     r = sd_bus_add_object_vtable(bus, &slot,
                                  "/io/netplan/Netplan",  /* object path */
@@ -853,6 +1595,17 @@ main(int argc, char *argv[])
     if (r < 0)
         fprintf(stderr, "Failed mainloop: %s\n", strerror(-r)); // LCOV_EXCL_LINE
 finish:
+    if (data->state_cache)
+        g_hash_table_destroy(data->state_cache);
+    if (data->watches)
+        g_hash_table_destroy(data->watches);
+    if (data->jobs)
+        g_queue_free_full(data->jobs, (GDestroyNotify) _job_free);
+    if (data->job)
+        _job_free(data->job);
+    sd_event_source_unref(data->inotify_es);
+    if (data->inotify_fd > 0)
+        close(data->inotify_fd);
     g_free(data);
     sd_event_unref(event);
     sd_bus_slot_unref(slot);
@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <glob.h>
+#include <fnmatch.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -40,14 +41,35 @@ static gchar** files;
 static gboolean any_networkd = FALSE;
 static gboolean any_sriov;
 static gchar* mapping_iface;
+static gint jobs = 1;
+static gboolean validate_only = FALSE;
 
 static GOptionEntry options[] = {
     {"root-dir", 'r', 0, G_OPTION_ARG_FILENAME, &rootdir, "Search for and generate configuration files in this root directory instead of /"},
     {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files, "Read configuration from this/these file(s) instead of /etc/netplan/*.yaml", "[config file ..]"},
     {"mapping", 0, 0, G_OPTION_ARG_STRING, &mapping_iface, "Only show the device to backend mapping for the specified interface."},
+    {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Render the configuration of up to N network definitions in parallel.", "N"},
+    {"validate", 0, 0, G_OPTION_ARG_NONE, &validate_only, "Only validate each given root directory or YAML file as a separate configuration."},
     {NULL}
 };
 
+typedef struct {
+    const NetplanState* np_state;
+    const NetplanNetDefinition* def;
+    /* outputs, to be written from the main thread */
+    GPtrArray* staged;
+    gboolean networkd_written;
+    gboolean success;
+    GError* error;
+} NetdefJob;
+
+typedef struct {
+    const char* config;
+    gboolean valid;
+    GError* warning;
+    GError* error;
+} ValidateJob;
+
 static void
 reload_udevd(void)
 {
@@ -113,19 +135,292 @@ start_unit_jit(gchar *unit)
 };
 // LCOV_EXCL_STOP
 
+/**
+ * Generate the backend configuration of a single netdef.
+ */
+static gboolean
+write_netdef(const NetplanState* np_state, const NetplanNetDefinition* def, gboolean* networkd_written, GError** error)
+{
+    gboolean has_been_written = FALSE;
+    NetplanProfileSpan* span = NULL;
+    gboolean ret;
+
+    netplan_profile_count("netdefs", 1);
+    span = netplan_profile_begin("networkd:%s", def->id);
+    ret = netplan_netdef_write_networkd(np_state, def, rootdir, &has_been_written, error);
+    netplan_profile_end(span);
+    if (!ret)
+        return FALSE;
+    *networkd_written = has_been_written;
+
+    span = netplan_profile_begin("ovs:%s", def->id);
+    ret = netplan_netdef_write_ovs(np_state, def, rootdir, &has_been_written, error);
+    netplan_profile_end(span);
+    if (!ret)
+        return FALSE;
+
+    span = netplan_profile_begin("nm:%s", def->id);
+    ret = netplan_netdef_write_nm(np_state, def, rootdir, &has_been_written, error);
+    netplan_profile_end(span);
+    return ret;
+}
+
+/* End the current phase of the run, if any, and begin the next one */
+static void
+profile_phase(NetplanProfileSpan** phase, const char* name)
+{
+    netplan_profile_end(*phase);
+    *phase = name ? netplan_profile_begin("%s", name) : NULL;
+}
+
+static void
+write_netdef_job(gpointer data, gpointer user_data)
+{
+    NetdefJob* job = data;
+
+    /* Only render the configuration on the worker thread: the files are
+     * written in order by the main thread, afterwards */
+    netplan_output_staging_begin();
+    job->success = write_netdef(job->np_state, job->def, &job->networkd_written, &job->error);
+    job->staged = netplan_output_staging_end();
+}
+
+/**
+ * Generate the backend configuration of all netdefs, rendering them on a pool
+ * of @jobs worker threads. The output is the same as if the netdefs were
+ * written one after the other.
+ */
+static gboolean
+write_netdefs_parallel(const NetplanState* np_state, GError** error)
+{
+    guint n = g_list_length(np_state->netdefs_ordered);
+    NetdefJob* netdef_jobs = g_new0(NetdefJob, n);
+    GThreadPool* pool = NULL;
+    gboolean ret = TRUE;
+    guint i = 0;
+
+    /* Initialize lazily populated lookup tables before going parallel */
+    wifi_get_freq24(1);
+    wifi_get_freq5(7);
+
+    pool = g_thread_pool_new(write_netdef_job, NULL, jobs, TRUE, NULL);
+    for (GList* iterator = np_state->netdefs_ordered; iterator; iterator = iterator->next, ++i) {
+        netdef_jobs[i].np_state = np_state;
+        netdef_jobs[i].def = iterator->data;
+        g_thread_pool_push(pool, &netdef_jobs[i], NULL);
+    }
+    /* wait for all jobs to be finished */
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    for (i = 0; i < n; ++i) {
+        const NetplanNetDefinition* def = netdef_jobs[i].def;
+        if (ret) {
+            netplan_output_tracking_set_owner(def->id);
+            /* Write whatever has been rendered before running into an
+             * error, just like in the sequential case */
+            ret = netplan_output_staging_commit(netdef_jobs[i].staged, error);
+            if (ret && !netdef_jobs[i].success) {
+                g_propagate_error(error, netdef_jobs[i].error);
+                ret = FALSE;
+            } else
+                g_clear_error(&netdef_jobs[i].error);
+            any_networkd = any_networkd || netdef_jobs[i].networkd_written;
+            if (def->sriov_explicit_vf_count < G_MAXUINT || def->sriov_link)
+                any_sriov = TRUE;
+        } else {
+            g_ptr_array_free(netdef_jobs[i].staged, TRUE);
+            g_clear_error(&netdef_jobs[i].error);
+        }
+    }
+    g_free(netdef_jobs);
+    return ret;
+}
+
+static void
+validate_parser_free(gpointer npp)
+{
+    netplan_parser_clear((NetplanParser**) &npp);
+}
+
+/* The parser of each thread, re-used for all configurations it validates */
+static GPrivate validate_parser = G_PRIVATE_INIT(validate_parser_free);
+
+static void
+validate_config_job(gpointer data, gpointer user_data)
+{
+    ValidateJob* job = data;
+    NetplanParser* npp = g_private_get(&validate_parser);
+
+    if (!npp) {
+        npp = netplan_parser_new();
+        g_private_set(&validate_parser, npp);
+    }
+
+    /* A directory is the root of a YAML hierarchy, anything else a single
+     * YAML file containing the whole configuration */
+    if (g_file_test(job->config, G_FILE_TEST_IS_DIR))
+        job->valid = netplan_parser_load_yaml_hierarchy(npp, job->config, &job->error);
+    else
+        job->valid = netplan_parser_load_yaml(npp, job->config, &job->error);
+    job->valid = job->valid && netplan_parser_validate(npp, &job->warning, &job->error);
+    netplan_parser_reset(npp);
+}
+
+/* Print the result of @job as a line of JSON */
+static void
+print_validate_result(const ValidateJob* job)
+{
+    GString* s = g_string_new("{\"config\": ");
+
+    netplan_json_append_string(s, job->config);
+    g_string_append(s, job->valid ? ", \"valid\": true" : ", \"valid\": false");
+    if (job->error) {
+        g_string_append(s, ", \"error\": ");
+        netplan_json_append_string(s, job->error->message);
+    }
+    if (job->warning) {
+        g_string_append(s, ", \"warning\": ");
+        netplan_json_append_string(s, job->warning->message);
+    }
+    g_string_append(s, "}\n");
+    fputs(s->str, stdout);
+    g_string_free(s, TRUE);
+}
+
+/**
+ * Validate each of @configs on its own, on a pool of @jobs worker threads,
+ * without writing anything. The results are printed in the order of @configs.
+ * Returns: 0 if all configurations are valid, 1 otherwise.
+ */
 static int
-find_interface(gchar* interface, GHashTable* netdefs)
+validate_configs(gchar** configs)
 {
-    GPtrArray *found;
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("validate-configs");
+    guint n = g_strv_length(configs);
+    ValidateJob* validate_jobs = g_new0(ValidateJob, n);
+    int ret = 0;
+
+    for (guint i = 0; i < n; ++i)
+        validate_jobs[i].config = configs[i];
+
+    if (jobs > 1) {
+        GThreadPool* pool = g_thread_pool_new(validate_config_job, NULL, jobs, TRUE, NULL);
+        for (guint i = 0; i < n; ++i)
+            g_thread_pool_push(pool, &validate_jobs[i], NULL);
+        /* wait for all jobs to be finished */
+        g_thread_pool_free(pool, FALSE, TRUE);
+    } else {
+        for (guint i = 0; i < n; ++i)
+            validate_config_job(&validate_jobs[i], NULL);
+    }
+
+    for (guint i = 0; i < n; ++i) {
+        print_validate_result(&validate_jobs[i]);
+        if (!validate_jobs[i].valid)
+            ret = 1;
+        g_clear_error(&validate_jobs[i].warning);
+        g_clear_error(&validate_jobs[i].error);
+    }
+    netplan_profile_count("configs_validated", n);
+    g_free(validate_jobs);
+    /* the parsers of the worker threads are released as they exit */
+    g_private_replace(&validate_parser, NULL);
+    return ret;
+}
+
+/*
+ * Lookup tables for --mapping, filled in a single pass over the netdefs:
+ * set-name/ID/match name, MAC address and driver, each one mapping to a
+ * GPtrArray of netdefs (in definition order).
+ */
+typedef struct {
+    GHashTable* names;
+    GHashTable* macs;
+    GHashTable* drivers;
+    /* netdefs matching on a glob pattern of the interface name */
+    GPtrArray* globs;
+    /* storage for the normalized (lowercase) MAC addresses */
+    GStringChunk* strings;
+} MappingIndex;
+
+static void
+mapping_index_add(GHashTable* table, const char* key, NetplanNetDefinition* nd)
+{
+    GPtrArray* list;
+
+    if (!key)
+        return;
+    list = g_hash_table_lookup(table, key);
+    if (!list) {
+        list = g_ptr_array_new();
+        g_hash_table_insert(table, (gpointer) key, list);
+    }
+    /* set-name, ID and match name of a netdef can be the same */
+    if (list->len == 0 || g_ptr_array_index(list, list->len - 1) != nd)
+        g_ptr_array_add(list, nd);
+}
+
+static void
+mapping_index_init(MappingIndex* idx, const NetplanState* np_state)
+{
+    idx->names = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+    idx->macs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+    idx->drivers = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+    idx->globs = g_ptr_array_new();
+    idx->strings = g_string_chunk_new(256);
+
+    for (GList* l = np_state->netdefs_ordered; l; l = l->next) {
+        NetplanNetDefinition* nd = l->data;
+        mapping_index_add(idx->names, nd->set_name, nd);
+        mapping_index_add(idx->names, nd->id, nd);
+        mapping_index_add(idx->names, nd->match.original_name, nd);
+        mapping_index_add(idx->drivers, nd->match.driver, nd);
+        if (nd->match.mac) {
+            g_autofree char* mac = g_ascii_strdown(nd->match.mac, -1);
+            mapping_index_add(idx->macs, g_string_chunk_insert_const(idx->strings, mac), nd);
+        }
+        if (nd->match.original_name && strpbrk(nd->match.original_name, "*[]?"))
+            g_ptr_array_add(idx->globs, nd);
+    }
+}
+
+static void
+mapping_index_clear(MappingIndex* idx)
+{
+    g_hash_table_destroy(idx->names);
+    g_hash_table_destroy(idx->macs);
+    g_hash_table_destroy(idx->drivers);
+    g_ptr_array_free(idx->globs, TRUE);
+    g_string_chunk_free(idx->strings);
+}
+
+/* Read a single line attribute of @interface from sysfs, or NULL */
+static char*
+get_sysfs_attribute(const char* interface, const char* attribute)
+{
+    g_autofree char* path = g_strdup_printf("/sys/class/net/%s/%s", interface, attribute);
+    char* contents = NULL;
+
+    if (!g_file_get_contents(path, &contents, NULL, NULL))
+        return NULL;
+    /* testing for MAC matching is done via autopkgtest */
+    return g_strstrip(contents); // LCOV_EXCL_LINE
+}
+
+static int
+find_interface(const char* interface, const NetplanState* np_state)
+{
+    MappingIndex idx = {};
+    const GPtrArray* found;
+    GPtrArray* globbed = NULL;
     GFileInfo *info;
     GFile *driver_file;
     gchar *driver_path;
     gchar *driver = NULL;
-    gpointer key, value;
-    GHashTableIter iter;
+    g_autofree gchar *mac = NULL;
     int ret = EXIT_FAILURE;
 
-    found = g_ptr_array_new ();
+    mapping_index_init(&idx, np_state);
 
     /* Try to get the driver name for the interface... */
     driver_path = g_strdup_printf("/sys/class/net/%s/device/driver", interface);
@@ -143,32 +438,32 @@ find_interface(gchar* interface, GHashTable* netdefs)
     g_object_unref (driver_file);
     g_free (driver_path);
 
-    g_hash_table_iter_init (&iter, netdefs);
-    while (g_hash_table_iter_next (&iter, &key, &value)) {
-        NetplanNetDefinition *nd = (NetplanNetDefinition *) value;
-        if (!g_strcmp0(nd->set_name, interface))
-            g_ptr_array_add (found, (gpointer) nd);
-        else if (!g_strcmp0(nd->id, interface))
-            g_ptr_array_add (found, (gpointer) nd);
-        else if (!g_strcmp0(nd->match.original_name, interface))
-            g_ptr_array_add (found, (gpointer) nd);
-    }
-    if (found->len == 0 && driver != NULL) {
+    found = g_hash_table_lookup(idx.names, interface);
+    if (!found && driver != NULL) {
         /* testing for driver matching is done via autopkgtest */
+        found = g_hash_table_lookup(idx.drivers, driver); // LCOV_EXCL_LINE
+    }
+    if (!found && (mac = get_sysfs_attribute(interface, "address"))) {
         // LCOV_EXCL_START
-        g_hash_table_iter_init (&iter, netdefs);
-        while (g_hash_table_iter_next (&iter, &key, &value)) {
-            NetplanNetDefinition *nd = (NetplanNetDefinition *) value;
-            if (!g_strcmp0(nd->match.driver, driver))
-                g_ptr_array_add (found, (gpointer) nd);
-        }
+        char* lower = g_ascii_strdown(mac, -1);
+        found = g_hash_table_lookup(idx.macs, lower);
+        g_free(lower);
         // LCOV_EXCL_STOP
     }
+    if (!found && idx.globs->len > 0) {
+        globbed = g_ptr_array_new();
+        for (unsigned i = 0; i < idx.globs->len; ++i) {
+            NetplanNetDefinition* nd = g_ptr_array_index(idx.globs, i);
+            if (fnmatch(nd->match.original_name, interface, 0) == 0)
+                g_ptr_array_add(globbed, nd);
+        }
+        found = globbed;
+    }
 
     if (driver)
         g_free (driver); // LCOV_EXCL_LINE
 
-    if (found->len != 1) {
+    if (!found || found->len != 1) {
         goto exit_find;
     }
     else {
@@ -185,7 +480,9 @@ find_interface(gchar* interface, GHashTable* netdefs)
     ret = EXIT_SUCCESS;
 
 exit_find:
-    g_ptr_array_free (found, TRUE);
+    if (globbed)
+        g_ptr_array_free(globbed, TRUE);
+    mapping_index_clear(&idx);
     return ret;
 }
 
@@ -204,10 +501,18 @@ int main(int argc, char** argv)
     /* are we being called as systemd generator? */
     gboolean called_as_generator = (strstr(argv[0], "systemd/system-generators/") != NULL);
     g_autofree char* generator_run_stamp = NULL;
+    g_autofree char* bundle_key = NULL;
     glob_t gl;
     int error_code = 0;
+    gboolean udev_changed = FALSE;
+    gboolean staging = FALSE;
+    gboolean tracking = FALSE;
+    gboolean restored = FALSE;
+    gboolean from_snapshot = FALSE;
     NetplanParser* npp = NULL;
     NetplanState* np_state = NULL;
+    NetplanProfileSpan* run_span = NULL;
+    NetplanProfileSpan* phase = NULL;
 
     /* Parse CLI options */
     opt_context = g_option_context_new(NULL);
@@ -226,6 +531,16 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    if (jobs < 1) {
+        fprintf(stderr, "invalid number of jobs: %d\n", jobs);
+        return 1;
+    }
+
+    if (validate_only && !called_as_generator) {
+        gchar* hierarchy[] = { rootdir ?: "/", NULL };
+        return validate_configs(files ?: hierarchy);
+    }
+
     if (called_as_generator) {
         if (files == NULL || g_strv_length(files) != 3 || files[0] == NULL) {
             g_fprintf(stderr, "%s can not be called directly, use 'netplan generate'.", argv[0]);
@@ -238,56 +553,100 @@ int main(int argc, char** argv)
         }
     }
 
+    run_span = netplan_profile_begin("generate");
+
+    /* The outputs of a run over the hierarchy are kept for the next boot,
+     * keyed by the input files as they are before parsing them */
+    if (called_as_generator || (!files && !mapping_iface))
+        bundle_key = netplan_output_bundle_key(rootdir);
+
+    /* /run starts out empty on every boot, restore the outputs of the last run
+     * over the same configuration rather than parsing, validating and
+     * rendering it again */
+    if (called_as_generator && bundle_key) {
+        profile_phase(&phase, "restore");
+        netplan_output_tracking_begin(rootdir);
+        tracking = TRUE;
+        restored = netplan_output_bundle_restore(rootdir, bundle_key, &any_networkd, &error);
+        CHECK_CALL((restored || !error));
+        if (restored)
+            goto outputs_written;
+    }
+
+    profile_phase(&phase, "load");
     npp = netplan_parser_new();
     /* Read all input files */
     if (files && !called_as_generator) {
         for (gchar** f = files; f && *f; ++f) {
             CHECK_CALL(netplan_parser_load_yaml(npp, *f, &error));
         }
-    } else
-        CHECK_CALL(netplan_parser_load_yaml_hierarchy(npp, rootdir, &error));
+    } else {
+        /* Use the state validated by the last run, or the one the netplan
+         * D-Bus service keeps resident, if none of the YAML files changed
+         * since. E.g. the mapping is queried on every interface event (by
+         * ifupdown hooks). */
+        from_snapshot = netplan_parser_load_snapshot(npp, rootdir, &error);
+        if (error) {
+            // LCOV_EXCL_START
+            g_debug("Cannot load the state snapshot: %s", error->message);
+            g_clear_error(&error);
+            netplan_parser_reset(npp);
+            // LCOV_EXCL_STOP
+        }
+        if (!from_snapshot)
+            CHECK_CALL(netplan_parser_load_yaml_hierarchy(npp, rootdir, &error));
+    }
 
+    profile_phase(&phase, "import");
     np_state = netplan_state_new();
     CHECK_CALL(netplan_state_import_parser_results(np_state, npp, &error));
 
-    /* Clean up generated config from previous runs */
-    netplan_networkd_cleanup(rootdir);
-    netplan_nm_cleanup(rootdir);
-    netplan_ovs_cleanup(rootdir);
-
-    cleanup_sriov_conf(rootdir);
+    /* Let the CLI re-use the validated state of the hierarchy, rather than
+     * parsing it again */
+    if (files && !called_as_generator)
+        netplan_state_remove_snapshot(rootdir);
+    else if (!mapping_iface && !from_snapshot)
+        CHECK_CALL(netplan_state_write_snapshot(np_state, rootdir, &error));
 
+    /* Only a lookup, leave the generated configuration alone */
     if (mapping_iface && np_state->netdefs) {
-        error_code = find_interface(mapping_iface, np_state->netdefs);
+        error_code = find_interface(mapping_iface, np_state);
         goto cleanup;
     }
 
+    /* Keep track of all generated files, so that only the ones which changed
+     * since the previous run are touched (see generate.manifest), and write
+     * them out in one batch once everything has been rendered */
+    profile_phase(&phase, "emit");
+    if (!tracking)
+        netplan_output_tracking_begin(rootdir);
+    netplan_output_staging_begin();
+    staging = TRUE;
+    if (bundle_key)
+        netplan_output_bundle_begin();
+
     /* Generate backend specific configuration files from merged data. */
     CHECK_CALL(netplan_state_finish_ovs_write(np_state, rootdir, &error)); // OVS cleanup unit is always written
     if (np_state->netdefs) {
         g_debug("Generating output files..");
-        for (GList* iterator = np_state->netdefs_ordered; iterator; iterator = iterator->next) {
-            NetplanNetDefinition* def = (NetplanNetDefinition*) iterator->data;
-            gboolean has_been_written = FALSE;
-            CHECK_CALL(netplan_netdef_write_networkd(np_state, def, rootdir, &has_been_written, &error));
-            any_networkd = any_networkd || has_been_written;
-
-            CHECK_CALL(netplan_netdef_write_ovs(np_state, def, rootdir, &has_been_written, &error));
-            CHECK_CALL(netplan_netdef_write_nm(np_state, def, rootdir, &has_been_written, &error));
-
-            if (def->sriov_explicit_vf_count < G_MAXUINT || def->sriov_link)
-                any_sriov = TRUE;
+        if (jobs > 1) {
+            CHECK_CALL(write_netdefs_parallel(np_state, &error));
+        } else {
+            for (GList* iterator = np_state->netdefs_ordered; iterator; iterator = iterator->next) {
+                NetplanNetDefinition* def = (NetplanNetDefinition*) iterator->data;
+                gboolean has_been_written = FALSE;
+                netplan_output_tracking_set_owner(def->id);
+                CHECK_CALL(write_netdef(np_state, def, &has_been_written, &error));
+                any_networkd = any_networkd || has_been_written;
+
+                if (def->sriov_explicit_vf_count < G_MAXUINT || def->sriov_link)
+                    any_sriov = TRUE;
+            }
         }
+        netplan_output_tracking_set_owner(NULL);
 
         CHECK_CALL(netplan_state_finish_nm_write(np_state, rootdir, &error));
         if (any_sriov) write_sriov_conf_finish(rootdir);
-        /* We may have written .rules & .link files, thus we must
-         * invalidate udevd cache of its config as by default it only
-         * invalidates cache at most every 3 seconds. Not sure if this
-         * should live in `generate' or `apply', but it is confusing
-         * when udevd ignores just-in-time created rules files.
-         */
-        reload_udevd();
     }
 
     /* Disable /usr/lib/NetworkManager/conf.d/10-globally-managed-devices.conf
@@ -295,6 +654,32 @@ int main(int argc, char** argv)
     if (netplan_state_get_backend(np_state) == NETPLAN_BACKEND_NM)
         g_string_free_to_file(g_string_new(NULL), rootdir, "/run/NetworkManager/conf.d/10-globally-managed-devices.conf", NULL);
 
+    profile_phase(&phase, "write");
+    staging = FALSE;
+    CHECK_CALL(netplan_output_staging_commit(netplan_output_staging_end(), &error));
+    if (bundle_key)
+        netplan_output_bundle_save(rootdir, bundle_key, any_networkd);
+
+outputs_written:
+    /* Clean up generated config from previous runs, which has not been
+     * generated again by this run */
+    profile_phase(&phase, "cleanup");
+    netplan_networkd_cleanup(rootdir);
+    netplan_nm_cleanup(rootdir);
+    netplan_ovs_cleanup(rootdir);
+    cleanup_sriov_conf(rootdir);
+
+    CHECK_CALL(netplan_output_tracking_finish(&udev_changed, &error));
+    /* We may have written .rules & .link files, thus we must
+     * invalidate udevd cache of its config as by default it only
+     * invalidates cache at most every 3 seconds. Not sure if this
+     * should live in `generate' or `apply', but it is confusing
+     * when udevd ignores just-in-time created rules files.
+     */
+    profile_phase(&phase, NULL);
+    if (udev_changed)
+        reload_udevd();
+
     if (called_as_generator) {
         /* Ensure networkd starts if we have any configuration for it */
         if (any_networkd)
@@ -335,6 +720,10 @@ int main(int argc, char** argv)
     }
 
 cleanup:
+    profile_phase(&phase, NULL);
+    netplan_profile_end(run_span);
+    if (staging)
+        g_ptr_array_free(netplan_output_staging_end(), TRUE);
     if (npp)
         netplan_parser_clear(&npp);
     if (np_state)
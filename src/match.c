@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2022 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "util.h"
+#include "types.h"
+
+extern NetplanState global_state;
+
+/*
+ * Match engine: maps the network devices present on the system to the
+ * netdefs whose "match:" stanza (or ID, for netdefs without one) selects
+ * them. The match conditions of all netdefs are prepared once, so that each
+ * device is only compared against the netdefs that can possibly match it,
+ * and the sysfs attributes of each device are read at most once.
+ */
+
+typedef struct {
+    const NetplanNetDefinition* netdef;
+    /* definition order, to sort the matches of a device */
+    guint index;
+    /* NULL means "any" */
+    const char* name;
+    char* mac;
+    const char* driver;
+    gboolean driver_is_glob;
+} MatchRule;
+
+struct netplan_match_engine {
+    char* sysfs_dir;
+    MatchRule* rules;
+    guint n_rules;
+    /* exact name (or ID) -> GPtrArray of MatchRule* */
+    GHashTable* by_name;
+    /* rules with a glob or without name condition, tried for every device */
+    GPtrArray* others;
+    gboolean need_mac;
+    gboolean need_driver;
+    GString* result;
+};
+
+static gboolean
+is_glob(const char* pattern)
+{
+    return strpbrk(pattern, "*[]?") != NULL;
+}
+
+static void
+add_rule_by_name(NetplanMatchEngine* engine, const char* name, MatchRule* rule)
+{
+    GPtrArray* list = g_hash_table_lookup(engine->by_name, name);
+    if (!list) {
+        list = g_ptr_array_new();
+        g_hash_table_insert(engine->by_name, (gpointer) name, list);
+    }
+    g_ptr_array_add(list, rule);
+}
+
+/**
+ * Prepare the match conditions of all netdefs of @np_state.
+ * @np_state: the state to match against, needs to outlive the engine
+ * @sysfs_dir: where to read the device attributes from, NULL for /sys/class/net
+ */
+NETPLAN_PUBLIC NetplanMatchEngine*
+netplan_match_engine_new(const NetplanState* np_state, const char* sysfs_dir)
+{
+    NetplanMatchEngine* engine = g_new0(NetplanMatchEngine, 1);
+    guint i = 0;
+
+    engine->sysfs_dir = g_strdup(sysfs_dir ?: "/sys/class/net");
+    engine->by_name = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
+    engine->others = g_ptr_array_new();
+    engine->result = g_string_new(NULL);
+    engine->rules = g_new0(MatchRule, g_list_length(np_state->netdefs_ordered));
+
+    for (GList* l = np_state->netdefs_ordered; l; l = l->next, ++i) {
+        const NetplanNetDefinition* nd = l->data;
+        MatchRule* rule = &engine->rules[i];
+
+        rule->netdef = nd;
+        rule->index = i;
+        if (!nd->has_match) {
+            /* the ID is the interface name */
+            rule->name = nd->id;
+            add_rule_by_name(engine, rule->name, rule);
+            continue;
+        }
+
+        rule->name = nd->match.original_name;
+        if (nd->match.mac) {
+            rule->mac = g_ascii_strdown(nd->match.mac, -1);
+            engine->need_mac = TRUE;
+        }
+        if (nd->match.driver) {
+            rule->driver = nd->match.driver;
+            rule->driver_is_glob = is_glob(rule->driver);
+            engine->need_driver = TRUE;
+        }
+        if (rule->name && !is_glob(rule->name))
+            add_rule_by_name(engine, rule->name, rule);
+        else
+            g_ptr_array_add(engine->others, rule);
+    }
+    engine->n_rules = i;
+    return engine;
+}
+
+NETPLAN_PUBLIC void
+netplan_match_engine_free(NetplanMatchEngine* engine)
+{
+    if (!engine)
+        return;
+    for (guint i = 0; i < engine->n_rules; ++i)
+        g_free(engine->rules[i].mac);
+    g_free(engine->rules);
+    g_hash_table_destroy(engine->by_name);
+    g_ptr_array_free(engine->others, TRUE);
+    g_string_free(engine->result, TRUE);
+    g_free(engine->sysfs_dir);
+    g_free(engine);
+}
+
+static char*
+read_mac(const NetplanMatchEngine* engine, const char* interface)
+{
+    g_autofree char* path = g_build_filename(engine->sysfs_dir, interface, "address", NULL);
+    char* contents = NULL;
+
+    if (!g_file_get_contents(path, &contents, NULL, NULL))
+        return NULL;
+    g_strstrip(contents);
+    for (char* c = contents; *c; ++c)
+        *c = g_ascii_tolower(*c);
+    return contents;
+}
+
+static char*
+read_driver(const NetplanMatchEngine* engine, const char* interface)
+{
+    g_autofree char* path = g_build_filename(engine->sysfs_dir, interface, "device", "driver", NULL);
+    g_autofree char* target = g_file_read_link(path, NULL);
+
+    return target ? g_path_get_basename(target) : NULL;
+}
+
+static gboolean
+rule_matches(const MatchRule* rule, const char* interface, const char* mac, const char* driver)
+{
+    if (rule->name && fnmatch(rule->name, interface, 0) != 0)
+        return FALSE;
+    if (rule->mac && g_strcmp0(rule->mac, mac) != 0)
+        return FALSE;
+    if (rule->driver) {
+        if (!driver)
+            return FALSE;
+        if (rule->driver_is_glob ? fnmatch(rule->driver, driver, 0) != 0 : strcmp(rule->driver, driver) != 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gint
+compare_rules(gconstpointer a, gconstpointer b)
+{
+    const MatchRule* ra = *(const MatchRule**) a;
+    const MatchRule* rb = *(const MatchRule**) b;
+    return (ra->index > rb->index) - (ra->index < rb->index);
+}
+
+/**
+ * Match all devices in @interfaces (a NULL terminated array of interface
+ * names) against the netdefs.
+ * Returns one "<interface>\t<netdef ID>\n" line per match, ordered by device
+ * and then by definition order of the netdefs. The string is owned by the
+ * engine and valid until the next call.
+ */
+NETPLAN_PUBLIC const char*
+netplan_match_engine_map(NetplanMatchEngine* engine, const char* const* interfaces)
+{
+    GPtrArray* matches = g_ptr_array_new();
+
+    g_string_truncate(engine->result, 0);
+    for (const char* const* iface = interfaces; iface && *iface; ++iface) {
+        const GPtrArray* named = g_hash_table_lookup(engine->by_name, *iface);
+        g_autofree char* mac = engine->need_mac ? read_mac(engine, *iface) : NULL;
+        g_autofree char* driver = engine->need_driver ? read_driver(engine, *iface) : NULL;
+
+        g_ptr_array_set_size(matches, 0);
+        for (guint i = 0; named && i < named->len; ++i) {
+            MatchRule* rule = g_ptr_array_index(named, i);
+            if (rule_matches(rule, *iface, mac, driver))
+                g_ptr_array_add(matches, rule);
+        }
+        for (guint i = 0; i < engine->others->len; ++i) {
+            MatchRule* rule = g_ptr_array_index(engine->others, i);
+            if (rule_matches(rule, *iface, mac, driver))
+                g_ptr_array_add(matches, rule);
+        }
+        g_ptr_array_sort(matches, compare_rules);
+        for (guint i = 0; i < matches->len; ++i) {
+            const MatchRule* rule = g_ptr_array_index(matches, i);
+            g_string_append_printf(engine->result, "%s\t%s\n", *iface, rule->netdef->id);
+        }
+    }
+    g_ptr_array_free(matches, TRUE);
+    return engine->result->str;
+}
+
+/* Match engine over the global state, for the Python CLI */
+NETPLAN_INTERNAL NetplanMatchEngine*
+_netplan_match_engine_new_global(const char* sysfs_dir)
+{
+    return netplan_match_engine_new(&global_state, sysfs_dir);
+}
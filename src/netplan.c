@@ -15,6 +15,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
 #include <glib.h>
 #include <yaml.h>
 
@@ -268,6 +272,8 @@ err_path: return FALSE; // LCOV_EXCL_LINE
 static gboolean
 write_addresses(yaml_event_t* event, yaml_emitter_t* emitter, const NetplanNetDefinition* def)
 {
+    char buf[NETPLAN_IP_PREFIX_STRLEN];
+
     YAML_SCALAR_PLAIN(event, emitter, "addresses");
     YAML_SEQUENCE_OPEN(event, emitter);
     if (def->address_options) {
@@ -283,12 +289,16 @@ write_addresses(yaml_event_t* event, yaml_emitter_t* emitter, const NetplanNetDe
         }
     }
     if (def->ip4_addresses) {
-        for (unsigned i = 0; i < def->ip4_addresses->len; ++i)
-            YAML_SCALAR_QUOTED(event, emitter, g_array_index(def->ip4_addresses, char*, i));
+        for (unsigned i = 0; i < def->ip4_addresses->len; ++i) {
+            const char* address = netplan_ip_prefix_to_string(&g_array_index(def->ip4_addresses, NetplanIPPrefix, i), buf);
+            YAML_SCALAR_QUOTED(event, emitter, address);
+        }
     }
     if (def->ip6_addresses) {
-        for (unsigned i = 0; i < def->ip6_addresses->len; ++i)
-            YAML_SCALAR_QUOTED(event, emitter, g_array_index(def->ip6_addresses, char*, i));
+        for (unsigned i = 0; i < def->ip6_addresses->len; ++i) {
+            const char* address = netplan_ip_prefix_to_string(&g_array_index(def->ip6_addresses, NetplanIPPrefix, i), buf);
+            YAML_SCALAR_QUOTED(event, emitter, address);
+        }
     }
 
     YAML_SEQUENCE_CLOSE(event, emitter);
@@ -299,18 +309,24 @@ err_path: return FALSE; // LCOV_EXCL_LINE
 static gboolean
 write_nameservers(yaml_event_t* event, yaml_emitter_t* emitter, const NetplanNetDefinition* def)
 {
+    char buf[NETPLAN_IP_PREFIX_STRLEN];
+
     YAML_SCALAR_PLAIN(event, emitter, "nameservers");
     YAML_MAPPING_OPEN(event, emitter);
     if (def->ip4_nameservers || def->ip6_nameservers){
         YAML_SCALAR_PLAIN(event, emitter, "addresses");
         YAML_SEQUENCE_OPEN(event, emitter);
         if (def->ip4_nameservers) {
-            for (unsigned i = 0; i < def->ip4_nameservers->len; ++i)
-                YAML_SCALAR_PLAIN(event, emitter, g_array_index(def->ip4_nameservers, char*, i));
+            for (unsigned i = 0; i < def->ip4_nameservers->len; ++i) {
+                const char* address = netplan_ip_prefix_to_string(&g_array_index(def->ip4_nameservers, NetplanIPPrefix, i), buf);
+                YAML_SCALAR_PLAIN(event, emitter, address);
+            }
         }
         if (def->ip6_nameservers) {
-            for (unsigned i = 0; i < def->ip6_nameservers->len; ++i)
-                YAML_SCALAR_PLAIN(event, emitter, g_array_index(def->ip6_nameservers, char*, i));
+            for (unsigned i = 0; i < def->ip6_nameservers->len; ++i) {
+                const char* address = netplan_ip_prefix_to_string(&g_array_index(def->ip6_nameservers, NetplanIPPrefix, i), buf);
+                YAML_SCALAR_PLAIN(event, emitter, address);
+            }
         }
         YAML_SEQUENCE_CLOSE(event, emitter);
     }
@@ -415,7 +431,8 @@ write_tunnel_settings(yaml_event_t* event, yaml_emitter_t* emitter, const Netpla
                 YAML_SCALAR_PLAIN(event, emitter, "allowed-ips");
                 YAML_SEQUENCE_OPEN(event, emitter);
                 for (unsigned i = 0; i < peer->allowed_ips->len; ++i) {
-                    char *ip = g_array_index(peer->allowed_ips, char*, i);
+                    char buf[NETPLAN_IP_PREFIX_STRLEN];
+                    const char *ip = netplan_ip_prefix_to_string(&g_array_index(peer->allowed_ips, NetplanIPPrefix, i), buf);
                     YAML_SCALAR_QUOTED(event, emitter, ip);
                 }
                 YAML_SEQUENCE_CLOSE(event, emitter);
@@ -603,8 +620,6 @@ _serialize_yaml(
         const NetplanNetDefinition* def)
 {
     GArray* tmp_arr = NULL;
-    GHashTableIter iter;
-    gpointer key, value;
 
     YAML_SCALAR_PLAIN(event, emitter, def->id);
     YAML_MAPPING_OPEN(event, emitter);
@@ -682,10 +697,10 @@ _serialize_yaml(
 
     /* Search interfaces */
     if (def->type == NETPLAN_DEF_TYPE_BRIDGE || def->type == NETPLAN_DEF_TYPE_BOND) {
+        const GPtrArray* members = netplan_state_get_members(np_state, def);
         tmp_arr = g_array_new(FALSE, FALSE, sizeof(NetplanNetDefinition*));
-        g_hash_table_iter_init(&iter, np_state->netdefs);
-        while (g_hash_table_iter_next (&iter, &key, &value)) {
-            NetplanNetDefinition *nd = (NetplanNetDefinition *) value;
+        for (unsigned i = 0; members && i < members->len; ++i) {
+            NetplanNetDefinition *nd = g_ptr_array_index(members, i);
             if (g_strcmp0(nd->bond, def->id) == 0 || g_strcmp0(nd->bridge, def->id) == 0)
                 g_array_append_val(tmp_arr, nd);
         }
@@ -890,37 +905,18 @@ contains_netdef_type(gpointer key, gpointer value, gpointer user_data)
     return nd->type == *type;
 }
 
-/**
- * Generate the Netplan YAML configuration for all netdefs in the state
- * @np_state: the state for which to generate the config
- * @file_hint: Name hint for the generated output YAML file
- * @rootdir: If not %NULL, generate configuration in this root directory
- *           (useful for testing).
- */
-NETPLAN_INTERNAL gboolean
-netplan_state_write_yaml(const NetplanState* np_state, const char* file_hint, const char* rootdir, GError** error)
+static gboolean
+netplan_state_emit_yaml(const NetplanState* np_state, FILE* output, GError** error)
 {
-    g_autofree gchar *path = NULL;
     GHashTable *ovs_ports = NULL;
     GHashTableIter iter;
     gpointer key, value;
 
-    gboolean global_values = (np_state->backend != NETPLAN_BACKEND_NONE
-                              || has_openvswitch(&np_state->ovs_settings, NETPLAN_BACKEND_NONE, NULL));
-
-    if (!global_values && netplan_state_get_netdefs_size(np_state) == 0) {
-        g_debug("No data/netdefs to serialize into YAML.");
-        return TRUE;
-    }
-
-    path = g_build_path(G_DIR_SEPARATOR_S, rootdir ?: G_DIR_SEPARATOR_S, "etc", "netplan", file_hint, NULL);
-
     /* Start rendering YAML output */
     yaml_emitter_t emitter_data;
     yaml_event_t event_data;
     yaml_emitter_t* emitter = &emitter_data;
     yaml_event_t* event = &event_data;
-    FILE *output = fopen(path, "wb");
 
     YAML_OUT_START(event, emitter, output);
     /* build the netplan boilerplate YAML structure */
@@ -974,18 +970,83 @@ netplan_state_write_yaml(const NetplanState* np_state, const char* file_hint, co
 
     /* Tear down the YAML emitter */
     YAML_OUT_STOP(event, emitter);
-    fclose(output);
+    if (ovs_ports)
+        g_hash_table_destroy(ovs_ports);
     return TRUE;
 
     // LCOV_EXCL_START
 err_path:
     g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT, "Error generating YAML: %s", emitter->problem);
     yaml_emitter_delete(emitter);
-    fclose(output);
+    if (ovs_ports)
+        g_hash_table_destroy(ovs_ports);
     return FALSE;
     // LCOV_EXCL_STOP
 }
 
+static gboolean
+netplan_state_has_yaml(const NetplanState* np_state)
+{
+    gboolean global_values = (np_state->backend != NETPLAN_BACKEND_NONE
+                              || has_openvswitch(&np_state->ovs_settings, NETPLAN_BACKEND_NONE, NULL));
+
+    if (!global_values && netplan_state_get_netdefs_size(np_state) == 0) {
+        g_debug("No data/netdefs to serialize into YAML.");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Generate the Netplan YAML configuration for all netdefs in the state
+ * @np_state: the state for which to generate the config
+ * @file_hint: Name hint for the generated output YAML file
+ * @rootdir: If not %NULL, generate configuration in this root directory
+ *           (useful for testing).
+ */
+NETPLAN_INTERNAL gboolean
+netplan_state_write_yaml(const NetplanState* np_state, const char* file_hint, const char* rootdir, GError** error)
+{
+    g_autofree gchar *path = NULL;
+    gboolean ret;
+
+    if (!netplan_state_has_yaml(np_state))
+        return TRUE;
+
+    path = g_build_path(G_DIR_SEPARATOR_S, rootdir ?: G_DIR_SEPARATOR_S, "etc", "netplan", file_hint, NULL);
+    FILE *output = fopen(path, "wb");
+    ret = netplan_state_emit_yaml(np_state, output, error);
+    fclose(output);
+    return ret;
+}
+
+/**
+ * Dump the Netplan YAML configuration for all netdefs in the state into an
+ * already open file descriptor, which is left open.
+ * @np_state: the state for which to generate the config
+ * @output_fd: file descriptor to write the YAML into
+ */
+NETPLAN_INTERNAL gboolean
+netplan_state_dump_yaml(const NetplanState* np_state, int output_fd, GError** error)
+{
+    gboolean ret;
+    FILE *output = NULL;
+
+    if (!netplan_state_has_yaml(np_state))
+        return TRUE;
+
+    output = fdopen(dup(output_fd), "wb");
+    if (!output) {
+        // LCOV_EXCL_START
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot open output: %m");
+        return FALSE;
+        // LCOV_EXCL_STOP
+    }
+    ret = netplan_state_emit_yaml(np_state, output, error);
+    fclose(output);
+    return ret;
+}
+
 /* XXX: implement the following functions, once needed:
 void write_netplan_conf_finish(const char* rootdir)
 void cleanup_netplan_conf(const char* rootdir)
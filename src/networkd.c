@@ -194,9 +194,10 @@ write_wireguard_params(GString* s, const NetplanNetDefinition* def)
         g_string_append_printf(peer_s, "PublicKey=%s\n", peer->public_key);
         g_string_append(peer_s, "AllowedIPs=");
         for (guint i = 0; i < peer->allowed_ips->len; ++i) {
+            char buf[NETPLAN_IP_PREFIX_STRLEN];
             if (i > 0 )
                 g_string_append_c(peer_s, ',');
-            g_string_append_printf(peer_s, "%s", g_array_index(peer->allowed_ips, char*, i));
+            g_string_append(peer_s, netplan_ip_prefix_to_string(&g_array_index(peer->allowed_ips, NetplanIPPrefix, i), buf));
         }
         g_string_append_c(peer_s, '\n');
 
@@ -224,7 +225,6 @@ static void
 write_link_file(const NetplanNetDefinition* def, const char* rootdir, const char* path)
 {
     GString* s = NULL;
-    mode_t orig_umask;
 
     /* Don't write .link files for virtual devices; they use .netdev instead.
      * Don't write .link files for MODEM devices, as they aren't supported by networkd.
@@ -279,9 +279,7 @@ write_link_file(const NetplanNetDefinition* def, const char* rootdir, const char
     if (def->large_receive_offload)
         g_string_append_printf(s, "LargeReceiveOffload=%u\n", def->large_receive_offload);
 
-    orig_umask = umask(022);
-    g_string_free_to_file(s, rootdir, path, ".link");
-    umask(orig_umask);
+    g_string_free_to_file_with_umask(s, rootdir, path, ".link", 022);
 }
 
 
@@ -380,7 +378,6 @@ static void
 write_netdev_file(const NetplanNetDefinition* def, const char* rootdir, const char* path)
 {
     GString* s = NULL;
-    mode_t orig_umask;
 
     g_assert(def->type >= NETPLAN_DEF_TYPE_VIRTUAL);
 
@@ -449,9 +446,7 @@ write_netdev_file(const NetplanNetDefinition* def, const char* rootdir, const ch
 
     /* these do not contain secrets and need to be readable by
      * systemd-networkd - LP: #1736965 */
-    orig_umask = umask(022);
-    g_string_free_to_file(s, rootdir, path, ".netdev");
-    umask(orig_umask);
+    g_string_free_to_file_with_umask(s, rootdir, path, ".netdev", 022);
 }
 
 static void
@@ -595,8 +590,8 @@ netplan_netdef_write_network_file(
     GString* network = NULL;
     GString* link = NULL;
     GString* s = NULL;
-    mode_t orig_umask;
     gboolean is_optional = def->optional;
+    char buf[NETPLAN_IP_PREFIX_STRLEN];
 
     SET_OPT_OUT_PTR(has_been_written, FALSE);
 
@@ -668,10 +663,12 @@ netplan_netdef_write_network_file(
 
     if (def->ip4_addresses)
         for (unsigned i = 0; i < def->ip4_addresses->len; ++i)
-            g_string_append_printf(network, "Address=%s\n", g_array_index(def->ip4_addresses, char*, i));
+            g_string_append_printf(network, "Address=%s\n",
+                                   netplan_ip_prefix_to_string(&g_array_index(def->ip4_addresses, NetplanIPPrefix, i), buf));
     if (def->ip6_addresses)
         for (unsigned i = 0; i < def->ip6_addresses->len; ++i)
-            g_string_append_printf(network, "Address=%s\n", g_array_index(def->ip6_addresses, char*, i));
+            g_string_append_printf(network, "Address=%s\n",
+                                   netplan_ip_prefix_to_string(&g_array_index(def->ip6_addresses, NetplanIPPrefix, i), buf));
     if (def->ip6_addr_gen_token) {
         g_string_append_printf(network, "IPv6Token=static:%s\n", def->ip6_addr_gen_token);
     } else if (def->ip6_addr_gen_mode > NETPLAN_ADDRGEN_EUI64) {
@@ -693,10 +690,12 @@ netplan_netdef_write_network_file(
         g_string_append_printf(network, "Gateway=%s\n", def->gateway6);
     if (def->ip4_nameservers)
         for (unsigned i = 0; i < def->ip4_nameservers->len; ++i)
-            g_string_append_printf(network, "DNS=%s\n", g_array_index(def->ip4_nameservers, char*, i));
+            g_string_append_printf(network, "DNS=%s\n",
+                                   netplan_ip_prefix_to_string(&g_array_index(def->ip4_nameservers, NetplanIPPrefix, i), buf));
     if (def->ip6_nameservers)
         for (unsigned i = 0; i < def->ip6_nameservers->len; ++i)
-            g_string_append_printf(network, "DNS=%s\n", g_array_index(def->ip6_nameservers, char*, i));
+            g_string_append_printf(network, "DNS=%s\n",
+                                   netplan_ip_prefix_to_string(&g_array_index(def->ip6_nameservers, NetplanIPPrefix, i), buf));
     if (def->search_domains) {
         g_string_append_printf(network, "Domains=%s", g_array_index(def->search_domains, char*, 0));
         for (unsigned i = 1; i < def->search_domains->len; ++i)
@@ -822,9 +821,7 @@ netplan_netdef_write_network_file(
 
         /* these do not contain secrets and need to be readable by
          * systemd-networkd - LP: #1736965 */
-        orig_umask = umask(022);
-        g_string_free_to_file(s, rootdir, path, ".network");
-        umask(orig_umask);
+        g_string_free_to_file_with_umask(s, rootdir, path, ".network", 022);
     }
 
     SET_OPT_OUT_PTR(has_been_written, TRUE);
@@ -836,7 +833,6 @@ write_rules_file(const NetplanNetDefinition* def, const char* rootdir)
 {
     GString* s = NULL;
     g_autofree char* path = g_strjoin(NULL, "run/udev/rules.d/99-netplan-", def->id, ".rules", NULL);
-    mode_t orig_umask;
 
     /* do we need to write a .rules file?
      * It's only required for reliably setting the name of a physical device
@@ -870,9 +866,7 @@ write_rules_file(const NetplanNetDefinition* def, const char* rootdir)
 
     g_string_append_printf(s, "NAME=\"%s\"\n", def->set_name);
 
-    orig_umask = umask(022);
-    g_string_free_to_file(s, rootdir, path, NULL);
-    umask(orig_umask);
+    g_string_free_to_file_with_umask(s, rootdir, path, NULL, 022);
 }
 
 static gboolean
@@ -974,7 +968,6 @@ static void
 write_wpa_unit(const NetplanNetDefinition* def, const char* rootdir)
 {
     g_autofree gchar *stdouth = NULL;
-    mode_t orig_umask;
 
     stdouth = systemd_escape(def->id);
 
@@ -993,9 +986,7 @@ write_wpa_unit(const NetplanNetDefinition* def, const char* rootdir)
     } else {
         g_string_append(s, " -Dnl80211,wext\n");
     }
-    orig_umask = umask(022);
-    g_string_free_to_file(s, rootdir, path, NULL);
-    umask(orig_umask);
+    g_string_free_to_file_with_umask(s, rootdir, path, NULL, 022);
 }
 
 static gboolean
@@ -1004,7 +995,6 @@ write_wpa_conf(const NetplanNetDefinition* def, const char* rootdir, GError** er
     GHashTableIter iter;
     GString* s = g_string_new("ctrl_interface=/run/wpa_supplicant\n\n");
     g_autofree char* path = g_strjoin(NULL, "run/netplan/wpa-", def->id, ".conf", NULL);
-    mode_t orig_umask;
 
     g_debug("%s: Creating wpa_supplicant configuration file %s", def->id, path);
     if (def->type == NETPLAN_DEF_TYPE_WIFI) {
@@ -1080,9 +1070,7 @@ write_wpa_conf(const NetplanNetDefinition* def, const char* rootdir, GError** er
     }
 
     /* use tight permissions as this contains secrets */
-    orig_umask = umask(077);
-    g_string_free_to_file(s, rootdir, path, NULL);
-    umask(orig_umask);
+    g_string_free_to_file_with_umask(s, rootdir, path, NULL, 077);
     return TRUE;
 }
 
@@ -1136,14 +1124,8 @@ netplan_netdef_write_networkd(
         write_wpa_unit(def, rootdir);
 
         g_debug("Creating wpa_supplicant service enablement link %s", link);
-        safe_mkdir_p_dir(link);
-
-        if (symlink(slink, link) < 0 && errno != EEXIST) {
-            // LCOV_EXCL_START
-            g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT, "failed to create enablement symlink: %m\n");
-            return FALSE;
-            // LCOV_EXCL_STOP
-        }
+        if (!create_enablement_symlink(slink, link, error))
+            return FALSE; // LCOV_EXCL_LINE
 
     }
 
@@ -192,19 +192,295 @@ addr_gen_mode_str(const NetplanAddrGenMode mode)
     }
 }
 
+/*
+ * Ordered keyfile builder, rendering the same output as g_key_file_to_data()
+ * would for the same sequence of g_key_file_set_*() calls, but without a hash
+ * table and list nodes per entry: all group names, keys, values and comments
+ * are appended to one string arena, which is reused for every connection
+ * profile of a netdef. Groups and keys are kept in insertion order, setting
+ * an existing key replaces its value in place.
+ */
+
+typedef struct {
+    gsize name;
+    /* first and last entry of the group, -1 if it has none */
+    gint first;
+    gint last;
+} KeyFileGroup;
+
+typedef struct {
+    gsize key;
+    gsize value;
+    /* comment written above the key, -1 if it has none */
+    gssize comment;
+    /* next entry of the same group, -1 for the last one */
+    gint next;
+    gboolean removed;
+} KeyFileEntry;
+
+typedef struct {
+    GString* strings;
+    GArray* groups;
+    GArray* entries;
+} KeyFile;
+
+#define KEYFILE_STR(kf, offset) ((kf)->strings->str + (offset))
+#define KEYFILE_ENTRY(kf, i) (&g_array_index((kf)->entries, KeyFileEntry, (i)))
+
+static KeyFile*
+keyfile_new(void)
+{
+    KeyFile* kf = g_new0(KeyFile, 1);
+    kf->strings = g_string_sized_new(4096);
+    kf->groups = g_array_new(FALSE, FALSE, sizeof(KeyFileGroup));
+    kf->entries = g_array_new(FALSE, FALSE, sizeof(KeyFileEntry));
+    return kf;
+}
+
+static void
+keyfile_reset(KeyFile* kf)
+{
+    g_string_truncate(kf->strings, 0);
+    g_array_set_size(kf->groups, 0);
+    g_array_set_size(kf->entries, 0);
+}
+
+static void
+keyfile_free(KeyFile* kf)
+{
+    g_string_free(kf->strings, TRUE);
+    g_array_free(kf->groups, TRUE);
+    g_array_free(kf->entries, TRUE);
+    g_free(kf);
+}
+
+/* Copy @s (including its NUL) into the arena, return its offset */
+static gsize
+keyfile_intern(KeyFile* kf, const char* s)
+{
+    gsize offset = kf->strings->len;
+    g_string_append_len(kf->strings, s, strlen(s) + 1);
+    return offset;
+}
+
+static KeyFileGroup*
+keyfile_group(KeyFile* kf, const char* group, gboolean create)
+{
+    KeyFileGroup new_group = { 0, -1, -1 };
+
+    for (guint i = 0; i < kf->groups->len; ++i) {
+        KeyFileGroup* g = &g_array_index(kf->groups, KeyFileGroup, i);
+        if (!strcmp(KEYFILE_STR(kf, g->name), group))
+            return g;
+    }
+    if (!create)
+        return NULL;
+    new_group.name = keyfile_intern(kf, group);
+    g_array_append_val(kf->groups, new_group);
+    return &g_array_index(kf->groups, KeyFileGroup, kf->groups->len - 1);
+}
+
+/* Return the index of the entry @key of @g, or -1 if it is not set */
+static gint
+keyfile_lookup(const KeyFile* kf, const KeyFileGroup* g, const char* key)
+{
+    for (gint i = g ? g->first : -1; i >= 0; i = KEYFILE_ENTRY(kf, i)->next) {
+        const KeyFileEntry* e = KEYFILE_ENTRY(kf, i);
+        if (!e->removed && !strcmp(KEYFILE_STR(kf, e->key), key))
+            return i;
+    }
+    return -1;
+}
+
+/* Return the entry @key of @group, appending it if it does not exist yet. The
+ * caller needs to set its value. */
+static KeyFileEntry*
+keyfile_entry(KeyFile* kf, const char* group, const char* key)
+{
+    KeyFileGroup* g = keyfile_group(kf, group, TRUE);
+    gint i = keyfile_lookup(kf, g, key);
+    KeyFileEntry e = { 0, 0, -1, -1, FALSE };
+
+    if (i < 0) {
+        e.key = keyfile_intern(kf, key);
+        i = kf->entries->len;
+        g_array_append_val(kf->entries, e);
+        if (g->last >= 0)
+            KEYFILE_ENTRY(kf, g->last)->next = i;
+        else
+            g->first = i;
+        g->last = i;
+    }
+    return KEYFILE_ENTRY(kf, i);
+}
+
+/* Append @s to @out, escaped like g_key_file_set_string() and (with
+ * @escape_separator) g_key_file_set_string_list() do */
+static void
+keyfile_append_escaped(GString* out, const char* s, gboolean escape_separator)
+{
+    gboolean leading_space = TRUE;
+
+    for (const char* p = s; *p; ++p) {
+        switch (*p) {
+            case ' ':
+                g_string_append(out, leading_space ? "\\s" : " ");
+                break;
+            case '\t':
+                g_string_append(out, leading_space ? "\\t" : "\t");
+                break;
+            case '\n':
+                g_string_append(out, "\\n");
+                leading_space = FALSE;
+                break;
+            case '\r':
+                g_string_append(out, "\\r");
+                leading_space = FALSE;
+                break;
+            case '\\':
+                g_string_append(out, "\\\\");
+                leading_space = FALSE;
+                break;
+            default:
+                if (escape_separator && *p == ';') {
+                    g_string_append(out, "\\;");
+                    leading_space = TRUE;
+                } else {
+                    g_string_append_c(out, *p);
+                    leading_space = FALSE;
+                }
+        }
+    }
+}
+
+/* Set @key of @group to @value as-is, like g_key_file_set_value() */
+static void
+keyfile_set_value(KeyFile* kf, const char* group, const char* key, const char* value)
+{
+    KeyFileEntry* e = keyfile_entry(kf, group, key);
+    e->value = keyfile_intern(kf, value);
+}
+
+static void
+keyfile_set_string(KeyFile* kf, const char* group, const char* key, const char* value)
+{
+    KeyFileEntry* e = keyfile_entry(kf, group, key);
+    e->value = kf->strings->len;
+    keyfile_append_escaped(kf->strings, value, FALSE);
+    g_string_append_c(kf->strings, '\0');
+}
+
+static void
+keyfile_set_string_list(KeyFile* kf, const char* group, const char* key, const gchar* const* list, gsize len)
+{
+    KeyFileEntry* e = keyfile_entry(kf, group, key);
+    e->value = kf->strings->len;
+    for (gsize i = 0; i < len; ++i) {
+        keyfile_append_escaped(kf->strings, list[i], TRUE);
+        g_string_append_c(kf->strings, ';');
+    }
+    g_string_append_c(kf->strings, '\0');
+}
+
+static void
+keyfile_set_integer(KeyFile* kf, const char* group, const char* key, gint value)
+{
+    KeyFileEntry* e = keyfile_entry(kf, group, key);
+    e->value = kf->strings->len;
+    g_string_append_printf(kf->strings, "%d", value);
+    g_string_append_c(kf->strings, '\0');
+}
+
+static void
+keyfile_set_uint64(KeyFile* kf, const char* group, const char* key, guint64 value)
+{
+    KeyFileEntry* e = keyfile_entry(kf, group, key);
+    e->value = kf->strings->len;
+    g_string_append_printf(kf->strings, "%" G_GUINT64_FORMAT, value);
+    g_string_append_c(kf->strings, '\0');
+}
+
+static void
+keyfile_set_boolean(KeyFile* kf, const char* group, const char* key, gboolean value)
+{
+    keyfile_set_value(kf, group, key, value ? "true" : "false");
+}
+
+/* Set the comment written above the existing @key of @group */
 static void
-write_search_domains(const NetplanNetDefinition* def, const char* group, GKeyFile *kf)
+keyfile_set_comment(KeyFile* kf, const char* group, const char* key, const char* comment)
+{
+    gint i = keyfile_lookup(kf, keyfile_group(kf, group, FALSE), key);
+    g_assert(i >= 0);
+    KEYFILE_ENTRY(kf, i)->comment = keyfile_intern(kf, comment);
+}
+
+/* Remove @key of @group, the group itself is kept even if it becomes empty */
+static void
+keyfile_remove_key(KeyFile* kf, const char* group, const char* key)
+{
+    gint i = keyfile_lookup(kf, keyfile_group(kf, group, FALSE), key);
+    if (i >= 0)
+        KEYFILE_ENTRY(kf, i)->removed = TRUE;
+}
+
+/* Render @kf into a new string, in the format of g_key_file_to_data() */
+static GString*
+keyfile_to_data(const KeyFile* kf)
+{
+    GString* out = g_string_sized_new(kf->strings->len + 256);
+
+    for (guint i = 0; i < kf->groups->len; ++i) {
+        const KeyFileGroup* g = &g_array_index(kf->groups, KeyFileGroup, i);
+        /* separate groups by an empty line */
+        if (out->len >= 2 && out->str[out->len - 2] != '\n')
+            g_string_append_c(out, '\n');
+        g_string_append_printf(out, "[%s]\n", KEYFILE_STR(kf, g->name));
+        for (gint j = g->first; j >= 0; j = KEYFILE_ENTRY(kf, j)->next) {
+            const KeyFileEntry* e = KEYFILE_ENTRY(kf, j);
+            if (e->removed)
+                continue;
+            if (e->comment >= 0) {
+                /* every line of the comment is prefixed with '#' */
+                g_string_append_c(out, '#');
+                for (const char* c = KEYFILE_STR(kf, e->comment); *c; ++c) {
+                    g_string_append_c(out, *c);
+                    if (*c == '\n')
+                        g_string_append_c(out, '#');
+                }
+                g_string_append_c(out, '\n');
+            }
+            g_string_append_printf(out, "%s=%s\n", KEYFILE_STR(kf, e->key), KEYFILE_STR(kf, e->value));
+        }
+    }
+    return out;
+}
+
+static void
+write_search_domains(const NetplanNetDefinition* def, const char* group, KeyFile* kf)
 {
     if (def->search_domains) {
         const gchar* list[def->search_domains->len];
         for (unsigned i = 0; i < def->search_domains->len; ++i)
             list[i] = g_array_index(def->search_domains, char*, i);
-        g_key_file_set_string_list(kf, group, "dns-search", list, def->search_domains->len);
+        keyfile_set_string_list(kf, group, "dns-search", list, def->search_domains->len);
     }
 }
 
+/* Set @key of @group to the list of NetplanIPPrefix in @prefixes */
+static void
+set_ip_prefix_list(KeyFile* kf, const gchar* group, const gchar* key, const GArray* prefixes)
+{
+    char bufs[prefixes->len][NETPLAN_IP_PREFIX_STRLEN];
+    const gchar* list[prefixes->len];
+
+    for (guint i = 0; i < prefixes->len; ++i)
+        list[i] = netplan_ip_prefix_to_string(&g_array_index(prefixes, NetplanIPPrefix, i), bufs[i]);
+    keyfile_set_string_list(kf, group, key, list, prefixes->len);
+}
+
 static gboolean
-write_routes(const NetplanNetDefinition* def, GKeyFile *kf, int family, GError** error)
+write_routes(const NetplanNetDefinition* def, KeyFile* kf, int family, GError** error)
 {
     const gchar* group = NULL;
     gchar* tmp_key = NULL;
@@ -246,7 +522,7 @@ write_routes(const NetplanNetDefinition* def, GKeyFile *kf, int family, GError**
                                        cur_route->metric);
             else if (is_global) // no metric, but global gateway
                 g_string_append_printf(tmp_val, ",%s", cur_route->via);
-            g_key_file_set_string(kf, group, tmp_key, tmp_val->str);
+            keyfile_set_string(kf, group, tmp_key, tmp_val->str);
             g_free(tmp_key);
             g_string_free(tmp_val, TRUE);
 
@@ -273,7 +549,7 @@ write_routes(const NetplanNetDefinition* def, GKeyFile *kf, int family, GError**
                 if (cur_route->from)
                     g_string_append_printf(tmp_val, "src=%s,", cur_route->from);
                 tmp_val->str[tmp_val->len - 1] = '\0'; //remove trailing comma
-                g_key_file_set_string(kf, group, tmp_key, tmp_val->str);
+                keyfile_set_string(kf, group, tmp_key, tmp_val->str);
                 g_free(tmp_key);
                 g_string_free(tmp_val, TRUE);
             }
@@ -284,25 +560,25 @@ write_routes(const NetplanNetDefinition* def, GKeyFile *kf, int family, GError**
 }
 
 static void
-write_bond_parameters(const NetplanNetDefinition* def, GKeyFile *kf)
+write_bond_parameters(const NetplanNetDefinition* def, KeyFile* kf)
 {
     GString* tmp_val = NULL;
     if (def->bond_params.mode)
-        g_key_file_set_string(kf, "bond", "mode", def->bond_params.mode);
+        keyfile_set_string(kf, "bond", "mode", def->bond_params.mode);
     if (def->bond_params.lacp_rate)
-        g_key_file_set_string(kf, "bond", "lacp_rate", def->bond_params.lacp_rate);
+        keyfile_set_string(kf, "bond", "lacp_rate", def->bond_params.lacp_rate);
     if (def->bond_params.monitor_interval)
-        g_key_file_set_string(kf, "bond", "miimon", def->bond_params.monitor_interval);
+        keyfile_set_string(kf, "bond", "miimon", def->bond_params.monitor_interval);
     if (def->bond_params.min_links)
-        g_key_file_set_integer(kf, "bond", "min_links", def->bond_params.min_links);
+        keyfile_set_integer(kf, "bond", "min_links", def->bond_params.min_links);
     if (def->bond_params.transmit_hash_policy)
-        g_key_file_set_string(kf, "bond", "xmit_hash_policy", def->bond_params.transmit_hash_policy);
+        keyfile_set_string(kf, "bond", "xmit_hash_policy", def->bond_params.transmit_hash_policy);
     if (def->bond_params.selection_logic)
-        g_key_file_set_string(kf, "bond", "ad_select", def->bond_params.selection_logic);
+        keyfile_set_string(kf, "bond", "ad_select", def->bond_params.selection_logic);
     if (def->bond_params.all_slaves_active)
-        g_key_file_set_integer(kf, "bond", "all_slaves_active", def->bond_params.all_slaves_active);
+        keyfile_set_integer(kf, "bond", "all_slaves_active", def->bond_params.all_slaves_active);
     if (def->bond_params.arp_interval)
-        g_key_file_set_string(kf, "bond", "arp_interval", def->bond_params.arp_interval);
+        keyfile_set_string(kf, "bond", "arp_interval", def->bond_params.arp_interval);
     if (def->bond_params.arp_ip_targets) {
         tmp_val = g_string_new(NULL);
         for (unsigned i = 0; i < def->bond_params.arp_ip_targets->len; ++i) {
@@ -310,57 +586,57 @@ write_bond_parameters(const NetplanNetDefinition* def, GKeyFile *kf)
                 g_string_append_printf(tmp_val, ",");
             g_string_append_printf(tmp_val, "%s", g_array_index(def->bond_params.arp_ip_targets, char*, i));
         }
-        g_key_file_set_string(kf, "bond", "arp_ip_target", tmp_val->str);
+        keyfile_set_string(kf, "bond", "arp_ip_target", tmp_val->str);
         g_string_free(tmp_val, TRUE);
     }
     if (def->bond_params.arp_validate)
-        g_key_file_set_string(kf, "bond", "arp_validate", def->bond_params.arp_validate);
+        keyfile_set_string(kf, "bond", "arp_validate", def->bond_params.arp_validate);
     if (def->bond_params.arp_all_targets)
-        g_key_file_set_string(kf, "bond", "arp_all_targets", def->bond_params.arp_all_targets);
+        keyfile_set_string(kf, "bond", "arp_all_targets", def->bond_params.arp_all_targets);
     if (def->bond_params.up_delay)
-        g_key_file_set_string(kf, "bond", "updelay", def->bond_params.up_delay);
+        keyfile_set_string(kf, "bond", "updelay", def->bond_params.up_delay);
     if (def->bond_params.down_delay)
-        g_key_file_set_string(kf, "bond", "downdelay", def->bond_params.down_delay);
+        keyfile_set_string(kf, "bond", "downdelay", def->bond_params.down_delay);
     if (def->bond_params.fail_over_mac_policy)
-        g_key_file_set_string(kf, "bond", "fail_over_mac", def->bond_params.fail_over_mac_policy);
+        keyfile_set_string(kf, "bond", "fail_over_mac", def->bond_params.fail_over_mac_policy);
     if (def->bond_params.gratuitous_arp) {
-        g_key_file_set_integer(kf, "bond", "num_grat_arp", def->bond_params.gratuitous_arp);
+        keyfile_set_integer(kf, "bond", "num_grat_arp", def->bond_params.gratuitous_arp);
         /* Work around issue in NM where unset unsolicited_na will overwrite num_grat_arp:
          * https://github.com/NetworkManager/NetworkManager/commit/42b0bef33c77a0921590b2697f077e8ea7805166 */
-        g_key_file_set_integer(kf, "bond", "num_unsol_na", def->bond_params.gratuitous_arp);
+        keyfile_set_integer(kf, "bond", "num_unsol_na", def->bond_params.gratuitous_arp);
     }
     if (def->bond_params.packets_per_slave)
-        g_key_file_set_integer(kf, "bond", "packets_per_slave", def->bond_params.packets_per_slave);
+        keyfile_set_integer(kf, "bond", "packets_per_slave", def->bond_params.packets_per_slave);
     if (def->bond_params.primary_reselect_policy)
-        g_key_file_set_string(kf, "bond", "primary_reselect", def->bond_params.primary_reselect_policy);
+        keyfile_set_string(kf, "bond", "primary_reselect", def->bond_params.primary_reselect_policy);
     if (def->bond_params.resend_igmp)
-        g_key_file_set_integer(kf, "bond", "resend_igmp", def->bond_params.resend_igmp);
+        keyfile_set_integer(kf, "bond", "resend_igmp", def->bond_params.resend_igmp);
     if (def->bond_params.learn_interval)
-        g_key_file_set_string(kf, "bond", "lp_interval", def->bond_params.learn_interval);
+        keyfile_set_string(kf, "bond", "lp_interval", def->bond_params.learn_interval);
     if (def->bond_params.primary_slave)
-        g_key_file_set_string(kf, "bond", "primary", def->bond_params.primary_slave);
+        keyfile_set_string(kf, "bond", "primary", def->bond_params.primary_slave);
 }
 
 static void
-write_bridge_params(const NetplanNetDefinition* def, GKeyFile *kf)
+write_bridge_params(const NetplanNetDefinition* def, KeyFile* kf)
 {
     if (def->custom_bridging) {
         if (def->bridge_params.ageing_time)
-            g_key_file_set_string(kf, "bridge", "ageing-time", def->bridge_params.ageing_time);
+            keyfile_set_string(kf, "bridge", "ageing-time", def->bridge_params.ageing_time);
         if (def->bridge_params.priority)
-            g_key_file_set_uint64(kf, "bridge", "priority", def->bridge_params.priority);
+            keyfile_set_uint64(kf, "bridge", "priority", def->bridge_params.priority);
         if (def->bridge_params.forward_delay)
-            g_key_file_set_string(kf, "bridge", "forward-delay", def->bridge_params.forward_delay);
+            keyfile_set_string(kf, "bridge", "forward-delay", def->bridge_params.forward_delay);
         if (def->bridge_params.hello_time)
-            g_key_file_set_string(kf, "bridge", "hello-time", def->bridge_params.hello_time);
+            keyfile_set_string(kf, "bridge", "hello-time", def->bridge_params.hello_time);
         if (def->bridge_params.max_age)
-            g_key_file_set_string(kf, "bridge", "max-age", def->bridge_params.max_age);
-        g_key_file_set_boolean(kf, "bridge", "stp", def->bridge_params.stp);
+            keyfile_set_string(kf, "bridge", "max-age", def->bridge_params.max_age);
+        keyfile_set_boolean(kf, "bridge", "stp", def->bridge_params.stp);
     }
 }
 
 static gboolean
-write_wireguard_params(const NetplanNetDefinition* def, GKeyFile *kf, GError** error)
+write_wireguard_params(const NetplanNetDefinition* def, KeyFile* kf, GError** error)
 {
     gchar* tmp_group = NULL;
     g_assert(def->tunnel.private_key);
@@ -373,12 +649,12 @@ write_wireguard_params(const NetplanNetDefinition* def, GKeyFile *kf, GError** e
         g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT, "%s: private key needs to be base64 encoded when using the NM backend\n", def->id);
         return FALSE;
     } else
-        g_key_file_set_string(kf, "wireguard", "private-key", def->tunnel.private_key);
+        keyfile_set_string(kf, "wireguard", "private-key", def->tunnel.private_key);
 
     if (def->tunnel.port)
-        g_key_file_set_uint64(kf, "wireguard", "listen-port", def->tunnel.port);
+        keyfile_set_uint64(kf, "wireguard", "listen-port", def->tunnel.port);
     if (def->tunnel.fwmark)
-        g_key_file_set_uint64(kf, "wireguard", "fwmark", def->tunnel.fwmark);
+        keyfile_set_uint64(kf, "wireguard", "fwmark", def->tunnel.fwmark);
 
     for (guint i = 0; i < def->wireguard_peers->len; i++) {
         NetplanWireguardPeer *peer = g_array_index (def->wireguard_peers, NetplanWireguardPeer*, i);
@@ -386,9 +662,9 @@ write_wireguard_params(const NetplanNetDefinition* def, GKeyFile *kf, GError** e
         tmp_group = g_strdup_printf("wireguard-peer.%s", peer->public_key);
 
         if (peer->keepalive)
-            g_key_file_set_integer(kf, tmp_group, "persistent-keepalive", peer->keepalive);
+            keyfile_set_integer(kf, tmp_group, "persistent-keepalive", peer->keepalive);
         if (peer->endpoint)
-            g_key_file_set_string(kf, tmp_group, "endpoint", peer->endpoint);
+            keyfile_set_string(kf, tmp_group, "endpoint", peer->endpoint);
 
         /* The key was already validated via validate_tunnel_grammar(), but we need
          * to differentiate between base64 key VS absolute path key-file. And a base64
@@ -399,89 +675,85 @@ write_wireguard_params(const NetplanNetDefinition* def, GKeyFile *kf, GError** e
                 g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT, "%s: shared key needs to be base64 encoded when using the NM backend\n", def->id);
                 return FALSE;
             } else {
-                g_key_file_set_value(kf, tmp_group, "preshared-key", peer->preshared_key);
-                g_key_file_set_uint64(kf, tmp_group, "preshared-key-flags", 0);
+                keyfile_set_value(kf, tmp_group, "preshared-key", peer->preshared_key);
+                keyfile_set_uint64(kf, tmp_group, "preshared-key-flags", 0);
             }
         }
-        if (peer->allowed_ips && peer->allowed_ips->len > 0) {
-            const gchar* list[peer->allowed_ips->len];
-            for (guint j = 0; j < peer->allowed_ips->len; ++j)
-                list[j] = g_array_index(peer->allowed_ips, char*, j);
-            g_key_file_set_string_list(kf, tmp_group, "allowed-ips", list, peer->allowed_ips->len);
-        }
+        if (peer->allowed_ips && peer->allowed_ips->len > 0)
+            set_ip_prefix_list(kf, tmp_group, "allowed-ips", peer->allowed_ips);
         g_free(tmp_group);
     }
     return TRUE;
 }
 
 static void
-write_tunnel_params(const NetplanNetDefinition* def, GKeyFile *kf)
+write_tunnel_params(const NetplanNetDefinition* def, KeyFile* kf)
 {
-    g_key_file_set_integer(kf, "ip-tunnel", "mode", def->tunnel.mode);
-    g_key_file_set_string(kf, "ip-tunnel", "local", def->tunnel.local_ip);
-    g_key_file_set_string(kf, "ip-tunnel", "remote", def->tunnel.remote_ip);
+    keyfile_set_integer(kf, "ip-tunnel", "mode", def->tunnel.mode);
+    keyfile_set_string(kf, "ip-tunnel", "local", def->tunnel.local_ip);
+    keyfile_set_string(kf, "ip-tunnel", "remote", def->tunnel.remote_ip);
     if (def->tunnel_ttl)
-        g_key_file_set_uint64(kf, "ip-tunnel", "ttl", def->tunnel_ttl);
+        keyfile_set_uint64(kf, "ip-tunnel", "ttl", def->tunnel_ttl);
     if (def->tunnel.input_key)
-        g_key_file_set_string(kf, "ip-tunnel", "input-key", def->tunnel.input_key);
+        keyfile_set_string(kf, "ip-tunnel", "input-key", def->tunnel.input_key);
     if (def->tunnel.output_key)
-        g_key_file_set_string(kf, "ip-tunnel", "output-key", def->tunnel.output_key);
+        keyfile_set_string(kf, "ip-tunnel", "output-key", def->tunnel.output_key);
 }
 
 static void
-write_dot1x_auth_parameters(const NetplanAuthenticationSettings* auth, GKeyFile *kf)
+write_dot1x_auth_parameters(const NetplanAuthenticationSettings* auth, KeyFile* kf)
 {
     if (auth->eap_method == NETPLAN_AUTH_EAP_NONE)
         return;
 
     switch (auth->eap_method) {
         case NETPLAN_AUTH_EAP_TLS:
-            g_key_file_set_string(kf, "802-1x", "eap", "tls");
+            keyfile_set_string(kf, "802-1x", "eap", "tls");
             break;
         case NETPLAN_AUTH_EAP_PEAP:
-            g_key_file_set_string(kf, "802-1x", "eap", "peap");
+            keyfile_set_string(kf, "802-1x", "eap", "peap");
             break;
         case NETPLAN_AUTH_EAP_TTLS:
-            g_key_file_set_string(kf, "802-1x", "eap", "ttls");
+            keyfile_set_string(kf, "802-1x", "eap", "ttls");
             break;
         default: break;  // LCOV_EXCL_LINE
     }
 
     if (auth->identity)
-        g_key_file_set_string(kf, "802-1x", "identity", auth->identity);
+        keyfile_set_string(kf, "802-1x", "identity", auth->identity);
     if (auth->anonymous_identity)
-        g_key_file_set_string(kf, "802-1x", "anonymous-identity", auth->anonymous_identity);
+        keyfile_set_string(kf, "802-1x", "anonymous-identity", auth->anonymous_identity);
     if (auth->password && auth->key_management != NETPLAN_AUTH_KEY_MANAGEMENT_WPA_PSK)
-        g_key_file_set_string(kf, "802-1x", "password", auth->password);
+        keyfile_set_string(kf, "802-1x", "password", auth->password);
     if (auth->ca_certificate)
-        g_key_file_set_string(kf, "802-1x", "ca-cert", auth->ca_certificate);
+        keyfile_set_string(kf, "802-1x", "ca-cert", auth->ca_certificate);
     if (auth->client_certificate)
-        g_key_file_set_string(kf, "802-1x", "client-cert", auth->client_certificate);
+        keyfile_set_string(kf, "802-1x", "client-cert", auth->client_certificate);
     if (auth->client_key)
-        g_key_file_set_string(kf, "802-1x", "private-key", auth->client_key);
+        keyfile_set_string(kf, "802-1x", "private-key", auth->client_key);
     if (auth->client_key_password)
-        g_key_file_set_string(kf, "802-1x", "private-key-password", auth->client_key_password);
+        keyfile_set_string(kf, "802-1x", "private-key-password", auth->client_key_password);
     if (auth->phase2_auth)
-        g_key_file_set_string(kf, "802-1x", "phase2-auth", auth->phase2_auth);
+        keyfile_set_string(kf, "802-1x", "phase2-auth", auth->phase2_auth);
 }
 
 static void
-write_wifi_auth_parameters(const NetplanAuthenticationSettings* auth, GKeyFile *kf)
+write_wifi_auth_parameters(const NetplanAuthenticationSettings* auth, KeyFile* kf)
 {
     if (auth->key_management == NETPLAN_AUTH_KEY_MANAGEMENT_NONE)
         return;
 
     switch (auth->key_management) {
         case NETPLAN_AUTH_KEY_MANAGEMENT_WPA_PSK:
-            g_key_file_set_string(kf, "wifi-security", "key-mgmt", "wpa-psk");
+            keyfile_set_string(kf, "wifi-security", "key-mgmt", "wpa-psk");
             if (auth->password)
-                g_key_file_set_string(kf, "wifi-security", "psk", auth->password);
+                keyfile_set_string(kf, "wifi-security", "psk", auth->password);
             break;
         case NETPLAN_AUTH_KEY_MANAGEMENT_WPA_EAP:
-            g_key_file_set_string(kf, "wifi-security", "key-mgmt", "wpa-eap");
+            keyfile_set_string(kf, "wifi-security", "key-mgmt", "wpa-eap");
             break;
         case NETPLAN_AUTH_KEY_MANAGEMENT_8021X:
-            g_key_file_set_string(kf, "wifi-security", "key-mgmt", "ieee8021x");
+            keyfile_set_string(kf, "wifi-security", "key-mgmt", "ieee8021x");
             break;
         default: break; // LCOV_EXCL_LINE
     }
@@ -503,7 +775,7 @@ maybe_generate_uuid(const NetplanNetDefinition* def)
 static void
 write_fallback_key_value(GQuark key_id, gpointer value, gpointer user_data)
 {
-    GKeyFile *kf = user_data;
+    KeyFile* kf = user_data;
     gchar* val = value;
     /* Group name may contain dots, but key name may not.
      * The "tc" group is a special case, where it is the other way around, e.g.:
@@ -512,8 +784,8 @@ write_fallback_key_value(GQuark key_id, gpointer value, gpointer user_data)
     const gchar* key = g_quark_to_string(key_id);
     gchar **group_key = g_strsplit(key, ".", -1);
     guint len = g_strv_length(group_key);
-    g_autofree gchar* old_key = NULL;
-    gboolean has_key = FALSE;
+    gint existing = -1;
+    gsize old_value = 0;
     g_autofree gchar* k = NULL;
     g_autofree gchar* group = NULL;
     if (!g_strcmp0(group_key[0], "tc") && len > 2) {
@@ -525,18 +797,20 @@ write_fallback_key_value(GQuark key_id, gpointer value, gpointer user_data)
         group = g_strjoinv(".", group_key); //re-combine group parts
     }
 
-    has_key = g_key_file_has_key(kf, group, k, NULL);
-    old_key = g_key_file_get_string(kf, group, k, NULL);
-    g_key_file_set_string(kf, group, k, val);
+    existing = keyfile_lookup(kf, keyfile_group(kf, group, FALSE), k);
+    /* the old value stays in the arena when overridden */
+    if (existing >= 0)
+        old_value = KEYFILE_ENTRY(kf, existing)->value;
+    keyfile_set_string(kf, group, k, val);
     /* delete the dummy key, if this was just an empty group */
     if (!g_strcmp0(k, NETPLAN_NM_EMPTY_GROUP))
-        g_key_file_remove_key(kf, group, k, NULL);
-    else if (!has_key) {
+        keyfile_remove_key(kf, group, k);
+    else if (existing < 0) {
         g_debug("NetworkManager: passing through fallback key: %s.%s=%s", group, k, val);
-        g_key_file_set_comment(kf, group, k, "Netplan: passthrough setting", NULL);
-    } else if (!!g_strcmp0(val, old_key)) {
+        keyfile_set_comment(kf, group, k, "Netplan: passthrough setting");
+    } else if (!!strcmp(KEYFILE_STR(kf, old_value), KEYFILE_STR(kf, KEYFILE_ENTRY(kf, existing)->value))) {
         g_debug("NetworkManager: fallback override: %s.%s=%s", group, k, val);
-        g_key_file_set_comment(kf, group, k, "Netplan: passthrough override", NULL);
+        keyfile_set_comment(kf, group, k, "Netplan: passthrough override");
     }
 
     g_strfreev(group_key);
@@ -551,18 +825,18 @@ write_fallback_key_value(GQuark key_id, gpointer value, gpointer user_data)
  *           (useful for testing).
  * @ap: The access point for which to create a connection. Must be %NULL for
  *      non-wifi types.
+ * @kf: The keyfile builder to render the connection profile with, reset first.
  */
 static gboolean
-write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir, const NetplanWifiAccessPoint* ap, GError** error)
+write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir, const NetplanWifiAccessPoint* ap,
+                           KeyFile* kf, GError** error)
 {
-    g_autoptr(GKeyFile) kf = NULL;
     g_autofree gchar* conf_path = NULL;
-    g_autofree gchar* full_path = NULL;
     g_autofree gchar* nd_nm_id = NULL;
     const gchar* nm_type = NULL;
     gchar* tmp_key = NULL;
-    mode_t orig_umask;
     char uuidstr[37];
+    char buf[NETPLAN_IP_PREFIX_STRLEN];
     const char *match_interface_name = NULL;
 
     if (def->type == NETPLAN_DEF_TYPE_WIFI)
@@ -575,35 +849,35 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
         return TRUE;
     }
 
-    kf = g_key_file_new();
+    keyfile_reset(kf);
     if (ap && ap->backend_settings.nm.name)
-        g_key_file_set_string(kf, "connection", "id", ap->backend_settings.nm.name);
+        keyfile_set_string(kf, "connection", "id", ap->backend_settings.nm.name);
     else if (def->backend_settings.nm.name)
-        g_key_file_set_string(kf, "connection", "id", def->backend_settings.nm.name);
+        keyfile_set_string(kf, "connection", "id", def->backend_settings.nm.name);
     else {
         /* Auto-generate a name for the connection profile, if not specified */
         if (ap)
             nd_nm_id = g_strdup_printf("netplan-%s-%s", def->id, ap->ssid);
         else
             nd_nm_id = g_strdup_printf("netplan-%s", def->id);
-        g_key_file_set_string(kf, "connection", "id", nd_nm_id);
+        keyfile_set_string(kf, "connection", "id", nd_nm_id);
     }
 
     nm_type = type_str(def);
     if (nm_type)
-        g_key_file_set_string(kf, "connection", "type", nm_type);
+        keyfile_set_string(kf, "connection", "type", nm_type);
 
     if (ap && ap->backend_settings.nm.uuid)
-        g_key_file_set_string(kf, "connection", "uuid", ap->backend_settings.nm.uuid);
+        keyfile_set_string(kf, "connection", "uuid", ap->backend_settings.nm.uuid);
     else if (def->backend_settings.nm.uuid)
-        g_key_file_set_string(kf, "connection", "uuid", def->backend_settings.nm.uuid);
+        keyfile_set_string(kf, "connection", "uuid", def->backend_settings.nm.uuid);
     /* VLAN devices refer to us as their parent; if our ID is not a name but we
      * have matches, parent= must be the connection UUID, so put it into the
      * connection */
     if (def->has_vlans && def->has_match) {
         maybe_generate_uuid(def);
         uuid_unparse(def->uuid, uuidstr);
-        g_key_file_set_string(kf, "connection", "uuid", uuidstr);
+        keyfile_set_string(kf, "connection", "uuid", uuidstr);
     }
 
     if (def->activation_mode) {
@@ -614,7 +888,7 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
             return FALSE;
         }
         /* "manual" */
-        g_key_file_set_boolean(kf, "connection", "autoconnect", FALSE);
+        keyfile_set_boolean(kf, "connection", "autoconnect", FALSE);
     }
 
     if (def->type < NETPLAN_DEF_TYPE_VIRTUAL) {
@@ -622,14 +896,14 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
          * supported, MAC matching is done below (different keyfile section),
          * so only match names here */
         if (def->set_name)
-            g_key_file_set_string(kf, "connection", "interface-name", def->set_name);
+            keyfile_set_string(kf, "connection", "interface-name", def->set_name);
         else if (!def->has_match)
-            g_key_file_set_string(kf, "connection", "interface-name", def->id);
+            keyfile_set_string(kf, "connection", "interface-name", def->id);
         else if (def->match.original_name) {
             if (strpbrk(def->match.original_name, "*[]?"))
                 match_interface_name = def->match.original_name;
             else
-                g_key_file_set_string(kf, "connection", "interface-name", def->match.original_name);
+                keyfile_set_string(kf, "connection", "interface-name", def->match.original_name);
         }
         /* else matches on something other than the name, do not restrict interface-name */
     } else {
@@ -637,7 +911,7 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
         if (strlen(def->id) > 15)
             g_debug("interface-name longer than 15 characters is not supported");
         else
-            g_key_file_set_string(kf, "connection", "interface-name", def->id);
+            keyfile_set_string(kf, "connection", "interface-name", def->id);
 
         if (def->type == NETPLAN_DEF_TYPE_BRIDGE)
             write_bridge_params(def, kf);
@@ -648,43 +922,43 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
         /* Use NetworkManager's auto configuration feature if no APN, username, or password is specified */
         if (def->modem_params.auto_config || (!def->modem_params.apn &&
                 !def->modem_params.username && !def->modem_params.password)) {
-            g_key_file_set_boolean(kf, modem_type, "auto-config", TRUE);
+            keyfile_set_boolean(kf, modem_type, "auto-config", TRUE);
         } else {
             if (def->modem_params.apn)
-                g_key_file_set_string(kf, modem_type, "apn", def->modem_params.apn);
+                keyfile_set_string(kf, modem_type, "apn", def->modem_params.apn);
             if (def->modem_params.password)
-                g_key_file_set_string(kf, modem_type, "password", def->modem_params.password);
+                keyfile_set_string(kf, modem_type, "password", def->modem_params.password);
             if (def->modem_params.username)
-                g_key_file_set_string(kf, modem_type, "username", def->modem_params.username);
+                keyfile_set_string(kf, modem_type, "username", def->modem_params.username);
         }
 
         if (def->modem_params.device_id)
-            g_key_file_set_string(kf, modem_type, "device-id", def->modem_params.device_id);
+            keyfile_set_string(kf, modem_type, "device-id", def->modem_params.device_id);
         if (def->mtubytes)
-            g_key_file_set_uint64(kf, modem_type, "mtu", def->mtubytes);
+            keyfile_set_uint64(kf, modem_type, "mtu", def->mtubytes);
         if (def->modem_params.network_id)
-            g_key_file_set_string(kf, modem_type, "network-id", def->modem_params.network_id);
+            keyfile_set_string(kf, modem_type, "network-id", def->modem_params.network_id);
         if (def->modem_params.number)
-            g_key_file_set_string(kf, modem_type, "number", def->modem_params.number);
+            keyfile_set_string(kf, modem_type, "number", def->modem_params.number);
         if (def->modem_params.pin)
-            g_key_file_set_string(kf, modem_type, "pin", def->modem_params.pin);
+            keyfile_set_string(kf, modem_type, "pin", def->modem_params.pin);
         if (def->modem_params.sim_id)
-            g_key_file_set_string(kf, modem_type, "sim-id", def->modem_params.sim_id);
+            keyfile_set_string(kf, modem_type, "sim-id", def->modem_params.sim_id);
         if (def->modem_params.sim_operator_id)
-            g_key_file_set_string(kf, modem_type, "sim-operator-id", def->modem_params.sim_operator_id);
+            keyfile_set_string(kf, modem_type, "sim-operator-id", def->modem_params.sim_operator_id);
     }
     if (def->bridge) {
-        g_key_file_set_string(kf, "connection", "slave-type", "bridge");
-        g_key_file_set_string(kf, "connection", "master", def->bridge);
+        keyfile_set_string(kf, "connection", "slave-type", "bridge");
+        keyfile_set_string(kf, "connection", "master", def->bridge);
 
         if (def->bridge_params.path_cost)
-            g_key_file_set_uint64(kf, "bridge-port", "path-cost", def->bridge_params.path_cost);
+            keyfile_set_uint64(kf, "bridge-port", "path-cost", def->bridge_params.path_cost);
         if (def->bridge_params.port_priority)
-            g_key_file_set_uint64(kf, "bridge-port", "priority", def->bridge_params.port_priority);
+            keyfile_set_uint64(kf, "bridge-port", "priority", def->bridge_params.port_priority);
     }
     if (def->bond) {
-        g_key_file_set_string(kf, "connection", "slave-type", "bond");
-        g_key_file_set_string(kf, "connection", "master", def->bond);
+        keyfile_set_string(kf, "connection", "slave-type", "bond");
+        keyfile_set_string(kf, "connection", "master", def->bond);
     }
 
     if (def->ipv6_mtubytes) {
@@ -694,7 +968,7 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
 
     if (def->type < NETPLAN_DEF_TYPE_VIRTUAL) {
         if (def->type == NETPLAN_DEF_TYPE_ETHERNET)
-            g_key_file_set_integer(kf, "ethernet", "wake-on-lan", def->wake_on_lan ? 1 : 0);
+            keyfile_set_integer(kf, "ethernet", "wake-on-lan", def->wake_on_lan ? 1 : 0);
 
         const char* con_type = NULL;
         switch (def->type) {
@@ -709,34 +983,34 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
 
         if (con_type) {
             if (!def->set_name && def->match.mac)
-                g_key_file_set_string(kf, con_type, "mac-address", def->match.mac);
+                keyfile_set_string(kf, con_type, "mac-address", def->match.mac);
             if (def->set_mac)
-                g_key_file_set_string(kf, con_type, "cloned-mac-address", def->set_mac);
+                keyfile_set_string(kf, con_type, "cloned-mac-address", def->set_mac);
             if (def->mtubytes)
-                g_key_file_set_uint64(kf, con_type, "mtu", def->mtubytes);
+                keyfile_set_uint64(kf, con_type, "mtu", def->mtubytes);
             if (def->wowlan && def->wowlan > NETPLAN_WIFI_WOWLAN_DEFAULT)
-                g_key_file_set_uint64(kf, con_type, "wake-on-wlan", def->wowlan);
+                keyfile_set_uint64(kf, con_type, "wake-on-wlan", def->wowlan);
         }
     } else {
         if (def->set_mac)
-            g_key_file_set_string(kf, "ethernet", "cloned-mac-address", def->set_mac);
+            keyfile_set_string(kf, "ethernet", "cloned-mac-address", def->set_mac);
         if (def->mtubytes)
-            g_key_file_set_uint64(kf, "ethernet", "mtu", def->mtubytes);
+            keyfile_set_uint64(kf, "ethernet", "mtu", def->mtubytes);
     }
 
     if (def->type == NETPLAN_DEF_TYPE_VLAN) {
         g_assert(def->vlan_id < G_MAXUINT);
         g_assert(def->vlan_link != NULL);
-        g_key_file_set_uint64(kf, "vlan", "id", def->vlan_id);
+        keyfile_set_uint64(kf, "vlan", "id", def->vlan_id);
         if (def->vlan_link->has_match) {
             /* we need to refer to the parent's UUID as we don't have an
              * interface name with match: */
             maybe_generate_uuid(def->vlan_link);
             uuid_unparse(def->vlan_link->uuid, uuidstr);
-            g_key_file_set_string(kf, "vlan", "parent", uuidstr);
+            keyfile_set_string(kf, "vlan", "parent", uuidstr);
         } else {
             /* if we have an interface name, use that as parent */
-            g_key_file_set_string(kf, "vlan", "parent", def->vlan_link->id);
+            keyfile_set_string(kf, "vlan", "parent", def->vlan_link->id);
         }
     }
 
@@ -753,38 +1027,35 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
 
     if (match_interface_name) {
         const gchar* list[1] = {match_interface_name};
-        g_key_file_set_string_list(kf, "match", "interface-name", list, 1);
+        keyfile_set_string_list(kf, "match", "interface-name", list, 1);
     }
 
     if (ap && ap->mode == NETPLAN_WIFI_MODE_AP)
-        g_key_file_set_string(kf, "ipv4", "method", "shared");
+        keyfile_set_string(kf, "ipv4", "method", "shared");
     else if (def->dhcp4)
-        g_key_file_set_string(kf, "ipv4", "method", "auto");
+        keyfile_set_string(kf, "ipv4", "method", "auto");
     else if (def->ip4_addresses)
         /* This requires adding at least one address (done below) */
-        g_key_file_set_string(kf, "ipv4", "method", "manual");
+        keyfile_set_string(kf, "ipv4", "method", "manual");
     else if (def->type == NETPLAN_DEF_TYPE_TUNNEL)
         /* sit tunnels will not start in link-local apparently */
-        g_key_file_set_string(kf, "ipv4", "method", "disabled");
+        keyfile_set_string(kf, "ipv4", "method", "disabled");
     else
         /* Without any address, this is the only available mode */
-        g_key_file_set_string(kf, "ipv4", "method", "link-local");
+        keyfile_set_string(kf, "ipv4", "method", "link-local");
 
     if (def->ip4_addresses) {
         for (unsigned i = 0; i < def->ip4_addresses->len; ++i) {
             tmp_key = g_strdup_printf("address%i", i+1);
-            g_key_file_set_string(kf, "ipv4", tmp_key, g_array_index(def->ip4_addresses, char*, i));
+            keyfile_set_string(kf, "ipv4", tmp_key,
+                                  netplan_ip_prefix_to_string(&g_array_index(def->ip4_addresses, NetplanIPPrefix, i), buf));
             g_free(tmp_key);
         }
     }
     if (def->gateway4)
-        g_key_file_set_string(kf, "ipv4", "gateway", def->gateway4);
-    if (def->ip4_nameservers) {
-        const gchar* list[def->ip4_nameservers->len];
-        for (unsigned i = 0; i < def->ip4_nameservers->len; ++i)
-            list[i] = g_array_index(def->ip4_nameservers, char*, i);
-        g_key_file_set_string_list(kf, "ipv4", "dns", list, def->ip4_nameservers->len);
-    }
+        keyfile_set_string(kf, "ipv4", "gateway", def->gateway4);
+    if (def->ip4_nameservers)
+        set_ip_prefix_list(kf, "ipv4", "dns", def->ip4_nameservers);
 
     /* We can only write search domains and routes if we have an address */
     if (def->ip4_addresses || def->dhcp4) {
@@ -794,41 +1065,38 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
     }
 
     if (!def->dhcp4_overrides.use_routes) {
-        g_key_file_set_boolean(kf, "ipv4", "ignore-auto-routes", TRUE);
-        g_key_file_set_boolean(kf, "ipv4", "never-default", TRUE);
+        keyfile_set_boolean(kf, "ipv4", "ignore-auto-routes", TRUE);
+        keyfile_set_boolean(kf, "ipv4", "never-default", TRUE);
     }
 
     if (def->dhcp4 && def->dhcp4_overrides.metric != NETPLAN_METRIC_UNSPEC)
-        g_key_file_set_uint64(kf, "ipv4", "route-metric", def->dhcp4_overrides.metric);
+        keyfile_set_uint64(kf, "ipv4", "route-metric", def->dhcp4_overrides.metric);
 
     if (def->dhcp6 || def->ip6_addresses || def->gateway6 || def->ip6_nameservers || def->ip6_addr_gen_mode) {
-        g_key_file_set_string(kf, "ipv6", "method", def->dhcp6 ? "auto" : "manual");
+        keyfile_set_string(kf, "ipv6", "method", def->dhcp6 ? "auto" : "manual");
 
         if (def->ip6_addresses) {
             for (unsigned i = 0; i < def->ip6_addresses->len; ++i) {
                 tmp_key = g_strdup_printf("address%i", i+1);
-                g_key_file_set_string(kf, "ipv6", tmp_key, g_array_index(def->ip6_addresses, char*, i));
+                keyfile_set_string(kf, "ipv6", tmp_key,
+                                      netplan_ip_prefix_to_string(&g_array_index(def->ip6_addresses, NetplanIPPrefix, i), buf));
                 g_free(tmp_key);
             }
         }
         if (def->ip6_addr_gen_token) {
             /* Token implies EUI-64, i.e mode=0 */
-            g_key_file_set_integer(kf, "ipv6", "addr-gen-mode", 0);
-            g_key_file_set_string(kf, "ipv6", "token", def->ip6_addr_gen_token);
+            keyfile_set_integer(kf, "ipv6", "addr-gen-mode", 0);
+            keyfile_set_string(kf, "ipv6", "token", def->ip6_addr_gen_token);
         } else if (def->ip6_addr_gen_mode)
-            g_key_file_set_string(kf, "ipv6", "addr-gen-mode", addr_gen_mode_str(def->ip6_addr_gen_mode));
+            keyfile_set_string(kf, "ipv6", "addr-gen-mode", addr_gen_mode_str(def->ip6_addr_gen_mode));
         if (def->ip6_privacy)
-            g_key_file_set_integer(kf, "ipv6", "ip6-privacy", 2);
+            keyfile_set_integer(kf, "ipv6", "ip6-privacy", 2);
         else
-            g_key_file_set_integer(kf, "ipv6", "ip6-privacy", 0);
+            keyfile_set_integer(kf, "ipv6", "ip6-privacy", 0);
         if (def->gateway6)
-            g_key_file_set_string(kf, "ipv6", "gateway", def->gateway6);
-        if (def->ip6_nameservers) {
-            const gchar* list[def->ip6_nameservers->len];
-            for (unsigned i = 0; i < def->ip6_nameservers->len; ++i)
-                list[i] = g_array_index(def->ip6_nameservers, char*, i);
-            g_key_file_set_string_list(kf, "ipv6", "dns", list, def->ip6_nameservers->len);
-        }
+            keyfile_set_string(kf, "ipv6", "gateway", def->gateway6);
+        if (def->ip6_nameservers)
+            set_ip_prefix_list(kf, "ipv6", "dns", def->ip6_nameservers);
         /* nm-settings(5) specifies search-domain for both [ipv4] and [ipv6] --
          * We need to specify it here for the IPv6-only case - see LP: #1786726 */
         write_search_domains(def, "ipv6", kf);
@@ -838,15 +1106,15 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
             return FALSE;
 
         if (!def->dhcp6_overrides.use_routes) {
-            g_key_file_set_boolean(kf, "ipv6", "ignore-auto-routes", TRUE);
-            g_key_file_set_boolean(kf, "ipv6", "never-default", TRUE);
+            keyfile_set_boolean(kf, "ipv6", "ignore-auto-routes", TRUE);
+            keyfile_set_boolean(kf, "ipv6", "never-default", TRUE);
         }
 
         if (def->dhcp6_overrides.metric != NETPLAN_METRIC_UNSPEC)
-            g_key_file_set_uint64(kf, "ipv6", "route-metric", def->dhcp6_overrides.metric);
+            keyfile_set_uint64(kf, "ipv6", "route-metric", def->dhcp6_overrides.metric);
     }
     else
-        g_key_file_set_string(kf, "ipv6", "method", "ignore");
+        keyfile_set_string(kf, "ipv6", "method", "ignore");
 
     if (def->backend_settings.nm.passthrough) {
         g_debug("NetworkManager: using keyfile passthrough mode");
@@ -859,15 +1127,15 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
         g_autofree char* escaped_ssid = g_uri_escape_string(ap->ssid, NULL, TRUE);
         conf_path = g_strjoin(NULL, "run/NetworkManager/system-connections/netplan-", def->id, "-", escaped_ssid, ".nmconnection", NULL);
 
-        g_key_file_set_string(kf, "wifi", "ssid", ap->ssid);
+        keyfile_set_string(kf, "wifi", "ssid", ap->ssid);
         if (ap->mode < NETPLAN_WIFI_MODE_OTHER)
-            g_key_file_set_string(kf, "wifi", "mode", wifi_mode_str(ap->mode));
+            keyfile_set_string(kf, "wifi", "mode", wifi_mode_str(ap->mode));
         if (ap->bssid)
-            g_key_file_set_string(kf, "wifi", "bssid", ap->bssid);
+            keyfile_set_string(kf, "wifi", "bssid", ap->bssid);
         if (ap->hidden)
-            g_key_file_set_boolean(kf, "wifi", "hidden", TRUE);
+            keyfile_set_boolean(kf, "wifi", "hidden", TRUE);
         if (ap->band == NETPLAN_WIFI_BAND_5 || ap->band == NETPLAN_WIFI_BAND_24) {
-            g_key_file_set_string(kf, "wifi", "band", wifi_band_str(ap->band));
+            keyfile_set_string(kf, "wifi", "band", wifi_band_str(ap->band));
             /* Channel is only unambiguous, if band is set. */
             if (ap->channel) {
                 /* Validate WiFi channel */
@@ -875,7 +1143,7 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
                     wifi_get_freq5(ap->channel);
                 else
                     wifi_get_freq24(ap->channel);
-                g_key_file_set_uint64(kf, "wifi", "channel", ap->channel);
+                keyfile_set_uint64(kf, "wifi", "channel", ap->channel);
             }
         }
         if (ap->has_auth) {
@@ -898,12 +1166,7 @@ write_nm_conf_access_point(const NetplanNetDefinition* def, const char* rootdir,
     }
 
     /* NM connection files might contain secrets, and NM insists on tight permissions */
-    full_path = g_strjoin(G_DIR_SEPARATOR_S, rootdir ?: "", conf_path, NULL);
-    orig_umask = umask(077);
-    safe_mkdir_p_dir(full_path);
-    if (!g_key_file_save_to_file(kf, full_path, error))
-        return FALSE; // LCOV_EXCL_LINE
-    umask(orig_umask);
+    g_string_free_to_file_with_umask(keyfile_to_data(kf), rootdir, conf_path, NULL, 077);
     return TRUE;
 }
 
@@ -922,6 +1185,7 @@ netplan_netdef_write_nm(
         GError** error)
 {
     gboolean no_error = TRUE;
+    KeyFile* kf = NULL;
 
     SET_OPT_OUT_PTR(has_been_written, FALSE);
     if (netdef->backend != NETPLAN_BACKEND_NM) {
@@ -939,6 +1203,8 @@ netplan_netdef_write_nm(
         return FALSE;
     }
 
+    /* one builder for all connection profiles (e.g. one per SSID) of the netdef */
+    kf = keyfile_new();
     if (netdef->type == NETPLAN_DEF_TYPE_WIFI) {
         GHashTableIter iter;
         gpointer key;
@@ -946,11 +1212,12 @@ netplan_netdef_write_nm(
         g_assert(netdef->access_points);
         g_hash_table_iter_init(&iter, netdef->access_points);
         while (g_hash_table_iter_next(&iter, &key, (gpointer) &ap) && no_error)
-            no_error = write_nm_conf_access_point(netdef, rootdir, ap, error);
+            no_error = write_nm_conf_access_point(netdef, rootdir, ap, kf, error);
     } else {
         g_assert(netdef->access_points == NULL);
-        no_error = write_nm_conf_access_point(netdef, rootdir, NULL, error);
+        no_error = write_nm_conf_access_point(netdef, rootdir, NULL, kf, error);
     }
+    keyfile_free(kf);
     SET_OPT_OUT_PTR(has_been_written, TRUE);
     return no_error;
 }
@@ -1007,10 +1274,8 @@ netplan_state_finish_nm_write(
 gboolean
 netplan_nm_cleanup(const char* rootdir)
 {
-    g_autofree char* confpath = g_strjoin(NULL, rootdir ?: "", "/run/NetworkManager/conf.d/netplan.conf", NULL);
-    g_autofree char* global_manage_path = g_strjoin(NULL, rootdir ?: "", "/run/NetworkManager/conf.d/10-globally-managed-devices.conf", NULL);
-    unlink(confpath);
-    unlink(global_manage_path);
+    unlink_glob(rootdir, "/run/NetworkManager/conf.d/netplan.conf");
+    unlink_glob(rootdir, "/run/NetworkManager/conf.d/10-globally-managed-devices.conf");
     unlink_glob(rootdir, "/run/NetworkManager/system-connections/netplan-*");
     return TRUE;
 }
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -64,14 +65,7 @@ write_ovs_systemd_unit(const char* id, const GString* cmds, const char* rootdir,
 
     g_string_free_to_file(s, rootdir, path, NULL);
 
-    safe_mkdir_p_dir(link);
-    if (symlink(path, link) < 0 && errno != EEXIST) {
-        // LCOV_EXCL_START
-        g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT, "failed to create enablement symlink: %m\n");
-        return FALSE;
-        // LCOV_EXCL_STOP
-    }
-    return TRUE;
+    return create_enablement_symlink(path, link, error);
 }
 
 #define append_systemd_cmd(s, command, ...) \
@@ -81,6 +75,34 @@ write_ovs_systemd_unit(const char* id, const GString* cmds, const char* rootdir,
     g_string_append(s, "\n"); \
 }
 
+#define OVS_VSCTL_EXEC "ExecStart=" OPENVSWITCH_OVS_VSCTL " "
+
+/* Consecutive ovs-vsctl commands of a unit are chained with "--" into a single
+ * ExecStart= line, so they are executed as one OVSDB transaction rather
+ * than spawning ovs-vsctl (and doing a database round-trip) for each one. */
+static void G_GNUC_PRINTF(2, 3)
+append_ovs_vsctl_cmd(GString* s, const char* command, ...)
+{
+    va_list args;
+    const char* last_line = NULL;
+
+    /* Only chain to an ovs-vsctl command on the last line of @s (which ends
+     * with a newline), never across other commands */
+    if (s->len > 0 && s->str[s->len - 1] == '\n') {
+        last_line = g_strrstr_len(s->str, s->len - 1, "\n");
+        last_line = last_line ? last_line + 1 : s->str;
+    }
+    if (last_line && g_str_has_prefix(last_line, OVS_VSCTL_EXEC)) {
+        g_string_truncate(s, s->len - 1);
+        g_string_append(s, " -- ");
+    } else
+        g_string_append(s, OVS_VSCTL_EXEC);
+    va_start(args, command);
+    g_string_append_vprintf(s, command, args);
+    va_end(args);
+    g_string_append_c(s, '\n');
+}
+
 static char*
 netplan_type_to_table_name(const NetplanDefType type)
 {
@@ -127,7 +149,7 @@ write_ovs_tag_setting(const gchar* id, const char* type, const char* col, const
     if (key)
         g_string_append_printf(s, "/%s", key);
     g_string_append_printf(s, "=%s", clean_value);
-    append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set %s %s %s", type, id, s->str);
+    append_ovs_vsctl_cmd(cmds, "set %s %s %s", type, id, s->str);
     g_string_free(s, TRUE);
 }
 
@@ -142,7 +164,7 @@ write_ovs_additional_data(GHashTable *data, const char* type, const gchar* id, G
     while (g_hash_table_iter_next(&iter, (gpointer) &key, (gpointer) &value)) {
         /* XXX: we need to check what happens when an invalid key=value pair
             gets supplied here. We might want to handle this somehow. */
-        append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set %s %s %s:%s=%s",
+        append_ovs_vsctl_cmd(cmds, "set %s %s %s:%s=%s",
                            type, id, setting, key, value);
         write_ovs_tag_setting(id, type, setting, key, value, cmds);
     }
@@ -163,9 +185,7 @@ setup_patch_port(GString* s, const NetplanNetDefinition* def)
 static char*
 write_ovs_bond_interfaces(const NetplanState* np_state, const NetplanNetDefinition* def, GString* cmds, GError** error)
 {
-    NetplanNetDefinition* tmp_nd;
-    GHashTableIter iter;
-    gchar* key;
+    const GPtrArray* members = netplan_state_get_members(np_state, def);
     guint i = 0;
     GString* s = NULL;
     GString* patch_ports = g_string_new("");
@@ -175,11 +195,11 @@ write_ovs_bond_interfaces(const NetplanState* np_state, const NetplanNetDefiniti
         return NULL;
     }
 
-    s = g_string_new(OPENVSWITCH_OVS_VSCTL " --may-exist add-bond");
+    s = g_string_new("--may-exist add-bond");
     g_string_append_printf(s, " %s %s", def->bridge, def->id);
 
-    g_hash_table_iter_init(&iter, np_state->netdefs);
-    while (g_hash_table_iter_next(&iter, (gpointer) &key, (gpointer) &tmp_nd)) {
+    for (guint j = 0; members && j < members->len; ++j) {
+        const NetplanNetDefinition* tmp_nd = g_ptr_array_index(members, j);
         if (!g_strcmp0(def->id, tmp_nd->bond)) {
             /* Append and count bond interfaces */
             g_string_append_printf(s, " %s", tmp_nd->id);
@@ -195,7 +215,7 @@ write_ovs_bond_interfaces(const NetplanState* np_state, const NetplanNetDefiniti
 
     g_string_append(s, patch_ports->str);
     g_string_free(patch_ports, TRUE);
-    append_systemd_cmd(cmds, s->str, def->bridge, def->id);
+    append_ovs_vsctl_cmd(cmds, "%s", s->str);
     g_string_free(s, TRUE);
     return def->bridge;
 }
@@ -204,7 +224,7 @@ static void
 write_ovs_tag_netplan(const gchar* id, const char* type, GString* cmds)
 {
     /* Mark this bridge/port/interface as created by netplan */
-    append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set %s %s external-ids:netplan=true",
+    append_ovs_vsctl_cmd(cmds, "set %s %s external-ids:netplan=true",
                        type, id);
 }
 
@@ -218,7 +238,7 @@ write_ovs_bond_mode(const NetplanNetDefinition* def, GString* cmds, GError** err
         !strcmp(def->bond_params.mode, "balance-tcp") ||
         !strcmp(def->bond_params.mode, "balance-slb")) {
         value = def->bond_params.mode;
-        append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set Port %s bond_mode=%s", def->id, value);
+        append_ovs_vsctl_cmd(cmds, "set Port %s bond_mode=%s", def->id, value);
         write_ovs_tag_setting(def->id, "Port", "bond_mode", NULL, value, cmds);
     } else {
         g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT, "%s: bond mode '%s' not supported by openvswitch\n",
@@ -231,21 +251,19 @@ write_ovs_bond_mode(const NetplanNetDefinition* def, GString* cmds, GError** err
 static void
 write_ovs_bridge_interfaces(const NetplanState* np_state, const NetplanNetDefinition* def, GString* cmds)
 {
-    NetplanNetDefinition* tmp_nd;
-    GHashTableIter iter;
-    gchar* key;
+    const GPtrArray* members = netplan_state_get_members(np_state, def);
 
-    append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " --may-exist add-br %s", def->id);
+    append_ovs_vsctl_cmd(cmds, "--may-exist add-br %s", def->id);
 
-    g_hash_table_iter_init(&iter, np_state->netdefs);
-    while (g_hash_table_iter_next(&iter, (gpointer) &key, (gpointer) &tmp_nd)) {
+    for (guint i = 0; members && i < members->len; ++i) {
+        const NetplanNetDefinition* tmp_nd = g_ptr_array_index(members, i);
         /* OVS bonds will connect to their OVS bridge and create the interface/port themselves */
         if ((tmp_nd->type != NETPLAN_DEF_TYPE_BOND || tmp_nd->backend != NETPLAN_BACKEND_OVS)
             && !g_strcmp0(def->id, tmp_nd->bridge)) {
             GString * patch_ports = g_string_new("");
             if (tmp_nd->type == NETPLAN_DEF_TYPE_PORT)
                 setup_patch_port(patch_ports, tmp_nd);
-            append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " --may-exist add-port %s %s%s",
+            append_ovs_vsctl_cmd(cmds, "--may-exist add-port %s %s%s",
                                def->id, tmp_nd->id, patch_ports->str);
             g_string_free(patch_ports, TRUE);
         }
@@ -261,7 +279,7 @@ write_ovs_protocols(const NetplanOVSSettings* ovs_settings, const gchar* bridge,
     for (unsigned i = 1; i < ovs_settings->protocols->len; ++i)
         g_string_append_printf(s, ",%s", g_array_index(ovs_settings->protocols, char*, i));
 
-    append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set Bridge %s protocols=%s", bridge, s->str);
+    append_ovs_vsctl_cmd(cmds, "set Bridge %s protocols=%s", bridge, s->str);
     write_ovs_tag_setting(bridge, "Bridge", "protocols", NULL, s->str, cmds);
     g_string_free(s, TRUE);
 }
@@ -303,7 +321,7 @@ write_ovs_bridge_controller_targets(const NetplanOVSSettings* settings, const Ne
     }
     g_string_erase(s, s->len-1, 1);
 
-    append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set-controller %s %s", bridge, s->str);
+    append_ovs_vsctl_cmd(cmds, "set-controller %s %s", bridge, s->str);
     write_ovs_tag_setting(bridge, "Bridge", "global", "set-controller", s->str, cmds);
 
 cleanup:
@@ -342,7 +360,7 @@ netplan_netdef_write_ovs(const NetplanState* np_state, const NetplanNetDefinitio
                 write_ovs_tag_netplan(def->id, type, cmds);
                 /* Set LACP mode, default to "off" */
                 value = def->ovs_settings.lacp? def->ovs_settings.lacp : "off";
-                append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set Port %s lacp=%s", def->id, value);
+                append_ovs_vsctl_cmd(cmds, "set Port %s lacp=%s", def->id, value);
                 write_ovs_tag_setting(def->id, type, "lacp", NULL, value, cmds);
                 if (def->bond_params.mode && !write_ovs_bond_mode(def, cmds, error))
                     return FALSE;
@@ -353,15 +371,15 @@ netplan_netdef_write_ovs(const NetplanState* np_state, const NetplanNetDefinitio
                 write_ovs_tag_netplan(def->id, type, cmds);
                 /* Set fail-mode, default to "standalone" */
                 value = def->ovs_settings.fail_mode? def->ovs_settings.fail_mode : "standalone";
-                append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set-fail-mode %s %s", def->id, value);
+                append_ovs_vsctl_cmd(cmds, "set-fail-mode %s %s", def->id, value);
                 write_ovs_tag_setting(def->id, type, "global", "set-fail-mode", value, cmds);
                 /* Enable/disable mcast-snooping */ 
                 value = def->ovs_settings.mcast_snooping? "true" : "false";
-                append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set Bridge %s mcast_snooping_enable=%s", def->id, value);
+                append_ovs_vsctl_cmd(cmds, "set Bridge %s mcast_snooping_enable=%s", def->id, value);
                 write_ovs_tag_setting(def->id, type, "mcast_snooping_enable", NULL, value, cmds);
                 /* Enable/disable rstp */
                 value = def->ovs_settings.rstp? "true" : "false";
-                append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set Bridge %s rstp_enable=%s", def->id, value);
+                append_ovs_vsctl_cmd(cmds, "set Bridge %s rstp_enable=%s", def->id, value);
                 write_ovs_tag_setting(def->id, type, "rstp_enable", NULL, value, cmds);
                 /* Set protocols */
                 if (def->ovs_settings.protocols && def->ovs_settings.protocols->len > 0)
@@ -376,7 +394,7 @@ netplan_netdef_write_ovs(const NetplanState* np_state, const NetplanNetDefinitio
                     /* Set controller connection mode, only applicable if at least one controller target address was set */
                     if (def->ovs_settings.controller.connection_mode) {
                         value = def->ovs_settings.controller.connection_mode;
-                        append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set Controller %s connection-mode=%s", def->id, value);
+                        append_ovs_vsctl_cmd(cmds, "set Controller %s connection-mode=%s", def->id, value);
                         write_ovs_tag_setting(def->id, "Controller", "connection-mode", NULL, value, cmds);
                     }
                 }
@@ -402,7 +420,7 @@ netplan_netdef_write_ovs(const NetplanState* np_state, const NetplanNetDefinitio
                 g_assert(def->vlan_link);
                 dependency = def->vlan_link->id;
                 /* Create a fake VLAN bridge */
-                append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " --may-exist add-br %s %s %i", def->id, def->vlan_link->id, def->vlan_id)
+                append_ovs_vsctl_cmd(cmds, "--may-exist add-br %s %s %i", def->id, def->vlan_link->id, def->vlan_id);
                 write_ovs_tag_netplan(def->id, type, cmds);
                 break;
 
@@ -478,7 +496,7 @@ netplan_state_finish_ovs_write(const NetplanState* np_state, const char* rootdir
                         settings->ssl.client_key,
                         settings->ssl.client_certificate,
                         settings->ssl.ca_certificate);
-        append_systemd_cmd(cmds, OPENVSWITCH_OVS_VSCTL " set-ssl %s", value->str);
+        append_ovs_vsctl_cmd(cmds, "set-ssl %s", value->str);
         write_ovs_tag_setting(".", "open_vswitch", "global", "set-ssl", value->str, cmds);
         g_string_free(value, TRUE);
     }
@@ -144,7 +144,7 @@ handle_bridge_uint(GKeyFile* kf, const gchar* key, NetplanNetDefinition* nd, cha
 }
 
 static void
-parse_addresses(GKeyFile* kf, const gchar* group, GArray** ip_arr)
+parse_addresses(NetplanArena* arena, GKeyFile* kf, const gchar* group, GArray** ip_arr)
 {
     g_assert(ip_arr);
     if (kf_matches(kf, group, "method", "manual")) {
@@ -160,14 +160,14 @@ parse_addresses(GKeyFile* kf, const gchar* group, GArray** ip_arr)
                 break;
             }
             if (!*ip_arr)
-                *ip_arr = g_array_new(FALSE, FALSE, sizeof(char*));
+                *ip_arr = g_array_new(FALSE, FALSE, sizeof(NetplanIPPrefix));
             split = g_strsplit(kf_value, ",", 2);
             g_free(kf_value);
-            /* Append "address/prefix" */
+            /* Append "address/prefix", kept verbatim if it cannot be parsed */
             if (split[0]) {
-                /* no need to free 's', this will stay in the netdef */
-                gchar* s = g_strdup(split[0]);
-                g_array_append_val(*ip_arr, s);
+                NetplanIPPrefix address;
+                netplan_ip_prefix_init(&address, arena, split[0], TRUE);
+                g_array_append_val(*ip_arr, address);
             }
             if (!split[1])
                 _kf_clear_key(kf, group, key);
@@ -184,7 +184,7 @@ parse_addresses(GKeyFile* kf, const gchar* group, GArray** ip_arr)
 }
 
 static void
-parse_routes(GKeyFile* kf, const gchar* group, GArray** routes_arr)
+parse_routes(NetplanArena* arena, GKeyFile* kf, const gchar* group, GArray** routes_arr)
 {
     g_assert(routes_arr);
     NetplanIPRoute *route = NULL;
@@ -207,8 +207,8 @@ parse_routes(GKeyFile* kf, const gchar* group, GArray** routes_arr)
         }
         if (!*routes_arr)
             *routes_arr = g_array_new(FALSE, TRUE, sizeof(NetplanIPRoute*));
-        route = g_new0(NetplanIPRoute, 1);
-        route->type = g_strdup("unicast");
+        route = netplan_arena_new0(arena, NetplanIPRoute);
+        route->type = netplan_arena_strdup(arena, "unicast");
         route->family = G_MAXUINT; /* 0 is a valid family ID */
         route->metric = NETPLAN_METRIC_UNSPEC; /* 0 is a valid metric */
         g_debug("%s: adding new route (kf)", key);
@@ -221,18 +221,18 @@ parse_routes(GKeyFile* kf, const gchar* group, GArray** routes_arr)
         split = g_strsplit(kf_value, ",", 3);
         /* Append "to" (address/prefix) */
         if (split[0])
-            route->to = g_strdup(split[0]); //no need to free, will stay in netdef
+            route->to = netplan_arena_strdup(arena, split[0]);
         /* Append gateway/via IP */
         if (split[0] && split[1] &&
             g_strcmp0(split[1], get_unspecified_address(route->family)) != 0) {
-            route->scope = g_strdup("global");
-            route->via = g_strdup(split[1]); //no need to free, will stay in netdef
+            route->scope = netplan_arena_strdup(arena, "global");
+            route->via = netplan_arena_strdup(arena, split[1]);
         } else {
             /* If the gateway (via) is unspecified, it means that this route is
              * only valid on the local network (see nm-keyfile.c ->
              * read_one_ip_address_or_route()), e.g.:
              * ip route add NETWORK dev DEV [metric METRIC] */
-            route->scope = g_strdup("link");
+            route->scope = netplan_arena_strdup(arena, "link");
         }
 
         /* Append metric */
@@ -258,7 +258,7 @@ parse_routes(GKeyFile* kf, const gchar* group, GArray** routes_arr)
                 else if (g_strcmp0(kv[0], "table") == 0)
                     route->table = strtoul(kv[1], NULL, 10);
                 else if (g_strcmp0(kv[0], "src") == 0)
-                    route->from = g_strdup(kv[1]); //no need to free, will stay in netdef
+                    route->from = netplan_arena_strdup(arena, kv[1]);
                 else
                     unhandled_data = TRUE;
                 g_strfreev(kv);
@@ -320,17 +320,18 @@ parse_search_domains(GKeyFile* kf, const gchar* group, GArray** domains_arr)
 }
 
 static void
-parse_nameservers(GKeyFile* kf, const gchar* group, GArray** nameserver_arr)
+parse_nameservers(NetplanArena* arena, GKeyFile* kf, const gchar* group, GArray** nameserver_arr)
 {
     g_assert(nameserver_arr);
     gchar **split = g_key_file_get_string_list(kf, group, "dns", NULL, NULL);
     if (split) {
         if (!*nameserver_arr)
-            *nameserver_arr = g_array_new(FALSE, FALSE, sizeof(char*));
+            *nameserver_arr = g_array_new(FALSE, FALSE, sizeof(NetplanIPPrefix));
         for(unsigned i = 0; split[i]; ++i) {
             if (strlen(split[i]) > 0) {
-                gchar* s = g_strdup(split[i]); //no need to free, will stay in netdef
-                g_array_append_val(*nameserver_arr, s);
+                NetplanIPPrefix nameserver;
+                netplan_ip_prefix_init(&nameserver, arena, split[i], FALSE);
+                g_array_append_val(*nameserver_arr, nameserver);
             }
         }
         _kf_clear_key(kf, group, "dns");
@@ -520,22 +521,22 @@ netplan_parser_load_keyfile(NetplanParser* npp, const char* filename, GError** e
     parse_dhcp_overrides(kf, "ipv6", &nd->dhcp6_overrides);
 
     /* Manual IPv4/6 addresses */
-    parse_addresses(kf, "ipv4", &nd->ip4_addresses);
-    parse_addresses(kf, "ipv6", &nd->ip6_addresses);
+    parse_addresses(netplan_parser_arena(npp), kf, "ipv4", &nd->ip4_addresses);
+    parse_addresses(netplan_parser_arena(npp), kf, "ipv6", &nd->ip6_addresses);
 
     /* Default gateways */
     handle_generic_str(kf, "ipv4", "gateway", &nd->gateway4);
     handle_generic_str(kf, "ipv6", "gateway", &nd->gateway6);
 
     /* Routes */
-    parse_routes(kf, "ipv4", &nd->routes);
-    parse_routes(kf, "ipv6", &nd->routes);
+    parse_routes(netplan_parser_arena(npp), kf, "ipv4", &nd->routes);
+    parse_routes(netplan_parser_arena(npp), kf, "ipv6", &nd->routes);
 
     /* DNS: XXX: How to differentiate ip4/ip6 search_domains? */
     parse_search_domains(kf, "ipv4", &nd->search_domains);
     parse_search_domains(kf, "ipv6", &nd->search_domains);
-    parse_nameservers(kf, "ipv4", &nd->ip4_nameservers);
-    parse_nameservers(kf, "ipv6", &nd->ip6_nameservers);
+    parse_nameservers(netplan_parser_arena(npp), kf, "ipv4", &nd->ip4_nameservers);
+    parse_nameservers(netplan_parser_arena(npp), kf, "ipv6", &nd->ip6_nameservers);
 
     /* IP6 addr-gen
      * Different than suggested by the docs, NM stores 'addr-gen-mode' as string */
@@ -750,3 +751,109 @@ only_passthrough:
     g_key_file_free(kf);
     return TRUE;
 }
+
+typedef struct {
+    char* filename;
+    /* private parser of the worker thread, merged into the caller's one */
+    NetplanParser* npp;
+    gboolean success;
+    GError* error;
+} KeyfileJob;
+
+static void
+load_keyfile_job(gpointer data, G_GNUC_UNUSED gpointer user_data)
+{
+    KeyfileJob* job = data;
+    job->success = netplan_parser_load_keyfile(job->npp, job->filename, &job->error);
+}
+
+/* Move the netdefs of @src (and the arena they live in) over to @npp, in
+ * definition order */
+static void
+merge_parser_netdefs(NetplanParser* npp, NetplanParser* src, GList** ordered)
+{
+    for (GList* l = src->ordered; l; l = l->next) {
+        NetplanNetDefinition* nd = l->data;
+        if (!npp->parsed_defs)
+            npp->parsed_defs = g_hash_table_new(g_str_hash, g_str_equal);
+        g_hash_table_insert(npp->parsed_defs, nd->id, nd);
+        *ordered = g_list_prepend(*ordered, nd);
+    }
+    g_clear_pointer(&src->ordered, g_list_free);
+    g_clear_pointer(&src->parsed_defs, g_hash_table_destroy);
+    if (src->arena) {
+        netplan_arena_merge(netplan_parser_arena(npp), src->arena);
+        src->arena = NULL;
+    }
+}
+
+static gint
+compare_strings(gconstpointer a, gconstpointer b)
+{
+    return g_strcmp0(*(const char* const*) a, *(const char* const*) b);
+}
+
+/**
+ * Parse all "*.nmconnection" keyfiles in @dirname, on a pool of @jobs worker
+ * threads (0 for one per CPU). The netdefs are added to @npp as if the files
+ * had been loaded one after the other via netplan_parser_load_keyfile(), in
+ * order of their names. If any of the files cannot be parsed, none of them are
+ * added.
+ */
+NETPLAN_PUBLIC gboolean
+netplan_parser_load_keyfile_dir(NetplanParser* npp, const char* dirname, guint jobs, GError** error)
+{
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("load_keyfiles:%s", dirname);
+    g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func(g_free);
+    GDir* dir = NULL;
+    GThreadPool* pool = NULL;
+    KeyfileJob* keyfile_jobs = NULL;
+    GList* ordered = NULL;
+    const char* name = NULL;
+    gboolean ret = TRUE;
+
+    dir = g_dir_open(dirname, 0, error);
+    if (!dir)
+        return FALSE;
+    while ((name = g_dir_read_name(dir)))
+        if (g_str_has_suffix(name, ".nmconnection"))
+            g_ptr_array_add(names, g_strdup(name));
+    g_dir_close(dir);
+    g_ptr_array_sort(names, compare_strings);
+
+    keyfile_jobs = g_new0(KeyfileJob, names->len);
+    pool = g_thread_pool_new(load_keyfile_job, NULL, jobs ?: g_get_num_processors(), TRUE, NULL);
+    for (guint i = 0; i < names->len; ++i) {
+        keyfile_jobs[i].filename = g_build_filename(dirname, g_ptr_array_index(names, i), NULL);
+        keyfile_jobs[i].npp = netplan_parser_new();
+        g_thread_pool_push(pool, &keyfile_jobs[i], NULL);
+    }
+    /* wait for all jobs to be finished */
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    for (guint i = 0; i < names->len; ++i) {
+        KeyfileJob* job = &keyfile_jobs[i];
+        if (ret && !job->success) {
+            if (job->error)
+                g_propagate_prefixed_error(error, job->error, "%s: ", job->filename);
+            else
+                g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "Cannot import keyfile %s", job->filename);
+            job->error = NULL;
+            ret = FALSE;
+        }
+        g_clear_error(&job->error);
+    }
+
+    /* Merge in order, so the result does not depend on the scheduling */
+    for (guint i = 0; i < names->len; ++i) {
+        KeyfileJob* job = &keyfile_jobs[i];
+        if (ret)
+            merge_parser_netdefs(npp, job->npp, &ordered);
+        netplan_parser_clear(&job->npp);
+        g_free(job->filename);
+    }
+    npp->ordered = g_list_concat(npp->ordered, g_list_reverse(ordered));
+    netplan_profile_count("keyfiles", names->len);
+    g_free(keyfile_jobs);
+    return ret;
+}
@@ -19,6 +19,9 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <regex.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 
 #include <glib.h>
@@ -58,34 +61,68 @@ extern NetplanState global_state;
 NetplanParser global_parser = {0};
 
 /**
- * Load YAML file name into a yaml_document_t.
+ * Map YAML file name into memory, so that libyaml can read it in place
+ * instead of through stdio buffers.
+ *
+ * Returns: the mapping, or NULL if the file cannot be read; @error gets set then.
+ */
+static GMappedFile*
+map_yaml(const char* yaml, GError** error)
+{
+    GMappedFile* map;
+    int fd;
+
+    fd = g_open(yaml, O_RDONLY, 0);
+    if (fd < 0) {
+        g_set_error(error, G_FILE_ERROR, errno, "Cannot open %s: %s", yaml, g_strerror(errno));
+        return NULL;
+    }
+    map = g_mapped_file_new_from_fd(fd, FALSE, error);
+    close(fd);
+    return map;
+}
+
+/* Contents of a mapped file, an empty file has no mapping at all */
+static const unsigned char*
+mapped_yaml_contents(GMappedFile* map)
+{
+    const char* contents = g_mapped_file_get_contents(map);
+    return (const unsigned char*) (contents ? contents : "");
+}
+
+/**
+ * Load the mapped YAML file name into a yaml_document_t.
  *
  * Returns: TRUE on success, FALSE if the document is malformed; @error gets set then.
  */
 static gboolean
-load_yaml(const char* yaml, yaml_document_t* doc, GError** error)
+load_mapped_yaml(GMappedFile* map, const char* yaml, yaml_document_t* doc, GError** error)
 {
-    FILE* fyaml = NULL;
     yaml_parser_t parser;
     gboolean ret = TRUE;
 
-    fyaml = g_fopen(yaml, "r");
-    if (!fyaml) {
-        g_set_error(error, G_FILE_ERROR, errno, "Cannot open %s: %s", yaml, g_strerror(errno));
-        return FALSE;
-    }
-
     yaml_parser_initialize(&parser);
-    yaml_parser_set_input_file(&parser, fyaml);
+    yaml_parser_set_input_string(&parser, mapped_yaml_contents(map), g_mapped_file_get_length(map));
     if (!yaml_parser_load(&parser, doc)) {
         ret = parser_error(&parser, yaml, error);
     }
 
     yaml_parser_delete(&parser);
-    fclose(fyaml);
     return ret;
 }
 
+/**
+ * Load YAML file name into a yaml_document_t.
+ *
+ * Returns: TRUE on success, FALSE if the document is malformed; @error gets set then.
+ */
+static gboolean
+load_yaml(const char* yaml, yaml_document_t* doc, GError** error)
+{
+    g_autoptr(GMappedFile) map = map_yaml(yaml, error);
+    return map && load_mapped_yaml(map, yaml, doc, error);
+}
+
 #define YAML_VARIABLE_NODE  YAML_NO_NODE
 
 /**
@@ -143,6 +180,7 @@ add_missing_node(NetplanParser *npp, const yaml_node_t* node)
 
     g_debug("recording missing yaml_node_t %s", scalar(node));
     g_hash_table_insert(npp->missing_id, (gpointer)scalar(node), missing);
+    npp->missing_refs++;
 }
 
 /**
@@ -152,13 +190,13 @@ static gboolean
 assert_valid_id(const NetplanParser* npp, yaml_node_t* node, GError** error)
 {
     static regex_t re;
-    static gboolean re_inited = FALSE;
+    static gsize re_inited = 0;
 
     assert_type(npp, node, YAML_SCALAR_NODE);
 
-    if (!re_inited) {
+    if (g_once_init_enter(&re_inited)) {
         g_assert(regcomp(&re, "^[[:alnum:][:punct:]]+$", REG_EXTENDED|REG_NOSUB) == 0);
-        re_inited = TRUE;
+        g_once_init_leave(&re_inited, 1);
     }
 
     if (regexec(&re, scalar(node), 0, NULL, 0) != 0)
@@ -203,15 +241,36 @@ typedef struct mapping_entry_handler_s {
 
 /**
  * Return the #mapping_entry_handler that matches @key, or NULL if not found.
+ * The lookup index of each handler table is built on first use and kept for
+ * the lifetime of the thread, as the tables themselves are static. Keeping
+ * one index per thread lets several parsers run concurrently.
  */
 static const mapping_entry_handler*
 get_handler(const mapping_entry_handler* handlers, const char* key)
 {
-    for (unsigned i = 0; handlers[i].key != NULL; ++i) {
-        if (g_strcmp0(handlers[i].key, key) == 0)
-            return &handlers[i];
+    static GPrivate handler_indexes = G_PRIVATE_INIT((GDestroyNotify) g_hash_table_destroy);
+    GHashTable* handler_index = g_private_get(&handler_indexes);
+    GHashTable* table_index;
+
+    if (key == NULL)
+        return NULL; // LCOV_EXCL_LINE
+
+    if (!handler_index) {
+        handler_index = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_hash_table_destroy);
+        g_private_set(&handler_indexes, handler_index);
+    }
+
+    table_index = g_hash_table_lookup(handler_index, handlers);
+    if (!table_index) {
+        table_index = g_hash_table_new(g_str_hash, g_str_equal);
+        /* the first entry wins, in case of duplicated keys */
+        for (unsigned i = 0; handlers[i].key != NULL; ++i) {
+            if (!g_hash_table_contains(table_index, handlers[i].key))
+                g_hash_table_insert(table_index, (gpointer) handlers[i].key, (gpointer) &handlers[i]);
+        }
+        g_hash_table_insert(handler_index, (gpointer) handlers, table_index);
     }
-    return NULL;
+    return g_hash_table_lookup(table_index, key);
 }
 
 /**
@@ -301,6 +360,24 @@ handle_generic_str(NetplanParser* npp, yaml_node_t* node, void* entryptr, const
     return TRUE;
 }
 
+/*
+ * Handler for setting a string field from a scalar node, inside a given struct
+ * which has been allocated from the arena of the parser
+ * @entryptr: pointer to the beginning of the to-be-modified data structure
+ * @data: offset into entryptr struct where the const char* field to write is
+ *        located
+ */
+static gboolean
+handle_generic_arena_str(NetplanParser* npp, yaml_node_t* node, void* entryptr, const void* data, GError** error)
+{
+    g_assert(entryptr);
+    guint offset = GPOINTER_TO_UINT(data);
+    char** dest = (char**) ((void*) entryptr + offset);
+    /* a previous value gets released along with the arena */
+    *dest = netplan_arena_strdup(netplan_parser_arena(npp), scalar(node));
+    return TRUE;
+}
+
 /*
  * Handler for setting a MAC address field from a scalar node, inside a given struct
  * @entryptr: pointer to the beginning of the to-be-modified data structure
@@ -312,13 +389,13 @@ handle_generic_mac(NetplanParser* npp, yaml_node_t* node, void* entryptr, const
 {
     g_assert(entryptr);
     static regex_t re;
-    static gboolean re_inited = FALSE;
+    static gsize re_inited = 0;
 
     g_assert(node->type == YAML_SCALAR_NODE);
 
-    if (!re_inited) {
+    if (g_once_init_enter(&re_inited)) {
         g_assert(regcomp(&re, "^[[:xdigit:]][[:xdigit:]]:[[:xdigit:]][[:xdigit:]]:[[:xdigit:]][[:xdigit:]]:[[:xdigit:]][[:xdigit:]]:[[:xdigit:]][[:xdigit:]]:[[:xdigit:]][[:xdigit:]]$", REG_EXTENDED|REG_NOSUB) == 0);
-        re_inited = TRUE;
+        g_once_init_leave(&re_inited, 1);
     }
 
     if (regexec(&re, scalar(node), 0, NULL, 0) != 0)
@@ -923,13 +1000,13 @@ handle_address_option_lifetime(NetplanParser* npp, yaml_node_t* node, const void
         g_ascii_strcasecmp(scalar(node), "forever") != 0) {
         return yaml_error(npp, node, error, "invalid lifetime value '%s'", scalar(node));
     }
-    return handle_generic_str(npp, node, npp->current.addr_options, data, error);
+    return handle_generic_arena_str(npp, node, npp->current.addr_options, data, error);
 }
 
 static gboolean
 handle_address_option_label(NetplanParser* npp, yaml_node_t* node, const void* data, GError** error)
 {
-    return handle_generic_str(npp, node, npp->current.addr_options, data, error);
+    return handle_generic_arena_str(npp, node, npp->current.addr_options, data, error);
 }
 
 const mapping_entry_handler address_option_handlers[] = {
@@ -938,6 +1015,24 @@ const mapping_entry_handler address_option_handlers[] = {
     {NULL}
 };
 
+/*
+ * Append @address to the NetplanIPPrefix @array, unless it already contains
+ * it (on multiple passes)
+ */
+static void
+append_ip_prefix(NetplanParser* npp, GArray** array, const char* address)
+{
+    NetplanIPPrefix prefix;
+
+    netplan_ip_prefix_init(&prefix, netplan_parser_arena(npp), address, TRUE);
+    if (!*array)
+        *array = g_array_new(FALSE, FALSE, sizeof(NetplanIPPrefix));
+    for (unsigned i = 0; i < (*array)->len; ++i)
+        if (netplan_ip_prefix_equal(&g_array_index(*array, NetplanIPPrefix, i), &prefix))
+            return;
+    g_array_append_val(*array, prefix);
+}
+
 /*
  * Handler for setting an array of IP addresses from a sequence node, inside a given struct
  * @entryptr: pointer to the beginning of the do-be-modified data structure
@@ -990,8 +1085,8 @@ handle_generic_addresses(NetplanParser* npp, yaml_node_t* node, gboolean check_z
                     return TRUE;
             }
 
-            npp->current.addr_options = g_new0(NetplanAddressOptions, 1);
-            npp->current.addr_options->address = g_strdup(scalar(key));
+            npp->current.addr_options = netplan_arena_new0(netplan_parser_arena(npp), NetplanAddressOptions);
+            npp->current.addr_options->address = netplan_arena_strdup(netplan_parser_arena(npp), scalar(key));
 
             if (!process_mapping(npp, value, address_option_handlers, NULL, error))
                 return FALSE;
@@ -1007,16 +1102,7 @@ handle_generic_addresses(NetplanParser* npp, yaml_node_t* node, gboolean check_z
             if ((check_zero_prefix && prefix_len_num == 0) || prefix_len_num > 32)
                 return yaml_error(npp, node, error, "invalid prefix length in address '%s'", scalar(entry));
 
-            if (!*ip4)
-                *ip4 = g_array_new(FALSE, FALSE, sizeof(char*));
-
-            /* Do not append the same IP (on multiple passes), if it is already contained */
-            for (unsigned i = 0; i < (*ip4)->len; ++i)
-                if (!g_strcmp0(scalar(entry), g_array_index(*ip4, char*, i)))
-                    goto skip_ip4;
-            char* s = g_strdup(scalar(entry));
-            g_array_append_val(*ip4, s);
-skip_ip4:
+            append_ip_prefix(npp, ip4, scalar(entry));
             continue;
         }
 
@@ -1024,16 +1110,8 @@ skip_ip4:
         if (is_ip6_address(addr)) {
             if ((check_zero_prefix && prefix_len_num == 0) || prefix_len_num > 128)
                 return yaml_error(npp, node, error, "invalid prefix length in address '%s'", scalar(entry));
-            if (!*ip6)
-                *ip6 = g_array_new(FALSE, FALSE, sizeof(char*));
 
-            /* Do not append the same IP (on multiple passes), if it is already contained */
-            for (unsigned i = 0; i < (*ip6)->len; ++i)
-                if (!g_strcmp0(scalar(entry), g_array_index(*ip6, char*, i)))
-                    goto skip_ip6;
-            char* s = g_strdup(scalar(entry));
-            g_array_append_val(*ip6, s);
-skip_ip6:
+            append_ip_prefix(npp, ip6, scalar(entry));
             continue;
         }
 
@@ -1228,27 +1306,20 @@ handle_nameservers_addresses(NetplanParser* npp, yaml_node_t* node, const void*
 {
     for (yaml_node_item_t *i = node->data.sequence.items.start; i < node->data.sequence.items.top; i++) {
         yaml_node_t *entry = yaml_document_get_node(&npp->doc, *i);
-        assert_type(npp, entry, YAML_SCALAR_NODE);
+        NetplanIPPrefix nameserver;
+        GArray** nameservers;
 
-        /* is it an IPv4 address? */
-        if (is_ip4_address(scalar(entry))) {
-            if (!npp->current.netdef->ip4_nameservers)
-                npp->current.netdef->ip4_nameservers = g_array_new(FALSE, FALSE, sizeof(char*));
-            char* s = g_strdup(scalar(entry));
-            g_array_append_val(npp->current.netdef->ip4_nameservers, s);
-            continue;
-        }
-
-        /* is it an IPv6 address? */
-        if (is_ip6_address(scalar(entry))) {
-            if (!npp->current.netdef->ip6_nameservers)
-                npp->current.netdef->ip6_nameservers = g_array_new(FALSE, FALSE, sizeof(char*));
-            char* s = g_strdup(scalar(entry));
-            g_array_append_val(npp->current.netdef->ip6_nameservers, s);
-            continue;
-        }
+        assert_type(npp, entry, YAML_SCALAR_NODE);
+        if (!netplan_ip_prefix_init(&nameserver, netplan_parser_arena(npp), scalar(entry), FALSE))
+            return yaml_error(npp, node, error, "malformed address '%s', must be X.X.X.X or X:X:X:X:X:X:X:X", scalar(entry));
 
-        return yaml_error(npp, node, error, "malformed address '%s', must be X.X.X.X or X:X:X:X:X:X:X:X", scalar(entry));
+        if (nameserver.family == AF_INET)
+            nameservers = &npp->current.netdef->ip4_nameservers;
+        else
+            nameservers = &npp->current.netdef->ip6_nameservers;
+        if (!*nameservers)
+            *nameservers = g_array_new(FALSE, FALSE, sizeof(NetplanIPPrefix));
+        g_array_append_val(*nameservers, nameserver);
     }
 
     return TRUE;
@@ -1355,9 +1426,7 @@ static gboolean
 handle_routes_scope(NetplanParser* npp, yaml_node_t* node, const void* data, GError** error)
 {
     NetplanIPRoute* route = npp->current.route;
-    if (route->scope)
-        g_free(route->scope);
-    route->scope = g_strdup(scalar(node));
+    route->scope = netplan_arena_strdup(netplan_parser_arena(npp), scalar(node));
 
     if (g_ascii_strcasecmp(route->scope, "global") == 0 ||
         g_ascii_strcasecmp(route->scope, "link") == 0 ||
@@ -1371,9 +1440,7 @@ static gboolean
 handle_routes_type(NetplanParser* npp, yaml_node_t* node, const void* data, GError** error)
 {
     NetplanIPRoute* route = npp->current.route;
-    if (route->type)
-        g_free(route->type);
-    route->type = g_strdup(scalar(node));
+    route->type = netplan_arena_strdup(netplan_parser_arena(npp), scalar(node));
 
     if (g_ascii_strcasecmp(route->type, "unicast") == 0 ||
         g_ascii_strcasecmp(route->type, "unreachable") == 0 ||
@@ -1398,8 +1465,7 @@ handle_routes_ip(NetplanParser* npp, yaml_node_t* node, const void* data, GError
     if (!check_and_set_family(family, &route->family))
         return yaml_error(npp, node, error, "IP family mismatch in route to %s", scalar(node));
 
-    g_free(*dest);
-    *dest = g_strdup(scalar(node));
+    *dest = netplan_arena_strdup(netplan_parser_arena(npp), scalar(node));
 
     return TRUE;
 }
@@ -1410,7 +1476,10 @@ handle_routes_destination(NetplanParser *npp, yaml_node_t *node, const void *dat
     const char *addr = scalar(node);
     if (g_strcmp0(addr, "default") != 0) /* netplan-feature: default-routes */
         return handle_routes_ip(npp, node, route_offset(to), error);
-    set_str_if_null(npp->current.route->to, addr);
+    if (npp->current.route->to)
+        g_assert_cmpstr(addr, ==, npp->current.route->to);
+    else
+        npp->current.route->to = netplan_arena_strdup(netplan_parser_arena(npp), addr);
     return TRUE;
 }
 
@@ -1428,8 +1497,7 @@ handle_ip_rule_ip(NetplanParser* npp, yaml_node_t* node, const void* data, GErro
     if (!check_and_set_family(family, &ip_rule->family))
         return yaml_error(npp, node, error, "IP family mismatch in route to %s", scalar(node));
 
-    g_free(*dest);
-    *dest = g_strdup(scalar(node));
+    *dest = netplan_arena_strdup(netplan_parser_arena(npp), scalar(node));
 
     return TRUE;
 }
@@ -1595,9 +1663,9 @@ handle_routes(NetplanParser* npp, yaml_node_t* node, const void* _, GError** err
         assert_type(npp, entry, YAML_MAPPING_NODE);
 
         g_assert(npp->current.route == NULL);
-        route = g_new0(NetplanIPRoute, 1);
-        route->type = g_strdup("unicast");
-        route->scope = g_strdup("global");
+        route = netplan_arena_new0(netplan_parser_arena(npp), NetplanIPRoute);
+        route->type = netplan_arena_strdup(netplan_parser_arena(npp), "unicast");
+        route->scope = netplan_arena_strdup(netplan_parser_arena(npp), "global");
         route->family = G_MAXUINT; /* 0 is a valid family ID */
         route->metric = NETPLAN_METRIC_UNSPEC; /* 0 is a valid metric */
         route->table = NETPLAN_ROUTE_TABLE_UNSPEC;
@@ -1629,10 +1697,7 @@ handle_routes(NetplanParser* npp, yaml_node_t* node, const void* _, GError** err
     return TRUE;
 
 err:
-    if (npp->current.route) {
-        g_free(npp->current.route);
-        npp->current.route = NULL;
-    }
+    route_clear(&npp->current.route);
     return FALSE;
 }
 
@@ -1653,7 +1718,7 @@ handle_ip_rules(NetplanParser* npp, yaml_node_t* node, const void* _, GError** e
         yaml_node_t *entry = yaml_document_get_node(&npp->doc, *i);
         gboolean ret;
 
-        NetplanIPRule* ip_rule = g_new0(NetplanIPRule, 1);
+        NetplanIPRule* ip_rule = netplan_arena_new0(netplan_parser_arena(npp), NetplanIPRule);
         ip_rule->family = G_MAXUINT; /* 0 is a valid family ID */
         ip_rule->priority = NETPLAN_IP_RULE_PRIO_UNSPEC;
         ip_rule->table = NETPLAN_ROUTE_TABLE_UNSPEC;
@@ -1875,7 +1940,7 @@ static gboolean
 handle_wireguard_peer_str(NetplanParser* npp, yaml_node_t* node, const void* data, GError** error)
 {
     g_assert(npp->current.wireguard_peer);
-    return handle_generic_str(npp, node, npp->current.wireguard_peer, data, error);
+    return handle_generic_arena_str(npp, node, npp->current.wireguard_peer, data, error);
 }
 
 /**
@@ -1974,8 +2039,8 @@ handle_wireguard_peers(NetplanParser* npp, yaml_node_t* node, const void* _, GEr
         assert_type(npp, entry, YAML_MAPPING_NODE);
 
         g_assert(npp->current.wireguard_peer == NULL);
-        npp->current.wireguard_peer = g_new0(NetplanWireguardPeer, 1);
-        npp->current.wireguard_peer->allowed_ips = g_array_new(FALSE, FALSE, sizeof(char*));
+        npp->current.wireguard_peer = netplan_arena_new0(netplan_parser_arena(npp), NetplanWireguardPeer);
+        npp->current.wireguard_peer->allowed_ips = g_array_new(FALSE, FALSE, sizeof(NetplanIPPrefix));
         g_debug("%s: adding new wireguard peer", npp->current.netdef->id);
 
         if (!process_mapping(npp, entry, wireguard_peer_handlers, NULL, error)) {
@@ -2417,15 +2482,109 @@ handle_network_ovs_settings_global_ports(NetplanParser* npp, yaml_node_t* node,
 }
 
 /**
- * Callback for a net device type entry like "ethernets:" in "network:"
- * @data: netdef_type (as pointer)
+ * A netdef entry of the current YAML document, which needs another look once
+ * all definition IDs of the document are known (see process_document()).
+ */
+typedef struct {
+    yaml_node_t* key;
+    yaml_node_t* value;
+    NetplanDefType type;
+    NetplanBackend backend;
+    /* the entry refers to IDs that had not been defined yet, so it needs
+     * to be processed again. Otherwise only its validation got postponed. */
+    gboolean unresolved;
+    /* the chunk of the document holding the entry, when streaming (see
+     * process_yaml_stream()), or NULL if it is npp->doc */
+    yaml_document_t* doc;
+} NetplanPendingEntry;
+
+static gboolean
+validate_netdef_entry(NetplanParser* npp, yaml_node_t* value, GError** error)
+{
+    /* validate definition-level conditions */
+    if (!validate_netdef_grammar(npp, npp->current.netdef, value, error))
+        return FALSE;
+
+    /* convenience shortcut: physical device without match: means match
+     * name on ID */
+    if (npp->current.netdef->type < NETPLAN_DEF_TYPE_VIRTUAL && !npp->current.netdef->has_match)
+        set_str_if_null(npp->current.netdef->match.original_name, npp->current.netdef->id);
+    return TRUE;
+}
+
+/**
+ * Create or update the netdef @key of type @type and fill it with the
+ * definitions from the @value mapping.
  */
 static gboolean
-handle_network_type(NetplanParser* npp, yaml_node_t* node, const void* data, GError** error)
+process_netdef_entry(NetplanParser* npp, yaml_node_t* key, yaml_node_t* value, NetplanDefType type, GError** error)
+{
+    const mapping_entry_handler* handlers;
+    int missing_refs = npp->missing_refs;
+
+    /* At this point we've seen a new starting definition, if it has been
+     * already mentioned in another netdef, removing it from our "missing"
+     * list. */
+    if(g_hash_table_remove(npp->missing_id, scalar(key)))
+        npp->missing_ids_found++;
+
+    npp->current.netdef = npp->parsed_defs ? g_hash_table_lookup(npp->parsed_defs, scalar(key)) : NULL;
+    if (npp->current.netdef) {
+        /* already exists, overriding/amending previous definition */
+        if (npp->current.netdef->type != type)
+            return yaml_error(npp, key, error, "Updated definition '%s' changes device type", scalar(key));
+    } else {
+        npp->current.netdef = netplan_netdef_new(npp, scalar(key), type, npp->current.backend);
+    }
+    g_assert(npp->current.filename);
+    npp->current.netdef->filename = g_strdup(npp->current.filename);
+
+    // XXX: breaks multi-pass parsing.
+    //if (!g_hash_table_add(ids_in_file, npp->current.netdef->id))
+    //    return yaml_error(npp, key, error, "Duplicate net definition ID '%s'", npp->current.netdef->id);
+
+    /* and fill it with definitions */
+    switch (npp->current.netdef->type) {
+        case NETPLAN_DEF_TYPE_BOND: handlers = bond_def_handlers; break;
+        case NETPLAN_DEF_TYPE_BRIDGE: handlers = bridge_def_handlers; break;
+        case NETPLAN_DEF_TYPE_ETHERNET: handlers = ethernet_def_handlers; break;
+        case NETPLAN_DEF_TYPE_MODEM: handlers = modem_def_handlers; break;
+        case NETPLAN_DEF_TYPE_TUNNEL: handlers = tunnel_def_handlers; break;
+        case NETPLAN_DEF_TYPE_VLAN: handlers = vlan_def_handlers; break;
+        case NETPLAN_DEF_TYPE_WIFI: handlers = wifi_def_handlers; break;
+        case NETPLAN_DEF_TYPE_NM:
+            g_warning("netplan: %s: handling NetworkManager passthrough device, settings are not fully supported.", npp->current.netdef->id);
+            handlers = ethernet_def_handlers;
+            break;
+        default: g_assert_not_reached(); // LCOV_EXCL_LINE
+    }
+    if (!process_mapping(npp, value, handlers, NULL, error))
+        return FALSE;
+
+    /* Validation is skipped as long as some IDs are missing, remember to
+     * come back to this entry once all of them are known. */
+    if (g_hash_table_size(npp->missing_id) > 0 && npp->pending_entries) {
+        NetplanPendingEntry* pending = g_new0(NetplanPendingEntry, 1);
+        pending->key = key;
+        pending->value = value;
+        pending->type = type;
+        pending->backend = npp->current.backend;
+        pending->unresolved = npp->missing_refs > missing_refs;
+        g_ptr_array_add(npp->pending_entries, pending);
+    }
+
+    return validate_netdef_entry(npp, value, error);
+}
+
+/**
+ * Process the definitions of type @type in the mapping @node, without
+ * resetting a per-type renderer afterwards.
+ */
+static gboolean
+process_network_type_entries(NetplanParser* npp, yaml_node_t* node, NetplanDefType type, GError** error)
 {
     for (yaml_node_pair_t* entry = node->data.mapping.pairs.start; entry < node->data.mapping.pairs.top; entry++) {
         yaml_node_t* key, *value;
-        const mapping_entry_handler* handlers;
 
         key = yaml_document_get_node(&npp->doc, entry->key);
         if (!assert_valid_id(npp, key, error))
@@ -2445,54 +2604,21 @@ handle_network_type(NetplanParser* npp, yaml_node_t* node, const void* data, GEr
 
         assert_type(npp, value, YAML_MAPPING_NODE);
 
-        /* At this point we've seen a new starting definition, if it has been
-         * already mentioned in another netdef, removing it from our "missing"
-         * list. */
-        if(g_hash_table_remove(npp->missing_id, scalar(key)))
-            npp->missing_ids_found++;
-
-        npp->current.netdef = npp->parsed_defs ? g_hash_table_lookup(npp->parsed_defs, scalar(key)) : NULL;
-        if (npp->current.netdef) {
-            /* already exists, overriding/amending previous definition */
-            if (npp->current.netdef->type != GPOINTER_TO_UINT(data))
-                return yaml_error(npp, key, error, "Updated definition '%s' changes device type", scalar(key));
-        } else {
-            npp->current.netdef = netplan_netdef_new(npp, scalar(key), GPOINTER_TO_UINT(data), npp->current.backend);
-        }
-        g_assert(npp->current.filename);
-        npp->current.netdef->filename = g_strdup(npp->current.filename);
-
-        // XXX: breaks multi-pass parsing.
-        //if (!g_hash_table_add(ids_in_file, npp->current.netdef->id))
-        //    return yaml_error(npp, key, error, "Duplicate net definition ID '%s'", npp->current.netdef->id);
-
-        /* and fill it with definitions */
-        switch (npp->current.netdef->type) {
-            case NETPLAN_DEF_TYPE_BOND: handlers = bond_def_handlers; break;
-            case NETPLAN_DEF_TYPE_BRIDGE: handlers = bridge_def_handlers; break;
-            case NETPLAN_DEF_TYPE_ETHERNET: handlers = ethernet_def_handlers; break;
-            case NETPLAN_DEF_TYPE_MODEM: handlers = modem_def_handlers; break;
-            case NETPLAN_DEF_TYPE_TUNNEL: handlers = tunnel_def_handlers; break;
-            case NETPLAN_DEF_TYPE_VLAN: handlers = vlan_def_handlers; break;
-            case NETPLAN_DEF_TYPE_WIFI: handlers = wifi_def_handlers; break;
-            case NETPLAN_DEF_TYPE_NM:
-                g_warning("netplan: %s: handling NetworkManager passthrough device, settings are not fully supported.", npp->current.netdef->id);
-                handlers = ethernet_def_handlers;
-                break;
-            default: g_assert_not_reached(); // LCOV_EXCL_LINE
-        }
-        if (!process_mapping(npp, value, handlers, NULL, error))
+        if (!process_netdef_entry(npp, key, value, type, error))
             return FALSE;
-
-        /* validate definition-level conditions */
-        if (!validate_netdef_grammar(npp, npp->current.netdef, value, error))
-            return FALSE;
-
-        /* convenience shortcut: physical device without match: means match
-         * name on ID */
-        if (npp->current.netdef->type < NETPLAN_DEF_TYPE_VIRTUAL && !npp->current.netdef->has_match)
-            set_str_if_null(npp->current.netdef->match.original_name, npp->current.netdef->id);
     }
+    return TRUE;
+}
+
+/**
+ * Callback for a net device type entry like "ethernets:" in "network:"
+ * @data: netdef_type (as pointer)
+ */
+static gboolean
+handle_network_type(NetplanParser* npp, yaml_node_t* node, const void* data, GError** error)
+{
+    if (!process_network_type_entries(npp, node, GPOINTER_TO_UINT(data), error))
+        return FALSE;
     npp->current.backend = NETPLAN_BACKEND_NONE;
     return TRUE;
 }
@@ -2550,7 +2676,41 @@ static const mapping_entry_handler root_handlers[] = {
 };
 
 /**
- * Handle multiple-pass parsing of the yaml document.
+ * Process the netdef entries which have been postponed during the last pass,
+ * in document order. At this point every ID defined in the document is known,
+ * so referring entries are resolved by processing them once more, while all
+ * other postponed entries only need to be validated.
+ */
+static gboolean
+process_pending_entries(NetplanParser* npp, GError** error)
+{
+    for (guint i = 0; i < npp->pending_entries->len; ++i) {
+        NetplanPendingEntry* pending = g_ptr_array_index(npp->pending_entries, i);
+        gboolean ret;
+
+        if (pending->doc)
+            npp->doc = *pending->doc;
+        if (pending->unresolved) {
+            npp->current.backend = pending->backend;
+            ret = process_netdef_entry(npp, pending->key, pending->value, pending->type, error);
+            npp->current.backend = NETPLAN_BACKEND_NONE;
+        } else {
+            npp->current.netdef = g_hash_table_lookup(npp->parsed_defs, scalar(pending->key));
+            ret = validate_netdef_entry(npp, pending->value, error);
+        }
+        if (pending->doc)
+            memset(&npp->doc, 0, sizeof(npp->doc));
+        if (!ret)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Handle parsing of the yaml document. Forward references to IDs defined later
+ * in the document are resolved after the first pass via the pending entries.
+ * Further passes over the whole document are only needed if a pass was aborted
+ * by an error before seeing all definitions.
  */
 static gboolean
 process_document(NetplanParser* npp, GError** error)
@@ -2558,26 +2718,48 @@ process_document(NetplanParser* npp, GError** error)
     gboolean ret;
     int previously_found;
     int still_missing;
+    int pass = 0;
+    NetplanProfileSpan* span = NULL;
 
     g_assert(npp->missing_id == NULL);
     npp->missing_id = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+    g_assert(npp->pending_entries == NULL);
+    npp->pending_entries = g_ptr_array_new_with_free_func(g_free);
 
     do {
         g_debug("starting new processing pass");
 
         previously_found = npp->missing_ids_found;
         npp->missing_ids_found = 0;
+        g_ptr_array_set_size(npp->pending_entries, 0);
 
         g_clear_error(error);
 
+        span = netplan_profile_begin("process_document:pass%d", ++pass);
         ret = process_mapping(npp, yaml_document_get_root_node(&npp->doc), root_handlers, NULL, error);
+        netplan_profile_end(span);
 
         still_missing = g_hash_table_size(npp->missing_id);
 
+        /* A complete pass has seen all definitions: IDs which are still
+         * missing are not defined at all, everything else can be resolved */
+        if (ret) {
+            if (still_missing == 0) {
+                g_debug("resolving %u pending definitions", npp->pending_entries->len);
+                span = netplan_profile_begin("process_document:pending");
+                ret = process_pending_entries(npp, error);
+                netplan_profile_end(span);
+            }
+            break;
+        }
+
         if (still_missing > 0 && npp->missing_ids_found == previously_found)
             break;
     } while (still_missing > 0 || npp->missing_ids_found > 0);
 
+    g_ptr_array_free(npp->pending_entries, TRUE);
+    npp->pending_entries = NULL;
+
     if (g_hash_table_size(npp->missing_id) > 0) {
         GHashTableIter iter;
         gpointer key, value;
@@ -2601,20 +2783,14 @@ process_document(NetplanParser* npp, GError** error)
     return ret;
 }
 
-/**
- * Parse given YAML file and create/update global "netdefs" list.
- */
-gboolean
-netplan_parser_load_yaml(NetplanParser* npp, const char* filename, GError** error)
+/* Process the YAML document loaded into npp->doc from @filename */
+static gboolean
+process_yaml_document(NetplanParser* npp, const char* filename, GError** error)
 {
-    yaml_document_t *doc = &npp->doc;
     gboolean ret;
 
-    if (!load_yaml(filename, doc, error))
-        return FALSE;
-
     /* empty file? */
-    if (yaml_document_get_root_node(doc) == NULL)
+    if (yaml_document_get_root_node(&npp->doc) == NULL)
         return TRUE;
 
     g_assert(npp->ids_in_file == NULL);
@@ -2625,12 +2801,534 @@ netplan_parser_load_yaml(NetplanParser* npp, const char* filename, GError** erro
     g_free((void *)npp->current.filename);
     npp->current.filename = NULL;
 
-    yaml_document_delete(doc);
     g_hash_table_destroy(npp->ids_in_file);
     npp->ids_in_file = NULL;
     return ret;
 }
 
+/*
+ * Streaming mode, for large YAML files.
+ *
+ * Rather than loading the whole file into one yaml_document_t, the event
+ * stream of libyaml is split into small chunks: one per definition in
+ * "network: <type>:" and one per other key in "network:" and in the root
+ * mapping. Each chunk is a document of its own with a single entry mapping
+ * at its root, which is processed by the usual handlers and dropped right
+ * away, unless it still needs to be looked at once the whole file has been
+ * read (pending entries, missing IDs or anchors for later aliases).
+ *
+ * A pass that is aborted by an error while IDs are still missing is retried
+ * on the whole document, like process_document() does. Errors in chunks are
+ * reported as soon as they are found, i.e. possibly before syntax errors
+ * further down the file.
+ */
+#define STREAMING_MIN_SIZE (1024 * 1024)
+
+typedef struct {
+    yaml_document_t* doc;
+    int id;
+} NetplanStreamAnchor;
+
+typedef struct {
+    yaml_parser_t parser;
+    const char* filename;
+    GHashTable* anchors; /* anchor -> NetplanStreamAnchor */
+    GPtrArray* chunks; /* retained chunk documents */
+} NetplanStream;
+
+typedef gboolean (*chunk_handler)(NetplanParser* npp, yaml_node_t* root, const void* data, GError** error);
+
+static void
+chunk_document_free(gpointer data)
+{
+    yaml_document_delete(data);
+    g_free(data);
+}
+
+static gboolean
+stream_next_event(NetplanStream* s, yaml_event_t* event, GError** error)
+{
+    if (!yaml_parser_parse(&s->parser, event))
+        return parser_error(&s->parser, s->filename, error);
+    return TRUE;
+}
+
+/* Copy node @id of @src, e.g. an anchor of an earlier chunk, into @dst */
+static int
+stream_copy_node(yaml_document_t* src, int id, yaml_document_t* dst)
+{
+    yaml_node_t* node = yaml_document_get_node(src, id);
+    yaml_node_t copy = *node;
+    int new_id = 0;
+
+    switch (node->type) {
+        case YAML_SCALAR_NODE:
+            new_id = yaml_document_add_scalar(dst, node->tag, node->data.scalar.value,
+                                              node->data.scalar.length, node->data.scalar.style);
+            break;
+        case YAML_SEQUENCE_NODE:
+            new_id = yaml_document_add_sequence(dst, node->tag, node->data.sequence.style);
+            for (yaml_node_item_t* i = copy.data.sequence.items.start; new_id && i < copy.data.sequence.items.top; i++) {
+                int item = stream_copy_node(src, *i, dst);
+                if (!item || !yaml_document_append_sequence_item(dst, new_id, item))
+                    new_id = 0; // LCOV_EXCL_LINE
+            }
+            break;
+        case YAML_MAPPING_NODE:
+            new_id = yaml_document_add_mapping(dst, node->tag, node->data.mapping.style);
+            for (yaml_node_pair_t* p = copy.data.mapping.pairs.start; new_id && p < copy.data.mapping.pairs.top; p++) {
+                int key = stream_copy_node(src, p->key, dst);
+                int value = key ? stream_copy_node(src, p->value, dst) : 0;
+                if (!value || !yaml_document_append_mapping_pair(dst, new_id, key, value))
+                    new_id = 0; // LCOV_EXCL_LINE
+            }
+            break;
+        default: g_assert_not_reached(); // LCOV_EXCL_LINE
+    }
+    if (new_id) {
+        yaml_document_get_node(dst, new_id)->start_mark = copy.start_mark;
+        yaml_document_get_node(dst, new_id)->end_mark = copy.end_mark;
+    }
+    return new_id;
+}
+
+static void
+stream_add_anchor(NetplanStream* s, const yaml_char_t* anchor, yaml_document_t* doc, int id)
+{
+    NetplanStreamAnchor* a = NULL;
+
+    if (!anchor)
+        return;
+    a = g_new0(NetplanStreamAnchor, 1);
+    a->doc = doc;
+    a->id = id;
+    g_hash_table_replace(s->anchors, g_strdup((const char*) anchor), a);
+}
+
+/**
+ * Add the node starting with @event (which is not consumed) to @doc.
+ * Returns: the node ID, or 0 on error (@error gets set then).
+ */
+static int
+stream_load_node(NetplanStream* s, yaml_document_t* doc, yaml_event_t* event, GError** error)
+{
+    yaml_event_t child;
+    NetplanStreamAnchor* anchor;
+    int id = 0;
+
+    switch (event->type) {
+        case YAML_ALIAS_EVENT:
+            anchor = g_hash_table_lookup(s->anchors, event->data.alias.anchor);
+            if (!anchor) {
+                g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE,
+                            "%s:%zu:%zu: Invalid YAML: found undefined alias",
+                            s->filename, event->start_mark.line + 1, event->start_mark.column + 1);
+                return 0;
+            }
+            /* aliases within a chunk share the node, just like yaml_parser_load() */
+            return anchor->doc == doc ? anchor->id : stream_copy_node(anchor->doc, anchor->id, doc);
+
+        case YAML_SCALAR_EVENT:
+            id = yaml_document_add_scalar(doc, event->data.scalar.tag, event->data.scalar.value,
+                                          (int) event->data.scalar.length, event->data.scalar.style);
+            if (!id)
+                break; // LCOV_EXCL_LINE
+            stream_add_anchor(s, event->data.scalar.anchor, doc, id);
+            yaml_document_get_node(doc, id)->end_mark = event->end_mark;
+            break;
+
+        case YAML_SEQUENCE_START_EVENT:
+            id = yaml_document_add_sequence(doc, event->data.sequence_start.tag, event->data.sequence_start.style);
+            if (!id)
+                break; // LCOV_EXCL_LINE
+            stream_add_anchor(s, event->data.sequence_start.anchor, doc, id);
+            while (TRUE) {
+                int item;
+                if (!stream_next_event(s, &child, error))
+                    return 0;
+                if (child.type == YAML_SEQUENCE_END_EVENT) {
+                    yaml_document_get_node(doc, id)->end_mark = child.end_mark;
+                    yaml_event_delete(&child);
+                    break;
+                }
+                item = stream_load_node(s, doc, &child, error);
+                yaml_event_delete(&child);
+                if (!item || !yaml_document_append_sequence_item(doc, id, item))
+                    return 0;
+            }
+            break;
+
+        case YAML_MAPPING_START_EVENT:
+            id = yaml_document_add_mapping(doc, event->data.mapping_start.tag, event->data.mapping_start.style);
+            if (!id)
+                break; // LCOV_EXCL_LINE
+            stream_add_anchor(s, event->data.mapping_start.anchor, doc, id);
+            while (TRUE) {
+                int key, value;
+                if (!stream_next_event(s, &child, error))
+                    return 0;
+                if (child.type == YAML_MAPPING_END_EVENT) {
+                    yaml_document_get_node(doc, id)->end_mark = child.end_mark;
+                    yaml_event_delete(&child);
+                    break;
+                }
+                key = stream_load_node(s, doc, &child, error);
+                yaml_event_delete(&child);
+                if (!key || !stream_next_event(s, &child, error))
+                    return 0;
+                value = stream_load_node(s, doc, &child, error);
+                yaml_event_delete(&child);
+                if (!value || !yaml_document_append_mapping_pair(doc, id, key, value))
+                    return 0;
+            }
+            break;
+
+        default: g_assert_not_reached(); // LCOV_EXCL_LINE
+    }
+
+    if (!id) {
+        // LCOV_EXCL_START
+        g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_PARSE, "%s: out of memory", s->filename);
+        return 0;
+        // LCOV_EXCL_STOP
+    }
+    yaml_document_get_node(doc, id)->start_mark = event->start_mark;
+    return id;
+}
+
+/**
+ * Read the entry of a mapping whose key starts with @key_event, up to the
+ * value starting with @value_event (if not %NULL, it is read from the stream
+ * otherwise), into a new chunk and process it with @handler.
+ */
+static gboolean
+stream_process_chunk(NetplanParser* npp, NetplanStream* s, yaml_event_t* key_event, yaml_event_t* value_event,
+                     chunk_handler handler, const void* data, GError** error)
+{
+    yaml_document_t* chunk = g_new0(yaml_document_t, 1);
+    guint pending = npp->pending_entries->len;
+    guint anchors = g_hash_table_size(s->anchors);
+    int missing_refs = npp->missing_refs;
+    yaml_event_t event;
+    gboolean ret = FALSE;
+    int root, key, value;
+
+    yaml_document_initialize(chunk, NULL, NULL, NULL, 1, 1);
+    root = yaml_document_add_mapping(chunk, NULL, YAML_BLOCK_MAPPING_STYLE);
+    key = root ? stream_load_node(s, chunk, key_event, error) : 0;
+    if (!key)
+        goto cleanup;
+    if (value_event)
+        value = stream_load_node(s, chunk, value_event, error);
+    else {
+        if (!stream_next_event(s, &event, error))
+            goto cleanup;
+        value = stream_load_node(s, chunk, &event, error);
+        yaml_event_delete(&event);
+    }
+    if (!value || !yaml_document_append_mapping_pair(chunk, root, key, value))
+        goto cleanup;
+    yaml_document_get_node(chunk, root)->start_mark = key_event->start_mark;
+
+    npp->doc = *chunk;
+    ret = handler(npp, yaml_document_get_node(chunk, root), data, error);
+    memset(&npp->doc, 0, sizeof(npp->doc));
+
+    for (guint i = pending; i < npp->pending_entries->len; ++i)
+        ((NetplanPendingEntry*) g_ptr_array_index(npp->pending_entries, i))->doc = chunk;
+    /* keep the nodes which the parser might still refer to */
+    if (npp->pending_entries->len > pending || npp->missing_refs > missing_refs
+        || g_hash_table_size(s->anchors) > anchors) {
+        g_ptr_array_add(s->chunks, chunk);
+        return ret;
+    }
+
+cleanup:
+    chunk_document_free(chunk);
+    return ret;
+}
+
+static gboolean
+process_root_chunk(NetplanParser* npp, yaml_node_t* root, const void* _, GError** error)
+{
+    return process_mapping(npp, root, root_handlers, NULL, error);
+}
+
+static gboolean
+process_network_chunk(NetplanParser* npp, yaml_node_t* root, const void* _, GError** error)
+{
+    return process_mapping(npp, root, network_handlers, NULL, error);
+}
+
+static gboolean
+process_network_type_chunk(NetplanParser* npp, yaml_node_t* root, const void* data, GError** error)
+{
+    return process_network_type_entries(npp, root, GPOINTER_TO_UINT(data), error);
+}
+
+/**
+ * Process the entries of the mapping whose start event has just been read,
+ * via @handler for each entry. If @nested is set, "network:" (at the root)
+ * and "<type>:" definition mappings (in "network:") of its keys are streamed
+ * entry by entry as well.
+ */
+static gboolean
+stream_process_mapping(NetplanParser* npp, NetplanStream* s, chunk_handler handler,
+                       const mapping_entry_handler* nested, GError** error)
+{
+    yaml_event_t key, value;
+    gboolean ret = TRUE;
+
+    while (ret) {
+        const mapping_entry_handler* h = NULL;
+
+        if (!stream_next_event(s, &key, error))
+            return FALSE;
+        if (key.type == YAML_MAPPING_END_EVENT) {
+            yaml_event_delete(&key);
+            break;
+        }
+        if (nested && key.type == YAML_SCALAR_EVENT)
+            h = get_handler(nested, (const char*) key.data.scalar.value);
+        if (!h || (h->map_handlers != network_handlers && h->handler != handle_network_type)) {
+            ret = stream_process_chunk(npp, s, &key, NULL, handler, NULL, error);
+            yaml_event_delete(&key);
+            continue;
+        }
+
+        if (!stream_next_event(s, &value, error)) {
+            yaml_event_delete(&key);
+            return FALSE;
+        }
+        if (value.type != YAML_MAPPING_START_EVENT || value.data.mapping_start.anchor) {
+            /* not a mapping, let the handler complain about it */
+            ret = stream_process_chunk(npp, s, &key, &value, handler, NULL, error);
+        } else if (h->map_handlers) {
+            /* "network:" */
+            ret = stream_process_mapping(npp, s, process_network_chunk, h->map_handlers, error);
+        } else {
+            /* "network: <type>:" */
+            while (ret) {
+                yaml_event_t id;
+                if (!stream_next_event(s, &id, error)) {
+                    ret = FALSE;
+                    break;
+                }
+                if (id.type == YAML_MAPPING_END_EVENT) {
+                    yaml_event_delete(&id);
+                    break;
+                }
+                ret = stream_process_chunk(npp, s, &id, NULL, process_network_type_chunk, h->data, error);
+                yaml_event_delete(&id);
+            }
+            npp->current.backend = NETPLAN_BACKEND_NONE;
+        }
+        yaml_event_delete(&key);
+        yaml_event_delete(&value);
+    }
+    return ret;
+}
+
+/**
+ * Process the YAML document in @contents, which has been read from
+ * @filename, in streaming mode.
+ */
+static gboolean
+process_yaml_stream(NetplanParser* npp, const char* filename, const char* contents, gsize length, GError** error)
+{
+    NetplanStream s = {};
+    yaml_event_t event = {};
+    gboolean ret = FALSE;
+    gboolean streamed = FALSE;
+
+    yaml_parser_initialize(&s.parser);
+    yaml_parser_set_input_string(&s.parser, (const unsigned char*) contents, length);
+    s.filename = filename;
+    s.anchors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    s.chunks = g_ptr_array_new_with_free_func(chunk_document_free);
+
+    /* Anything but a mapping at the root is left to the regular document
+     * mode, including empty files */
+    do {
+        yaml_event_delete(&event);
+        if (!stream_next_event(&s, &event, error))
+            goto cleanup;
+    } while (event.type == YAML_STREAM_START_EVENT || event.type == YAML_DOCUMENT_START_EVENT);
+    if (event.type != YAML_MAPPING_START_EVENT || event.data.mapping_start.anchor)
+        goto document_mode;
+    yaml_event_delete(&event);
+
+    g_assert(npp->ids_in_file == NULL);
+    npp->ids_in_file = g_hash_table_new(g_str_hash, NULL);
+    npp->current.filename = g_strdup(filename);
+    g_assert(npp->missing_id == NULL);
+    npp->missing_id = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+    g_assert(npp->pending_entries == NULL);
+    npp->pending_entries = g_ptr_array_new_with_free_func(g_free);
+    npp->missing_ids_found = 0;
+    streamed = TRUE;
+
+    g_debug("streaming %s", filename);
+    ret = stream_process_mapping(npp, &s, process_root_chunk, root_handlers, error);
+
+    if (ret && g_hash_table_size(npp->missing_id) == 0) {
+        g_debug("resolving %u pending definitions", npp->pending_entries->len);
+        ret = process_pending_entries(npp, error);
+    } else if (ret) {
+        GHashTableIter iter;
+        gpointer key, value;
+        NetplanMissingNode *missing;
+
+        /* Get the first missing identifier we can get from our list, to
+         * approximate early failure and give the user a meaningful error. */
+        g_hash_table_iter_init (&iter, npp->missing_id);
+        g_hash_table_iter_next (&iter, &key, &value);
+        missing = (NetplanMissingNode*) value;
+
+        ret = yaml_error(npp, missing->node, error, "%s: interface '%s' is not defined",
+                         missing->netdef_id,
+                         key);
+    } else if (g_hash_table_size(npp->missing_id) > 0) {
+        /* The error might be due to IDs which are defined further down,
+         * run further passes over the whole document */
+        g_debug("streaming pass aborted with missing IDs, falling back to document mode");
+        g_clear_error(error);
+        npp->missing_refs = 0;
+        goto document_mode;
+    }
+    goto cleanup;
+
+document_mode:
+    yaml_event_delete(&event);
+    yaml_parser_delete(&s.parser);
+    yaml_parser_initialize(&s.parser);
+    yaml_parser_set_input_string(&s.parser, (const unsigned char*) contents, length);
+    if (!yaml_parser_load(&s.parser, &npp->doc)) {
+        ret = parser_error(&s.parser, filename, error);
+        goto cleanup;
+    }
+    if (streamed) {
+        g_clear_pointer(&npp->pending_entries, g_ptr_array_unref);
+        g_clear_pointer(&npp->missing_id, g_hash_table_destroy);
+        g_clear_pointer(&npp->ids_in_file, g_hash_table_destroy);
+        g_clear_pointer(&npp->current.filename, g_free);
+        streamed = FALSE;
+    }
+    ret = process_yaml_document(npp, filename, error);
+    yaml_document_delete(&npp->doc);
+
+cleanup:
+    if (streamed) {
+        g_ptr_array_free(npp->pending_entries, TRUE);
+        npp->pending_entries = NULL;
+        g_clear_pointer(&npp->missing_id, g_hash_table_destroy);
+        g_clear_pointer(&npp->ids_in_file, g_hash_table_destroy);
+        g_clear_pointer(&npp->current.filename, g_free);
+    }
+    yaml_event_delete(&event);
+    yaml_parser_delete(&s.parser);
+    g_ptr_array_free(s.chunks, TRUE);
+    g_hash_table_destroy(s.anchors);
+    return ret;
+}
+
+/**
+ * Parse given YAML file and create/update global "netdefs" list.
+ */
+gboolean
+netplan_parser_load_yaml(NetplanParser* npp, const char* filename, GError** error)
+{
+    yaml_document_t *doc = &npp->doc;
+    g_autoptr(GMappedFile) map = NULL;
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("load_yaml:%s", filename);
+    gboolean ret;
+
+    map = map_yaml(filename, error);
+    if (!map)
+        return FALSE;
+
+    if (g_mapped_file_get_length(map) >= STREAMING_MIN_SIZE)
+        return process_yaml_stream(npp, filename, (const char*) mapped_yaml_contents(map),
+                                   g_mapped_file_get_length(map), error);
+
+    if (!load_mapped_yaml(map, filename, doc, error))
+        return FALSE;
+
+    ret = process_yaml_document(npp, filename, error);
+    yaml_document_delete(doc);
+    return ret;
+}
+
+/*
+ * Cache of loaded YAML documents, so that a set of files can be parsed again
+ * without reading the unchanged ones from disk again.
+ */
+struct netplan_document_cache {
+    GHashTable* documents; /* filename -> yaml_document_t */
+};
+
+static void
+cached_document_free(gpointer data)
+{
+    yaml_document_delete(data);
+    g_free(data);
+}
+
+NetplanDocumentCache*
+netplan_document_cache_new(void)
+{
+    NetplanDocumentCache* cache = g_new0(NetplanDocumentCache, 1);
+    cache->documents = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, cached_document_free);
+    return cache;
+}
+
+/**
+ * Drop the cached document of @filename, or all of them if @filename is %NULL.
+ */
+void
+netplan_document_cache_invalidate(NetplanDocumentCache* cache, const char* filename)
+{
+    if (filename)
+        g_hash_table_remove(cache->documents, filename);
+    else
+        g_hash_table_remove_all(cache->documents);
+}
+
+void
+netplan_document_cache_free(NetplanDocumentCache* cache)
+{
+    g_hash_table_destroy(cache->documents);
+    g_free(cache);
+}
+
+/**
+ * Same as netplan_parser_load_yaml(), but take the YAML document of @filename
+ * from @cache, if available, and store it there otherwise.
+ */
+gboolean
+netplan_parser_load_yaml_cached(NetplanParser* npp, const char* filename, NetplanDocumentCache* cache, GError** error)
+{
+    yaml_document_t *doc = g_hash_table_lookup(cache->documents, filename);
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("load_yaml:%s", filename);
+    gboolean ret;
+
+    if (!doc) {
+        doc = g_new0(yaml_document_t, 1);
+        if (!load_yaml(filename, doc, error)) {
+            g_free(doc);
+            return FALSE;
+        }
+        g_hash_table_insert(cache->documents, g_strdup(filename), doc);
+    }
+
+    /* The document is only ever read while processing it, so the parser can
+     * work on a shallow copy of the cached one */
+    npp->doc = *doc;
+    ret = process_yaml_document(npp, filename, error);
+    memset(&npp->doc, 0, sizeof(npp->doc));
+    return ret;
+}
+
 static gboolean
 finish_iterator(const NetplanParser* npp, NetplanNetDefinition* nd, GError **error)
 {
@@ -2647,40 +3345,64 @@ finish_iterator(const NetplanParser* npp, NetplanNetDefinition* nd, GError **err
 static gboolean
 insert_kv_into_hash(void *key, void *value, void *hash)
 {
+    g_assert(g_hash_table_lookup(hash, key) == NULL);
     g_hash_table_insert(hash, key, value);
     return TRUE;
 }
 
+/**
+ * Run the final round of validation over all netdefs parsed by @npp, without
+ * importing them into a state. Problems the configuration can be used with
+ * are returned in @warning or, if that is NULL, logged as warnings.
+ */
 gboolean
-netplan_state_import_parser_results(NetplanState* np_state, NetplanParser* npp, GError** error)
+netplan_parser_validate(NetplanParser* npp, GError** warning, GError** error)
 {
     if (npp->parsed_defs) {
+        g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("validate");
         GError *recoverable = NULL;
         GHashTableIter iter;
-        gpointer key, value;
+        gpointer value;
         g_debug("We have some netdefs, pass them through a final round of validation");
         if (!validate_default_route_consistency(npp, npp->parsed_defs, &recoverable)) {
-            g_warning("Problem encountered while validating default route consistency."
-                      "Please set up multiple routing tables and use `routing-policy` instead.\n"
-                      "Error: %s", (recoverable) ? recoverable->message : "");
-            g_clear_error(&recoverable);
+            if (warning)
+                g_propagate_error(warning, recoverable);
+            else {
+                g_warning("Problem encountered while validating default route consistency."
+                          "Please set up multiple routing tables and use `routing-policy` instead.\n"
+                          "Error: %s", (recoverable) ? recoverable->message : "");
+                g_clear_error(&recoverable);
+            }
         }
 
         g_hash_table_iter_init (&iter, npp->parsed_defs);
 
-        while (g_hash_table_iter_next (&iter, &key, &value)) {
-            g_assert(np_state->netdefs == NULL ||
-                    g_hash_table_lookup(np_state->netdefs, key) == NULL);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
             if (!finish_iterator(npp, (NetplanNetDefinition *) value, error))
                 return FALSE;
             g_debug("Configuration is valid");
         }
     }
+    return TRUE;
+}
+
+gboolean
+netplan_state_import_parser_results(NetplanState* np_state, NetplanParser* npp, GError** error)
+{
+    if (!netplan_parser_validate(npp, NULL, error))
+        return FALSE;
 
     if (npp->parsed_defs) {
         if (!np_state->netdefs)
             np_state->netdefs = g_hash_table_new(g_str_hash, g_str_equal);
         g_hash_table_foreach_steal(npp->parsed_defs, insert_kv_into_hash, np_state->netdefs);
+        netplan_state_index_members(np_state);
+    }
+    for (GList* l = npp->ordered; l; l = l->next) {
+        NetplanNetDefinition* nd = l->data;
+        if (!np_state->netdefs_by_type[nd->type])
+            np_state->netdefs_by_type[nd->type] = g_ptr_array_new();
+        g_ptr_array_add(np_state->netdefs_by_type[nd->type], nd);
     }
     np_state->netdefs_ordered = g_list_concat(np_state->netdefs_ordered, npp->ordered);
     np_state->ovs_settings = npp->global_ovs_settings;
@@ -2692,6 +3414,12 @@ netplan_state_import_parser_results(NetplanState* np_state, NetplanParser* npp,
     npp->parsed_defs = NULL;
     npp->ordered = NULL;
     memset(&npp->global_ovs_settings, 0, sizeof(NetplanOVSSettings));
+    if (npp->arena) {
+        if (!np_state->arenas)
+            np_state->arenas = g_ptr_array_new_with_free_func((GDestroyNotify) netplan_arena_free);
+        g_ptr_array_add(np_state->arenas, npp->arena);
+        npp->arena = NULL;
+    }
 
     netplan_parser_reset(npp);
     return TRUE;
@@ -2754,7 +3482,26 @@ netplan_parser_reset(NetplanParser* npp)
         npp->missing_id = NULL;
     }
 
+    //LCOV_EXCL_START
+    if (npp->pending_entries) {
+        g_ptr_array_free(npp->pending_entries, TRUE);
+        npp->pending_entries = NULL;
+    }
+    //LCOV_EXCL_STOP
+
     npp->missing_ids_found = 0;
+    npp->missing_refs = 0;
+
+    /* Last, as it owns data of the netdefs released above */
+    g_clear_pointer(&npp->arena, netplan_arena_free);
+}
+
+NetplanArena*
+netplan_parser_arena(NetplanParser* npp)
+{
+    if (!npp->arena)
+        npp->arena = netplan_arena_new();
+    return npp->arena;
 }
 
 void
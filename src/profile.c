@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2022 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "util-internal.h"
+
+/*
+ * Phase timing, enabled via NETPLAN_PROFILE=json. A span measures the wall
+ * clock and CPU time of a phase, e.g. loading a YAML file or rendering the
+ * networkd configuration of a netdef, while counters count e.g. the files
+ * written. Whenever the outermost open span ends, all spans and counters
+ * recorded since are printed to stderr as a single line of JSON:
+ *
+ *   {"process": "generate", "pid": 42, "trace": "<ID>",
+ *    "spans": [{"name": "generate", "start": <µs since the epoch>,
+ *               "wall_us": 1500, "cpu_us": 1200}, ...],
+ *    "counters": {"files_written": 3, "netdefs": 2}}
+ *
+ * The trace ID is passed on to child processes via $NETPLAN_TRACE_ID, so that
+ * the records of e.g. the D-Bus daemon, of the "netplan apply" it spawns and
+ * of the "netplan generate" spawned by that can be joined. Spans begin and end
+ * on any thread, so the trace ID is never put into the environment of this
+ * process (setenv() is not thread-safe); children get it via the environment
+ * returned by netplan_profile_child_environ().
+ */
+
+struct netplan_profile_span {
+    char* name;
+    /* real time the span began at, in µs */
+    gint64 start;
+    /* monotonic and CPU time the span began at, its duration once ended */
+    gint64 wall;
+    gint64 cpu;
+};
+
+static struct {
+    GMutex lock;
+    GPtrArray* spans;
+    GHashTable* counters; /* name -> GUINT_TO_POINTER(count) */
+    guint open;
+    char* trace; /* ID of the current trace, while a span is open */
+} profile;
+
+static void
+span_free(gpointer data)
+{
+    NetplanProfileSpan* span = data;
+    g_free(span->name);
+    g_free(span);
+}
+
+/* CPU time of the calling thread, spans are expected to end on the thread
+ * they began on */
+static gint64
+thread_cpu_time(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0)
+        return 0; // LCOV_EXCL_LINE
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/* Append @str to @s as a quoted JSON string */
+void
+netplan_json_append_string(GString* s, const char* str)
+{
+    g_string_append_c(s, '"');
+    for (const char* c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\' || (guchar) *c < 0x20)
+            g_string_append_printf(s, "\\u%04x", (guchar) *c);
+        else
+            g_string_append_c(s, *c);
+    }
+    g_string_append_c(s, '"');
+}
+
+/* Print the record of all spans and counters, called with the lock held */
+static void
+profile_flush(void)
+{
+    GString* s = g_string_new("{\"process\": ");
+    GList* counters = NULL;
+
+    netplan_json_append_string(s, g_get_prgname() ?: "netplan");
+    g_string_append_printf(s, ", \"pid\": %d, \"trace\": ", (int) getpid());
+    netplan_json_append_string(s, profile.trace ?: "");
+    g_string_append(s, ", \"spans\": [");
+    for (guint i = 0; i < profile.spans->len; ++i) {
+        const NetplanProfileSpan* span = g_ptr_array_index(profile.spans, i);
+        g_string_append(s, i ? ", {\"name\": " : "{\"name\": ");
+        netplan_json_append_string(s, span->name);
+        g_string_append_printf(s, ", \"start\": %" G_GINT64_FORMAT ", \"wall_us\": %" G_GINT64_FORMAT
+                               ", \"cpu_us\": %" G_GINT64_FORMAT "}", span->start, span->wall, span->cpu);
+    }
+    g_string_append(s, "], \"counters\": {");
+    if (profile.counters)
+        counters = g_list_sort(g_hash_table_get_keys(profile.counters), (GCompareFunc) g_strcmp0);
+    for (GList* l = counters; l; l = l->next) {
+        if (l != counters)
+            g_string_append(s, ", ");
+        netplan_json_append_string(s, l->data);
+        g_string_append_printf(s, ": %u", GPOINTER_TO_UINT(g_hash_table_lookup(profile.counters, l->data)));
+    }
+    g_list_free(counters);
+    g_string_append(s, "}}\n");
+    fputs(s->str, stderr);
+    fflush(stderr);
+    g_string_free(s, TRUE);
+
+    g_ptr_array_set_size(profile.spans, 0);
+    if (profile.counters)
+        g_hash_table_remove_all(profile.counters);
+    /* the next outermost span begins a new trace, unless inherited */
+    g_clear_pointer(&profile.trace, g_free);
+}
+
+/* Whether phase timing has been enabled via NETPLAN_PROFILE=json */
+static gboolean
+profile_enabled(void)
+{
+    static gsize enabled = 0;
+    if (g_once_init_enter(&enabled))
+        g_once_init_leave(&enabled, g_strcmp0(g_getenv("NETPLAN_PROFILE"), "json") == 0 ? 2 : 1);
+    return enabled == 2;
+}
+
+/**
+ * Begin a span named after the printf-style @format.
+ * Returns: the span, to be passed to netplan_profile_end(), or %NULL if phase
+ *          timing is disabled
+ */
+NetplanProfileSpan*
+netplan_profile_begin(const char* format, ...)
+{
+    NetplanProfileSpan* span = NULL;
+    va_list args;
+
+    if (!profile_enabled())
+        return NULL;
+    span = g_new0(NetplanProfileSpan, 1);
+    va_start(args, format);
+    span->name = g_strdup_vprintf(format, args);
+    va_end(args);
+
+    g_mutex_lock(&profile.lock);
+    if (profile.open++ == 0)
+        profile.trace = g_strdup(g_getenv("NETPLAN_TRACE_ID")) ?: g_uuid_string_random();
+    if (!profile.spans)
+        profile.spans = g_ptr_array_new_with_free_func(span_free);
+    g_ptr_array_add(profile.spans, span);
+    g_mutex_unlock(&profile.lock);
+
+    span->start = g_get_real_time();
+    span->wall = g_get_monotonic_time();
+    span->cpu = thread_cpu_time();
+    return span;
+}
+
+/**
+ * End @span, which may be %NULL. The span is owned by the profile and must not
+ * be used anymore afterwards.
+ */
+void
+netplan_profile_end(NetplanProfileSpan* span)
+{
+    if (!span)
+        return;
+    span->wall = g_get_monotonic_time() - span->wall;
+    span->cpu = thread_cpu_time() - span->cpu;
+
+    g_mutex_lock(&profile.lock);
+    g_assert(profile.open > 0);
+    if (--profile.open == 0)
+        profile_flush();
+    g_mutex_unlock(&profile.lock);
+}
+
+/**
+ * Get the environment for a child process, which continues the current trace.
+ * Returns: a newly allocated environment, to be freed with g_strfreev(), or
+ *          %NULL (i.e. inherit the environment) if there is no trace
+ */
+gchar**
+netplan_profile_child_environ(void)
+{
+    gchar** envp = NULL;
+
+    if (!profile_enabled())
+        return NULL;
+    g_mutex_lock(&profile.lock);
+    if (profile.trace)
+        envp = g_environ_setenv(g_get_environ(), "NETPLAN_TRACE_ID", profile.trace, TRUE);
+    g_mutex_unlock(&profile.lock);
+    return envp;
+}
+
+/**
+ * Add @n to the counter named @counter, if phase timing is enabled.
+ */
+void
+netplan_profile_count(const char* counter, guint n)
+{
+    guint count;
+
+    if (!profile_enabled())
+        return;
+    g_mutex_lock(&profile.lock);
+    if (!profile.counters)
+        profile.counters = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    count = GPOINTER_TO_UINT(g_hash_table_lookup(profile.counters, counter));
+    g_hash_table_insert(profile.counters, g_strdup(counter), GUINT_TO_POINTER(count + n));
+    g_mutex_unlock(&profile.lock);
+}
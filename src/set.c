@@ -0,0 +1,1121 @@
+/*
+ * Copyright (C) 2022 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <yaml.h>
+
+#include "util.h"
+#include "util-internal.h"
+#include "error.h"
+#include "names.h"
+#include "parse.h"
+#include "types.h"
+#include "yaml-helpers.h"
+
+/*
+ * Native "netplan set" and "netplan get".
+ *
+ * "netplan set": a delta, given as a dotted key path (e.g.
+ * "ethernets.eth0.dhcp4") and a YAML value, is merged into the YAML file each
+ * of its netdefs is defined in, or into the file named by the origin hint.
+ * Each file written is validated on its own before it replaces the old one,
+ * all other files are left alone.
+ *
+ * The files are merged as plain YAML trees rather than as netdefs, so that
+ * keys the netdef serializer does not know about (e.g. passthrough settings)
+ * survive. The output matches what the former Python implementation dumped
+ * via PyYAML: mappings sorted by key, YAML 1.1 booleans and integers
+ * normalized and strings only quoted if they would read as another type.
+ *
+ * "netplan get": the YAML files are merged into a tree once, which then
+ * answers any number of key path queries. The netdefs of each device type are
+ * indexed by ID, so that per interface queries do not need to scan them.
+ */
+
+#define SET_FALLBACK_HINT "70-netplan-set"
+#define SET_MAX_DEPTH 64
+
+typedef struct set_node SetNode;
+
+struct set_node {
+    /* YAML_NO_NODE for null */
+    yaml_node_type_t type;
+    /* key within the parent mapping, NULL for other nodes */
+    char* key;
+    gboolean key_is_str;
+    /* YAML_SCALAR_NODE */
+    char* value;
+    gboolean value_is_str;
+    /* YAML_SEQUENCE_NODE and YAML_MAPPING_NODE, of SetNode* */
+    GPtrArray* children;
+};
+
+typedef struct {
+    char* hint;
+    SetNode* tree;
+} SetTarget;
+
+/* Types PyYAML resolves plain scalars to */
+typedef enum {
+    SCALAR_STR,
+    SCALAR_NULL,
+    SCALAR_BOOL,
+    SCALAR_INT,
+    /* floats, timestamps, sexagesimal integers, ... which are kept as written */
+    SCALAR_OTHER,
+    SCALAR_TYPES,
+} ScalarType;
+
+/* The implicit resolvers of YAML 1.1, as implemented by PyYAML */
+static const char* const scalar_patterns[SCALAR_TYPES] = {
+    [SCALAR_NULL] = "^(?:~|null|Null|NULL|)$",
+    [SCALAR_BOOL] = "^(?:yes|Yes|YES|no|No|NO|true|True|TRUE|false|False|FALSE|on|On|ON|off|Off|OFF)$",
+    [SCALAR_INT] = "^(?:[-+]?0b[0-1_]+|[-+]?0[0-7_]+|[-+]?(?:0|[1-9][0-9_]*)|[-+]?0x[0-9a-fA-F_]+)$",
+    [SCALAR_OTHER] = "^(?:[-+]?[1-9][0-9_]*(?::[0-5]?[0-9])+"
+                     "|[-+]?(?:[0-9][0-9_]*)\\.[0-9_]*(?:[eE][-+][0-9]+)?"
+                     "|\\.[0-9][0-9_]*(?:[eE][-+][0-9]+)?"
+                     "|[-+]?[0-9][0-9_]*(?::[0-5]?[0-9])+\\.[0-9_]*"
+                     "|[-+]?\\.(?:inf|Inf|INF)|\\.(?:nan|NaN|NAN)"
+                     "|[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]"
+                     "|[0-9][0-9][0-9][0-9]-[0-9][0-9]?-[0-9][0-9]?(?:[Tt]|[ \\t]+)[0-9][0-9]?:[0-9][0-9]:[0-9][0-9]"
+                     "(?:\\.[0-9]*)?(?:[ \\t]*(?:Z|[-+][0-9][0-9]?(?::[0-9][0-9])?))?"
+                     "|<<|=)$",
+};
+
+static ScalarType
+resolve_plain_scalar(const char* value)
+{
+    static GRegex* regexes[SCALAR_TYPES];
+    static gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized)) {
+        for (guint i = SCALAR_NULL; i < SCALAR_TYPES; ++i)
+            regexes[i] = g_regex_new(scalar_patterns[i], G_REGEX_OPTIMIZE, 0, NULL);
+        g_once_init_leave(&initialized, 1);
+    }
+    for (guint i = SCALAR_NULL; i < SCALAR_TYPES; ++i)
+        if (g_regex_match(regexes[i], value, 0, NULL))
+            return i;
+    return SCALAR_STR;
+}
+
+/* The YAML 1.1 integer @value in decimal, as PyYAML would dump it */
+static char*
+canonical_int(const char* value)
+{
+    g_autofree char* digits = g_new0(char, strlen(value) + 1);
+    const char* c = value;
+    char* d = digits;
+    char* end = NULL;
+    gboolean negative = FALSE;
+    guint base = 10;
+    guint64 n;
+
+    if (*c == '-' || *c == '+')
+        negative = *c++ == '-';
+    if (g_str_has_prefix(c, "0b")) {
+        base = 2;
+        c += 2;
+    } else if (g_str_has_prefix(c, "0x")) {
+        base = 16;
+        c += 2;
+    } else if (c[0] == '0' && c[1]) {
+        base = 8;
+        c += 1;
+    }
+    for (; *c; ++c)
+        if (*c != '_')
+            *d++ = *c;
+
+    errno = 0;
+    n = g_ascii_strtoull(digits, &end, base);
+    if (!*digits || errno || *end)
+        return g_strdup(value); // LCOV_EXCL_LINE
+    return g_strdup_printf("%s%" G_GUINT64_FORMAT, negative && n ? "-" : "", n);
+}
+
+/* The value of the scalar @node and whether it is a string, NULL for null */
+static char*
+scalar_from_yaml(const yaml_node_t* node, gboolean* is_str)
+{
+    const char* value = (const char*) node->data.scalar.value;
+
+    *is_str = node->data.scalar.style != YAML_PLAIN_SCALAR_STYLE;
+    if (*is_str)
+        return g_strdup(value);
+
+    switch (resolve_plain_scalar(value)) {
+        case SCALAR_NULL:
+            return NULL;
+        case SCALAR_BOOL:
+            return g_strdup(   !g_ascii_strcasecmp(value, "yes")
+                            || !g_ascii_strcasecmp(value, "true")
+                            || !g_ascii_strcasecmp(value, "on") ? "true" : "false");
+        case SCALAR_INT:
+            return canonical_int(value);
+        case SCALAR_OTHER:
+            return g_strdup(value);
+        default:
+            *is_str = TRUE;
+            return g_strdup(value);
+    }
+}
+
+static void
+set_node_free(gpointer data)
+{
+    SetNode* node = data;
+
+    if (!node)
+        return;
+    g_free(node->key);
+    g_free(node->value);
+    if (node->children)
+        g_ptr_array_free(node->children, TRUE);
+    g_free(node);
+}
+
+static SetNode*
+set_node_new(yaml_node_type_t type)
+{
+    SetNode* node = g_new0(SetNode, 1);
+
+    node->type = type;
+    if (type == YAML_SEQUENCE_NODE || type == YAML_MAPPING_NODE)
+        node->children = g_ptr_array_new_with_free_func(set_node_free);
+    return node;
+}
+
+static SetNode*
+mapping_get(const SetNode* map, const char* key)
+{
+    for (guint i = 0; i < map->children->len; ++i) {
+        SetNode* child = g_ptr_array_index(map->children, i);
+        if (!strcmp(child->key, key))
+            return child;
+    }
+    return NULL;
+}
+
+/* Add @child to @map, replacing the child of the same key in place */
+static void
+mapping_set(SetNode* map, SetNode* child)
+{
+    for (guint i = 0; i < map->children->len; ++i) {
+        SetNode* old = g_ptr_array_index(map->children, i);
+        if (!strcmp(old->key, child->key)) {
+            map->children->pdata[i] = child;
+            set_node_free(old);
+            return;
+        }
+    }
+    g_ptr_array_add(map->children, child);
+}
+
+static void
+mapping_remove(SetNode* map, const char* key)
+{
+    for (guint i = 0; i < map->children->len; ++i) {
+        SetNode* child = g_ptr_array_index(map->children, i);
+        if (!strcmp(child->key, key)) {
+            g_ptr_array_remove_index(map->children, i);
+            return;
+        }
+    }
+}
+
+/* Remove the child of @key from @map and return it, rather than freeing it */
+static SetNode*
+mapping_steal(SetNode* map, const char* key)
+{
+    for (guint i = 0; i < map->children->len; ++i) {
+        SetNode* child = g_ptr_array_index(map->children, i);
+        if (!strcmp(child->key, key)) {
+            map->children->pdata[i] = NULL;
+            g_ptr_array_remove_index(map->children, i);
+            return child;
+        }
+    }
+    return NULL;
+}
+
+static SetNode*
+node_from_yaml(yaml_document_t* doc, yaml_node_t* node, guint depth, GError** error)
+{
+    SetNode* n = NULL;
+
+    if (depth > SET_MAX_DEPTH) {
+        g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+                    "%zu:%zu: YAML is nested too deeply", node->start_mark.line + 1, node->start_mark.column + 1);
+        return NULL;
+    }
+
+    switch (node->type) {
+        case YAML_SCALAR_NODE:
+            n = set_node_new(YAML_SCALAR_NODE);
+            n->value = scalar_from_yaml(node, &n->value_is_str);
+            if (!n->value)
+                n->type = YAML_NO_NODE;
+            return n;
+
+        case YAML_SEQUENCE_NODE:
+            n = set_node_new(YAML_SEQUENCE_NODE);
+            for (yaml_node_item_t* i = node->data.sequence.items.start; i < node->data.sequence.items.top; ++i) {
+                SetNode* item = node_from_yaml(doc, yaml_document_get_node(doc, *i), depth + 1, error);
+                if (!item) {
+                    set_node_free(n);
+                    return NULL;
+                }
+                g_ptr_array_add(n->children, item);
+            }
+            return n;
+
+        case YAML_MAPPING_NODE:
+            n = set_node_new(YAML_MAPPING_NODE);
+            for (yaml_node_pair_t* p = node->data.mapping.pairs.start; p < node->data.mapping.pairs.top; ++p) {
+                yaml_node_t* key = yaml_document_get_node(doc, p->key);
+                SetNode* value = NULL;
+
+                if (key->type != YAML_SCALAR_NODE) {
+                    g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+                                "%zu:%zu: expected scalar key", key->start_mark.line + 1, key->start_mark.column + 1);
+                    set_node_free(n);
+                    return NULL;
+                }
+                value = node_from_yaml(doc, yaml_document_get_node(doc, p->value), depth + 1, error);
+                if (!value) {
+                    set_node_free(n);
+                    return NULL;
+                }
+                value->key = scalar_from_yaml(key, &value->key_is_str) ?: g_strdup("null");
+                mapping_set(n, value);
+            }
+            return n;
+
+        // LCOV_EXCL_START
+        default:
+            g_assert_not_reached();
+        // LCOV_EXCL_STOP
+    }
+    return NULL; // LCOV_EXCL_LINE
+}
+
+/*
+ * Load the YAML document @contents (read from @name) as a tree.
+ * *@tree is set to NULL for an empty document.
+ */
+static gboolean
+load_tree(const char* name, const char* contents, gsize len, SetNode** tree, GError** error)
+{
+    yaml_parser_t parser;
+    yaml_document_t doc;
+    yaml_node_t* root = NULL;
+    gboolean ret = TRUE;
+
+    *tree = NULL;
+    yaml_parser_initialize(&parser);
+    yaml_parser_set_input_string(&parser, (const unsigned char*) contents, len);
+    if (!yaml_parser_load(&parser, &doc)) {
+        ret = parser_error(&parser, name, error);
+        yaml_parser_delete(&parser);
+        return ret;
+    }
+    yaml_parser_delete(&parser);
+
+    root = yaml_document_get_root_node(&doc);
+    if (root) {
+        *tree = node_from_yaml(&doc, root, 0, error);
+        if (!*tree) {
+            g_prefix_error(error, "%s:", name);
+            ret = FALSE;
+        }
+    }
+    yaml_document_delete(&doc);
+    return ret;
+}
+
+/*
+ * Merge the mapping @b into the mapping @a: mappings are merged recursively,
+ * a null value deletes the key from @a and all other values replace it.
+ * @b is consumed.
+ */
+static void
+merge_tree(SetNode* a, SetNode* b)
+{
+    for (guint i = 0; i < b->children->len; ++i) {
+        SetNode* child = g_ptr_array_index(b->children, i);
+        SetNode* existing = mapping_get(a, child->key);
+
+        b->children->pdata[i] = NULL;
+        if (existing && existing->type == YAML_MAPPING_NODE && child->type == YAML_MAPPING_NODE) {
+            merge_tree(existing, child);
+        } else if (existing && child->type == YAML_NO_NODE) {
+            mapping_remove(a, child->key);
+            set_node_free(child);
+        } else
+            mapping_set(a, child);
+    }
+    set_node_free(b);
+}
+
+/* Drop null values, empty strings and (emptied) mappings from the mapping @map */
+static void
+strip_tree(SetNode* map)
+{
+    guint i = 0;
+
+    while (i < map->children->len) {
+        SetNode* child = g_ptr_array_index(map->children, i);
+
+        if (child->type == YAML_MAPPING_NODE)
+            strip_tree(child);
+        if (   child->type == YAML_NO_NODE
+            || (child->type == YAML_SCALAR_NODE && !*child->value)
+            || (child->type == YAML_MAPPING_NODE && !child->children->len))
+            g_ptr_array_remove_index(map->children, i);
+        else
+            ++i;
+    }
+}
+
+/* Nest @node, which has its key set already, into single entry mappings
+ * keyed by @keys (outermost first) and return the root mapping */
+static SetNode*
+nest_node(SetNode* node, const char* const* keys, guint n_keys)
+{
+    SetNode* root = set_node_new(YAML_MAPPING_NODE);
+
+    for (guint i = n_keys; i > 0; --i) {
+        SetNode* map = set_node_new(YAML_MAPPING_NODE);
+        map->key = g_strdup(keys[i - 1]);
+        map->key_is_str = TRUE;
+        g_ptr_array_add(map->children, node);
+        node = map;
+    }
+    g_ptr_array_add(root->children, node);
+    return root;
+}
+
+static int
+append_to_gstring(void* data, unsigned char* buffer, size_t size)
+{
+    g_string_append_len(data, (const char*) buffer, size);
+    return 1;
+}
+
+static gint
+compare_keys(gconstpointer a, gconstpointer b)
+{
+    return strcmp((*(SetNode* const*) a)->key, (*(SetNode* const*) b)->key);
+}
+
+static gboolean
+emit_scalar(yaml_emitter_t* emitter, const char* value, gboolean is_str)
+{
+    yaml_event_t event;
+    /* quote strings which would read as another type */
+    gboolean plain_implicit = !is_str || resolve_plain_scalar(value) == SCALAR_STR;
+
+    yaml_scalar_event_initialize(&event, NULL, (yaml_char_t*) YAML_STR_TAG, (yaml_char_t*) value, strlen(value),
+                                 plain_implicit, 1, YAML_ANY_SCALAR_STYLE);
+    return yaml_emitter_emit(emitter, &event);
+}
+
+static gboolean
+emit_node(yaml_emitter_t* emitter, const SetNode* node)
+{
+    yaml_event_t event;
+    g_autoptr(GPtrArray) sorted = NULL;
+
+    switch (node->type) {
+        case YAML_NO_NODE:
+            return emit_scalar(emitter, "null", FALSE);
+
+        case YAML_SCALAR_NODE:
+            return emit_scalar(emitter, node->value, node->value_is_str);
+
+        case YAML_SEQUENCE_NODE:
+            YAML_SEQUENCE_OPEN(&event, emitter);
+            for (guint i = 0; i < node->children->len; ++i)
+                if (!emit_node(emitter, g_ptr_array_index(node->children, i)))
+                    return FALSE;
+            YAML_SEQUENCE_CLOSE(&event, emitter);
+            return TRUE;
+
+        case YAML_MAPPING_NODE:
+            sorted = g_ptr_array_sized_new(node->children->len);
+            for (guint i = 0; i < node->children->len; ++i)
+                g_ptr_array_add(sorted, g_ptr_array_index(node->children, i));
+            g_ptr_array_sort(sorted, compare_keys);
+            YAML_MAPPING_OPEN(&event, emitter);
+            for (guint i = 0; i < sorted->len; ++i) {
+                const SetNode* child = g_ptr_array_index(sorted, i);
+                if (!emit_scalar(emitter, child->key, child->key_is_str) || !emit_node(emitter, child))
+                    return FALSE;
+            }
+            YAML_MAPPING_CLOSE(&event, emitter);
+            return TRUE;
+
+        // LCOV_EXCL_START
+        default:
+            g_assert_not_reached();
+        // LCOV_EXCL_STOP
+    }
+
+err_path:
+    return FALSE; // LCOV_EXCL_LINE
+}
+
+/* Serialize the mapping @root in block style, like PyYAML's dump() */
+static GString*
+dump_tree(const SetNode* root, GError** error)
+{
+    yaml_emitter_t emitter;
+    yaml_event_t event;
+    GString* out = g_string_new(NULL);
+
+    yaml_emitter_initialize(&emitter);
+    yaml_emitter_set_output(&emitter, append_to_gstring, out);
+    yaml_emitter_set_unicode(&emitter, 1);
+
+    yaml_stream_start_event_initialize(&event, YAML_UTF8_ENCODING);
+    if (!yaml_emitter_emit(&emitter, &event))
+        goto err_path; // LCOV_EXCL_LINE
+    yaml_document_start_event_initialize(&event, NULL, NULL, NULL, 1);
+    if (!yaml_emitter_emit(&emitter, &event) || !emit_node(&emitter, root))
+        goto err_path; // LCOV_EXCL_LINE
+    yaml_document_end_event_initialize(&event, 1);
+    if (!yaml_emitter_emit(&emitter, &event))
+        goto err_path; // LCOV_EXCL_LINE
+    yaml_stream_end_event_initialize(&event);
+    if (!yaml_emitter_emit(&emitter, &event))
+        goto err_path; // LCOV_EXCL_LINE
+    yaml_emitter_delete(&emitter);
+    return out;
+
+    // LCOV_EXCL_START
+err_path:
+    g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+                "Error generating YAML: %s", emitter.problem ?: "unknown");
+    yaml_emitter_delete(&emitter);
+    g_string_free(out, TRUE);
+    return NULL;
+    // LCOV_EXCL_STOP
+}
+
+/* Split @key_path at the dots which are not escaped as "\.", always starting
+ * with "network" */
+static gchar**
+split_key_path(const char* key_path)
+{
+    GPtrArray* parts = g_ptr_array_new();
+    GString* part = g_string_new(NULL);
+
+    if (!g_str_has_prefix(key_path, "network.") && g_strcmp0(key_path, "network"))
+        g_ptr_array_add(parts, g_strdup("network"));
+    for (const char* c = key_path; ; ++c) {
+        if (*c == '\\' && c[1] == '.') {
+            g_string_append_c(part, '.');
+            ++c;
+        } else if (*c == '.' || !*c) {
+            g_ptr_array_add(parts, g_string_free(part, FALSE));
+            if (!*c)
+                break;
+            part = g_string_new(NULL);
+        } else
+            g_string_append_c(part, *c);
+    }
+    g_ptr_array_add(parts, NULL);
+    return (gchar**) g_ptr_array_free(parts, FALSE);
+}
+
+static void
+set_target_free(gpointer data)
+{
+    SetTarget* target = data;
+
+    g_free(target->hint);
+    set_node_free(target->tree);
+    g_free(target);
+}
+
+/* Merge the tree @delta into the one to be written to the file of @hint */
+static void
+add_to_target(GPtrArray* targets, const char* hint, SetNode* delta)
+{
+    SetTarget* target = NULL;
+
+    for (guint i = 0; i < targets->len; ++i) {
+        target = g_ptr_array_index(targets, i);
+        if (!strcmp(target->hint, hint)) {
+            merge_tree(target->tree, delta);
+            return;
+        }
+    }
+    target = g_new0(SetTarget, 1);
+    target->hint = g_strdup(hint);
+    target->tree = delta;
+    g_ptr_array_add(targets, target);
+}
+
+static gboolean
+is_global_key(const char* key)
+{
+    return !strcmp(key, "renderer") || !strcmp(key, "version");
+}
+
+/*
+ * Split the "network:" mapping @network of a delta into one tree per file:
+ * the definitions found in @netdefs go to the file they were defined in
+ * first, all others to the fallback file. Global keys are written to the
+ * only file written anyway, or to the fallback file.
+ * The children of @network are consumed.
+ */
+static gboolean
+split_by_hint(SetNode* network, GHashTable* netdefs, GList* ordered, GPtrArray* targets, GError** error)
+{
+    SetNode* globals = set_node_new(YAML_MAPPING_NODE);
+    const char* path[] = { "network", NULL };
+
+    for (guint i = 0; i < network->children->len; ++i) {
+        SetNode* devtype = g_ptr_array_index(network->children, i);
+
+        if (is_global_key(devtype->key)) {
+            network->children->pdata[i] = NULL;
+            g_ptr_array_add(globals->children, devtype);
+            continue;
+        }
+
+        /* dropping a whole devtype drops each of its netdefs from its own file */
+        if (devtype->type == YAML_NO_NODE) {
+            devtype->type = YAML_MAPPING_NODE;
+            devtype->children = g_ptr_array_new_with_free_func(set_node_free);
+            for (GList* l = ordered; l; l = l->next) {
+                const NetplanNetDefinition* nd = l->data;
+                if (!g_strcmp0(netplan_def_type_name(nd->type), devtype->key)) {
+                    SetNode* null = set_node_new(YAML_NO_NODE);
+                    null->key = g_strdup(nd->id);
+                    null->key_is_str = TRUE;
+                    g_ptr_array_add(devtype->children, null);
+                }
+            }
+        }
+        if (devtype->type != YAML_MAPPING_NODE) {
+            g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+                        "Invalid value specified for '%s', expected a mapping", devtype->key);
+            set_node_free(globals);
+            return FALSE;
+        }
+
+        path[1] = devtype->key;
+        for (guint j = 0; j < devtype->children->len; ++j) {
+            SetNode* netdef = g_ptr_array_index(devtype->children, j);
+            const NetplanNetDefinition* nd = netdefs ? g_hash_table_lookup(netdefs, netdef->key) : NULL;
+            g_autofree char* hint = NULL;
+
+            if (nd && nd->filename) {
+                hint = g_path_get_basename(nd->filename);
+                if (g_str_has_suffix(hint, ".yaml"))
+                    hint[strlen(hint) - 5] = '\0';
+            }
+            devtype->children->pdata[j] = NULL;
+            add_to_target(targets, hint ?: SET_FALLBACK_HINT, nest_node(netdef, path, 2));
+        }
+    }
+
+    if (globals->children->len) {
+        const SetTarget* only = targets->len == 1 ? g_ptr_array_index(targets, 0) : NULL;
+        globals->key = g_strdup("network");
+        globals->key_is_str = TRUE;
+        add_to_target(targets, only ? only->hint : SET_FALLBACK_HINT, nest_node(globals, NULL, 0));
+    } else
+        set_node_free(globals);
+    return TRUE;
+}
+
+/* Write @yaml to @path, if it validates on its own */
+static gboolean
+write_validated(const char* path, const GString* yaml, GError** error)
+{
+    g_autofree char* tmp = g_strconcat(path, ".XXXXXX", NULL);
+    NetplanParser* npp = NULL;
+    NetplanState* np_state = NULL;
+    gboolean ret = FALSE;
+    FILE* f = NULL;
+    int fd;
+
+    safe_mkdir_p_dir(path);
+    fd = g_mkstemp_full(tmp, O_WRONLY, 0666);
+    if (fd < 0) {
+        // LCOV_EXCL_START
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot write %s: %s", path, g_strerror(errno));
+        return FALSE;
+        // LCOV_EXCL_STOP
+    }
+    f = fdopen(fd, "w");
+    if (!f || fwrite(yaml->str, 1, yaml->len, f) != yaml->len || fclose(f) != 0) {
+        // LCOV_EXCL_START
+        if (!f)
+            close(fd);
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot write %s: %s", path, g_strerror(errno));
+        goto cleanup;
+        // LCOV_EXCL_STOP
+    }
+
+    /* The temporary file does not match *.yaml, so nobody else picks it up
+     * while it is validated */
+    npp = netplan_parser_new();
+    np_state = netplan_state_new();
+    if (   !netplan_parser_load_yaml(npp, tmp, error)
+        || !netplan_state_import_parser_results(np_state, npp, error)) {
+        /* report errors against the file that was to be written */
+        if (error && *error && strstr((*error)->message, tmp)) {
+            g_auto(GStrv) parts = g_strsplit((*error)->message, tmp, -1);
+            g_free((*error)->message);
+            (*error)->message = g_strjoinv(path, parts);
+        }
+        goto cleanup;
+    }
+
+    if (rename(tmp, path) < 0) {
+        // LCOV_EXCL_START
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot write %s: %s", path, g_strerror(errno));
+        goto cleanup;
+        // LCOV_EXCL_STOP
+    }
+    g_debug("netplan set: wrote %s", path);
+    ret = TRUE;
+
+cleanup:
+    if (!ret)
+        unlink(tmp);
+    if (npp)
+        netplan_parser_clear(&npp);
+    if (np_state)
+        netplan_state_clear(&np_state);
+    return ret;
+}
+
+static gboolean
+remove_file(const char* path, GError** error)
+{
+    if (unlink(path) < 0 && errno != ENOENT) {
+        // LCOV_EXCL_START
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot remove %s: %s", path, g_strerror(errno));
+        return FALSE;
+        // LCOV_EXCL_STOP
+    }
+    g_debug("netplan set: removed %s", path);
+    return TRUE;
+}
+
+/* Merge @delta (consumed) into etc/netplan/<@hint>.yaml and rewrite that file */
+static gboolean
+write_target(const char* rootdir, const char* hint, SetNode* delta, GError** error)
+{
+    g_autofree char* name = g_strconcat(hint, ".yaml", NULL);
+    g_autofree char* path = g_build_filename(rootdir ?: G_DIR_SEPARATOR_S, "etc", "netplan", name, NULL);
+    g_autofree char* contents = NULL;
+    SetNode* config = NULL;
+    const SetNode* network = NULL;
+    GString* yaml = NULL;
+    gboolean ret = FALSE;
+    gsize len = 0;
+
+    if (g_file_get_contents(path, &contents, &len, NULL) && !load_tree(path, contents, len, &config, error)) {
+        set_node_free(delta);
+        return FALSE;
+    }
+    if (!config || config->type == YAML_NO_NODE) {
+        set_node_free(config);
+        config = set_node_new(YAML_MAPPING_NODE);
+    } else if (config->type != YAML_MAPPING_NODE) {
+        g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT, "%s: expected mapping", path);
+        goto cleanup;
+    }
+
+    merge_tree(config, delta);
+    delta = NULL;
+    strip_tree(config);
+
+    network = mapping_get(config, "network");
+    if (   network && network->type == YAML_MAPPING_NODE && network->children->len == 1
+        && !strcmp(((SetNode*) g_ptr_array_index(network->children, 0))->key, "version")) {
+        /* nothing but "version: 2" left */
+        ret = remove_file(path, error);
+    } else if (network) {
+        yaml = dump_tree(config, error);
+        ret = yaml && write_validated(path, yaml, error);
+    } else if (!config->children->len) {
+        ret = remove_file(path, error);
+    } else {
+        g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+                    "%s: Invalid input, expected a 'network:' mapping", path);
+    }
+
+cleanup:
+    if (yaml)
+        g_string_free(yaml, TRUE);
+    set_node_free(delta);
+    set_node_free(config);
+    return ret;
+}
+
+/**
+ * Merge the delta of @key_path (e.g. "ethernets.eth0.dhcp4", the "network."
+ * prefix is optional and dots within an ID can be escaped as "\.") and its
+ * YAML @value into the YAML files in @rootdir. A null @value deletes the key,
+ * mappings are merged and all other values replace the old one.
+ * Each definition is written to the file it is defined in, or to
+ * 70-netplan-set.yaml if it is a new one. Each file written is validated on
+ * its own before it replaces the old one.
+ * @np_state: the parsed configuration of @rootdir, to look up which file each
+ *            definition is defined in, or %NULL to parse the YAML files for that
+ * @origin_hint: write all of the delta to etc/netplan/<@origin_hint>.yaml instead,
+ *               or %NULL
+ */
+NETPLAN_PUBLIC gboolean
+netplan_util_set_yaml(const NetplanState* np_state, const char* key_path, const char* value,
+                      const char* origin_hint, const char* rootdir, GError** error)
+{
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("set");
+    g_autoptr(GPtrArray) targets = g_ptr_array_new_with_free_func(set_target_free);
+    g_auto(GStrv) keys = NULL;
+    SetNode* delta = NULL;
+    SetNode* root = NULL;
+    SetNode* network = NULL;
+    NetplanParser* npp = NULL;
+    gboolean ret = FALSE;
+    guint n_keys;
+
+    if (origin_hint && !*origin_hint) {
+        g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT, "Invalid/empty origin-hint");
+        return FALSE;
+    }
+
+    if (!load_tree("value", value, strlen(value), &delta, error))
+        return FALSE;
+    keys = split_key_path(key_path);
+    n_keys = g_strv_length(keys);
+    if (!delta)
+        delta = set_node_new(YAML_NO_NODE);
+    delta->key = g_strdup(keys[n_keys - 1]);
+    delta->key_is_str = TRUE;
+    root = nest_node(delta, (const char* const*) keys, n_keys - 1);
+    network = g_ptr_array_index(root->children, 0);
+
+    /* "network=null" clears the origin hint file, or all of etc/netplan */
+    if (network->type == YAML_NO_NODE) {
+        if (origin_hint) {
+            g_autofree char* name = g_strconcat(origin_hint, ".yaml", NULL);
+            g_autofree char* path = g_build_filename(rootdir ?: G_DIR_SEPARATOR_S, "etc", "netplan", name, NULL);
+            ret = remove_file(path, error);
+        } else {
+            unlink_glob(rootdir, "/etc/netplan/*.yaml");
+            ret = TRUE;
+        }
+        goto cleanup;
+    }
+
+    if (origin_hint) {
+        add_to_target(targets, origin_hint, root);
+        root = NULL;
+    } else {
+        GHashTable* netdefs = NULL;
+        GList* ordered = NULL;
+
+        if (network->type != YAML_MAPPING_NODE) {
+            g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+                        "Invalid value specified for 'network', expected a mapping");
+            goto cleanup;
+        }
+
+        if (np_state) {
+            netdefs = np_state->netdefs;
+            ordered = np_state->netdefs_ordered;
+        } else {
+            g_autoptr(GError) parse_error = NULL;
+
+            /* only the files the definitions come from are of interest here,
+             * the rewritten files get validated on their own */
+            npp = netplan_parser_new();
+            if (netplan_parser_load_yaml_hierarchy(npp, rootdir, &parse_error)) {
+                netdefs = npp->parsed_defs;
+                ordered = npp->ordered;
+            } else
+                g_debug("netplan set: cannot parse the existing configuration: %s", parse_error->message);
+        }
+        if (!split_by_hint(network, netdefs, ordered, targets, error))
+            goto cleanup;
+    }
+
+    for (guint i = 0; i < targets->len; ++i) {
+        SetTarget* target = g_ptr_array_index(targets, i);
+        SetNode* tree = target->tree;
+
+        target->tree = NULL;
+        if (!write_target(rootdir, target->hint, tree, error))
+            goto cleanup;
+    }
+    ret = TRUE;
+
+cleanup:
+    set_node_free(root);
+    if (npp)
+        netplan_parser_clear(&npp);
+    return ret;
+}
+
+/* The device types "netplan get" merges the definitions of */
+static const char* const get_devtypes[] = {
+    "ethernets", "modems", "wifis", "bridges", "bonds", "tunnels", "vlans", "nm-devices", NULL,
+};
+
+struct netplan_config_tree {
+    /* the merged configuration, a mapping containing "network" */
+    SetNode* root;
+    /* key of a mapping within "network" (e.g. "ethernets") -> its children by key */
+    GHashTable* index;
+    /* the YAML returned by the last netplan_config_tree_get() */
+    GString* result;
+};
+
+/* Add the patch ports of the openvswitch @settings to the spoofed "ovs_ports"
+ * definitions in @network, like the former Python implementation did */
+static void
+merge_ovs_ports(SetNode* network, const SetNode* settings)
+{
+    const SetNode* ports = mapping_get(settings, "ports");
+    SetNode* ovs_ports = mapping_get(network, "ovs_ports");
+
+    if (!ports || ports->type != YAML_SEQUENCE_NODE)
+        return;
+    if (!ovs_ports) {
+        ovs_ports = set_node_new(YAML_MAPPING_NODE);
+        ovs_ports->key = g_strdup("ovs_ports");
+        ovs_ports->key_is_str = TRUE;
+        g_ptr_array_add(network->children, ovs_ports);
+    }
+    for (guint i = 0; i < ports->children->len; ++i) {
+        const SetNode* pair = g_ptr_array_index(ports->children, i);
+        if (pair->type != YAML_SEQUENCE_NODE || pair->children->len != 2)
+            continue;
+        for (guint j = 0; j < 2; ++j) {
+            const SetNode* port = g_ptr_array_index(pair->children, j);
+            const SetNode* peer = g_ptr_array_index(pair->children, 1 - j);
+            SetNode* def = NULL;
+            SetNode* value = NULL;
+            if (port->type != YAML_SCALAR_NODE || peer->type != YAML_SCALAR_NODE)
+                continue;
+            def = mapping_get(ovs_ports, port->value);
+            if (!def || def->type != YAML_MAPPING_NODE) {
+                def = set_node_new(YAML_MAPPING_NODE);
+                def->key = g_strdup(port->value);
+                def->key_is_str = TRUE;
+                mapping_set(ovs_ports, def);
+            }
+            value = set_node_new(YAML_SCALAR_NODE);
+            value->key = g_strdup("peer");
+            value->key_is_str = TRUE;
+            value->value = g_strdup(peer->value);
+            value->value_is_str = peer->value_is_str;
+            mapping_set(def, value);
+        }
+    }
+}
+
+/*
+ * Merge the "network" mapping @new (consumed) of a YAML file into @network,
+ * the same way "netplan get" always did: the settings of a definition
+ * replace the former ones key by key, "openvswitch", "version" and "renderer"
+ * replace the former values and all other keys are ignored.
+ */
+static void
+merge_network(SetNode* network, SetNode* new)
+{
+    for (guint i = 0; i < new->children->len; ++i) {
+        SetNode* child = g_ptr_array_index(new->children, i);
+        SetNode* existing = mapping_get(network, child->key);
+
+        if (g_strv_contains(get_devtypes, child->key)) {
+            if (child->type != YAML_MAPPING_NODE)
+                continue;
+            if (!existing) {
+                new->children->pdata[i] = NULL;
+                g_ptr_array_add(network->children, child);
+                continue;
+            }
+            for (guint j = 0; j < child->children->len; ++j) {
+                SetNode* def = g_ptr_array_index(child->children, j);
+                SetNode* existing_def = mapping_get(existing, def->key);
+
+                child->children->pdata[j] = NULL;
+                if (existing_def && existing_def->type == YAML_MAPPING_NODE && def->type == YAML_MAPPING_NODE) {
+                    for (guint k = 0; k < def->children->len; ++k) {
+                        mapping_set(existing_def, g_ptr_array_index(def->children, k));
+                        def->children->pdata[k] = NULL;
+                    }
+                    set_node_free(def);
+                } else
+                    mapping_set(existing, def);
+            }
+        } else if (!strcmp(child->key, "openvswitch") || !strcmp(child->key, "version")
+                   || !strcmp(child->key, "renderer")) {
+            if (child->type == YAML_MAPPING_NODE && !strcmp(child->key, "openvswitch"))
+                merge_ovs_ports(network, child);
+            new->children->pdata[i] = NULL;
+            mapping_set(network, child);
+        }
+    }
+    set_node_free(new);
+}
+
+static NetplanConfigTree*
+config_tree_new(SetNode* root)
+{
+    NetplanConfigTree* tree = g_new0(NetplanConfigTree, 1);
+    const SetNode* network = NULL;
+
+    tree->root = root;
+    tree->index = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_hash_table_destroy);
+    network = mapping_get(root, "network");
+    if (network && network->type == YAML_MAPPING_NODE) {
+        for (guint i = 0; i < network->children->len; ++i) {
+            const SetNode* child = g_ptr_array_index(network->children, i);
+            GHashTable* ids = NULL;
+
+            if (child->type != YAML_MAPPING_NODE)
+                continue;
+            ids = g_hash_table_new(g_str_hash, g_str_equal);
+            for (guint j = 0; j < child->children->len; ++j) {
+                SetNode* def = g_ptr_array_index(child->children, j);
+                g_hash_table_insert(ids, def->key, def);
+            }
+            g_hash_table_insert(tree->index, child->key, ids);
+        }
+    }
+    return tree;
+}
+
+/**
+ * Merge the YAML files in @rootdir into a tree, to query it via
+ * netplan_config_tree_get(). Unlike a #NetplanState, the tree contains the
+ * settings as written, it is not validated.
+ * @rootdir: If not %NULL, read the configuration from this root directory
+ */
+NETPLAN_PUBLIC NetplanConfigTree*
+netplan_config_tree_new(const char* rootdir, GError** error)
+{
+    g_autoptr(NetplanProfileSpan) span = netplan_profile_begin("get");
+    g_auto(GStrv) files = find_yaml_hierarchy(rootdir);
+    SetNode* root = set_node_new(YAML_MAPPING_NODE);
+    SetNode* network = set_node_new(YAML_MAPPING_NODE);
+
+    network->key = g_strdup("network");
+    network->key_is_str = TRUE;
+    g_ptr_array_add(root->children, network);
+    for (gchar** filename = files; filename && *filename; ++filename) {
+        g_autofree char* contents = NULL;
+        SetNode* config = NULL;
+        SetNode* new = NULL;
+        gsize len = 0;
+
+        if (!g_file_get_contents(*filename, &contents, &len, error) || !load_tree(*filename, contents, len, &config, error)) {
+            set_node_free(root);
+            return NULL;
+        }
+        if (config && config->type == YAML_MAPPING_NODE && (new = mapping_steal(config, "network"))) {
+            if (new->type == YAML_MAPPING_NODE)
+                merge_network(network, new);
+            else
+                set_node_free(new);
+        }
+        set_node_free(config);
+    }
+    strip_tree(root);
+    return config_tree_new(root);
+}
+
+/* Load the serialized YAML @yaml of a #NetplanState as a tree, to query it via
+ * netplan_config_tree_get() */
+NETPLAN_INTERNAL NetplanConfigTree*
+netplan_config_tree_new_from_yaml(const char* yaml, GError** error)
+{
+    SetNode* root = NULL;
+
+    if (!load_tree("state", yaml, strlen(yaml), &root, error))
+        return NULL; // LCOV_EXCL_LINE
+    if (!root || root->type != YAML_MAPPING_NODE) {
+        set_node_free(root);
+        root = set_node_new(YAML_MAPPING_NODE);
+    }
+    return config_tree_new(root);
+}
+
+/**
+ * Look up the value of @key_path (e.g. "ethernets.eth0.addresses", "all" for
+ * everything), like "netplan get" does and serialize it as YAML. The lookup
+ * stops at the first value that is not a mapping, a missing key gives "null".
+ * Returns the YAML, which is valid until the next call, or %NULL on error.
+ */
+NETPLAN_PUBLIC const char*
+netplan_config_tree_get(NetplanConfigTree* tree, const char* key_path)
+{
+    static const SetNode null_node = { .type = YAML_NO_NODE };
+    g_auto(GStrv) keys = NULL;
+    const SetNode* node = tree->root;
+
+    if (g_strcmp0(key_path, "all")) {
+        keys = split_key_path(key_path);
+        for (guint i = 0; keys[i]; ++i) {
+            /* keys[0] is "network" and keys[1] the device type, if keys[2] is a netdef ID */
+            GHashTable* ids = i == 2 ? g_hash_table_lookup(tree->index, keys[1]) : NULL;
+
+            node = ids ? g_hash_table_lookup(ids, keys[i]) : mapping_get(node, keys[i]);
+            if (!node || node->type != YAML_MAPPING_NODE)
+                break;
+        }
+    }
+
+    if (tree->result)
+        g_string_free(tree->result, TRUE);
+    tree->result = dump_tree(node ?: &null_node, NULL);
+    if (!tree->result)
+        return NULL; // LCOV_EXCL_LINE
+    /* like PyYAML, libyaml ends a document of a single plain scalar explicitly */
+    if (g_str_has_suffix(tree->result->str, "\n...\n"))
+        g_string_truncate(tree->result, tree->result->len - 4);
+    return tree->result->str;
+}
+
+NETPLAN_PUBLIC void
+netplan_config_tree_free(NetplanConfigTree* tree)
+{
+    if (!tree)
+        return;
+    g_hash_table_destroy(tree->index);
+    set_node_free(tree->root);
+    if (tree->result)
+        g_string_free(tree->result, TRUE);
+    g_free(tree);
+}
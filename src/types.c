@@ -20,6 +20,9 @@
  * are implemented separately.
  */
 
+#include <string.h>
+#include <arpa/inet.h>
+
 #include <glib.h>
 #include "types.h"
 
@@ -56,46 +59,179 @@ free_hashtable_with_destructor(GHashTable** hash, void (destructor)(void *)) {
     }
 }
 
-static void
-free_address_options(void* ptr)
+/*
+ * Memory arena for the objects which are created in large numbers while
+ * parsing: routes, routing policies, address options and wireguard peers,
+ * including their strings. These are never freed one by one, but released
+ * all at once along with the netdefs referring to them.
+ */
+#define ARENA_BLOCK_SIZE 16384
+#define ARENA_ALIGNMENT (2 * sizeof(gpointer))
+
+struct netplan_arena {
+    /* Blocks of ARENA_BLOCK_SIZE bytes, the one being filled first */
+    GSList* blocks;
+    gsize block_used;
+    /* Allocations too large for sharing a block */
+    GSList* large;
+};
+
+NetplanArena*
+netplan_arena_new(void)
 {
-    NetplanAddressOptions* opts = ptr;
-    g_free(opts->address);
-    g_free(opts->label);
-    g_free(opts->lifetime);
-    g_free(opts);
+    return g_new0(NetplanArena, 1);
 }
 
-static void
-free_route(void* ptr)
+void
+netplan_arena_free(NetplanArena* arena)
 {
-    NetplanIPRoute* route = ptr;
-    g_free(route->scope);
-    g_free(route->type);
-    g_free(route->to);
-    g_free(route->from);
-    g_free(route->via);
-    g_free(route);
+    if (!arena)
+        return;
+    g_slist_free_full(arena->blocks, g_free);
+    g_slist_free_full(arena->large, g_free);
+    g_free(arena);
 }
 
-static void
-free_ip_rules(void* ptr)
+/**
+ * Move all allocations of @src over to @dest and free @src, e.g. to hand the
+ * data of netdefs parsed on another thread over to the parser they end up in.
+ */
+void
+netplan_arena_merge(NetplanArena* dest, NetplanArena* src)
+{
+    if (!src)
+        return;
+    /* the block being filled stays the one of @dest, if it has any */
+    if (!dest->blocks)
+        dest->block_used = src->block_used;
+    dest->blocks = g_slist_concat(dest->blocks, src->blocks);
+    dest->large = g_slist_concat(dest->large, src->large);
+    g_free(src);
+}
+
+gpointer
+netplan_arena_alloc0(NetplanArena* arena, gsize size)
+{
+    gpointer ptr;
+
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        ptr = g_malloc0(size);
+        arena->large = g_slist_prepend(arena->large, ptr);
+        return ptr;
+    }
+
+    if (!arena->blocks || arena->block_used + size > ARENA_BLOCK_SIZE) {
+        arena->blocks = g_slist_prepend(arena->blocks, g_malloc0(ARENA_BLOCK_SIZE));
+        arena->block_used = 0;
+    }
+    ptr = (char*) arena->blocks->data + arena->block_used;
+    arena->block_used += size;
+    return ptr;
+}
+
+gchar*
+netplan_arena_strdup(NetplanArena* arena, const gchar* str)
 {
-    NetplanIPRule* rule = ptr;
-    g_free(rule->to);
-    g_free(rule->from);
-    g_free(rule);
+    gsize len;
+    gchar* dup;
+
+    if (!str)
+        return NULL;
+    len = strlen(str) + 1;
+    dup = netplan_arena_alloc0(arena, len);
+    memcpy(dup, str, len);
+    return dup;
 }
 
+/* Everything but the array of allowed IPs of a peer lives in the arena */
 static void
 free_wireguard_peer(void* ptr)
 {
     NetplanWireguardPeer* wg = ptr;
-    g_free(wg->endpoint);
-    g_free(wg->preshared_key);
-    g_free(wg->public_key);
-    free_garray_with_destructor(&wg->allowed_ips, g_free);
-    g_free(wg);
+    g_clear_pointer(&wg->allowed_ips, g_array_unref);
+}
+
+/**
+ * Parse @text, an IP address followed by "/<prefix length>" if @has_prefix
+ * is set, into @prefix. @text gets copied into @arena if it isn't in
+ * canonical notation (or cannot be parsed at all), so that
+ * netplan_ip_prefix_to_string() returns it verbatim.
+ *
+ * Returns: TRUE if @text is a valid IP address (and prefix length).
+ */
+gboolean
+netplan_ip_prefix_init(NetplanIPPrefix* prefix, NetplanArena* arena, const char* text, gboolean has_prefix)
+{
+    g_autofree gchar* address = g_strdup(text);
+    char canonical[NETPLAN_IP_PREFIX_STRLEN];
+    char* prefix_len = NULL;
+    gboolean valid = TRUE;
+
+    memset(prefix, 0, sizeof(*prefix));
+    prefix->prefix = NETPLAN_IP_PREFIX_NONE;
+
+    if (has_prefix) {
+        gchar* endptr;
+        guint64 len;
+
+        prefix_len = strrchr(address, '/');
+        if (prefix_len) {
+            *prefix_len++ = '\0';
+            len = g_ascii_strtoull(prefix_len, &endptr, 10);
+            if (*prefix_len == '\0' || *endptr != '\0' || len > 128)
+                valid = FALSE;
+            else
+                prefix->prefix = (guint8) len;
+        } else
+            valid = FALSE;
+    }
+
+    if (valid && inet_pton(AF_INET, address, prefix->address) > 0)
+        prefix->family = AF_INET;
+    else if (valid && inet_pton(AF_INET6, address, prefix->address) > 0)
+        prefix->family = AF_INET6;
+    else
+        valid = FALSE;
+
+    if (!valid) {
+        memset(prefix, 0, sizeof(*prefix));
+        prefix->family = AF_UNSPEC;
+        prefix->prefix = NETPLAN_IP_PREFIX_NONE;
+    }
+    if (!valid || g_strcmp0(netplan_ip_prefix_to_string(prefix, canonical), text) != 0)
+        prefix->text = netplan_arena_strdup(arena, text);
+    return valid;
+}
+
+/* Same as comparing the notations, i.e. the same address written differently
+ * is not considered equal */
+gboolean
+netplan_ip_prefix_equal(const NetplanIPPrefix* a, const NetplanIPPrefix* b)
+{
+    return a->family == b->family
+        && a->prefix == b->prefix
+        && memcmp(a->address, b->address, sizeof(a->address)) == 0
+        && g_strcmp0(a->text, b->text) == 0;
+}
+
+/**
+ * Returns: @prefix in the notation of the configuration, formatted into @buf
+ *          of (at least) NETPLAN_IP_PREFIX_STRLEN bytes if needed.
+ */
+const char*
+netplan_ip_prefix_to_string(const NetplanIPPrefix* prefix, char* buf)
+{
+    gsize len;
+
+    if (prefix->text)
+        return prefix->text;
+    g_assert(prefix->family == AF_INET || prefix->family == AF_INET6);
+    inet_ntop(prefix->family, prefix->address, buf, NETPLAN_IP_PREFIX_STRLEN);
+    len = strlen(buf);
+    if (prefix->prefix != NETPLAN_IP_PREFIX_NONE)
+        g_snprintf(buf + len, NETPLAN_IP_PREFIX_STRLEN - len, "/%u", prefix->prefix);
+    return buf;
 }
 
 static void
@@ -209,9 +345,9 @@ reset_netdef(NetplanNetDefinition* netdef, NetplanDefType new_type, NetplanBacke
     reset_dhcp_overrides(&netdef->dhcp6_overrides);
     netdef->accept_ra = NETPLAN_RA_MODE_KERNEL;
 
-    free_garray_with_destructor(&netdef->ip4_addresses, g_free);
-    free_garray_with_destructor(&netdef->ip6_addresses, g_free);
-    free_garray_with_destructor(&netdef->address_options, free_address_options);
+    g_clear_pointer(&netdef->ip4_addresses, g_array_unref);
+    g_clear_pointer(&netdef->ip6_addresses, g_array_unref);
+    g_clear_pointer(&netdef->address_options, g_array_unref);
 
     netdef->ip6_privacy = FALSE;
     netdef->ip6_addr_gen_mode = NETPLAN_ADDRGEN_DEFAULT;
@@ -219,11 +355,11 @@ reset_netdef(NetplanNetDefinition* netdef, NetplanDefType new_type, NetplanBacke
 
     FREE_AND_NULLIFY(netdef->gateway4);
     FREE_AND_NULLIFY(netdef->gateway6);
-    free_garray_with_destructor(&netdef->ip4_nameservers, g_free);
-    free_garray_with_destructor(&netdef->ip6_nameservers, g_free);
+    g_clear_pointer(&netdef->ip4_nameservers, g_array_unref);
+    g_clear_pointer(&netdef->ip6_nameservers, g_array_unref);
     free_garray_with_destructor(&netdef->search_domains, g_free);
-    free_garray_with_destructor(&netdef->routes, free_route);
-    free_garray_with_destructor(&netdef->ip_rules, free_ip_rules);
+    g_clear_pointer(&netdef->routes, g_array_unref);
+    g_clear_pointer(&netdef->ip_rules, g_array_unref);
     free_garray_with_destructor(&netdef->wireguard_peers, free_wireguard_peer);
 
     netdef->linklocal.ipv4 = FALSE;
@@ -357,6 +493,9 @@ netplan_state_reset(NetplanState* np_state)
      * owning the allocated definitions, whereas netdefs only has "weak" pointers.
      * As such, we can destroy it without having to worry about freeing memory.
      */
+    g_clear_pointer(&np_state->members, g_hash_table_destroy);
+    for (unsigned i = 0; i < NETPLAN_DEF_TYPE_MAX_; ++i)
+        g_clear_pointer(&np_state->netdefs_by_type[i], g_ptr_array_unref);
     if(np_state->netdefs) {
         g_hash_table_destroy(np_state->netdefs);
         np_state->netdefs = NULL;
@@ -368,6 +507,9 @@ netplan_state_reset(NetplanState* np_state)
         np_state->netdefs_ordered = NULL;
     }
 
+    /* Only then, release the memory of the objects they were pointing to */
+    g_clear_pointer(&np_state->arenas, g_ptr_array_unref);
+
     np_state->backend = NETPLAN_BACKEND_NONE;
     reset_ovs_settings(&np_state->ovs_settings);
 }
@@ -403,10 +545,16 @@ access_point_clear(NetplanWifiAccessPoint** ap, NetplanBackend backend)
     free_fn(obj);\
 }
 
+/* The memory of those objects is owned by the arena they were allocated from */
+#define CLEAR_ARENA_OBJECT(clear_fn, type) void clear_fn(type** dest) \
+{ \
+    if (dest) *dest = NULL; \
+}
+
 CLEAR_FROM_FREE(free_wireguard_peer, wireguard_peer_clear, NetplanWireguardPeer);
-CLEAR_FROM_FREE(free_ip_rules, ip_rule_clear, NetplanIPRule);
-CLEAR_FROM_FREE(free_route, route_clear, NetplanIPRoute);
-CLEAR_FROM_FREE(free_address_options, address_options_clear, NetplanAddressOptions);
+CLEAR_ARENA_OBJECT(ip_rule_clear, NetplanIPRule);
+CLEAR_ARENA_OBJECT(route_clear, NetplanIPRoute);
+CLEAR_ARENA_OBJECT(address_options_clear, NetplanAddressOptions);
 
 NetplanNetDefinition*
 netplan_state_get_netdef(const NetplanState* np_state, const char* id)
@@ -416,6 +564,57 @@ netplan_state_get_netdef(const NetplanState* np_state, const char* id)
     return g_hash_table_lookup(np_state->netdefs, id);
 }
 
+static void
+index_member(GHashTable* members, GHashTable* netdefs, const char* parent_id, NetplanNetDefinition* member)
+{
+    NetplanNetDefinition* parent = parent_id ? g_hash_table_lookup(netdefs, parent_id) : NULL;
+    GPtrArray* list;
+
+    if (!parent)
+        return;
+    list = g_hash_table_lookup(members, parent);
+    if (!list) {
+        list = g_ptr_array_new();
+        g_hash_table_insert(members, parent, list);
+    }
+    g_ptr_array_add(list, member);
+}
+
+/*
+ * (Re)build the parent -> members index of the state. The hash table is walked
+ * once, after all netdefs have been inserted, so each member list comes out in
+ * the same order a full scan of np_state->netdefs would have yielded it.
+ */
+void
+netplan_state_index_members(NetplanState* np_state)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_clear_pointer(&np_state->members, g_hash_table_destroy);
+    if (!np_state->netdefs)
+        return;
+
+    np_state->members = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                              (GDestroyNotify) g_ptr_array_unref);
+    g_hash_table_iter_init(&iter, np_state->netdefs);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        NetplanNetDefinition* nd = value;
+        index_member(np_state->members, np_state->netdefs, nd->bond, nd);
+        /* Don't list a member twice if both fields refer to the same parent */
+        if (g_strcmp0(nd->bridge, nd->bond))
+            index_member(np_state->members, np_state->netdefs, nd->bridge, nd);
+    }
+}
+
+const GPtrArray*
+netplan_state_get_members(const NetplanState* np_state, const NetplanNetDefinition* parent)
+{
+    if (!np_state->members)
+        return NULL;
+    return g_hash_table_lookup(np_state->members, parent);
+}
+
 NETPLAN_PUBLIC const char *
 netplan_netdef_get_filename(const NetplanNetDefinition* netdef)
 {
@@ -110,6 +110,28 @@ typedef enum {
     NETPLAN_AUTH_EAP_METHOD_MAX,
 } NetplanAuthEAPMethod;
 
+/* Bump allocator for data sharing the lifetime of a set of netdefs, see types.c */
+typedef struct netplan_arena NetplanArena;
+
+/* Length of the buffer for netplan_ip_prefix_to_string(), fits
+ * "ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255/128" */
+#define NETPLAN_IP_PREFIX_STRLEN 50
+#define NETPLAN_IP_PREFIX_NONE G_MAXUINT8
+
+/* An IP address with an optional prefix length, parsed once into binary form.
+ * The notation used in the configuration is only kept if it differs from the
+ * canonical one, so that it can be written out unchanged. */
+typedef struct {
+    /* AF_INET or AF_INET6, AF_UNSPEC if the text could not be parsed */
+    guint8 family;
+    /* prefix length, or NETPLAN_IP_PREFIX_NONE */
+    guint8 prefix;
+    /* network byte order, IPv4 addresses only use the first 4 bytes */
+    guint8 address[16];
+    /* allocated from the arena, NULL if the canonical notation applies */
+    const char* text;
+} NetplanIPPrefix;
+
 typedef struct missing_node {
     char* netdef_id;
     const yaml_node_t* node;
@@ -190,6 +212,7 @@ struct netplan_net_definition {
     NetplanDHCPOverrides dhcp4_overrides;
     NetplanDHCPOverrides dhcp6_overrides;
     NetplanRAMode accept_ra;
+    /* arrays of NetplanIPPrefix */
     GArray* ip4_addresses;
     GArray* ip6_addresses;
     GArray* address_options;
@@ -198,6 +221,7 @@ struct netplan_net_definition {
     char* ip6_addr_gen_token;
     char* gateway4;
     char* gateway6;
+    /* arrays of NetplanIPPrefix, without prefix length */
     GArray* ip4_nameservers;
     GArray* ip6_nameservers;
     GArray* search_domains;
@@ -353,7 +377,7 @@ typedef struct {
     char *endpoint;
     char *public_key;
     char *preshared_key;
-    GArray *allowed_ips;
+    GArray *allowed_ips; /* of NetplanIPPrefix */
     guint keepalive;
 } NetplanWireguardPeer;
 
@@ -429,6 +453,19 @@ struct netplan_state {
     GList *netdefs_ordered;
     NetplanBackend backend;
     NetplanOVSSettings ovs_settings;
+
+    /* Arenas of the imported parsers, owning the routes, routing policies,
+     * address options and wireguard peers of netdefs_ordered */
+    GPtrArray* arenas;
+
+    /* Reverse index of the bond/bridge membership of netdefs: maps a parent
+     * netdef to a GPtrArray of (weak) pointers to its member netdefs. Rebuilt
+     * on every import, see netplan_state_index_members() */
+    GHashTable* members;
+
+    /* Same definitions as netdefs_ordered, split by type (weak references,
+     * GPtrArrays in definition order). Filled on import. */
+    GPtrArray* netdefs_by_type[NETPLAN_DEF_TYPE_MAX_];
 };
 
 struct netplan_parser {
@@ -480,6 +517,20 @@ struct netplan_parser {
      * */
     GHashTable* ids_in_file;
     int missing_ids_found;
+
+    /* Number of references to missing IDs recorded so far */
+    int missing_refs;
+
+    /* Netdef entries of the current YAML document, which need another look
+     * once all definition IDs are known, as they either refer to IDs that had
+     * not been defined yet or their validation has been postponed.
+     * Owns its NetplanPendingEntry elements, which refer to the document. */
+    GPtrArray* pending_entries;
+
+    /* Owns the routes, routing policies, address options and wireguard peers
+     * of the parsed netdefs, until netplan_state_import_parser_results().
+     * Created on first use, see netplan_parser_arena(). */
+    NetplanArena* arena;
 };
 
 #define NETPLAN_ADVERTISED_RECEIVE_WINDOW_UNSPEC 0
@@ -511,3 +562,38 @@ ip_rule_clear(NetplanIPRule** rule);
 
 void
 route_clear(NetplanIPRoute** route);
+
+NetplanArena*
+netplan_arena_new(void);
+
+void
+netplan_arena_free(NetplanArena* arena);
+
+void
+netplan_arena_merge(NetplanArena* dest, NetplanArena* src);
+
+gpointer
+netplan_arena_alloc0(NetplanArena* arena, gsize size);
+
+gchar*
+netplan_arena_strdup(NetplanArena* arena, const gchar* str);
+
+#define netplan_arena_new0(arena, type) ((type*) netplan_arena_alloc0(arena, sizeof(type)))
+
+NetplanArena*
+netplan_parser_arena(NetplanParser* npp);
+
+gboolean
+netplan_ip_prefix_init(NetplanIPPrefix* prefix, NetplanArena* arena, const char* text, gboolean has_prefix);
+
+gboolean
+netplan_ip_prefix_equal(const NetplanIPPrefix* a, const NetplanIPPrefix* b);
+
+const char*
+netplan_ip_prefix_to_string(const NetplanIPPrefix* prefix, char* buf);
+
+void
+netplan_state_index_members(NetplanState* np_state);
+
+const GPtrArray*
+netplan_state_get_members(const NetplanState* np_state, const NetplanNetDefinition* parent);
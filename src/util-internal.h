@@ -19,6 +19,7 @@
 
 #define __USE_MISC
 #include <glob.h>
+#include <sys/types.h>
 #include <glib.h>
 #include "types.h"
 
@@ -39,12 +40,58 @@ safe_mkdir_p_dir(const char* file_path);
 NETPLAN_INTERNAL void
 g_string_free_to_file(GString* s, const char* rootdir, const char* path, const char* suffix);
 
+NETPLAN_INTERNAL void
+g_string_free_to_file_with_umask(GString* s, const char* rootdir, const char* path, const char* suffix, mode_t mask);
+
+NETPLAN_INTERNAL gboolean
+create_enablement_symlink(const char* target, const char* link, GError** error);
+
 NETPLAN_INTERNAL void
 unlink_glob(const char* rootdir, const char* _glob);
 
+NETPLAN_INTERNAL void
+netplan_output_tracking_begin(const char* rootdir);
+
+NETPLAN_INTERNAL void
+netplan_output_tracking_set_owner(const char* netdef_id);
+
+NETPLAN_INTERNAL void
+netplan_output_staging_begin(void);
+
+NETPLAN_INTERNAL GPtrArray*
+netplan_output_staging_end(void);
+
+NETPLAN_INTERNAL gboolean
+netplan_output_staging_commit(GPtrArray* staged, GError** error);
+
+NETPLAN_INTERNAL gboolean
+netplan_output_tracking_finish(gboolean* udev_changed, GError** error);
+
 NETPLAN_INTERNAL int
 find_yaml_glob(const char* rootdir, glob_t* out_glob);
 
+NETPLAN_INTERNAL gchar**
+find_yaml_hierarchy(const char* rootdir);
+
+typedef struct netplan_profile_span NetplanProfileSpan;
+
+NETPLAN_INTERNAL NetplanProfileSpan*
+netplan_profile_begin(const char* format, ...) G_GNUC_PRINTF(1, 2);
+
+NETPLAN_INTERNAL void
+netplan_profile_end(NetplanProfileSpan* span);
+
+NETPLAN_INTERNAL void
+netplan_profile_count(const char* counter, guint n);
+
+NETPLAN_INTERNAL gchar**
+netplan_profile_child_environ(void);
+
+NETPLAN_INTERNAL void
+netplan_json_append_string(GString* s, const char* str);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(NetplanProfileSpan, netplan_profile_end)
+
 NETPLAN_ABI const char*
 get_global_network(int ip_family);
 
@@ -74,8 +121,55 @@ netplan_parser_get_filename(NetplanParser* npp);
 NETPLAN_INTERNAL gboolean
 netplan_parser_load_yaml_hierarchy(NetplanParser* npp, const char* rootdir, GError** error);
 
+NETPLAN_INTERNAL gboolean
+netplan_parser_validate(NetplanParser* npp, GError** warning, GError** error);
+
+typedef struct netplan_document_cache NetplanDocumentCache;
+
+NETPLAN_INTERNAL NetplanDocumentCache*
+netplan_document_cache_new(void);
+
+NETPLAN_INTERNAL void
+netplan_document_cache_invalidate(NetplanDocumentCache* cache, const char* filename);
+
+NETPLAN_INTERNAL void
+netplan_document_cache_free(NetplanDocumentCache* cache);
+
+NETPLAN_INTERNAL gboolean
+netplan_parser_load_yaml_cached(NetplanParser* npp, const char* filename, NetplanDocumentCache* cache, GError** error);
+
+NETPLAN_INTERNAL gboolean
+netplan_parser_load_yaml_hierarchy_cached(NetplanParser* npp, const char* rootdir, NetplanDocumentCache* cache, GError** error);
+
+NETPLAN_INTERNAL gboolean
+netplan_state_write_snapshot(const NetplanState* np_state, const char* rootdir, GError** error);
+
+NETPLAN_INTERNAL void
+netplan_state_remove_snapshot(const char* rootdir);
+
+NETPLAN_INTERNAL gboolean
+netplan_parser_load_snapshot(NetplanParser* npp, const char* rootdir, GError** error);
+
+NETPLAN_INTERNAL struct netplan_config_tree*
+netplan_config_tree_new_from_yaml(const char* yaml, GError** error);
+
+NETPLAN_INTERNAL char*
+netplan_output_bundle_key(const char* rootdir);
+
+NETPLAN_INTERNAL void
+netplan_output_bundle_begin(void);
+
+NETPLAN_INTERNAL void
+netplan_output_bundle_save(const char* rootdir, const char* key, gboolean any_networkd);
+
+NETPLAN_INTERNAL gboolean
+netplan_output_bundle_restore(const char* rootdir, const char* key, gboolean* any_networkd, GError** error);
+
 NETPLAN_INTERNAL void
 process_input_file(const char* f);
 
 NETPLAN_INTERNAL gboolean
 process_yaml_hierarchy(const char* rootdir);
+
+NETPLAN_INTERNAL gboolean
+process_yaml_snapshot(const char* rootdir);
@@ -15,9 +15,17 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE /* syncfs() */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
 #include <arpa/inet.h>
+#include <linux/magic.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -29,6 +37,8 @@
 #include "parse-globals.h"
 #include "names.h"
 
+extern NetplanState global_state;
+
 NETPLAN_ABI GHashTable*
 wifi_frequency_24;
 
@@ -49,37 +59,610 @@ safe_mkdir_p_dir(const char* file_path)
     }
 }
 
+/*
+ * Output tracking, to allow for incremental re-generation of the backend
+ * configuration. While active, every file produced by g_string_free_to_file()
+ * is recorded along with the checksum of its contents and the netdef it
+ * belongs to. Files whose contents did not change since the previous run, as
+ * recorded in the manifest, are not rewritten. unlink_glob() spares all files
+ * produced by the current run, so the cleanup of stale configuration can
+ * happen after the new configuration has been written.
+ *
+ * Tracked output is written as a batch: parent directories are only created
+ * once per run, files on tmpfs are written in place rather than via a
+ * temporary file and rename(), and files on persistent storage are flushed
+ * with a single syncfs() at the end rather than on a per file basis.
+ *
+ * The outputs which were added, changed or removed compared to the previous
+ * run are accumulated in a change set, which can be used by "netplan apply"
+ * to only reconfigure what actually differs. The change set is consumed (i.e.
+ * removed) by "netplan apply"; it does not exist if the previous run is not
+ * known, so that its absence means "everything might have changed".
+ */
+typedef struct netplan_output_entry {
+    char* checksum;
+    char* owner;
+    /* "added", "changed" or "removed" compared to the previous run, or NULL */
+    const char* change;
+} NetplanOutputEntry;
+
+static struct {
+    gboolean active;
+    gboolean udev_changed;
+    gboolean has_previous;
+    char* manifest;
+    char* changes;
+    char* owner;
+    GHashTable* previous; /* path -> NetplanOutputEntry */
+    GHashTable* current; /* path -> NetplanOutputEntry */
+    GHashTable* dirs; /* directory -> OUTPUT_DIR_* flags */
+    GHashTable* sync_dirs; /* directories written to outside of tmpfs */
+    GString* bundle; /* all outputs of this run, see netplan_output_bundle_save() */
+} output_tracking;
+
+#define OUTPUT_DIR_CREATED 0x1
+#define OUTPUT_DIR_TMPFS 0x2
+
+static void
+output_entry_free(gpointer data)
+{
+    NetplanOutputEntry* entry = data;
+    g_free(entry->checksum);
+    g_free(entry->owner);
+    g_free(entry);
+}
+
+/* Collapse repeated slashes, so that paths built via g_build_path() and
+ * via unlink_glob() compare equal. */
+static char*
+normalize_output_path(const char* path)
+{
+    GString* s = g_string_sized_new(strlen(path));
+    for (const char* p = path; *p; ++p)
+        if (*p != '/' || s->len == 0 || s->str[s->len - 1] != '/')
+            g_string_append_c(s, *p);
+    return g_string_free(s, FALSE);
+}
+
+/* The .link and .rules files are read by udevd, which reloads them whenever
+ * they change, so it might even read a partially written file */
+static gboolean
+output_read_by_udev(const char* path)
+{
+    return g_str_has_suffix(path, ".link") || g_str_has_suffix(path, ".rules");
+}
+
+static void
+output_tracking_changed(const char* path)
+{
+    /* udevd needs to be told about any changed .link or .rules file */
+    if (output_read_by_udev(path))
+        output_tracking.udev_changed = TRUE;
+}
+
 /**
- * Write a GString to a file and free it. Create necessary parent directories
- * and exit with error message on error.
- * @s: #GString whose contents to write. Will be fully freed afterwards.
+ * Record @full_path as output of the current run.
+ * Returns: %TRUE if @full_path needs to be (re-)written, %FALSE if it already
+ *          exists with the same @contents.
+ */
+static gboolean
+output_tracking_record(const char* full_path, const char* contents, gsize len, gboolean is_symlink, const char* owner)
+{
+    char* path = normalize_output_path(full_path);
+    NetplanOutputEntry* entry = g_new0(NetplanOutputEntry, 1);
+    NetplanOutputEntry* previous = g_hash_table_lookup(output_tracking.previous, path);
+    gboolean unchanged = FALSE;
+    struct stat st;
+
+    entry->checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar*) contents, len);
+    entry->owner = g_strdup(owner ?: "-");
+    if (previous && !g_strcmp0(previous->checksum, entry->checksum) && lstat(full_path, &st) == 0)
+        unchanged = is_symlink ? S_ISLNK(st.st_mode) : (S_ISREG(st.st_mode) && (gsize) st.st_size == len);
+    if (!unchanged) {
+        output_tracking_changed(path);
+        entry->change = previous ? "changed" : "added";
+    }
+    g_hash_table_replace(output_tracking.current, path, entry);
+    return !unchanged;
+}
+
+/**
+ * Create the parent directory of @path, unless that already happened during
+ * the current run.
+ * Returns: %TRUE if the parent directory is located on a tmpfs
+ */
+static gboolean
+output_tracking_prepare_dir(const char* path)
+{
+    g_autofree char* dir = g_path_get_dirname(path);
+    gint flags = GPOINTER_TO_INT(g_hash_table_lookup(output_tracking.dirs, dir));
+    struct statfs sfs;
+
+    if (!flags) {
+        safe_mkdir_p_dir(path);
+        flags = OUTPUT_DIR_CREATED;
+        if (statfs(dir, &sfs) == 0 && sfs.f_type == TMPFS_MAGIC)
+            flags |= OUTPUT_DIR_TMPFS;
+        g_hash_table_insert(output_tracking.dirs, g_strdup(dir), GINT_TO_POINTER(flags));
+    }
+    if (!(flags & OUTPUT_DIR_TMPFS))
+        g_hash_table_add(output_tracking.sync_dirs, g_steal_pointer(&dir));
+    return (flags & OUTPUT_DIR_TMPFS) != 0;
+}
+
+/* Flush all output written to persistent storage, using one syncfs() call per
+ * filesystem. */
+static void
+output_tracking_sync(void)
+{
+    GArray* synced = g_array_new(FALSE, FALSE, sizeof(dev_t));
+    GHashTableIter iter;
+    gpointer dir;
+    struct stat st;
+
+    g_hash_table_iter_init(&iter, output_tracking.sync_dirs);
+    while (g_hash_table_iter_next(&iter, &dir, NULL)) {
+        gboolean done = FALSE;
+        int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            continue; // LCOV_EXCL_LINE
+        if (fstat(fd, &st) == 0) {
+            for (guint i = 0; !done && i < synced->len; ++i)
+                done = g_array_index(synced, dev_t, i) == st.st_dev;
+            if (!done) {
+                syncfs(fd);
+                g_array_append_val(synced, st.st_dev);
+            }
+        }
+        close(fd);
+    }
+    g_array_free(synced, TRUE);
+}
+
+/**
+ * Start tracking the configuration written into @rootdir. The manifest of the
+ * previous run is read and removed, so that an interrupted run leads to a
+ * full re-generation next time.
  * @rootdir: optional rootdir (@NULL means "/")
- * @path: path of file to write (@rootdir will be prepended)
- * @suffix: optional suffix to append to path
  */
-void g_string_free_to_file(GString* s, const char* rootdir, const char* path, const char* suffix)
+void
+netplan_output_tracking_begin(const char* rootdir)
+{
+    g_autofree char* contents = NULL;
+
+    g_assert(!output_tracking.active);
+    output_tracking.manifest = g_build_path(G_DIR_SEPARATOR_S, rootdir ?: G_DIR_SEPARATOR_S,
+                                            "run", "netplan", "generate.manifest", NULL);
+    output_tracking.changes = g_build_path(G_DIR_SEPARATOR_S, rootdir ?: G_DIR_SEPARATOR_S,
+                                           "run", "netplan", "generate.changes", NULL);
+    output_tracking.previous = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, output_entry_free);
+    output_tracking.current = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, output_entry_free);
+    output_tracking.dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    output_tracking.sync_dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    output_tracking.udev_changed = FALSE;
+    output_tracking.has_previous = FALSE;
+    output_tracking.active = TRUE;
+
+    if (g_file_get_contents(output_tracking.manifest, &contents, NULL, NULL)) {
+        g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+        for (gchar** line = lines; *line; ++line) {
+            /* <checksum> <netdef ID> <path> */
+            g_auto(GStrv) fields = g_strsplit(*line, " ", 3);
+            if (g_strv_length(fields) == 3) {
+                NetplanOutputEntry* entry = g_new0(NetplanOutputEntry, 1);
+                entry->checksum = g_strdup(fields[0]);
+                entry->owner = g_strdup(fields[1]);
+                g_hash_table_insert(output_tracking.previous, g_strdup(fields[2]), entry);
+            }
+        }
+        unlink(output_tracking.manifest);
+        output_tracking.has_previous = TRUE;
+    } else {
+        /* The previous output is unknown, so is what changed */
+        unlink(output_tracking.changes);
+    }
+}
+
+/**
+ * Attribute all following output files to the netdef @netdef_id, or to the
+ * global configuration if @NULL.
+ */
+void
+netplan_output_tracking_set_owner(const char* netdef_id)
+{
+    g_free(output_tracking.owner);
+    output_tracking.owner = g_strdup(netdef_id);
+}
+
+/* Merge the change @change of @path into the pending change set @pending,
+ * which might not have been consumed by "netplan apply" yet. */
+static void
+output_tracking_merge_change(GHashTable* pending, const char* path, const char* change, const char* owner)
+{
+    const char* old = g_hash_table_lookup(pending, path);
+
+    /* something added since the last apply is still "added" when it changes
+     * again, something removed and added again has "changed" */
+    if (old && g_str_has_prefix(old, "added ") && !g_strcmp0(change, "changed"))
+        change = "added";
+    else if (old && g_str_has_prefix(old, "removed ") && !g_strcmp0(change, "added"))
+        change = "changed";
+    g_hash_table_replace(pending, g_strdup(path), g_strdup_printf("%s %s", change, owner));
+}
+
+/* Write the change set of this run, merged with the pending change set of
+ * previous runs, if any. */
+static gboolean
+output_tracking_write_changes(GError** error)
+{
+    g_autoptr(GHashTable) pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_autofree char* contents = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+    GString* s = NULL;
+    GList* paths = NULL;
+    gboolean ret;
+
+    if (g_file_get_contents(output_tracking.changes, &contents, NULL, NULL)) {
+        g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+        for (gchar** line = lines; *line; ++line) {
+            /* <change> <netdef ID> <path> */
+            g_auto(GStrv) fields = g_strsplit(*line, " ", 3);
+            if (g_strv_length(fields) == 3)
+                g_hash_table_insert(pending, g_strdup(fields[2]), g_strdup_printf("%s %s", fields[0], fields[1]));
+        }
+    }
+
+    g_hash_table_iter_init(&iter, output_tracking.current);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        NetplanOutputEntry* entry = value;
+        if (entry->change)
+            output_tracking_merge_change(pending, key, entry->change, entry->owner);
+    }
+    g_hash_table_iter_init(&iter, output_tracking.previous);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        NetplanOutputEntry* entry = value;
+        if (!g_hash_table_contains(output_tracking.current, key))
+            output_tracking_merge_change(pending, key, "removed", entry->owner);
+    }
+
+    s = g_string_new(NULL);
+    paths = g_list_sort(g_hash_table_get_keys(pending), (GCompareFunc) g_strcmp0);
+    for (GList* l = paths; l; l = l->next) {
+        /* <change> <netdef ID> */
+        const char* change = g_hash_table_lookup(pending, l->data);
+        g_string_append_printf(s, "%s %s\n", change, (char*) l->data);
+    }
+    g_list_free(paths);
+    ret = g_file_set_contents(output_tracking.changes, s->str, s->len, error);
+    g_string_free(s, TRUE);
+    return ret;
+}
+
+/**
+ * Stop tracking and write the manifest of all files produced by this run,
+ * as well as the change set compared to the previous run.
+ * @udev_changed: set to %TRUE if any .link or .rules file has been written
+ *                or removed during this run
+ */
+gboolean
+netplan_output_tracking_finish(gboolean* udev_changed, GError** error)
+{
+    GString* s = g_string_new(NULL);
+    GList* paths = NULL;
+    gboolean ret;
+
+    g_assert(output_tracking.active);
+    paths = g_list_sort(g_hash_table_get_keys(output_tracking.current), (GCompareFunc) g_strcmp0);
+    for (GList* l = paths; l; l = l->next) {
+        NetplanOutputEntry* entry = g_hash_table_lookup(output_tracking.current, l->data);
+        g_string_append_printf(s, "%s %s %s\n", entry->checksum, entry->owner, (char*) l->data);
+    }
+    g_list_free(paths);
+    /* Make sure the output hit the disk before it is recorded as complete */
+    output_tracking_sync();
+    safe_mkdir_p_dir(output_tracking.manifest);
+    ret = (!output_tracking.has_previous || output_tracking_write_changes(error))
+        && g_file_set_contents(output_tracking.manifest, s->str, s->len, error);
+    SET_OPT_OUT_PTR(udev_changed, output_tracking.udev_changed);
+
+    g_string_free(s, TRUE);
+    g_clear_pointer(&output_tracking.manifest, g_free);
+    g_clear_pointer(&output_tracking.changes, g_free);
+    g_clear_pointer(&output_tracking.owner, g_free);
+    g_clear_pointer(&output_tracking.previous, g_hash_table_destroy);
+    g_clear_pointer(&output_tracking.current, g_hash_table_destroy);
+    g_clear_pointer(&output_tracking.dirs, g_hash_table_destroy);
+    g_clear_pointer(&output_tracking.sync_dirs, g_hash_table_destroy);
+    if (output_tracking.bundle)
+        g_string_free(g_steal_pointer(&output_tracking.bundle), TRUE);
+    output_tracking.active = FALSE;
+    return ret;
+}
+
+/*
+ * Output staging, which allows rendering configuration on worker threads, and
+ * batching the writes of a whole run. While staging is active on the calling
+ * thread, g_string_free_to_file() and create_enablement_symlink() only record
+ * the outputs, which are written later on via netplan_output_staging_commit(),
+ * from the main thread.
+ */
+typedef struct netplan_staged_output {
+    char* path;
+    /* file contents, or target of the symlink */
+    char* contents;
+    gsize len;
+    gboolean is_symlink;
+    gboolean has_umask;
+    mode_t umask;
+    /* netdef ID, for output tracking */
+    char* owner;
+} NetplanStagedOutput;
+
+static GPrivate output_staging = G_PRIVATE_INIT(NULL);
+
+static void
+staged_output_free(gpointer data)
+{
+    NetplanStagedOutput* out = data;
+    g_free(out->path);
+    g_free(out->contents);
+    g_free(out->owner);
+    g_free(out);
+}
+
+/* Append @out to @bundle, see netplan_output_bundle_save() */
+static void
+output_bundle_append(GString* bundle, char type, const NetplanStagedOutput* out)
 {
-    g_autofree char* full_path = NULL;
-    g_autofree char* path_suffix = NULL;
-    g_autofree char* contents = g_string_free(s, FALSE);
-    GError* error = NULL;
+    /* <type> <umask> <netdef ID> <length> <path>\n<contents>\n */
+    if (out->has_umask)
+        g_string_append_printf(bundle, "%c %04o", type, (unsigned) out->umask);
+    else
+        g_string_append_printf(bundle, "%c -", type);
+    g_string_append_printf(bundle, " %s %" G_GSIZE_FORMAT " %s\n", out->owner ?: "-", out->len, out->path);
+    g_string_append_len(bundle, out->contents, out->len);
+    g_string_append_c(bundle, '\n');
+}
 
-    path_suffix = g_strjoin(NULL, path, suffix, NULL);
-    full_path = g_build_path(G_DIR_SEPARATOR_S, rootdir ?: G_DIR_SEPARATOR_S, path_suffix, NULL);
-    safe_mkdir_p_dir(full_path);
-    if (!g_file_set_contents(full_path, contents, -1, &error)) {
+static gboolean
+write_all(int fd, const char* contents, gsize len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, contents, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue; // LCOV_EXCL_LINE
+            return FALSE; // LCOV_EXCL_LINE
+        }
+        contents += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+/* The backends only pick up the configuration after generate is done, so on
+ * tmpfs (where nothing survives a crash anyway) there is no need for an atomic
+ * replacement. Symlinks are not followed, and the caller falls back to the
+ * atomic method in that case. This does not hold for the udev rules and .link
+ * files, which udevd reloads whenever they change, so these must not be
+ * written in place, see output_read_by_udev(). */
+static gboolean
+write_file_in_place(const char* path, const char* contents, gsize len)
+{
+    gboolean ret;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0666);
+
+    if (fd < 0)
+        return FALSE; // LCOV_EXCL_LINE
+    ret = write_all(fd, contents, len);
+    return close(fd) == 0 && ret;
+}
+
+/* Atomically replace @path, like g_file_set_contents(), without an fsync():
+ * batched output gets flushed by output_tracking_sync() */
+static gboolean
+write_file_atomically(const char* path, const char* contents, gsize len, int mode)
+{
+    g_autofree char* tmp = g_strjoin(NULL, path, ".XXXXXX", NULL);
+    gboolean ret;
+    int saved_errno;
+    int fd = g_mkstemp_full(tmp, O_WRONLY | O_CLOEXEC, mode);
+
+    if (fd < 0)
+        return FALSE; // LCOV_EXCL_LINE
+    ret = write_all(fd, contents, len);
+    ret = close(fd) == 0 && ret;
+    if (ret && rename(tmp, path) == 0)
+        return TRUE;
+    // LCOV_EXCL_START
+    saved_errno = errno;
+    unlink(tmp);
+    errno = saved_errno;
+    return FALSE;
+    // LCOV_EXCL_STOP
+}
+
+static gboolean
+write_output(const NetplanStagedOutput* out, GError** error)
+{
+    mode_t orig_umask = 0;
+    GError* err = NULL;
+    gboolean ret = TRUE;
+    gboolean on_tmpfs = FALSE;
+
+    if (output_tracking.bundle)
+        output_bundle_append(output_tracking.bundle, out->is_symlink ? 'l' : 'f', out);
+    if (output_tracking.active) {
+        /* Do not touch files which did not change since the previous run */
+        if (!output_tracking_record(out->path, out->contents, out->len, out->is_symlink, out->owner)) {
+            netplan_profile_count("files_unchanged", 1);
+            return TRUE;
+        }
+    }
+    netplan_profile_count("files_written", 1);
+
+    if (out->has_umask)
+        orig_umask = umask(out->umask);
+    if (output_tracking.active)
+        on_tmpfs = output_tracking_prepare_dir(out->path);
+    else
+        safe_mkdir_p_dir(out->path);
+    if (out->is_symlink) {
+        if (symlink(out->contents, out->path) < 0 && errno != EEXIST) {
+            // LCOV_EXCL_START
+            g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT, "failed to create enablement symlink: %m\n");
+            ret = FALSE;
+            // LCOV_EXCL_STOP
+        }
+    } else if (output_tracking.active) {
+        if (!(on_tmpfs && !output_read_by_udev(out->path)
+              && write_file_in_place(out->path, out->contents, out->len))
+            && !write_file_atomically(out->path, out->contents, out->len, 0666)) {
+            // LCOV_EXCL_START
+            g_fprintf(stderr, "ERROR: cannot create file %s: %m\n", out->path);
+            exit(1);
+            // LCOV_EXCL_STOP
+        }
+    } else if (!g_file_set_contents(out->path, out->contents, out->len, &err)) {
         /* the mkdir() just succeeded, there is no sensible
          * method to test this without root privileges, bind mounts, and
          * simulating ENOSPC */
         // LCOV_EXCL_START
-        g_fprintf(stderr, "ERROR: cannot create file %s: %s\n", path, error->message);
+        g_fprintf(stderr, "ERROR: cannot create file %s: %s\n", out->path, err->message);
         exit(1);
         // LCOV_EXCL_STOP
     }
+    if (out->has_umask)
+        umask(orig_umask);
+    return ret;
+}
+
+/* Stage @out if staging is active on this thread, write it otherwise */
+static gboolean
+stage_or_write_output(NetplanStagedOutput* out, GError** error)
+{
+    GPtrArray* staged = g_private_get(&output_staging);
+    gboolean ret = TRUE;
+
+    out->owner = g_strdup(output_tracking.owner);
+    if (staged) {
+        g_ptr_array_add(staged, out);
+        return TRUE;
+    }
+    ret = write_output(out, error);
+    staged_output_free(out);
+    return ret;
 }
 
 /**
- * Remove all files matching given glob.
+ * Start staging all outputs produced on the calling thread.
+ */
+void
+netplan_output_staging_begin(void)
+{
+    g_assert(g_private_get(&output_staging) == NULL);
+    g_private_set(&output_staging, g_ptr_array_new_with_free_func(staged_output_free));
+}
+
+/**
+ * Stop staging outputs on the calling thread.
+ * Returns: the staged outputs, to be passed to netplan_output_staging_commit()
+ */
+GPtrArray*
+netplan_output_staging_end(void)
+{
+    GPtrArray* staged = g_private_get(&output_staging);
+    g_assert(staged != NULL);
+    g_private_set(&output_staging, NULL);
+    return staged;
+}
+
+/**
+ * Write all @staged outputs, in the order they have been produced, and free
+ * them. If staging is active on the calling thread, the outputs are moved over
+ * to the thread's own batch instead, attributed to the current owner (see
+ * netplan_output_tracking_set_owner()).
+ */
+gboolean
+netplan_output_staging_commit(GPtrArray* staged, GError** error)
+{
+    GPtrArray* batch = g_private_get(&output_staging);
+    gboolean ret = TRUE;
+
+    if (batch) {
+        for (guint i = 0; i < staged->len; ++i) {
+            NetplanStagedOutput* out = g_ptr_array_index(staged, i);
+            g_free(out->owner);
+            out->owner = g_strdup(output_tracking.owner);
+            g_ptr_array_add(batch, out);
+        }
+        g_ptr_array_set_free_func(staged, NULL);
+        g_ptr_array_free(staged, TRUE);
+        return TRUE;
+    }
+
+    for (guint i = 0; ret && i < staged->len; ++i)
+        ret = write_output(g_ptr_array_index(staged, i), error);
+    g_ptr_array_free(staged, TRUE);
+    return ret;
+}
+
+static void
+string_free_to_file(GString* s, const char* rootdir, const char* path, const char* suffix, gboolean has_umask, mode_t mask)
+{
+    g_autofree char* path_suffix = g_strjoin(NULL, path, suffix, NULL);
+    NetplanStagedOutput* out = g_new0(NetplanStagedOutput, 1);
+
+    out->path = g_build_path(G_DIR_SEPARATOR_S, rootdir ?: G_DIR_SEPARATOR_S, path_suffix, NULL);
+    out->len = s->len;
+    out->contents = g_string_free(s, FALSE);
+    out->has_umask = has_umask;
+    out->umask = mask;
+    stage_or_write_output(out, NULL);
+}
+
+/**
+ * Write a GString to a file and free it. Create necessary parent directories
+ * and exit with error message on error.
+ * @s: #GString whose contents to write. Will be fully freed afterwards.
+ * @rootdir: optional rootdir (@NULL means "/")
+ * @path: path of file to write (@rootdir will be prepended)
+ * @suffix: optional suffix to append to path
+ */
+void g_string_free_to_file(GString* s, const char* rootdir, const char* path, const char* suffix)
+{
+    string_free_to_file(s, rootdir, path, suffix, FALSE, 0);
+}
+
+/**
+ * Same as g_string_free_to_file(), but create the file and its parent
+ * directories using the given @mask instead of the current umask.
+ */
+void g_string_free_to_file_with_umask(GString* s, const char* rootdir, const char* path, const char* suffix, mode_t mask)
+{
+    string_free_to_file(s, rootdir, path, suffix, TRUE, mask);
+}
+
+/**
+ * Create the systemd enablement symlink @link, pointing to @target, as well as
+ * its parent directories. An already existing @link is fine.
+ */
+gboolean
+create_enablement_symlink(const char* target, const char* link, GError** error)
+{
+    NetplanStagedOutput* out = g_new0(NetplanStagedOutput, 1);
+
+    out->path = g_strdup(link);
+    out->contents = g_strdup(target);
+    out->len = strlen(target);
+    out->is_symlink = TRUE;
+    return stage_or_write_output(out, error);
+}
+
+/**
+ * Remove all files matching given glob. While output tracking is active,
+ * files produced by the current run are kept.
  */
 void
 unlink_glob(const char* rootdir, const char* _glob)
@@ -96,8 +679,15 @@ unlink_glob(const char* rootdir, const char* _glob)
         // LCOV_EXCL_STOP
     }
 
-    for (size_t i = 0; i < gl.gl_pathc; ++i)
+    for (size_t i = 0; i < gl.gl_pathc; ++i) {
+        if (output_tracking.active) {
+            g_autofree char* path = normalize_output_path(gl.gl_pathv[i]);
+            if (g_hash_table_contains(output_tracking.current, path))
+                continue;
+            output_tracking_changed(path);
+        }
         unlink(gl.gl_pathv[i]);
+    }
     globfree(&gl);
 }
 
@@ -215,7 +805,9 @@ gboolean
 netplan_delete_connection(const char* id, const char* rootdir)
 {
     g_autofree gchar* filename = NULL;
-    g_autofree gchar* del = NULL;
+    g_autofree gchar* key = NULL;
+    g_auto(GStrv) id_parts = NULL;
+    g_autofree gchar* escaped_id = NULL;
     g_autoptr(GError) error = NULL;
     NetplanNetDefinition* nd = NULL;
     gboolean ret = TRUE;
@@ -251,17 +843,12 @@ netplan_delete_connection(const char* id, const char* rootdir)
 
     filename = g_path_get_basename(nd->filename);
     filename[strlen(filename) - 5] = '\0'; //stip ".yaml" suffix
-    del = g_strdup_printf("network.%s.%s=NULL", netplan_def_type_name(nd->type), id);
-
-    /* TODO: refactor logic to actually be inside the library instead of spawning another process */
-    const gchar *argv[] = { SBINDIR "/" "netplan", "set", del, "--origin-hint" , filename, NULL, NULL, NULL };
-    if (rootdir) {
-        argv[5] = "--root-dir";
-        argv[6] = rootdir;
-    }
-    if (getenv("TEST_NETPLAN_CMD") != 0)
-       argv[0] = getenv("TEST_NETPLAN_CMD");
-    ret = g_spawn_sync(NULL, (gchar**)argv, NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL);
+    id_parts = g_strsplit(id, ".", -1);
+    escaped_id = g_strjoinv("\\.", id_parts);
+    key = g_strdup_printf("network.%s.%s", netplan_def_type_name(nd->type), escaped_id);
+    ret = netplan_util_set_yaml(np_state, key, "NULL", filename, rootdir, &error);
+    if (!ret)
+        g_fprintf(stderr, "netplan_delete_connection: %s\n", error->message); // LCOV_EXCL_LINE
 
 cleanup:
     if (npp) netplan_parser_clear(&npp);
@@ -317,8 +904,13 @@ netplan_get_id_from_nm_filename(const char* filename, const char* ssid)
     return g_strndup(start, id_len);
 }
 
-gboolean
-netplan_parser_load_yaml_hierarchy(NetplanParser* npp, const char* rootdir, GError** error)
+/**
+ * The YAML files of the hierarchy in @rootdir, in the order they are to be
+ * merged in, as a %NULL terminated array to be freed with g_strfreev(), or
+ * %NULL if globbing failed.
+ */
+gchar**
+find_yaml_hierarchy(const char* rootdir)
 {
     glob_t gl;
     /* Files with asciibetically higher names override/append settings from
@@ -328,10 +920,11 @@ netplan_parser_load_yaml_hierarchy(NetplanParser* npp, const char* rootdir, GErr
      * file name, and add the entries from /run after the ones from /etc
      * and those after the ones from /lib. */
     if (find_yaml_glob(rootdir, &gl) != 0)
-        return FALSE; // LCOV_EXCL_LINE
+        return NULL; // LCOV_EXCL_LINE
     /* keys are strdup()ed, free them; values point into the glob_t, don't free them */
     g_autoptr(GHashTable) configs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     g_autoptr(GList) config_keys = NULL;
+    GPtrArray* files = g_ptr_array_new();
 
     for (size_t i = 0; i < gl.gl_pathc; ++i)
         g_hash_table_insert(configs, g_path_get_basename(gl.gl_pathv[i]), gl.gl_pathv[i]);
@@ -339,11 +932,437 @@ netplan_parser_load_yaml_hierarchy(NetplanParser* npp, const char* rootdir, GErr
     config_keys = g_list_sort(g_hash_table_get_keys(configs), (GCompareFunc) strcmp);
 
     for (GList* i = config_keys; i != NULL; i = i->next)
-        if (!netplan_parser_load_yaml(npp, g_hash_table_lookup(configs, i->data), error))
+        g_ptr_array_add(files, g_strdup(g_hash_table_lookup(configs, i->data)));
+    g_ptr_array_add(files, NULL);
+    globfree(&gl);
+    return (gchar**) g_ptr_array_free(files, FALSE);
+}
+
+static gboolean
+load_yaml_hierarchy(NetplanParser* npp, const char* rootdir, NetplanDocumentCache* cache, GError** error)
+{
+    g_auto(GStrv) files = find_yaml_hierarchy(rootdir);
+
+    if (!files)
+        return FALSE; // LCOV_EXCL_LINE
+    for (gchar** filename = files; *filename; ++filename) {
+        if (!(cache ? netplan_parser_load_yaml_cached(npp, *filename, cache, error)
+                    : netplan_parser_load_yaml(npp, *filename, error)))
             return FALSE;
+    }
     return TRUE;
 }
 
+gboolean
+netplan_parser_load_yaml_hierarchy(NetplanParser* npp, const char* rootdir, GError** error)
+{
+    return load_yaml_hierarchy(npp, rootdir, NULL, error);
+}
+
+/**
+ * Same as netplan_parser_load_yaml_hierarchy(), but keep the YAML documents
+ * of all files in @cache, so only files invalidated in there are read again.
+ */
+gboolean
+netplan_parser_load_yaml_hierarchy_cached(NetplanParser* npp, const char* rootdir, NetplanDocumentCache* cache, GError** error)
+{
+    return load_yaml_hierarchy(npp, rootdir, cache, error);
+}
+
+/*
+ * Snapshot of the validated state of the YAML hierarchy, written by
+ * "netplan generate" into /run/netplan/generate.state, so that the CLI can
+ * load it rather than parsing the whole hierarchy again. The snapshot is the
+ * canonical single document YAML serialization of the state, headed by a
+ * stamp of all input files; it is only used while the stamp still matches.
+ */
+#define SNAPSHOT_HEADER "# netplan-state 2\n"
+
+static char*
+snapshot_path(const char* rootdir)
+{
+    return g_build_path(G_DIR_SEPARATOR_S, rootdir ?: G_DIR_SEPARATOR_S, "run", "netplan", "generate.state", NULL);
+}
+
+/* Return the stamp of the YAML hierarchy in @rootdir, made of one comment
+ * line per input file with its mtime, ctime, inode, size and path. The
+ * snapshot is used for generating the configuration, too, so the stamp
+ * should also catch a file being replaced within the timestamp granularity
+ * of its file system. */
+static GString*
+snapshot_stamp(const char* rootdir)
+{
+    GString* s = NULL;
+    struct stat st;
+    glob_t gl;
+
+    if (find_yaml_glob(rootdir, &gl) != 0)
+        return NULL; // LCOV_EXCL_LINE
+    s = g_string_new(SNAPSHOT_HEADER);
+    for (size_t i = 0; i < gl.gl_pathc; ++i) {
+        /* <mtime> <ctime> <inode> <size> <path> */
+        if (stat(gl.gl_pathv[i], &st) < 0) {
+            // LCOV_EXCL_START
+            g_string_free(s, TRUE);
+            s = NULL;
+            break;
+            // LCOV_EXCL_STOP
+        }
+        g_string_append_printf(s, "# %lld.%09ld %lld.%09ld %llu %lld %s\n",
+                               (long long) st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+                               (long long) st.st_ctim.tv_sec, st.st_ctim.tv_nsec,
+                               (unsigned long long) st.st_ino, (long long) st.st_size, gl.gl_pathv[i]);
+    }
+    globfree(&gl);
+    return s;
+}
+
+/**
+ * Write the snapshot of @np_state, which has been parsed from the YAML
+ * hierarchy in @rootdir.
+ */
+gboolean
+netplan_state_write_snapshot(const NetplanState* np_state, const char* rootdir, GError** error)
+{
+    g_autofree char* path = snapshot_path(rootdir);
+    g_autofree char* tmp_path = g_strconcat(path, ".tmp", NULL);
+    GString* stamp = snapshot_stamp(rootdir);
+    gboolean ret = FALSE;
+    int fd = -1;
+
+    if (!stamp)
+        return TRUE; // LCOV_EXCL_LINE
+    safe_mkdir_p_dir(path);
+    /* The state contains secrets (PSKs, passwords, private keys), so it must
+     * only be readable by root; never reuse a leftover temporary file. */
+    unlink(tmp_path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        // LCOV_EXCL_START
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot write %s: %m", tmp_path);
+        goto cleanup;
+        // LCOV_EXCL_STOP
+    }
+    if (write(fd, stamp->str, stamp->len) != (ssize_t) stamp->len) {
+        // LCOV_EXCL_START
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot write %s: %m", tmp_path);
+        goto cleanup;
+        // LCOV_EXCL_STOP
+    }
+    if (!netplan_state_dump_yaml(np_state, fd, error))
+        goto cleanup; // LCOV_EXCL_LINE
+    if (rename(tmp_path, path) < 0) {
+        // LCOV_EXCL_START
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot rename %s: %m", tmp_path);
+        goto cleanup;
+        // LCOV_EXCL_STOP
+    }
+    ret = TRUE;
+
+cleanup:
+    if (fd >= 0)
+        close(fd);
+    if (!ret)
+        unlink(tmp_path); // LCOV_EXCL_LINE
+    g_string_free(stamp, TRUE);
+    return ret;
+}
+
+/**
+ * Remove the snapshot of the YAML hierarchy in @rootdir, e.g. if the state
+ * has not been parsed from it.
+ */
+void
+netplan_state_remove_snapshot(const char* rootdir)
+{
+    g_autofree char* path = snapshot_path(rootdir);
+    unlink(path);
+}
+
+/**
+ * Load the snapshot of the YAML hierarchy in @rootdir into @npp, instead of
+ * parsing the hierarchy itself.
+ * Returns %FALSE and leaves @npp untouched (no @error set) if there is no
+ * snapshot or if it is outdated.
+ */
+gboolean
+netplan_parser_load_snapshot(NetplanParser* npp, const char* rootdir, GError** error)
+{
+    g_autofree char* path = snapshot_path(rootdir);
+    g_autofree char* contents = NULL;
+    GString* stamp = NULL;
+    gboolean valid;
+
+    if (!g_file_get_contents(path, &contents, NULL, NULL))
+        return FALSE;
+    stamp = snapshot_stamp(rootdir);
+    /* the stamp must end right where the YAML starts */
+    valid = stamp && g_str_has_prefix(contents, stamp->str) && contents[stamp->len] != '#';
+    if (stamp)
+        g_string_free(stamp, TRUE);
+    if (!valid) {
+        g_debug("Ignoring outdated state snapshot %s", path);
+        return FALSE;
+    }
+    g_debug("Loading state snapshot %s", path);
+    return netplan_parser_load_yaml(npp, path, error);
+}
+
+/*
+ * Boot cache of the generated configuration. As /run starts out empty on
+ * every boot, the systemd generator would parse, validate and render the
+ * whole YAML hierarchy each time. Instead, each run over the hierarchy keeps
+ * a bundle of all its outputs, as well as of the state snapshot, in
+ * /var/cache/netplan/generate.bundle, if that directory exists (it is
+ * created by the package). The bundle is keyed by a hash of the
+ * netplan version, of the code producing the outputs and of all input files,
+ * and the generator restores it
+ * rather than generating the configuration again for as long as the key
+ * matches. The bundle may contain secrets, so it is only readable by root.
+ */
+#define BUNDLE_HEADER "# netplan-bundle 1\n"
+
+static char*
+bundle_path(const char* rootdir)
+{
+    return g_build_path(G_DIR_SEPARATOR_S, rootdir ?: G_DIR_SEPARATOR_S, "var", "cache", "netplan", "generate.bundle", NULL);
+}
+
+static char*
+bundle_header(const char* key)
+{
+    return g_strdup_printf(BUNDLE_HEADER "# key %s\n", key);
+}
+
+/* Add the identity of all executable files mapped into this process (the
+ * generator, libnetplan and the libraries they use) to @sum, so that outputs
+ * rendered by a different build are never restored, even if NETPLAN_VERSION
+ * has not been bumped. Hashing their contents would cost more than the
+ * generation this cache is meant to save, so their path, inode, size and
+ * mtime are used instead, which a package upgrade always changes. */
+static gboolean
+checksum_code_identity(GChecksum* sum)
+{
+    g_autofree char* maps = NULL;
+    g_auto(GStrv) lines = NULL;
+
+    if (!g_file_get_contents("/proc/self/maps", &maps, NULL, NULL))
+        return FALSE; // LCOV_EXCL_LINE
+    lines = g_strsplit(maps, "\n", -1);
+    for (char** l = lines; *l; ++l) {
+        g_autofree char* ident = NULL;
+        const char* path = strchr(*l, '/');
+        char perms[5] = { 0 };
+        struct stat st;
+
+        /* <address> <perms> <offset> <dev> <inode> <path> */
+        if (!path || sscanf(*l, "%*s %4s", perms) != 1 || perms[2] != 'x')
+            continue;
+        if (stat(path, &st) < 0)
+            return FALSE; // LCOV_EXCL_LINE
+        ident = g_strdup_printf("%s %llu %lld %lld.%09ld\n", path, (unsigned long long) st.st_ino,
+                                (long long) st.st_size, (long long) st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+        g_checksum_update(sum, (const guchar*) ident, -1);
+    }
+    return TRUE;
+}
+
+/**
+ * Compute the key of the YAML hierarchy in @rootdir, i.e. the SHA-256 of the
+ * netplan version, of the identity of the running code, and of the path and
+ * contents of all input files.
+ * Returns: the key, or %NULL if the input files cannot be read
+ */
+char*
+netplan_output_bundle_key(const char* rootdir)
+{
+    GChecksum* sum = NULL;
+    char* key = NULL;
+    glob_t gl;
+
+    if (find_yaml_glob(rootdir, &gl) != 0)
+        return NULL; // LCOV_EXCL_LINE
+    sum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(sum, (const guchar*) "netplan " NETPLAN_VERSION "\n", -1);
+    if (!checksum_code_identity(sum))
+        goto cleanup; // LCOV_EXCL_LINE
+    for (size_t i = 0; i < gl.gl_pathc; ++i) {
+        g_autofree char* contents = NULL;
+        g_autofree char* head = NULL;
+        gsize len = 0;
+
+        if (!g_file_get_contents(gl.gl_pathv[i], &contents, &len, NULL))
+            goto cleanup; // LCOV_EXCL_LINE
+        /* <length> <path>\n<contents> */
+        head = g_strdup_printf("%" G_GSIZE_FORMAT " %s\n", len, gl.gl_pathv[i]);
+        g_checksum_update(sum, (const guchar*) head, -1);
+        g_checksum_update(sum, (const guchar*) contents, len);
+    }
+    key = g_strdup(g_checksum_get_string(sum));
+
+cleanup:
+    g_checksum_free(sum);
+    globfree(&gl);
+    return key;
+}
+
+/**
+ * Record all following outputs of the current run, for
+ * netplan_output_bundle_save(). Output tracking needs to be active.
+ */
+void
+netplan_output_bundle_begin(void)
+{
+    g_assert(output_tracking.active && !output_tracking.bundle);
+    output_tracking.bundle = g_string_new(NULL);
+}
+
+/**
+ * Save the outputs recorded since netplan_output_bundle_begin(), along with
+ * the state snapshot, as the bundle of the YAML hierarchy in @rootdir. This is
+ * best effort: the generator usually runs while the root filesystem is still
+ * read-only, so failures to write the bundle are ignored.
+ * @key: as returned by netplan_output_bundle_key()
+ * @any_networkd: whether systemd-networkd needs to be enabled
+ */
+void
+netplan_output_bundle_save(const char* rootdir, const char* key, gboolean any_networkd)
+{
+    g_autofree char* path = bundle_path(rootdir);
+    g_autofree char* dir = g_path_get_dirname(path);
+    g_autofree char* header = bundle_header(key);
+    g_autofree char* previous = NULL;
+    g_autofree char* snapshot = snapshot_path(rootdir);
+    NetplanStagedOutput out = { 0 };
+    GString* s = NULL;
+
+    g_assert(output_tracking.bundle);
+    if (!g_file_test(dir, G_FILE_TEST_IS_DIR))
+        return;
+    /* The outputs only depend on the key, so there is nothing new to save */
+    if (g_file_get_contents(path, &previous, NULL, NULL) && g_str_has_prefix(previous, header))
+        return;
+
+    s = g_string_new(header);
+    g_string_append_printf(s, "# networkd %d\n", any_networkd ? 1 : 0);
+    g_string_append_len(s, output_tracking.bundle->str, output_tracking.bundle->len);
+    out.path = snapshot;
+    if (g_file_get_contents(snapshot, &out.contents, &out.len, NULL)) {
+        output_bundle_append(s, 's', &out);
+        g_free(out.contents);
+    }
+    if (!write_file_atomically(path, s->str, s->len, 0600))
+        g_debug("Cannot save the output bundle %s: %m", path); // LCOV_EXCL_LINE
+    g_string_free(s, TRUE);
+}
+
+/**
+ * Restore the outputs from the bundle of the YAML hierarchy in @rootdir, if
+ * its key is @key. Output tracking needs to be active.
+ * @any_networkd: set to whether systemd-networkd needs to be enabled
+ * Returns: %FALSE if there is no (valid) bundle for @key, in which case nothing
+ *          has been written, or if @error is set
+ */
+gboolean
+netplan_output_bundle_restore(const char* rootdir, const char* key, gboolean* any_networkd, GError** error)
+{
+    g_autofree char* path = bundle_path(rootdir);
+    g_autofree char* header = bundle_header(key);
+    g_autofree char* contents = NULL;
+    GPtrArray* outputs = NULL;
+    NetplanStagedOutput* snapshot = NULL;
+    gboolean networkd = FALSE;
+    gboolean ret = FALSE;
+    const char* p = NULL;
+    const char* end = NULL;
+    gsize len = 0;
+
+    g_assert(output_tracking.active);
+    if (!g_file_get_contents(path, &contents, &len, NULL))
+        return FALSE;
+    if (!g_str_has_prefix(contents, header)) {
+        g_debug("Ignoring outdated output bundle %s", path);
+        return FALSE;
+    }
+    p = contents + strlen(header);
+    end = contents + len;
+    if (g_str_has_prefix(p, "# networkd 1\n"))
+        networkd = TRUE;
+    else if (!g_str_has_prefix(p, "# networkd 0\n"))
+        goto invalid; // LCOV_EXCL_LINE
+    p += strlen("# networkd 0\n");
+
+    /* Read the whole bundle before writing anything */
+    outputs = g_ptr_array_new_with_free_func(staged_output_free);
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        g_autofree char* line = NULL;
+        g_auto(GStrv) fields = NULL;
+        NetplanStagedOutput* out = NULL;
+        char* endptr = NULL;
+        guint64 size;
+
+        if (!eol)
+            goto invalid; // LCOV_EXCL_LINE
+        /* <type> <umask> <netdef ID> <length> <path> */
+        line = g_strndup(p, eol - p);
+        fields = g_strsplit(line, " ", 5);
+        if (g_strv_length(fields) != 5 || strlen(fields[0]) != 1 || !strchr("fls", fields[0][0]))
+            goto invalid; // LCOV_EXCL_LINE
+        size = g_ascii_strtoull(fields[3], &endptr, 10);
+        if (endptr == fields[3] || *endptr || end - eol < 2 || size > (guint64) (end - eol - 2)
+            || eol[1 + size] != '\n')
+            goto invalid;
+
+        out = g_new0(NetplanStagedOutput, 1);
+        out->is_symlink = fields[0][0] == 'l';
+        if (g_strcmp0(fields[1], "-") != 0) {
+            out->has_umask = TRUE;
+            out->umask = (mode_t) g_ascii_strtoull(fields[1], NULL, 8);
+        }
+        out->owner = g_strdup(fields[2]);
+        out->path = g_strdup(fields[4]);
+        out->contents = g_strndup(eol + 1, size);
+        out->len = size;
+        if (fields[0][0] == 's') {
+            if (snapshot)
+                staged_output_free(snapshot); // LCOV_EXCL_LINE
+            snapshot = out;
+        } else
+            g_ptr_array_add(outputs, out);
+        p = eol + size + 2;
+    }
+
+    g_debug("Restoring %u outputs from %s", outputs->len, path);
+    ret = TRUE;
+    for (guint i = 0; ret && i < outputs->len; ++i)
+        ret = write_output(g_ptr_array_index(outputs, i), error);
+    if (ret && snapshot) {
+        /* the state contains secrets, see netplan_state_write_snapshot() */
+        safe_mkdir_p_dir(snapshot->path);
+        if (!write_file_atomically(snapshot->path, snapshot->contents, snapshot->len, 0600)) {
+            // LCOV_EXCL_START
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Cannot write %s: %m", snapshot->path);
+            ret = FALSE;
+            // LCOV_EXCL_STOP
+        }
+    }
+    SET_OPT_OUT_PTR(any_networkd, networkd);
+    goto cleanup;
+
+invalid:
+    /* Make sure the next run replaces it */
+    g_debug("Ignoring corrupted output bundle %s", path);
+    unlink(path);
+
+cleanup:
+    if (outputs)
+        g_ptr_array_free(outputs, TRUE);
+    if (snapshot)
+        staged_output_free(snapshot);
+    return ret;
+}
+
 /**
  * Get a static string describing the default global network
  * for a given address family.
@@ -365,42 +1384,73 @@ get_unspecified_address(int ip_family)
     return (ip_family == AF_INET) ? "0.0.0.0" : "::";
 }
 
-struct netdef_pertype_iterator {
-    NetplanDefType type;
-    GHashTableIter iter;
+struct netplan_state_iterator {
+    /* Netdefs of a single type, or NULL to walk all of them */
+    const GPtrArray* netdefs;
+    guint index;
+    const GList* next;
 };
 
-NETPLAN_INTERNAL struct netdef_pertype_iterator*
-_netplan_iter_defs_per_devtype_init(const char *devtype)
+/**
+ * Iterate over the netdefs of @np_state, in definition order.
+ * @np_state: the state to iterate over, needs to outlive the iterator
+ * @devtype: only return netdefs of this type (e.g. "ethernets"), or NULL for all
+ */
+NETPLAN_PUBLIC NetplanStateIterator*
+netplan_state_iterator_new(const NetplanState* np_state, const char* devtype)
 {
-    NetplanDefType type = netplan_def_type_from_name(devtype);
-    struct netdef_pertype_iterator *iter = g_malloc0(sizeof(*iter));
-    iter->type = type;
-    if (netdefs)
-        g_hash_table_iter_init(&iter->iter, netdefs);
+    NetplanStateIterator* iter = g_malloc0(sizeof(*iter));
+
+    if (!devtype) {
+        iter->next = np_state->netdefs_ordered;
+    } else {
+        NetplanDefType type = netplan_def_type_from_name(devtype);
+        /* Unknown types yield an empty iterator */
+        if ((guint) type < NETPLAN_DEF_TYPE_MAX_)
+            iter->netdefs = np_state->netdefs_by_type[type];
+    }
     return iter;
 }
 
-NETPLAN_INTERNAL NetplanNetDefinition*
-_netplan_iter_defs_per_devtype_next(struct netdef_pertype_iterator* it)
+NETPLAN_PUBLIC NetplanNetDefinition*
+netplan_state_iterator_next(NetplanStateIterator* iter)
 {
-    gpointer key, value;
-
-    if (!netdefs)
-        return NULL;
+    NetplanNetDefinition* netdef = NULL;
 
-    while (g_hash_table_iter_next(&it->iter, &key, &value)) {
-        NetplanNetDefinition* netdef = value;
-        if (netdef->type == it->type)
-            return netdef;
+    if (iter->netdefs) {
+        if (iter->index < iter->netdefs->len)
+            netdef = g_ptr_array_index(iter->netdefs, iter->index++);
+    } else if (iter->next) {
+        netdef = iter->next->data;
+        iter->next = iter->next->next;
     }
-    return NULL;
+    return netdef;
+}
+
+NETPLAN_PUBLIC void
+netplan_state_iterator_free(NetplanStateIterator* iter)
+{
+    g_free(iter);
+}
+
+/* Legacy iterator over the global state, kept for the Python CLI */
+NETPLAN_INTERNAL NetplanStateIterator*
+_netplan_iter_defs_per_devtype_init(const char *devtype)
+{
+    /* A NULL devtype never matched any netdef, don't walk all of them */
+    return netplan_state_iterator_new(&global_state, devtype ? devtype : "");
+}
+
+NETPLAN_INTERNAL NetplanNetDefinition*
+_netplan_iter_defs_per_devtype_next(NetplanStateIterator* it)
+{
+    return netplan_state_iterator_next(it);
 }
 
 NETPLAN_INTERNAL void
-_netplan_iter_defs_per_devtype_free(struct netdef_pertype_iterator* it)
+_netplan_iter_defs_per_devtype_free(NetplanStateIterator* it)
 {
-    g_free(it);
+    netplan_state_iterator_free(it);
 }
 
 NETPLAN_INTERNAL const char*
@@ -409,30 +409,38 @@ defroute_err(struct _defroute_entry *entry, const char *new_netdef_id, GError **
             new_netdef_id);
 }
 
+static guint
+defroute_hash(gconstpointer key)
+{
+    const struct _defroute_entry *e = key;
+    return (guint) e->family ^ ((guint) e->table * 16777619U) ^ ((guint) e->metric * 2654435761U);
+}
+
+static gboolean
+defroute_equal(gconstpointer a, gconstpointer b)
+{
+    const struct _defroute_entry *x = a, *y = b;
+    return x->family == y->family && x->table == y->table && x->metric == y->metric;
+}
+
 static gboolean
 check_defroute(struct _defroute_entry *candidate,
-               GSList **entries,
+               GHashTable *entries,
                GError **error)
 {
     struct _defroute_entry *entry;
-    GSList *it;
 
     g_assert(entries != NULL);
-    it = *entries;
-
-    while (it) {
-        struct _defroute_entry *e = it->data;
-        if (e->family == candidate->family &&
-                e->table == candidate->table &&
-                e->metric == candidate->metric) {
-            defroute_err(e, candidate->netdef_id, error);
-            return FALSE;
-        }
-        it = it->next;
+
+    /* entries are keyed by (family, table, metric) */
+    entry = g_hash_table_lookup(entries, candidate);
+    if (entry) {
+        defroute_err(entry, candidate->netdef_id, error);
+        return FALSE;
     }
     entry = g_malloc(sizeof(*entry));
     *entry = *candidate;
-    *entries = g_slist_prepend(*entries, entry);
+    g_hash_table_add(entries, entry);
     return TRUE;
 }
 
@@ -440,7 +448,7 @@ gboolean
 validate_default_route_consistency(const NetplanParser* npp, GHashTable *netdefs, GError ** error)
 {
     struct _defroute_entry candidate = {};
-    GSList *defroutes = NULL;
+    GHashTable *defroutes = g_hash_table_new_full(defroute_hash, defroute_equal, g_free, NULL);
     gboolean ret = TRUE;
     gpointer key, value;
     GHashTableIter iter;
@@ -454,14 +462,14 @@ validate_default_route_consistency(const NetplanParser* npp, GHashTable *netdefs
         candidate.table = NETPLAN_ROUTE_TABLE_UNSPEC;
         if (nd->gateway4) {
             candidate.family = AF_INET;
-            if (!check_defroute(&candidate, &defroutes, error)) {
+            if (!check_defroute(&candidate, defroutes, error)) {
                 ret = FALSE;
                 break;
             }
         }
         if (nd->gateway6) {
             candidate.family = AF_INET6;
-            if (!check_defroute(&candidate, &defroutes, error)) {
+            if (!check_defroute(&candidate, defroutes, error)) {
                 ret = FALSE;
                 break;
             }
@@ -472,18 +480,19 @@ validate_default_route_consistency(const NetplanParser* npp, GHashTable *netdefs
 
         for (size_t i = 0; i < nd->routes->len; i++) {
             NetplanIPRoute* r = g_array_index(nd->routes, NetplanIPRoute*, i);
-            char *suffix = strrchr(r->to, '/');
-            if (g_strcmp0(suffix, "/0") == 0 || g_strcmp0(r->to, "default") == 0) {
+            if (g_str_has_suffix(r->to, "/0") || g_strcmp0(r->to, "default") == 0) {
                 candidate.family = r->family;
                 candidate.table = r->table;
                 candidate.metric = r->metric;
-                if (!check_defroute(&candidate, &defroutes, error)) {
+                if (!check_defroute(&candidate, defroutes, error)) {
                     ret = FALSE;
                     break;
                 }
             }
         }
+        if (!ret)
+            break;
     }
-    g_slist_free_full(defroutes, g_free);
+    g_hash_table_destroy(defroutes);
     return ret;
 }
@@ -36,5 +36,5 @@ validate_netdef_grammar(const NetplanParser* npp, NetplanNetDefinition* nd, yaml
 gboolean
 validate_backend_rules(const NetplanParser* npp, NetplanNetDefinition* nd, GError** error);
 
-gboolean
+NETPLAN_INTERNAL gboolean
 validate_default_route_consistency(const NetplanParser* npp, GHashTable* netdefs, GError** error);
@@ -0,0 +1,432 @@
+/*
+ * Copyright (C) 2026 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark driver for the parse/validate/import/emit pipeline of libnetplan.
+ *
+ * It generates a synthetic YAML configuration of the requested size, runs it
+ * through the pipeline a number of times and reports the median and minimum
+ * wall clock time of each phase, as well as the peak RSS of the process. The
+ * results can be saved and compared against a previously saved baseline.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include "parse.h"
+#include "types.h"
+#include "validation.h"
+#include "networkd.h"
+#include "nm.h"
+#include "openvswitch.h"
+
+static gint n_ethernets = 100;
+static gint n_vlans = 2;
+static gint n_bonds = 4;
+static gint n_bridges = 4;
+static gint n_routes = 4;
+static gint n_rules = 2;
+static gint n_wifis = 2;
+static gint n_aps = 4;
+static gboolean default_routes = FALSE;
+static gchar* renderer = NULL;
+static gint iterations = 5;
+static gchar* save_path = NULL;
+static gchar* baseline_path = NULL;
+static gdouble threshold = 10.0;
+static gchar* yaml_path = NULL;
+
+static GOptionEntry options[] = {
+    {"ethernets", 'e', 0, G_OPTION_ARG_INT, &n_ethernets, "Number of ethernets (default: 100)", "N"},
+    {"vlans", 'v', 0, G_OPTION_ARG_INT, &n_vlans, "Number of VLANs per ethernet (default: 2)", "M"},
+    {"bonds", 'b', 0, G_OPTION_ARG_INT, &n_bonds, "Number of bonds, with two members each (default: 4)", "N"},
+    {"bridges", 'B', 0, G_OPTION_ARG_INT, &n_bridges, "Number of bridges, with two members each (default: 4)", "N"},
+    {"routes", 'R', 0, G_OPTION_ARG_INT, &n_routes, "Number of routes per ethernet (default: 4)", "K"},
+    {"rules", 'P', 0, G_OPTION_ARG_INT, &n_rules, "Number of routing-policy rules per ethernet (default: 2)", "K"},
+    {"wifis", 'w', 0, G_OPTION_ARG_INT, &n_wifis, "Number of wifis (default: 2)", "N"},
+    {"access-points", 'a', 0, G_OPTION_ARG_INT, &n_aps, "Number of access points per wifi (default: 4)", "N"},
+    {"default-routes", 'd', 0, G_OPTION_ARG_NONE, &default_routes, "Add a default route per ethernet, in its own routing table", NULL},
+    {"renderer", 'r', 0, G_OPTION_ARG_STRING, &renderer, "Global renderer: networkd (default) or NetworkManager", "RENDERER"},
+    {"iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Number of runs of the pipeline (default: 5)", "N"},
+    {"save", 's', 0, G_OPTION_ARG_FILENAME, &save_path, "Save the results to this file", "FILE"},
+    {"baseline", 'c', 0, G_OPTION_ARG_FILENAME, &baseline_path, "Compare the results against a saved baseline", "FILE"},
+    {"threshold", 't', 0, G_OPTION_ARG_DOUBLE, &threshold, "Fail if a phase is slower than the baseline by more than this percentage (default: 10)", "PCT"},
+    {"dump-yaml", 0, 0, G_OPTION_ARG_FILENAME, &yaml_path, "Only write the generated YAML configuration to this file", "FILE"},
+    {NULL}
+};
+
+typedef enum {
+    PHASE_PARSE,
+    PHASE_VALIDATE,
+    PHASE_IMPORT,
+    PHASE_EMIT_NETWORKD,
+    PHASE_EMIT_NM,
+    PHASE_EMIT_OVS,
+    PHASE_MAX_,
+} BenchPhase;
+
+static const char* const phase_names[PHASE_MAX_] = {
+    [PHASE_PARSE] = "parse",
+    [PHASE_VALIDATE] = "validate",
+    [PHASE_IMPORT] = "import",
+    [PHASE_EMIT_NETWORKD] = "emit-networkd",
+    [PHASE_EMIT_NM] = "emit-nm",
+    [PHASE_EMIT_OVS] = "emit-ovs",
+};
+
+/* wall clock time of each phase, per iteration, in µs */
+static GArray* samples[PHASE_MAX_];
+
+static gint64
+now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/**
+ * Generate the synthetic YAML configuration.
+ */
+static GString*
+generate_yaml(void)
+{
+    GString* s = g_string_new("network:\n  version: 2\n");
+
+    if (renderer)
+        g_string_append_printf(s, "  renderer: %s\n", renderer);
+
+    g_string_append(s, "  ethernets:\n");
+    for (int i = 0; i < n_ethernets; ++i) {
+        g_string_append_printf(s, "    eth%d:\n", i);
+        g_string_append_printf(s, "      match: {macaddress: \"02:00:00:%02x:%02x:%02x\"}\n",
+                               (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+        g_string_append_printf(s, "      set-name: eth%d\n", i);
+        g_string_append_printf(s, "      addresses: [10.%d.%d.1/24, \"fd00:%x::1/64\"]\n",
+                               (i >> 8) & 0xff, i & 0xff, i);
+        g_string_append(s, "      nameservers: {addresses: [10.255.255.53, \"fd00:ffff::53\"], search: [example.com]}\n");
+        if (n_routes > 0 || default_routes) {
+            g_string_append(s, "      routes:\n");
+            if (default_routes)
+                g_string_append_printf(s, "        - {to: default, via: 10.%d.%d.254, table: %d}\n",
+                                       (i >> 8) & 0xff, i & 0xff, 1000 + i);
+            for (int k = 0; k < n_routes; ++k)
+                g_string_append_printf(s, "        - {to: 172.%d.%d.0/24, via: 10.%d.%d.254, metric: %d}\n",
+                                       16 + (k >> 8) % 16, k & 0xff, (i >> 8) & 0xff, i & 0xff, 100 + k);
+        }
+        if (n_rules > 0) {
+            g_string_append(s, "      routing-policy:\n");
+            for (int k = 0; k < n_rules; ++k)
+                g_string_append_printf(s, "        - {from: 10.%d.%d.0/24, to: 172.%d.%d.0/24, table: %d, priority: %d}\n",
+                                       (i >> 8) & 0xff, i & 0xff, 16 + (k >> 8) % 16, k & 0xff, 1000 + i, 100 + k);
+        }
+    }
+    for (int i = 0; i < n_bonds; ++i)
+        for (int m = 0; m < 2; ++m)
+            g_string_append_printf(s, "    bond%dm%d: {dhcp4: false}\n", i, m);
+    for (int i = 0; i < n_bridges; ++i)
+        for (int m = 0; m < 2; ++m)
+            g_string_append_printf(s, "    br%dm%d: {dhcp4: false}\n", i, m);
+
+    if (n_vlans > 0 && n_ethernets > 0) {
+        g_string_append(s, "  vlans:\n");
+        for (int i = 0; i < n_ethernets; ++i)
+            for (int v = 0; v < n_vlans; ++v)
+                g_string_append_printf(s, "    eth%d.%d: {id: %d, link: eth%d, addresses: [\"fd01:%x:%x::1/64\"]}\n",
+                                       i, v + 1, v + 1, i, i, v + 1);
+    }
+
+    if (n_bonds > 0) {
+        g_string_append(s, "  bonds:\n");
+        for (int i = 0; i < n_bonds; ++i)
+            g_string_append_printf(s, "    bond%d:\n      interfaces: [bond%dm0, bond%dm1]\n"
+                                   "      parameters: {mode: 802.3ad, lacp-rate: fast, mii-monitor-interval: 100}\n"
+                                   "      dhcp4: true\n", i, i, i);
+    }
+
+    if (n_bridges > 0) {
+        g_string_append(s, "  bridges:\n");
+        for (int i = 0; i < n_bridges; ++i)
+            g_string_append_printf(s, "    br%d:\n      interfaces: [br%dm0, br%dm1]\n"
+                                   "      parameters: {stp: false, forward-delay: 4}\n"
+                                   "      dhcp6: true\n", i, i, i);
+    }
+
+    if (n_wifis > 0) {
+        g_string_append(s, "  wifis:\n");
+        for (int i = 0; i < n_wifis; ++i) {
+            g_string_append_printf(s, "    wlan%d:\n      dhcp4: true\n      access-points:\n", i);
+            for (int a = 0; a < n_aps; ++a)
+                g_string_append_printf(s, "        \"ssid-%d-%d\": {password: \"passw0rd-%d\"}\n", i, a, a);
+        }
+    }
+    return s;
+}
+
+static int
+remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+    return remove(path);
+}
+
+/**
+ * Run the whole pipeline once, adding the time of each phase to samples[].
+ */
+static gboolean
+run_pipeline(const char* input, const char* rootdir, GError** error)
+{
+    NetplanParser* npp = netplan_parser_new();
+    NetplanState* np_state = netplan_state_new();
+    GError* recoverable = NULL;
+    gboolean ret = FALSE;
+    gboolean written = FALSE;
+    gint64 t;
+
+    t = now_usec();
+    if (!netplan_parser_load_yaml(npp, input, error))
+        goto cleanup;
+    t = now_usec() - t;
+    g_array_append_val(samples[PHASE_PARSE], t);
+
+    /* importing validates the default routes again, this is the cost of
+     * the validation on its own */
+    t = now_usec();
+    if (npp->parsed_defs && !validate_default_route_consistency(npp, npp->parsed_defs, &recoverable))
+        g_clear_error(&recoverable);
+    t = now_usec() - t;
+    g_array_append_val(samples[PHASE_VALIDATE], t);
+
+    t = now_usec();
+    if (!netplan_state_import_parser_results(np_state, npp, error))
+        goto cleanup;
+    t = now_usec() - t;
+    g_array_append_val(samples[PHASE_IMPORT], t);
+
+    t = now_usec();
+    for (GList* l = np_state->netdefs_ordered; l; l = l->next)
+        if (!netplan_netdef_write_networkd(np_state, l->data, rootdir, &written, error))
+            goto cleanup;
+    t = now_usec() - t;
+    g_array_append_val(samples[PHASE_EMIT_NETWORKD], t);
+
+    t = now_usec();
+    for (GList* l = np_state->netdefs_ordered; l; l = l->next)
+        if (!netplan_netdef_write_nm(np_state, l->data, rootdir, &written, error))
+            goto cleanup;
+    if (!netplan_state_finish_nm_write(np_state, rootdir, error))
+        goto cleanup;
+    t = now_usec() - t;
+    g_array_append_val(samples[PHASE_EMIT_NM], t);
+
+    t = now_usec();
+    for (GList* l = np_state->netdefs_ordered; l; l = l->next)
+        if (!netplan_netdef_write_ovs(np_state, l->data, rootdir, &written, error))
+            goto cleanup;
+    if (!netplan_state_finish_ovs_write(np_state, rootdir, error))
+        goto cleanup;
+    t = now_usec() - t;
+    g_array_append_val(samples[PHASE_EMIT_OVS], t);
+    ret = TRUE;
+
+cleanup:
+    netplan_parser_clear(&npp);
+    netplan_state_clear(&np_state);
+    return ret;
+}
+
+static gint
+compare_gint64(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64*) a, y = *(const gint64*) b;
+    return (x > y) - (x < y);
+}
+
+static gint64
+median(GArray* a)
+{
+    g_array_sort(a, compare_gint64);
+    return g_array_index(a, gint64, a->len / 2);
+}
+
+static gchar*
+config_description(void)
+{
+    return g_strdup_printf("ethernets=%d vlans=%d bonds=%d bridges=%d routes=%d rules=%d wifis=%d access-points=%d default-routes=%s renderer=%s",
+                           n_ethernets, n_vlans, n_bonds, n_bridges, n_routes, n_rules, n_wifis, n_aps,
+                           default_routes ? "yes" : "no", renderer ?: "default");
+}
+
+/**
+ * Load a saved baseline into a table of result name -> value.
+ */
+static GHashTable*
+load_baseline(const char* path, gchar** config, GError** error)
+{
+    g_autofree gchar* contents = NULL;
+    GHashTable* results = NULL;
+
+    if (!g_file_get_contents(path, &contents, NULL, error))
+        return NULL;
+
+    results = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+    for (gchar** line = lines; *line; ++line) {
+        if (g_str_has_prefix(*line, "# ")) {
+            g_free(*config);
+            *config = g_strdup(*line + 2);
+            continue;
+        }
+        /* <name> <value> */
+        g_auto(GStrv) fields = g_strsplit(*line, " ", 2);
+        if (g_strv_length(fields) == 2)
+            g_hash_table_insert(results, g_strdup(fields[0]), g_strdup(fields[1]));
+    }
+    return results;
+}
+
+int main(int argc, char** argv)
+{
+    GError* error = NULL;
+    GOptionContext* opt_context;
+    g_autofree gchar* tmpdir = NULL;
+    g_autofree gchar* input = NULL;
+    g_autofree gchar* rootdir = NULL;
+    g_autofree gchar* config = NULL;
+    g_autofree gchar* baseline_config = NULL;
+    GHashTable* baseline = NULL;
+    GString* yaml = NULL;
+    GString* results = NULL;
+    struct rusage usage;
+    int ret = 0;
+
+    opt_context = g_option_context_new(NULL);
+    g_option_context_set_summary(opt_context, "Benchmark the netplan parse/generate pipeline on a synthetic configuration.");
+    g_option_context_add_main_entries(opt_context, options, NULL);
+    if (!g_option_context_parse(opt_context, &argc, &argv, &error)) {
+        fprintf(stderr, "failed to parse options: %s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(opt_context);
+
+    if (iterations < 1 || n_ethernets < 0 || n_vlans < 0 || n_bonds < 0 || n_bridges < 0
+        || n_routes < 0 || n_rules < 0 || n_wifis < 0 || n_aps < 1) {
+        fprintf(stderr, "invalid configuration size or number of iterations\n");
+        return 1;
+    }
+
+    yaml = generate_yaml();
+    if (yaml_path) {
+        if (!g_file_set_contents(yaml_path, yaml->str, yaml->len, &error)) {
+            fprintf(stderr, "%s\n", error->message);
+            ret = 1;
+        }
+        g_string_free(yaml, TRUE);
+        return ret;
+    }
+
+    tmpdir = g_dir_make_tmp("netplan-bench-XXXXXX", &error);
+    if (!tmpdir) {
+        fprintf(stderr, "%s\n", error->message);
+        return 1;
+    }
+    input = g_build_filename(tmpdir, "bench.yaml", NULL);
+    rootdir = g_build_filename(tmpdir, "root", NULL);
+    if (!g_file_set_contents(input, yaml->str, yaml->len, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        ret = 1;
+        goto cleanup;
+    }
+
+    config = config_description();
+    g_printf("configuration: %s (%" G_GSIZE_FORMAT " bytes of YAML)\n", config, yaml->len);
+
+    for (unsigned i = 0; i < PHASE_MAX_; ++i)
+        samples[i] = g_array_new(FALSE, FALSE, sizeof(gint64));
+    for (int i = 0; i < iterations; ++i) {
+        if (!run_pipeline(input, rootdir, &error)) {
+            fprintf(stderr, "%s\n", error->message);
+            ret = 1;
+            goto cleanup;
+        }
+        g_debug("iteration %d done", i + 1);
+    }
+    getrusage(RUSAGE_SELF, &usage);
+
+    if (baseline_path) {
+        baseline = load_baseline(baseline_path, &baseline_config, &error);
+        if (!baseline) {
+            fprintf(stderr, "%s\n", error->message);
+            ret = 1;
+            goto cleanup;
+        }
+        if (g_strcmp0(config, baseline_config))
+            fprintf(stderr, "WARNING: the baseline was taken with a different configuration: %s\n", baseline_config);
+    }
+
+    /* <name> <value> */
+    results = g_string_new(NULL);
+    g_string_append_printf(results, "# %s\n", config);
+    g_printf("%-16s %12s %12s", "phase", "median (µs)", "min (µs)");
+    if (baseline)
+        g_printf(" %12s %8s", "baseline", "delta");
+    g_printf("\n");
+    for (unsigned i = 0; i < PHASE_MAX_; ++i) {
+        gint64 med = median(samples[i]);
+        gint64 min = g_array_index(samples[i], gint64, 0);
+        g_printf("%-16s %12" G_GINT64_FORMAT " %12" G_GINT64_FORMAT, phase_names[i], med, min);
+        g_string_append_printf(results, "%s %" G_GINT64_FORMAT "\n", phase_names[i], med);
+        if (baseline) {
+            const char* value = g_hash_table_lookup(baseline, phase_names[i]);
+            gint64 base = value ? g_ascii_strtoll(value, NULL, 10) : 0;
+            if (base > 0) {
+                gdouble delta = 100.0 * (med - base) / base;
+                g_printf(" %12" G_GINT64_FORMAT " %+7.1f%%", base, delta);
+                if (delta > threshold) {
+                    g_printf("  REGRESSION");
+                    ret = 2;
+                }
+            }
+        }
+        g_printf("\n");
+    }
+    g_printf("%-16s %12ld kB\n", "peak RSS", usage.ru_maxrss);
+    g_string_append_printf(results, "peak-rss-kb %ld\n", usage.ru_maxrss);
+
+    if (save_path && !g_file_set_contents(save_path, results->str, results->len, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        ret = 1;
+    }
+
+cleanup:
+    nftw(tmpdir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    g_clear_error(&error);
+    if (baseline)
+        g_hash_table_destroy(baseline);
+    if (results)
+        g_string_free(results, TRUE);
+    g_string_free(yaml, TRUE);
+    for (unsigned i = 0; i < PHASE_MAX_; ++i)
+        if (samples[i])
+            g_array_free(samples[i], TRUE);
+    return ret;
+}
@@ -150,6 +150,41 @@ class TestGenerate(unittest.TestCase):
         self.assertNotEqual(b'', out)
         self.assertIn('renamediface', out.decode('utf-8'))
 
+    def test_mapping_for_glob_iface(self):
+        os.environ['NETPLAN_GENERATE_PATH'] = os.path.join(rootdir, 'generate')
+        c = os.path.join(self.workdir.name, 'etc', 'netplan')
+        os.makedirs(c)
+        with open(os.path.join(c, 'a.yaml'), 'w') as f:
+            f.write('''network:
+  version: 2
+  ethernets:
+    myif:
+      match:
+        name: "enl[aeiou]*"
+      dhcp4: yes
+''')
+        out = subprocess.check_output(exe_cli +
+                                      ['generate', '--root-dir', self.workdir.name, '--mapping', 'enlol'])
+        self.assertIn('id=myif,', out.decode('utf-8'))
+
+    def test_mapping_keeps_generated_files(self):
+        os.environ['NETPLAN_GENERATE_PATH'] = os.path.join(rootdir, 'generate')
+        c = os.path.join(self.workdir.name, 'etc', 'netplan')
+        os.makedirs(c)
+        with open(os.path.join(c, 'a.yaml'), 'w') as f:
+            f.write('''network:
+  version: 2
+  ethernets:
+    enlol: {dhcp4: yes}''')
+        subprocess.check_call(exe_cli + ['generate', '--root-dir', self.workdir.name])
+        network_dir = os.path.join(self.workdir.name, 'run', 'systemd', 'network')
+        self.assertEqual(os.listdir(network_dir), ['10-netplan-enlol.network'])
+        # answered from the snapshot, without touching the generated files
+        out = subprocess.check_output(exe_cli +
+                                      ['generate', '--root-dir', self.workdir.name, '--mapping', 'enlol'])
+        self.assertIn('id=enlol,', out.decode('utf-8'))
+        self.assertEqual(os.listdir(network_dir), ['10-netplan-enlol.network'])
+
 
 class TestIfupdownMigrate(unittest.TestCase):
 
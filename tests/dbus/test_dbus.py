@@ -259,6 +259,12 @@ class TestNetplanDBus(unittest.TestCase):
         self.assertEquals(self.mock_netplan_cmd.calls(), [
                 ["netplan", "generate"],
         ])
+        # the resident state is handed to 'netplan generate' as its snapshot
+        with open(os.path.join(self.tmp, 'run', 'netplan', 'generate.state')) as f:
+            snapshot = f.read()
+        self.assertTrue(snapshot.startswith('# netplan-state 2\n'))
+        self.assertIn('/etc/netplan/main_test.yaml\n', snapshot)
+        self.assertIn('eth0:', snapshot)
 
     def test_netplan_dbus_info(self):
         BUSCTL_NETPLAN_INFO = [
@@ -271,14 +277,66 @@ class TestNetplanDBus(unittest.TestCase):
         output = subprocess.check_output(BUSCTL_NETPLAN_INFO)
         self.assertIn("Features", output.decode("utf-8"))
 
+    def test_netplan_dbus_apply_nonblocking(self):
+        with open(self.mock_netplan_cmd.path, "a") as fp:
+            fp.write("sleep 2\n")
+        BUSCTL_NETPLAN_CMD = [
+            "busctl", "call", "--system",
+            "io.netplan.Netplan",
+            "/io/netplan/Netplan",
+            "io.netplan.Netplan",
+        ]
+        p = subprocess.Popen(BUSCTL_NETPLAN_CMD + ["Apply"], stdout=subprocess.PIPE)
+        time.sleep(0.5)  # Give some time for 'netplan apply' to start
+        # Info is answered while 'netplan apply' is still running
+        start = time.monotonic()
+        output = subprocess.check_output(BUSCTL_NETPLAN_CMD + ["Info"])
+        self.assertLess(time.monotonic() - start, 1)
+        self.assertIn("Features", output.decode("utf-8"))
+        self.assertIsNone(p.poll())
+        # Apply is replied to once the child process exited
+        self.assertEqual(p.communicate()[0].decode("utf-8"), "b true\n")
+        self.assertEquals(self.mock_netplan_cmd.calls(), [["netplan", "apply"]])
+
+    def test_netplan_dbus_apply_failed(self):
+        with open(self.mock_netplan_cmd.path, "a") as fp:
+            fp.write("echo applying\n")
+        self.mock_netplan_cmd.set_returncode(1)
+        err = self._check_dbus_error([
+            "busctl", "call", "--system",
+            "io.netplan.Netplan",
+            "/io/netplan/Netplan",
+            "io.netplan.Netplan",
+            "Apply",
+        ])
+        self.assertIn("netplan apply failed: Child process exited with code 1", err)
+        self.assertIn("stdout: 'applying", err)
+
+    def test_netplan_dbus_config_queued(self):
+        with open(self.mock_netplan_cmd.path, "a") as fp:
+            fp.write("sleep 1\n")
+        cid = self._new_config_object()
+        BUSCTL_NETPLAN_CMD = [
+            "busctl", "call", "--system",
+            "io.netplan.Netplan",
+            "/io/netplan/Netplan/config/{}".format(cid),
+            "io.netplan.Netplan.Config",
+        ]
+        p = subprocess.Popen(BUSCTL_NETPLAN_CMD + ["Apply"], stdout=subprocess.PIPE)
+        time.sleep(0.5)  # Give some time for 'netplan apply' to start
+        # Cancel is served after Apply, which removed the config object
+        err = self._check_dbus_error(BUSCTL_NETPLAN_CMD + ["Cancel"])
+        self.assertIn('Unknown object \'/io/netplan/Netplan/config/{}\''.format(cid), err)
+        self.assertEqual(p.communicate()[0].decode("utf-8"), "b true\n")
+
     def test_netplan_dbus_config(self):
         # Create test YAML
         test_file_lib = os.path.join(self.tmp, 'lib', 'netplan', 'lib_test.yaml')
         with open(test_file_lib, 'w') as f:
-            f.write('TESTING-lib')
+            f.write('network:\n  ethernets:\n    eth1: {dhcp6: true}')
         test_file_run = os.path.join(self.tmp, 'run', 'netplan', 'run_test.yaml')
         with open(test_file_run, 'w') as f:
-            f.write('TESTING-run')
+            f.write('network:\n  ethernets:\n    eth2: {dhcp6: true}')
         self.assertTrue(os.path.isfile(os.path.join(self.tmp, 'etc', 'netplan', 'main_test.yaml')))
         self.assertTrue(os.path.isfile(os.path.join(self.tmp, 'lib', 'netplan', 'lib_test.yaml')))
         self.assertTrue(os.path.isfile(os.path.join(self.tmp, 'run', 'netplan', 'run_test.yaml')))
@@ -297,10 +355,10 @@ class TestNetplanDBus(unittest.TestCase):
             "Get",
         ]
         out = subprocess.check_output(BUSCTL_NETPLAN_CMD, universal_newlines=True)
-        self.assertIn(r's ""', out)  # No output as 'netplan get' is actually mocked
-        self.assertEquals(self.mock_netplan_cmd.calls(), [[
-            "netplan", "get", "all", "--root-dir={}".format(tmpdir)
-        ]])
+        # Served from the YAML files copied into the config state
+        for iface in ['eth0', 'eth1', 'eth2']:
+            self.assertIn(r'\n    {}:\n'.format(iface), out)
+        self.assertEquals(self.mock_netplan_cmd.calls(), [])
 
         # Verify all *.yaml files have been copied
         self.assertTrue(os.path.isfile(os.path.join(tmpdir, 'etc', 'netplan', 'main_test.yaml')))
@@ -323,7 +381,6 @@ class TestNetplanDBus(unittest.TestCase):
         self.addCleanup(shutil.rmtree, tmpdir)
 
         # Verify .Config.Set() on the config object
-        # No actual YAML file will be created, as the netplan command is mocked
         BUSCTL_NETPLAN_CMD = [
             "busctl", "call", "--system",
             "io.netplan.Netplan",
@@ -333,10 +390,20 @@ class TestNetplanDBus(unittest.TestCase):
         ]
         out = subprocess.check_output(BUSCTL_NETPLAN_CMD)
         self.assertEqual(b'b true\n', out)
-        self.assertEquals(self.mock_netplan_cmd.calls(), [[
-            "netplan", "set", "ethernets.eth42.dhcp6=true",
-            "--root-dir={}".format(tmpdir)
-        ]])
+        # Merged in-process, without spawning 'netplan set'
+        self.assertEquals(self.mock_netplan_cmd.calls(), [])
+        with open(os.path.join(tmpdir, 'etc', 'netplan', '70-netplan-set.yaml')) as f:
+            self.assertEqual('network:\n  ethernets:\n    eth42:\n      dhcp6: true\n', f.read())
+
+        # An invalid delta is rejected, leaving the YAML files alone
+        BUSCTL_NETPLAN_CMD[-2] = "ethernets.eth42.set-name=eth0"
+        err = self._check_dbus_error(BUSCTL_NETPLAN_CMD)
+        self.assertIn("'set-name:' requires 'match:' properties", err)
+        BUSCTL_NETPLAN_CMD[-2] = "ethernets.eth42"
+        err = self._check_dbus_error(BUSCTL_NETPLAN_CMD)
+        self.assertIn("Invalid value specified", err)
+        with open(os.path.join(tmpdir, 'etc', 'netplan', '70-netplan-set.yaml')) as f:
+            self.assertEqual('network:\n  ethernets:\n    eth42:\n      dhcp6: true\n', f.read())
 
     def test_netplan_dbus_config_get(self):
         cid = self._new_config_object()
@@ -344,7 +411,6 @@ class TestNetplanDBus(unittest.TestCase):
         self.addCleanup(shutil.rmtree, tmpdir)
 
         # Verify .Config.Get() on the config object
-        self.mock_netplan_cmd.set_output("network:\n  eth42:\n    dhcp6: true")
         BUSCTL_NETPLAN_CMD = [
             "busctl", "call", "--system",
             "io.netplan.Netplan",
@@ -353,10 +419,94 @@ class TestNetplanDBus(unittest.TestCase):
             "Get",
         ]
         out = subprocess.check_output(BUSCTL_NETPLAN_CMD, universal_newlines=True)
-        self.assertIn(r's "network:\n  eth42:\n    dhcp6: true\n"', out)
-        self.assertEquals(self.mock_netplan_cmd.calls(), [[
-            "netplan", "get", "all", "--root-dir={}".format(tmpdir)
-        ]])
+        self.assertIn(r's "network:\n  version: 2\n  ethernets:\n    eth0:\n', out)
+        self.assertIn(r'      dhcp4: true\n', out)
+        # The cached state is refreshed, once the YAML files change
+        with open(os.path.join(tmpdir, 'etc', 'netplan', 'main_test.yaml'), 'w') as f:
+            f.write('network:\n  ethernets:\n    eth42: {dhcp6: true}')
+        out = subprocess.check_output(BUSCTL_NETPLAN_CMD, universal_newlines=True)
+        self.assertIn(r'\n    eth42:\n', out)
+        self.assertIn(r'      dhcp6: true\n', out)
+        self.assertNotIn('eth0', out)
+        # Get() does not spawn 'netplan get' anymore
+        self.assertEquals(self.mock_netplan_cmd.calls(), [])
+
+    def test_netplan_dbus_config_get_keys(self):
+        cid = self._new_config_object()
+        tmpdir = self.tmp + '/run/netplan/config-{}'.format(cid)
+        self.addCleanup(shutil.rmtree, tmpdir)
+
+        # Verify .Config.GetKeys() answers several keys in one call
+        BUSCTL_NETPLAN_CMD = [
+            "busctl", "call", "--system",
+            "io.netplan.Netplan",
+            "/io/netplan/Netplan/config/{}".format(cid),
+            "io.netplan.Netplan.Config",
+            "GetKeys", "as", "3", "ethernets.eth0.dhcp4", "network.ethernets.eth0", "ethernets.eth9",
+        ]
+        out = subprocess.check_output(BUSCTL_NETPLAN_CMD, universal_newlines=True)
+        self.assertTrue(out.startswith(r'as 3 "true\n" "'), out)
+        self.assertIn(r'dhcp4: true\n', out)
+        self.assertTrue(out.endswith('" "null\\n"\n'), out)
+        # The keys are looked up in the refreshed state, once the YAML files change
+        with open(os.path.join(tmpdir, 'etc', 'netplan', 'main_test.yaml.new'), 'w') as f:
+            f.write('network:\n  ethernets:\n    eth0: {dhcp6: true}')
+        os.replace(os.path.join(tmpdir, 'etc', 'netplan', 'main_test.yaml.new'),
+                   os.path.join(tmpdir, 'etc', 'netplan', 'main_test.yaml'))
+        out = subprocess.check_output(BUSCTL_NETPLAN_CMD[:-4] + ["2", "ethernets.eth0.dhcp4", "ethernets.eth0.dhcp6"],
+                                      universal_newlines=True)
+        self.assertEqual('as 2 "null\\n" "true\\n"\n', out)
+        self.assertEquals(self.mock_netplan_cmd.calls(), [])
+
+    def test_netplan_dbus_config_get_files_changed(self):
+        cid = self._new_config_object()
+        tmpdir = self.tmp + '/run/netplan/config-{}'.format(cid)
+        self.addCleanup(shutil.rmtree, tmpdir)
+        BUSCTL_NETPLAN_CMD = [
+            "busctl", "call", "--system",
+            "io.netplan.Netplan",
+            "/io/netplan/Netplan/config/{}".format(cid),
+            "io.netplan.Netplan.Config",
+            "Get",
+        ]
+        out = subprocess.check_output(BUSCTL_NETPLAN_CMD, universal_newlines=True)
+        self.assertNotIn('eth1', out)
+
+        # New files are merged into the cached state, in the usual order
+        run_yaml = os.path.join(tmpdir, 'run', 'netplan', 'main_test.yaml')
+        with open(run_yaml, 'w') as f:
+            f.write('network:\n  ethernets:\n    eth1: {dhcp6: true}')
+        lib_yaml = os.path.join(tmpdir, 'lib', 'netplan', 'b.yaml')
+        with open(lib_yaml, 'w') as f:
+            f.write('network:\n  ethernets:\n    eth1: {dhcp4: true}')
+        out = subprocess.check_output(BUSCTL_NETPLAN_CMD, universal_newlines=True)
+        self.assertNotIn('eth0', out)  # /etc/netplan/main_test.yaml is shadowed
+        self.assertIn(r'\n    eth1:\n', out)
+        self.assertIn(r'      dhcp4: true\n', out)
+        self.assertIn(r'      dhcp6: true\n', out)
+
+        # Removed files are dropped from it
+        os.remove(run_yaml)
+        os.remove(lib_yaml)
+        out = subprocess.check_output(BUSCTL_NETPLAN_CMD, universal_newlines=True)
+        self.assertIn(r'\n    eth0:\n', out)
+        self.assertNotIn('eth1', out)
+
+    def test_netplan_dbus_config_get_invalid(self):
+        cid = self._new_config_object()
+        tmpdir = self.tmp + '/run/netplan/config-{}'.format(cid)
+        self.addCleanup(shutil.rmtree, tmpdir)
+        with open(os.path.join(tmpdir, 'etc', 'netplan', 'main_test.yaml'), 'w') as f:
+            f.write('network:\n  ethernets:\n    eth0: {dhcp4: maybe}')
+        err = self._check_dbus_error([
+            "busctl", "call", "--system",
+            "io.netplan.Netplan",
+            "/io/netplan/Netplan/config/{}".format(cid),
+            "io.netplan.Netplan.Config",
+            "Get",
+        ])
+        self.assertIn("netplan get failed", err)
+        self.assertIn("invalid boolean value 'maybe'", err)
 
     def test_netplan_dbus_config_cancel(self):
         cid = self._new_config_object()
@@ -424,6 +574,49 @@ class TestNetplanDBus(unittest.TestCase):
         self.assertFalse(os.path.isdir(backup))
         self.assertFalse(os.path.isdir(tmpdir))
 
+    def test_netplan_dbus_config_apply_changed_files(self):
+        other = os.path.join(self.tmp, 'etc', 'netplan', 'other.yaml')
+        with open(other, 'w') as f:
+            f.write('network:\n  ethernets:\n    eth1: {dhcp6: true}')
+        main = os.path.join(self.tmp, 'etc', 'netplan', 'main_test.yaml')
+        other_ino = os.stat(other).st_ino
+        main_ino = os.stat(main).st_ino
+        cid = self._new_config_object()
+        tmpdir = self.tmp + '/run/netplan/config-{}'.format(cid)
+
+        # The config state copies the files of the main state, which might be
+        # modified in place, rather than sharing them
+        for name, ino in (('other.yaml', other_ino), ('main_test.yaml', main_ino)):
+            path = os.path.join(tmpdir, 'etc', 'netplan', name)
+            self.assertNotEqual(os.stat(path).st_ino, ino)
+            with open(path) as f, open(os.path.join(self.tmp, 'etc', 'netplan', name)) as g:
+                self.assertEqual(f.read(), g.read())
+
+        # Set() replaces the file it writes, leaving the main state alone
+        BUSCTL_NETPLAN_CMD = [
+            "busctl", "call", "--system",
+            "io.netplan.Netplan",
+            "/io/netplan/Netplan/config/{}".format(cid),
+            "io.netplan.Netplan.Config",
+            "Set", "ss", "ethernets.eth0.dhcp6=true", "",
+        ]
+        out = subprocess.check_output(BUSCTL_NETPLAN_CMD)
+        self.assertEqual(b'b true\n', out)
+        self.assertNotEqual(os.stat(os.path.join(tmpdir, 'etc', 'netplan', 'main_test.yaml')).st_ino, main_ino)
+        with open(main) as f:
+            self.assertNotIn('dhcp6', f.read())
+
+        # Apply() only replaces the changed file
+        BUSCTL_NETPLAN_CMD = BUSCTL_NETPLAN_CMD[:-4] + ["Apply"]
+        out = subprocess.check_output(BUSCTL_NETPLAN_CMD)
+        self.assertEqual(b'b true\n', out)
+        time.sleep(1)  # Give some time for 'Apply' to clean up
+        self.assertFalse(os.path.isdir(tmpdir))
+        self.assertEqual(os.stat(other).st_ino, other_ino)
+        self.assertNotEqual(os.stat(main).st_ino, main_ino)
+        with open(main) as f:
+            self.assertIn('dhcp6: true', f.read())
+
     def test_netplan_dbus_config_try_cancel(self):
         # touch self._netplan_try_stamp to signal that 'netplan try' is ready
         # to take (Accept/Reject) input signals, before the timeout
@@ -457,9 +650,11 @@ class TestNetplanDBus(unittest.TestCase):
         self.assertTrue(os.path.isfile(os.path.join(tmpdir, 'run', 'netplan', 'try_test.yaml')))
         self.assertTrue(os.path.isfile(os.path.join(tmpdir, 'lib', 'netplan', 'try_test.yaml')))
 
-        # Verify the backup has been created
+        # Verify the backup has been created, sharing the unchanged files
         self.assertTrue(os.path.isdir(backup))
         self.assertTrue(os.path.isfile(os.path.join(backup, 'etc', 'netplan', 'main_test.yaml')))
+        self.assertEqual(os.stat(os.path.join(backup, 'etc', 'netplan', 'main_test.yaml')).st_ino,
+                         os.stat(os.path.join(tmpdir, 'etc', 'netplan', 'main_test.yaml')).st_ino)
 
         # Verify the new YAML files were copied over
         self.assertTrue(os.path.isfile(os.path.join(self.tmp, 'etc', 'netplan', 'try_test.yaml')))
@@ -495,6 +690,36 @@ class TestNetplanDBus(unittest.TestCase):
         self.assertEquals(self.mock_netplan_cmd.calls(),
                           [["netplan", "try", "--timeout=3", "--state=%s/run/netplan/config-BACKUP" % self.tmp]])
 
+    def test_netplan_dbus_config_try_cancel_nonblocking(self):
+        self.mock_netplan_cmd.touch(self._netplan_try_stamp)
+        self.mock_netplan_cmd.set_timeout(30)  # 30 dsec = 3 sec
+        # reverting the configuration takes a while
+        with open(self.mock_netplan_cmd.path, "a") as fp:
+            fp.write("sleep 2\n")
+        cid = self._new_config_object()
+        tmpdir = self.tmp + '/run/netplan/config-{}'.format(cid)
+        BUSCTL_NETPLAN_CMD = [
+            "busctl", "call", "--system",
+            "io.netplan.Netplan",
+        ]
+        CONFIG_CMD = BUSCTL_NETPLAN_CMD + ["/io/netplan/Netplan/config/{}".format(cid), "io.netplan.Netplan.Config"]
+        out = subprocess.check_output(CONFIG_CMD + ["Try", "u", "3"])
+        self.assertEqual(b'b true\n', out)
+
+        p = subprocess.Popen(CONFIG_CMD + ["Cancel"], stdout=subprocess.PIPE)
+        time.sleep(0.5)  # Give some time for 'netplan try' to get the signal
+        # Info is answered while 'netplan try' is still reverting
+        start = time.monotonic()
+        output = subprocess.check_output(BUSCTL_NETPLAN_CMD + ["/io/netplan/Netplan", "io.netplan.Netplan", "Info"])
+        self.assertLess(time.monotonic() - start, 1)
+        self.assertIn("Features", output.decode("utf-8"))
+        self.assertIsNone(p.poll())
+        self.assertTrue(os.path.isdir(tmpdir))
+        # Cancel is replied to once the child process exited, and cleaned up
+        self.assertEqual(p.communicate()[0], b'b true\n')
+        self.assertFalse(os.path.isdir(tmpdir))
+        self.assertFalse(os.path.isdir(self.tmp + '/run/netplan/config-BACKUP'))
+
     def test_netplan_dbus_config_try_cb(self):
         self.mock_netplan_cmd.touch(self._netplan_try_stamp)
         self.mock_netplan_cmd.set_timeout(1)  # actually self-terminate after 0.1 sec
@@ -668,12 +893,8 @@ class TestNetplanDBus(unittest.TestCase):
         out = subprocess.check_output(BUSCTL_NETPLAN_CMD5)
         self.assertEqual(b'b true\n', out)
 
-        # Verify that Set()/Apply() was only called by one config object
+        # Verify that Apply() was only called by one config object
         self.assertEquals(self.mock_netplan_cmd.calls(), [
-            ["netplan", "set", "ethernets.eth0.dhcp4=true", "--origin-hint=70-snapd",
-             "--root-dir={}/run/netplan/config-{}".format(self.tmp, cid)],
-            ["netplan", "set", "ethernets.eth0.dhcp4=yes", "--origin-hint=70-snapd",
-             "--root-dir={}/run/netplan/config-{}".format(self.tmp, cid)],
             ["netplan", "apply", "--state=%s/run/netplan/config-BACKUP" % self.tmp]
         ])
 
@@ -738,13 +959,10 @@ class TestNetplanDBus(unittest.TestCase):
         out = subprocess.check_output(BUSCTL_NETPLAN_CMD2)
         self.assertEqual(b'b true\n', out)
 
-        # Verify the call stack
-        self.assertEquals(self.mock_netplan_cmd.calls(), [
-            ["netplan", "set", "ethernets.eth0.dhcp4=true", "--origin-hint=70-snapd",
-             "--root-dir={}/run/netplan/config-{}".format(self.tmp, cid)],
-            ["netplan", "set", "ethernets.eth0.dhcp4=false", "--origin-hint=70-snapd",
-             "--root-dir={}/run/netplan/config-{}".format(self.tmp, cid2)]
-        ])
+        # Verify the YAML of the config object that was written last
+        self.assertEquals(self.mock_netplan_cmd.calls(), [])
+        with open(os.path.join(self.tmp, 'run', 'netplan', 'config-{}'.format(cid2), 'etc', 'netplan', '70-snapd.yaml')) as f:
+            self.assertEqual('network:\n  ethernets:\n    eth0:\n      dhcp4: false\n', f.read())
 
     def test_netplan_dbus_config_set_uninvalidate_timeout(self):
         self.mock_netplan_cmd.touch(self._netplan_try_stamp)
@@ -790,9 +1008,5 @@ class TestNetplanDBus(unittest.TestCase):
 
         # Verify the call stack
         self.assertEquals(self.mock_netplan_cmd.calls(), [
-            ["netplan", "set", "ethernets.eth0.dhcp4=true", "--origin-hint=70-snapd",
-             "--root-dir={}/run/netplan/config-{}".format(self.tmp, cid)],
             ["netplan", "try", "--timeout=1", "--state=%s/run/netplan/config-BACKUP" % self.tmp],
-            ["netplan", "set", "ethernets.eth0.dhcp4=false", "--origin-hint=70-snapd",
-             "--root-dir={}/run/netplan/config-{}".format(self.tmp, cid2)]
         ])
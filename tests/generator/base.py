@@ -69,6 +69,7 @@ OVS_BR_EMPTY = _OVS_BASE + 'After=netplan-ovs-cleanup.service\nBefore=network.ta
 Type=oneshot\nExecStart=/usr/bin/ovs-vsctl --may-exist add-br %(iface)s\n' + OVS_BR_DEFAULT
 OVS_CLEANUP = _OVS_BASE + 'ConditionFileIsExecutable=/usr/bin/ovs-vsctl\nBefore=network.target\nWants=network.target\n\n\
 [Service]\nType=oneshot\nExecStart=/usr/sbin/netplan apply --only-ovs-cleanup\n'
+OVS_VSCTL_EXEC = 'ExecStart=/usr/bin/ovs-vsctl '
 UDEV_MAC_RULE = 'SUBSYSTEM=="net", ACTION=="add", DRIVERS=="%s", ATTR{address}=="%s", NAME="%s"\n'
 UDEV_NO_MAC_RULE = 'SUBSYSTEM=="net", ACTION=="add", DRIVERS=="%s", NAME="%s"\n'
 UDEV_SRIOV_RULE = 'ACTION=="add", SUBSYSTEM=="net", ATTRS{sriov_totalvfs}=="?*", RUN+="/usr/sbin/netplan apply --sriov-only"\n'
@@ -433,7 +434,22 @@ class TestBase(unittest.TestCase):
         with open(rule_path) as f:
             self.assertEqual(f.read(), contents)
 
+    @staticmethod
+    def chain_ovs_vsctl(contents):
+        '''Chain consecutive ovs-vsctl ExecStart= lines with "--", as the generator does'''
+        lines = []
+        for line in contents.split('\n'):
+            if line.startswith(OVS_VSCTL_EXEC) and lines and lines[-1].startswith(OVS_VSCTL_EXEC):
+                lines[-1] += ' -- ' + line[len(OVS_VSCTL_EXEC):]
+            else:
+                lines.append(line)
+        return '\n'.join(lines)
+
     def assert_ovs(self, file_contents_map):
+        '''
+        Check the generated OVS units. The expected ovs-vsctl commands can be
+        given one per ExecStart= line, they are chained like in the generator.
+        '''
         systemd_dir = os.path.join(self.workdir.name, 'run', 'systemd', 'system')
         if not file_contents_map:
             # in this case we assume no OVS configuration should be present
@@ -447,7 +463,7 @@ class TestBase(unittest.TestCase):
         for fname, contents in file_contents_map.items():
             fname = 'netplan-ovs-' + fname
             with open(os.path.join(systemd_dir, fname)) as f:
-                self.assertEqual(f.read(), contents)
+                self.assertEqual(f.read(), self.chain_ovs_vsctl(contents))
             if fname.endswith('.service'):
                 link_path = os.path.join(
                     systemd_dir, 'systemd-networkd.service.wants', fname)
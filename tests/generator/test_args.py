@@ -16,7 +16,9 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+import json
 import os
+import shutil
 import subprocess
 
 from .base import TestBase, exe_generate, OVS_CLEANUP
@@ -77,6 +79,136 @@ class TestConfigArgs(TestBase):
         self.assertEqual(err, 'Cannot open /non/existing/config: No such file or directory\n')
         self.assertEqual(os.listdir(self.workdir.name), ['etc'])
 
+    def _read_run_tree(self):
+        tree = {}
+        rundir = os.path.join(self.workdir.name, 'run')
+        for root, dirs, files in os.walk(rundir):
+            for name in files:
+                path = os.path.join(root, name)
+                if os.path.islink(path):
+                    tree[path] = os.readlink(path)
+                else:
+                    with open(path) as f:
+                        tree[path] = f.read()
+        return tree
+
+    def test_jobs(self):
+        conf = '''network:
+  version: 2
+  ethernets:
+    eth0: {dhcp4: true}
+    eth1: {wakeonlan: true}
+    eth2: {renderer: NetworkManager, dhcp6: true}
+  bonds:
+    bond0: {interfaces: [eth0, eth1], parameters: {mode: active-backup}}
+  vlans:
+    vlan20: {id: 20, link: bond0, addresses: [10.0.0.1/24]}
+  wifis:
+    wl0:
+      access-points:
+        "Joe's Home": {password: "s0s3kr1t"}'''
+        self.generate(conf)
+        serial = self._read_run_tree()
+        shutil.rmtree(os.path.join(self.workdir.name, 'run'))
+        self.generate(conf, extra_args=['--jobs', '4'])
+        self.assertEqual(self._read_run_tree(), serial)
+
+    def test_profile(self):
+        conf = os.path.join(self.confdir, 'a.yaml')
+        os.makedirs(self.confdir)
+        with open(conf, 'w') as f:
+            f.write('network:\n  version: 2\n  ethernets:\n    eth0: {dhcp4: true}\n    eth1: {wakeonlan: true}')
+        p = subprocess.run([exe_generate, '--root-dir', self.workdir.name], check=True, stderr=subprocess.PIPE,
+                           universal_newlines=True, env=dict(os.environ, NETPLAN_PROFILE='json', NETPLAN_TRACE_ID='apply'))
+        record = json.loads(p.stderr)
+        self.assertEqual(record['trace'], 'apply')
+        names = [span['name'] for span in record['spans']]
+        self.assertEqual(names[0], 'generate')
+        for name in ['load', 'load_yaml:' + conf, 'process_document:pass1', 'import', 'validate',
+                     'emit', 'networkd:eth0', 'nm:eth1', 'write', 'cleanup']:
+            self.assertIn(name, names)
+        self.assertEqual(record['counters']['netdefs'], 2)
+        self.assertGreater(record['counters']['files_written'], 2)
+
+        # unchanged files are not written again
+        p = subprocess.run([exe_generate, '--root-dir', self.workdir.name, '--jobs', '2'], check=True,
+                           stderr=subprocess.PIPE, universal_newlines=True, env=dict(os.environ, NETPLAN_PROFILE='json'))
+        record = json.loads(p.stderr)
+        self.assertNotIn('files_written', record['counters'])
+        self.assertGreater(record['counters']['files_unchanged'], 2)
+        self.assertIn('ovs:eth1', [span['name'] for span in record['spans']])
+
+    def test_jobs_invalid(self):
+        err = self.generate('network:\n  version: 2', extra_args=['--jobs', '0'], expect_fail=True)
+        self.assertIn('invalid number of jobs: 0', err)
+
+    def _validate(self, configs, extra_args=[]):
+        p = subprocess.run([exe_generate, '--validate'] + extra_args + configs, stdout=subprocess.PIPE,
+                           stderr=subprocess.PIPE, universal_newlines=True)
+        return (p.returncode, [json.loads(line) for line in p.stdout.splitlines()])
+
+    def test_validate(self):
+        host = os.path.join(self.workdir.name, 'host1')
+        os.makedirs(os.path.join(host, 'etc', 'netplan'))
+        with open(os.path.join(host, 'etc', 'netplan', 'a.yaml'), 'w') as f:
+            f.write('network:\n  version: 2\n  ethernets:\n    eth0: {dhcp4: true}')
+        with open(os.path.join(host, 'etc', 'netplan', 'b.yaml'), 'w') as f:
+            f.write('network:\n  version: 2\n  bonds:\n    bond0: {interfaces: [eth0]}')
+        good = os.path.join(self.workdir.name, 'good.yaml')
+        with open(good, 'w') as f:
+            f.write('network:\n  version: 2\n  ethernets:\n    eth0: {wakeonlan: true}')
+        bad = os.path.join(self.workdir.name, 'bad.yaml')
+        with open(bad, 'w') as f:
+            f.write('network:\n  version: 2\n  ethernets:\n    "eth0": {dhcp4: "maybe"}')
+        backend = os.path.join(self.workdir.name, 'backend.yaml')
+        with open(backend, 'w') as f:
+            f.write('network:\n  version: 2\n  tunnels:\n'
+                    '    tun0: {mode: isatap, local: 10.10.10.10, remote: 20.20.20.20}')
+        missing = os.path.join(self.workdir.name, 'missing.yaml')
+        configs = [host, good, bad, backend, missing] * 5
+
+        for jobs in ['1', '4']:
+            (code, results) = self._validate(configs, ['--jobs', jobs])
+            self.assertEqual(code, 1)
+            self.assertEqual([r['config'] for r in results], configs)
+            self.assertEqual([r['valid'] for r in results], [True, True, False, False, False] * 5)
+            self.assertNotIn('error', results[0])
+            self.assertNotIn('error', results[1])
+            self.assertIn('bad.yaml:4:21: Error in network definition: invalid boolean value \'maybe\'', results[2]['error'])
+            self.assertIn('"maybe"', results[2]['error'])
+            self.assertIn('tun0: ISATAP tunnel mode is not supported by networkd', results[3]['error'])
+            self.assertIn('missing.yaml', results[4]['error'])
+            self.assertEqual(results[:5], results[5:10])
+        # nothing is written
+        self.assertCountEqual(os.listdir(self.workdir.name), ['host1', 'good.yaml', 'bad.yaml', 'backend.yaml'])
+        self.assertEqual(os.listdir(host), ['etc'])
+
+    def test_validate_warning(self):
+        conf = os.path.join(self.workdir.name, 'a.yaml')
+        with open(conf, 'w') as f:
+            f.write('''network:
+  version: 2
+  ethernets:
+    engreen:
+      addresses: [192.168.22.78/24]
+      gateway4: 192.168.22.1
+    enblue:
+      addresses: [10.49.34.4/16]
+      gateway4: 10.49.2.38''')
+        (code, results) = self._validate([conf])
+        self.assertEqual(code, 0)
+        self.assertTrue(results[0]['valid'])
+        self.assertIn('Conflicting default route declarations for IPv4', results[0]['warning'])
+
+    def test_validate_root_dir(self):
+        os.makedirs(self.confdir)
+        with open(os.path.join(self.confdir, 'a.yaml'), 'w') as f:
+            f.write('network:\n  version: 2\n  ethernets:\n    eth0: {dhcp4: true}')
+        (code, results) = self._validate([], ['--root-dir', self.workdir.name])
+        self.assertEqual(code, 0)
+        self.assertEqual(results, [{'config': self.workdir.name, 'valid': True}])
+        self.assertEqual(os.listdir(self.workdir.name), ['etc'])
+
     def test_help(self):
         conf = os.path.join(self.workdir.name, 'etc', 'netplan', 'a.yaml')
         os.makedirs(os.path.dirname(conf))
@@ -155,6 +287,82 @@ class TestConfigArgs(TestBase):
         subprocess.check_output([generator, '--root-dir', self.workdir.name, outdir, outdir, outdir])
         self.assertTrue(os.path.exists(n))
 
+    def test_systemd_generator_cache(self):
+        conf = os.path.join(self.confdir, 'a.yaml')
+        os.makedirs(os.path.dirname(conf))
+        yaml = '''network:
+  version: 2
+  ethernets:
+    eth0:
+      dhcp4: true
+  wifis:
+    wl0:
+      access-points:
+        "Joe's Home": {password: "s0s3kr1t"}'''
+        with open(conf, 'w') as f:
+            f.write(yaml)
+        outdir = os.path.join(self.workdir.name, 'out')
+        generator = os.path.join(self.workdir.name, 'systemd', 'system-generators', 'netplan')
+        os.makedirs(os.path.dirname(generator))
+        os.symlink(exe_generate, generator)
+        bundle = os.path.join(self.workdir.name, 'var', 'cache', 'netplan', 'generate.bundle')
+        os.makedirs(os.path.dirname(bundle))
+        n = os.path.join(self.workdir.name, 'run', 'systemd', 'network', '10-netplan-eth0.network')
+
+        def boot():
+            # /run and the generator directory start out empty
+            shutil.rmtree(os.path.join(self.workdir.name, 'run'), ignore_errors=True)
+            shutil.rmtree(outdir, ignore_errors=True)
+            os.mkdir(outdir)
+            return subprocess.check_output([generator, '--root-dir', self.workdir.name, outdir, outdir, outdir],
+                                           stderr=subprocess.STDOUT, universal_newlines=True,
+                                           env=dict(os.environ, G_MESSAGES_DEBUG='all'))
+
+        # the first boot generates the configuration and saves the bundle
+        out = boot()
+        self.assertNotIn('Restoring', out)
+        self.assertEqual(os.stat(bundle).st_mode & 0o777, 0o600)
+        tree = self._read_run_tree()
+        self.assertIn(n, tree)
+        # which is kept as is by runs with the same configuration
+        mtime = os.stat(bundle).st_mtime_ns
+        subprocess.check_call([exe_generate, '--root-dir', self.workdir.name])
+        self.assertEqual(os.stat(bundle).st_mtime_ns, mtime)
+
+        # the next boots restore it
+        out = boot()
+        self.assertIn('Restoring', out)
+        self.assertEqual(self._read_run_tree(), tree)
+        self.assertTrue(os.path.islink(os.path.join(
+            outdir, 'multi-user.target.wants', 'systemd-networkd.service')))
+        self.assertTrue(os.path.exists(os.path.join(outdir, 'netplan.stamp')))
+        # the restored state snapshot contains secrets, too
+        snapshot = os.path.join(self.workdir.name, 'run', 'netplan', 'generate.state')
+        self.assertEqual(os.stat(snapshot).st_mode & 0o777, 0o600)
+
+        # a different build of the generator does not use it
+        os.unlink(generator)
+        shutil.copy(exe_generate, generator)
+        out = boot()
+        self.assertIn('Ignoring outdated output bundle', out)
+        self.assertEqual(self._read_run_tree(), tree)
+        self.assertIn('Restoring', boot())
+
+        # a changed configuration is generated again
+        with open(conf, 'w') as f:
+            f.write(yaml.replace('  wifis:', '    eth1: {dhcp6: true}\n  wifis:'))
+        out = boot()
+        self.assertIn('Ignoring outdated output bundle', out)
+        self.assertTrue(os.path.exists(n.replace('eth0', 'eth1')))
+
+        # a broken bundle is not used
+        with open(bundle, 'r+') as f:
+            f.truncate(os.path.getsize(bundle) - 10)
+        out = boot()
+        self.assertIn('Ignoring corrupted output bundle', out)
+        self.assertTrue(os.path.exists(n.replace('eth0', 'eth1')))
+        self.assertIn('Restoring', boot())
+
     def test_systemd_generator_noconf(self):
         outdir = os.path.join(self.workdir.name, 'out')
         os.mkdir(outdir)
@@ -17,9 +17,11 @@
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 import os
+import stat
+import subprocess
 import textwrap
 
-from .base import TestBase, ND_DHCP4, ND_DHCP6, ND_DHCPYES, ND_EMPTY
+from .base import TestBase, exe_generate, ND_DHCP4, ND_DHCP6, ND_DHCPYES, ND_EMPTY
 
 
 class TestNetworkd(TestBase):
@@ -313,6 +315,33 @@ Name=engreen
 LinkLocalAddressing=ipv6
 Address=192.168.14.2/24
 Address=2001:FFfe::1/64
+'''})
+
+    def test_eth_manual_addresses_notation(self):
+        # addresses are stored in binary form, but written as configured
+        self.generate('''network:
+  version: 2
+  ethernets:
+    engreen:
+      addresses:
+        - 10.0.0.1/24
+        - 2001:db8:0::1/64
+        - 2001:db8::2/64
+        - 2001:db8::2/64
+      nameservers:
+        addresses: [8.8.8.8, "2001:4860:4860:0:0:0:0:8888", "2001:4860:4860::8844"]''')
+
+        self.assert_networkd({'engreen.network': '''[Match]
+Name=engreen
+
+[Network]
+LinkLocalAddressing=ipv6
+Address=10.0.0.1/24
+Address=2001:db8:0::1/64
+Address=2001:db8::2/64
+DNS=8.8.8.8
+DNS=2001:4860:4860:0:0:0:0:8888
+DNS=2001:4860:4860::8844
 '''})
 
     def test_eth_manual_addresses_dhcp(self):
@@ -1409,6 +1438,40 @@ LinkLocalAddressing=no
 Bond=bond0
 '''})
 
+    def test_fwdecl_large_file(self):
+        '''Files of 1 MiB or more are parsed in streaming mode'''
+        config = '''network:
+  version: 2
+  bridges:
+    br0:
+      interfaces: ['bond0']
+      dhcp4: true
+  bonds:
+    bond0:
+      interfaces: ['eth0', 'eth1']
+  ethernets:
+    eth0:
+      match:
+        macaddress: 00:01:02:03:04:05
+      set-name: eth0
+      wakeonlan: &wol false
+%s    eth1:
+      match:
+        macaddress: 02:01:02:03:04:05
+      set-name: eth1
+      wakeonlan: *wol
+'''
+        networkd_dir = os.path.join(self.workdir.name, 'run', 'systemd', 'network')
+
+        def networkd_output():
+            return {f: open(os.path.join(networkd_dir, f)).read() for f in os.listdir(networkd_dir)}
+
+        self.generate(config % '')
+        expected = networkd_output()
+        self.assertEqual(len(expected), 7)
+        self.generate(config % (('#' * 79 + '\n') * 14000))
+        self.assertEqual(networkd_output(), expected)
+
     def test_fwdecl_feature_blend(self):
         self.generate('''network:
   version: 2
@@ -1613,6 +1676,176 @@ unmanaged-devices+=interface-name:engreen,interface-name:enblue,''')
 unmanaged-devices+=interface-name:engreen,''')
         self.assert_nm_udev(None)
 
+    def test_incremental_regeneration(self):
+        self.generate('''network:
+  version: 2
+  ethernets:
+    engreen: {dhcp4: true}
+    enblue: {dhcp4: true}
+    enred: {dhcp4: true}''')
+        networkd_dir = os.path.join(self.workdir.name, 'run', 'systemd', 'network')
+        green_ino = os.stat(os.path.join(networkd_dir, '10-netplan-engreen.network')).st_ino
+        blue_ino = os.stat(os.path.join(networkd_dir, '10-netplan-enblue.network')).st_ino
+
+        self.generate('''network:
+  version: 2
+  ethernets:
+    engreen: {dhcp4: true}
+    enblue: {dhcp6: true}''')
+
+        self.assert_networkd({'engreen.network': ND_DHCP4 % 'engreen',
+                              'enblue.network': ND_DHCP6 % 'enblue'})
+        # unchanged files are not rewritten
+        self.assertEqual(os.stat(os.path.join(networkd_dir, '10-netplan-engreen.network')).st_ino, green_ino)
+        self.assertNotEqual(os.stat(os.path.join(networkd_dir, '10-netplan-enblue.network')).st_ino, blue_ino)
+        with open(os.path.join(self.workdir.name, 'run', 'netplan', 'generate.manifest')) as f:
+            manifest = f.read()
+        self.assertRegex(manifest, r'[0-9a-f]{64} engreen \S*/run/systemd/network/10-netplan-engreen.network\n')
+        self.assertRegex(manifest, r'[0-9a-f]{64} - \S*/run/systemd/system/netplan-ovs-cleanup.service\n')
+        self.assertNotIn('enred', manifest)
+
+    def test_incremental_regeneration_udev_replaced(self):
+        config = '''network:
+  version: 2
+  ethernets:
+    def1:
+      match:
+        driver: %s
+      set-name: lom1'''
+        self.generate(config % 'ixgbe')
+        link = os.path.join(self.workdir.name, 'run', 'systemd', 'network', '10-netplan-def1.link')
+        rules = os.path.join(self.workdir.name, 'run', 'udev', 'rules.d', '99-netplan-def1.rules')
+        with open(link) as old_link, open(rules) as old_rules:
+            self.generate(config % 'e1000')
+            # udevd might read the files at any time, so they must be replaced
+            # atomically, never rewritten in place, even on tmpfs
+            self.assertIn('Driver=ixgbe', old_link.read())
+            self.assertIn('"ixgbe"', old_rules.read())
+        with open(link) as f:
+            self.assertIn('Driver=e1000', f.read())
+        with open(rules) as f:
+            self.assertIn('"e1000"', f.read())
+
+    def test_change_set(self):
+        changes_path = os.path.join(self.workdir.name, 'run', 'netplan', 'generate.changes')
+        self.generate('''network:
+  version: 2
+  ethernets:
+    engreen: {dhcp4: true}
+    enblue: {dhcp4: true}''')
+        # the previous output is unknown
+        self.assertFalse(os.path.exists(changes_path))
+
+        self.generate('''network:
+  version: 2
+  ethernets:
+    engreen: {dhcp4: true}
+    enblue: {dhcp6: true}
+    enred: {dhcp4: true}''')
+        with open(changes_path) as f:
+            changes = f.read()
+        self.assertIn('changed enblue {}/run/systemd/network/10-netplan-enblue.network\n'.format(self.workdir.name), changes)
+        self.assertIn('added enred {}/run/systemd/network/10-netplan-enred.network\n'.format(self.workdir.name), changes)
+        self.assertNotIn('engreen', changes)
+
+        # changes are accumulated until they are consumed by 'netplan apply'
+        self.generate('''network:
+  version: 2
+  ethernets:
+    engreen: {dhcp4: true}
+    enblue: {dhcp6: true}
+    enred: {dhcp6: true}''')
+        with open(changes_path) as f:
+            changes = f.read()
+        self.assertIn('changed enblue {}/run/systemd/network/10-netplan-enblue.network\n'.format(self.workdir.name), changes)
+        self.assertIn('added enred {}/run/systemd/network/10-netplan-enred.network\n'.format(self.workdir.name), changes)
+
+        os.unlink(changes_path)
+        self.generate('''network:
+  version: 2
+  ethernets:
+    engreen: {dhcp4: true}
+    enred: {dhcp6: true}''')
+        with open(changes_path) as f:
+            changes = f.read()
+        self.assertIn('removed enblue {}/run/systemd/network/10-netplan-enblue.network\n'.format(self.workdir.name), changes)
+        self.assertNotIn(' engreen ', changes)
+        self.assertNotIn(' enred ', changes)
+
+    def test_state_snapshot(self):
+        snapshot_path = os.path.join(self.workdir.name, 'run', 'netplan', 'generate.state')
+        self.generate('''network:
+  version: 2
+  renderer: NetworkManager
+  ethernets:
+    engreen: {dhcp4: true}''')
+        with open(snapshot_path) as f:
+            snapshot = f.read()
+        self.assertTrue(snapshot.startswith('# netplan-state 2\n'))
+        self.assertRegex(snapshot, r'# [0-9]+\.[0-9]{9} [0-9]+\.[0-9]{9} [0-9]+ [0-9]+ \S*/etc/netplan/a.yaml\n')
+        self.assertIn('renderer: NetworkManager', snapshot)
+        self.assertIn('engreen:', snapshot)
+
+        # not written for explicitly given input files
+        self.generate(None, extra_args=[os.path.join(self.confdir, 'a.yaml')])
+        self.assertFalse(os.path.exists(snapshot_path))
+
+    def test_state_snapshot_reused(self):
+        snapshot_path = os.path.join(self.workdir.name, 'run', 'netplan', 'generate.state')
+        self.generate('''network:
+  version: 2
+  ethernets:
+    engreen: {dhcp4: true}''')
+        # an up to date snapshot (e.g. written by the netplan D-Bus service
+        # from its resident state) is used instead of parsing the YAML files
+        with open(snapshot_path) as f:
+            snapshot = f.read()
+        self.assertIn('dhcp4: true', snapshot)
+        with open(snapshot_path, 'w') as f:
+            f.write(snapshot.replace('dhcp4: true', 'dhcp6: true'))
+        subprocess.check_call([exe_generate, '--root-dir', self.workdir.name])
+        self.assert_networkd({'engreen.network': ND_DHCP6 % 'engreen'})
+
+        # an outdated one is ignored
+        self.generate('''network:
+  version: 2
+  ethernets:
+    engreen: {dhcp4: yes}''')
+        self.assert_networkd({'engreen.network': ND_DHCP4 % 'engreen'})
+
+    def test_state_snapshot_permissions(self):
+        snapshot_path = os.path.join(self.workdir.name, 'run', 'netplan', 'generate.state')
+        self.generate('''network:
+  version: 2
+  wifis:
+    wl0:
+      access-points:
+        "Joe's Home":
+          password: "s0s3kr1t"''')
+        # the state contains secrets, so it must only be readable by root
+        self.assertEqual(stat.S_IMODE(os.stat(snapshot_path).st_mode), 0o600)
+        with open(snapshot_path) as f:
+            self.assertIn('s0s3kr1t', f.read())
+
+    def test_failed_regeneration_keeps_output(self):
+        self.generate('''network:
+  version: 2
+  ethernets:
+    engreen: {dhcp4: true}''')
+        err = self.generate('''network:
+  version: 2
+  ethernets:
+    engreen: {dhcp6: true}
+  bridges:
+    br0:
+      openvswitch:
+        controller:
+          addresses: [ptcp]''', expect_fail=True)
+        self.assertIn("Unsupported OVS controller target: ptcp", err)
+        # output is written in one batch, after everything has been rendered
+        self.assert_networkd({'engreen.network': ND_DHCP4 % 'engreen'})
+        self.assertFalse(os.path.exists(os.path.join(self.workdir.name, 'run', 'netplan', 'generate.manifest')))
+
     def test_ref(self):
         self.generate('''network:
   version: 2
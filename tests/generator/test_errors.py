@@ -551,6 +551,18 @@ class TestConfigErrors(TestBase):
         self.assertIn("Conflicting default route declarations for IPv4 (table: main, metric: default)", err)
         self.assertIn("engreen", err)
 
+    def test_default_routes_per_table_and_family(self):
+        ethernets = ''.join('''
+    eth%d:
+      addresses: [10.%d.0.2/24, "2001:db8:%d::2/64"]
+      routes:
+      - {to: default, via: 10.%d.0.1, table: %d}
+      - {to: "::/0", via: "2001:db8:%d::1", table: %d}''' % (i, i, i, i, 100 + i, i, 100 + i) for i in range(64))
+        err = self.generate('''network:
+  version: 2
+  ethernets:''' + ethernets, expect_fail=False)
+        self.assertNotIn("Problem encountered while validating default route consistency", err)
+
     def test_invalid_nameserver_ipv4(self):
         for a in ['300.400.1.1', '1.2.3', '192.168.14.1/24']:
             err = self.generate('''network:
@@ -608,6 +620,15 @@ class TestConfigErrors(TestBase):
     ena: {id: 1, link: en1}''', expect_fail=True)
         self.assertIn("ena: interface 'en1' is not defined", err)
 
+    def test_vlan_unknown_link_large_file(self):
+        err = self.generate('''network:
+  version: 2
+  vlans:
+    ena: {id: 1, link: en1}
+''' + ('#' * 79 + '\n') * 14000 + '''  ethernets:
+    en0: {}''', expect_fail=True)
+        self.assertIn("ena: interface 'en1' is not defined", err)
+
     def test_vlan_unknown_renderer(self):
         err = self.generate('''network:
   version: 2
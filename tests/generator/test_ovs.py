@@ -17,6 +17,8 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+import os
+
 from .base import TestBase, ND_EMPTY, ND_WITHIP, ND_DHCP4, ND_DHCP6, \
                             OVS_PHYSICAL, OVS_VIRTUAL, \
                             OVS_BR_EMPTY, OVS_BR_DEFAULT, \
@@ -26,6 +28,29 @@ from .base import TestBase, ND_EMPTY, ND_WITHIP, ND_DHCP4, ND_DHCP6, \
 class TestOpenVSwitch(TestBase):
     '''OVS output'''
 
+    def test_bridge_single_transaction(self):
+        self.generate('''network:
+  version: 2
+  ethernets:
+    eth0: {}
+  bridges:
+    ovs0:
+      interfaces: [eth0]
+      openvswitch: {}
+''')
+        with open(os.path.join(self.workdir.name, 'run/systemd/system/netplan-ovs-ovs0.service')) as f:
+            exec_lines = [line for line in f.read().splitlines() if line.startswith('ExecStart=')]
+        # all settings of the bridge are applied by one ovs-vsctl call
+        self.assertEqual(exec_lines, ['ExecStart=/usr/bin/ovs-vsctl --may-exist add-br ovs0 -- '
+                                      '--may-exist add-port ovs0 eth0 -- '
+                                      'set Bridge ovs0 external-ids:netplan=true -- '
+                                      'set-fail-mode ovs0 standalone -- '
+                                      'set Bridge ovs0 external-ids:netplan/global/set-fail-mode=standalone -- '
+                                      'set Bridge ovs0 mcast_snooping_enable=false -- '
+                                      'set Bridge ovs0 external-ids:netplan/mcast_snooping_enable=false -- '
+                                      'set Bridge ovs0 rstp_enable=false -- '
+                                      'set Bridge ovs0 external-ids:netplan/rstp_enable=false'])
+
     def test_interface_external_ids_other_config(self):
         self.generate('''network:
   version: 2
@@ -16,6 +16,8 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+import os
+
 from .base import TestBase
 
 
@@ -249,6 +251,67 @@ method=ignore
 [proxy]
 '''})
 
+    def test_passthrough_escaping_and_unchanged_override(self):
+        self.generate(r'''network:
+  ethernets:
+    eth0:
+      renderer: NetworkManager
+      networkmanager:
+        passthrough:
+          connection.stable-id: " my\\id"
+          ipv4.method: link-local
+          ipv6.method: auto''')
+
+        self.assert_nm({'eth0': r'''[connection]
+id=netplan-eth0
+type=ethernet
+interface-name=eth0
+#Netplan: passthrough setting
+stable-id=\smy\\id
+
+[ethernet]
+wake-on-lan=0
+
+[ipv4]
+method=link-local
+
+[ipv6]
+#Netplan: passthrough override
+method=auto
+'''})
+
+    def test_passthrough_escaping_like_gkeyfile(self):
+        values = {'a': '\\ x', 'b': 'a\n b', 'c': 'a\r b', 'd': '  \\\n\t x'}
+        self.generate('''network:
+  ethernets:
+    eth0:
+      renderer: NetworkManager
+      networkmanager:
+        passthrough:
+          user.a: "\\\\ x"
+          user.b: "a\\n b"
+          user.c: "a\\r b"
+          user.d: "  \\\\\\n\\t x"''')
+
+        with open(os.path.join(self.workdir.name, 'run/NetworkManager/system-connections/netplan-eth0.nmconnection')) as f:
+            lines = f.read().splitlines()
+        # a space after an escaped backslash, newline or carriage return is not leading
+        expected = {'a': r'a=\\ x', 'b': r'b=a\n b', 'c': r'c=a\r b', 'd': 'd=\\s\\s\\\\\\n\t x'}
+        for line in expected.values():
+            self.assertIn(line, lines)
+
+        # and is escaped byte for byte like GKeyFile does
+        try:
+            import gi
+            gi.require_version('GLib', '2.0')
+            from gi.repository import GLib
+        except (ImportError, ValueError):  # pragma: nocover
+            return
+        for key, value in values.items():
+            kf = GLib.KeyFile()
+            kf.set_string('user', key, value)
+            self.assertIn(kf.to_data()[0].splitlines()[1], lines)
+
     def test_passthrough_interface_rename_existing_id(self):
         self.generate('''network:
   version: 2
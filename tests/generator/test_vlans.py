@@ -71,6 +71,27 @@ Id=3
 unmanaged-devices+=interface-name:en1,interface-name:enblue,interface-name:enred,interface-name:engreen,''')
         self.assert_nm_udev(None)
 
+    def test_vlan_forward_reference(self):
+        self.generate('''network:
+  version: 2
+  vlans:
+    enblue:
+      id: 1
+      link: en1
+      addresses: [1.2.3.4/24]
+  ethernets:
+    en1: {}''')
+
+        self.assert_networkd({'en1.network': '''[Match]
+Name=en1
+
+[Network]
+LinkLocalAddressing=ipv6
+VLAN=enblue
+''',
+                              'enblue.netdev': ND_VLAN % ('enblue', 1),
+                              'enblue.network': ND_WITHIP % ('enblue', '1.2.3.4/24')})
+
     def test_vlan_sriov(self):
         # we need to make sure renderer: sriov vlans are not saved as part of
         # the NM/networkd config
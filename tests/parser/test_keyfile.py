@@ -21,7 +21,7 @@ import os
 import ctypes
 import ctypes.util
 
-from .base import TestKeyfileBase
+from .base import TestKeyfileBase, capture_stderr
 
 rootdir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
 exe_cli = os.path.join(rootdir, 'src', 'netplan.script')
@@ -1133,3 +1133,73 @@ route4=5:6:7:8:9:0:1:2/62
           ipv6.dns-search: "wallaceandgromit.com;"
           proxy._: ""
 '''.format(UUID, UUID)})
+
+    def _keyfile_dir(self, count):
+        path = os.path.join(self.workdir.name, 'etc/NetworkManager/system-connections')
+        os.makedirs(path)
+        for i in range(count):
+            uuid = '{:08x}-226d-4f82-a485-b7ff83b9607f'.format(i)
+            with open(os.path.join(path, 'conn{:03d}.nmconnection'.format(i)), 'w') as f:
+                f.write('''[connection]
+id=Conn {0}
+uuid={1}
+type=ethernet
+interface-name=eth{0}
+
+[ipv4]
+method=manual
+address1=10.0.{0}.2/24,10.0.{0}.1
+route1=10.{0}.0.0/16,10.0.{0}.254,3
+'''.format(i, uuid))
+        return path
+
+    def _write_state(self, npp, name):
+        lib.netplan_state_new.restype = ctypes.c_void_p
+        lib.netplan_state_import_parser_results.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p]
+        lib.netplan_state_write_yaml.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_void_p]
+        np_state = ctypes.c_void_p(lib.netplan_state_new())
+        self.assertTrue(lib.netplan_state_import_parser_results(np_state, npp, None))
+        self.assertTrue(lib.netplan_state_write_yaml(np_state, name.encode(), self.workdir.name.encode(), None))
+        lib.netplan_state_clear(ctypes.byref(np_state))
+        return os.path.join(self.confdir, name)
+
+    def test_keyfile_dir_import(self):
+        path = self._keyfile_dir(24)
+        lib.netplan_parser_new.restype = ctypes.c_void_p
+        lib.netplan_parser_load_keyfile.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_void_p]
+        lib.netplan_parser_load_keyfile_dir.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint, ctypes.c_void_p]
+
+        # one file after the other
+        npp = ctypes.c_void_p(lib.netplan_parser_new())
+        for name in sorted(os.listdir(path)):
+            self.assertTrue(lib.netplan_parser_load_keyfile(npp, os.path.join(path, name).encode(), None))
+        with open(self._write_state(npp, '90-serial.yaml')) as f:
+            serial = f.read()
+        lib.netplan_parser_clear(ctypes.byref(npp))
+
+        # all at once, on a thread pool
+        npp = ctypes.c_void_p(lib.netplan_parser_new())
+        self.assertTrue(lib.netplan_parser_load_keyfile_dir(npp, path.encode(), 4, None))
+        with open(self._write_state(npp, '90-parallel.yaml')) as f:
+            parallel = f.read()
+        lib.netplan_parser_clear(ctypes.byref(npp))
+
+        self.assertEqual(serial, parallel)
+        self.assertLess(parallel.index('NM-00000000-'), parallel.index('NM-00000017-'))
+        self.assertIn('to: "10.23.0.0/16"', parallel)
+
+    def test_keyfile_dir_import_invalid(self):
+        path = self._keyfile_dir(3)
+        with open(os.path.join(path, 'conn001.nmconnection'), 'w') as f:
+            f.write('[connection]\ntype=ethernet')
+        lib.netplan_parser_new.restype = ctypes.c_void_p
+        lib.netplan_parser_load_keyfile_dir.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint, ctypes.c_void_p]
+        npp = ctypes.c_void_p(lib.netplan_parser_new())
+        with capture_stderr() as outf:
+            self.assertFalse(lib.netplan_parser_load_keyfile_dir(npp, path.encode(), 0, None))
+            self.assertFalse(lib.netplan_parser_load_keyfile_dir(npp, b'/nonexistent', 0, None))
+            with open(outf.name, 'r') as f:
+                self.assertIn('netplan: Keyfile: cannot find connection.uuid', f.read())
+        # none of the files got imported
+        self.assertFalse(os.path.exists(self._write_state(npp, '90-none.yaml')))
+        lib.netplan_parser_clear(ctypes.byref(npp))
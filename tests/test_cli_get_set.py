@@ -339,6 +339,106 @@ class TestSet(unittest.TestCase):
             self.assertIn('  version: 2', out)
             self.assertIn('  renderer: NetworkManager', out)
 
+    def test_set_global_same_file(self):
+        some_file = os.path.join(self.workdir.name, 'etc', 'netplan', 'some-file.yaml')
+        with open(some_file, 'w') as f:
+            f.write('network: {ethernets: {eth0: {dhcp4: true}}}')
+        self._set(['network={renderer: networkd, ethernets: {eth0: {dhcp6: true}}}'])
+        self.assertFalse(os.path.isfile(self.path))
+        with open(some_file, 'r') as f:
+            self.assertEqual('network:\n  ethernets:\n    eth0:\n      dhcp4: true\n      dhcp6: true\n'
+                             '  renderer: networkd\n', f.read())
+
+    def test_set_yaml_types(self):
+        self._set(['ethernets.eth0={dhcp4: on, dhcp6: "off", mtu: 0x5dc, ipv6-mtu: 1_280, '
+                   'macaddress: 00:11:22:33:44:55, addresses: ["1.2.3.4/24", \'5.6.7.8/24\'], '
+                   'set-name: ~, optional: Off}'])
+        with open(self.path, 'r') as f:
+            self.assertEqual('''network:
+  ethernets:
+    eth0:
+      addresses:
+      - 1.2.3.4/24
+      - 5.6.7.8/24
+      dhcp4: true
+      dhcp6: 'off'
+      ipv6-mtu: 1280
+      macaddress: 00:11:22:33:44:55
+      mtu: 1500
+      optional: false
+''', f.read())
+
+    def test_set_keeps_unknown_settings(self):
+        with open(self.path, 'w') as f:
+            f.write('''network:
+  ethernets:
+    eth0:
+      renderer: NetworkManager
+      networkmanager:
+        uuid: 6b2e9f0c-5a61-4f55-8e36-0c0d6c1f5c7e
+        passthrough:
+          ethernet.wake-on-lan: "0"
+          ipv4.dns-priority: 010''')
+        self._set(['ethernets.eth0.dhcp4=true'])
+        with open(self.path, 'r') as f:
+            self.assertEqual('''network:
+  ethernets:
+    eth0:
+      dhcp4: true
+      networkmanager:
+        passthrough:
+          ethernet.wake-on-lan: '0'
+          ipv4.dns-priority: 8
+        uuid: 6b2e9f0c-5a61-4f55-8e36-0c0d6c1f5c7e
+      renderer: NetworkManager
+''', f.read())
+
+    def test_set_invalid_yaml_value(self):
+        with self.assertRaises(Exception) as context:
+            self._set(['ethernets.eth0={dhcp4: [true}'])
+        self.assertIn('value:1:', str(context.exception))
+        self.assertFalse(os.path.isfile(self.path))
+
+    def test_set_invalid_yaml_key(self):
+        with self.assertRaises(Exception) as context:
+            self._set(['ethernets.eth0={[dhcp4]: true}'])
+        self.assertIn('expected scalar key', str(context.exception))
+        self.assertFalse(os.path.isfile(self.path))
+
+    def test_set_invalid_yaml_nesting(self):
+        with self.assertRaises(Exception) as context:
+            self._set(['ethernets.eth0=' + '[' * 100 + ']' * 100])
+        self.assertIn('nested too deeply', str(context.exception))
+        self.assertFalse(os.path.isfile(self.path))
+
+    def test_set_invalid_devtype(self):
+        with self.assertRaises(Exception) as context:
+            self._set(['ethernets=eth0'])
+        self.assertIn('Invalid value specified for \'ethernets\'', str(context.exception))
+        with self.assertRaises(Exception) as context:
+            self._set(['network=[ethernets]'])
+        self.assertIn('Invalid value specified for \'network\'', str(context.exception))
+        self.assertFalse(os.path.isfile(self.path))
+
+    def test_set_invalid_file(self):
+        with open(self.path, 'w') as f:
+            f.write('network: {ethernets: {eth0: {dhcp4: true}')
+        with self.assertRaises(Exception) as context:
+            self._set(['ethernets.eth0.dhcp4=false', '--origin-hint', '70-netplan-set'])
+        self.assertIn('70-netplan-set.yaml', str(context.exception))
+        with open(self.path, 'w') as f:
+            f.write('- network')
+        with self.assertRaises(Exception) as context:
+            self._set(['ethernets.eth0.dhcp4=false'])
+        self.assertIn('70-netplan-set.yaml: expected mapping', str(context.exception))
+        with open(self.path, 'w') as f:
+            f.write('foo: bar\nnetwork: {ethernets: {eth0: {dhcp4: true}}}')
+        with self.assertRaises(Exception) as context:
+            self._set(['ethernets.eth0=null'])
+        self.assertIn('Invalid input', str(context.exception))
+        with open(self.path, 'r') as f:
+            self.assertIn('foo: bar', f.read())
+
 
 class TestGet(unittest.TestCase):
     '''Test netplan get'''
@@ -439,3 +539,79 @@ pin: 1234''', out)
             f.write('network:\n  version: 2\n  renderer: NetworkManager')
         out = self._get(['network'])
         self.assertEquals('renderer: NetworkManager\nversion: 2\n', out)
+
+    def test_get_multiple_keys(self):
+        with open(self.path, 'w') as f:
+            f.write('''network:
+  version: 2
+  ethernets:
+    eth0: {dhcp4: yes}
+    eth1: {addresses: [1.2.3.4/24]}''')
+        out = self._get(['ethernets.eth1.addresses', 'ethernets.eth0', 'ethernets.eth2', 'version'])
+        self.assertEquals('- 1.2.3.4/24\ndhcp4: true\nnull\n2\n', out)
+
+    def test_get_merged_files(self):
+        with open(self.path, 'w') as f:
+            f.write('''network:
+  version: 2
+  renderer: networkd
+  ethernets:
+    eth0:
+      dhcp4: yes
+      nameservers: {addresses: [8.8.8.8], search: [lab]}
+  openvswitch:
+    ports: [[patch0-1, patch1-0]]
+  unknown: {foo: bar}
+other: true''')
+        with open(os.path.join(self.workdir.name, 'etc', 'netplan', '10-override.yaml'), 'w') as f:
+            f.write('''network:
+  renderer: NetworkManager
+  ethernets:
+    eth0:
+      nameservers: {addresses: [1.1.1.1]}
+      dhcp6: true
+      macaddress: ""
+  vlans:
+    vlan1: {id: 1, link: eth0}''')
+        # shadowed by /etc/netplan/10-override.yaml
+        os.makedirs(os.path.join(self.workdir.name, 'lib', 'netplan'))
+        with open(os.path.join(self.workdir.name, 'lib', 'netplan', '10-override.yaml'), 'w') as f:
+            f.write('network: {ethernets: {eth2: {dhcp4: true}}}')
+        # settings of a definition are replaced key by key, rather than merged
+        self.assertEquals(self._get([]), '''network:
+  ethernets:
+    eth0:
+      dhcp4: true
+      dhcp6: true
+      nameservers:
+        addresses:
+        - 1.1.1.1
+  openvswitch:
+    ports:
+    - - patch0-1
+      - patch1-0
+  ovs_ports:
+    patch0-1:
+      peer: patch1-0
+    patch1-0:
+      peer: patch0-1
+  renderer: NetworkManager
+  version: 2
+  vlans:
+    vlan1:
+      id: 1
+      link: eth0
+''')
+        self.assertEquals(self._get(['ethernets.eth0.dhcp4.foo', 'ethernets.eth2', 'unknown']), 'true\nnull\nnull\n')
+
+    def test_get_no_files(self):
+        self.assertEquals(self._get([]), '{}\n')
+        self.assertEquals(self._get(['network']), 'null\n')
+
+    def test_get_invalid_yaml(self):
+        with open(self.path, 'w') as f:
+            f.write('network: {ethernets: {eth0: {dhcp4: yes}}')
+        with self.assertLogs() as cm, self.assertRaises(SystemExit) as e:
+            self._get(['ethernets'])
+        self.assertEqual(e.exception.code, 1)
+        self.assertIn('00-config.yaml', cm.output[0])
@@ -26,6 +26,7 @@ import tempfile
 from unittest.mock import patch
 from netplan.cli.commands.apply import NetplanApply
 from netplan.cli.commands.try_command import NetplanTry
+from netplan.configmanager import ConfigManager
 
 
 class TestCLI(unittest.TestCase):
@@ -92,6 +93,67 @@ class TestCLI(unittest.TestCase):
             self.assertEqual(ctx.output, ['WARNING:root:Cannot clear virtual links: no network interfaces provided.'])
         mock.assert_not_called()
 
+    @patch('netplan.cli.utils.networkd_match_names')
+    def test_changed_networkd_interfaces(self, mock):
+        mock.return_value = {'eth0'}
+        changes = {'/run/systemd/network/10-netplan-eth0.network': ('changed', 'eth0'),
+                   '/run/systemd/network/10-netplan-br0.network': ('removed', 'br0'),
+                   '/run/systemd/network/10-netplan-bond0.netdev': ('added', 'bond0'),
+                   '/run/systemd/network/10-netplan-eth1.link': ('changed', 'eth1'),
+                   '/run/systemd/system/netplan-wpa-wlan0.service': ('changed', 'wlan0'),
+                   '/run/NetworkManager/system-connections/netplan-eth2.nmconnection': ('changed', 'eth2')}
+        res = NetplanApply.changed_networkd_interfaces(changes, ['eth0', 'br0', 'eth2'])
+        self.assertEqual(res, {'eth0', 'br0'})
+        mock.assert_called_once_with('/run/systemd/network/10-netplan-eth0.network')
+
+    @patch('netplan.cli.utils.networkd_match_names')
+    def test_changed_networkd_interfaces_unknown(self, mock):
+        mock.return_value = None
+        changes = {'/run/systemd/network/10-netplan-eth0.network': ('changed', 'eth0')}
+        self.assertIsNone(NetplanApply.changed_networkd_interfaces(changes, ['eth0']))
+        # the interface of a removed netdef is gone already
+        changes = {'/run/systemd/network/10-netplan-eth1.network': ('removed', 'eth1')}
+        self.assertIsNone(NetplanApply.changed_networkd_interfaces(changes, ['eth0']))
+
+    def test_changed_nm_interfaces(self):
+        changes = {'/run/NetworkManager/system-connections/netplan-eth0.nmconnection': ('removed', 'eth0'),
+                   '/run/systemd/network/10-netplan-eth1.network': ('changed', 'eth1')}
+        old = {'/run/NetworkManager/system-connections/netplan-eth0.nmconnection': {'eth0'},
+               '/run/NetworkManager/system-connections/netplan-eth2.nmconnection': {'eth2'}}
+        self.assertEqual(NetplanApply.changed_nm_interfaces(changes, old, ['eth0', 'eth1', 'eth2']), {'eth0'})
+        changes['/run/NetworkManager/conf.d/netplan.conf'] = ('changed', None)
+        self.assertIsNone(NetplanApply.changed_nm_interfaces(changes, old, ['eth0', 'eth1', 'eth2']))
+
+    def test_changed_units(self):
+        changes = {'/run/systemd/system/netplan-ovs-cleanup.service': ('changed', None),
+                   '/run/systemd/system/netplan-ovs-br0.service': ('added', 'br0'),
+                   '/run/systemd/system/systemd-networkd.service.wants/netplan-ovs-br0.service': ('added', 'br0'),
+                   '/run/systemd/system/netplan-wpa-wlan0.service': ('removed', 'wlan0')}
+        self.assertEqual(NetplanApply.changed_units(changes, 'netplan-ovs-*.service'), ['netplan-ovs-br0.service'])
+        self.assertEqual(NetplanApply.changed_units(changes, 'netplan-wpa-*.service'), ['netplan-wpa-wlan0.service'])
+        self.assertEqual(NetplanApply.changed_units({}, 'netplan-wpa-*.service'), [])
+
+    @patch('netplan.cli.utils.netplan_get_interface_mapping')
+    def test_process_link_changes_prefix(self, mock):
+        os.makedirs(os.path.join(self.tmproot, 'etc', 'netplan'))
+        with open(os.path.join(self.tmproot, 'etc', 'netplan', 'test.yaml'), 'w') as f:
+            f.write('''network:
+  ethernets:
+    eth0:
+      match: {macaddress: "00:11:22:33:44:55"}
+      set-name: lan0
+    eth1:
+      match: {name: "enp*"}
+      set-name: wan0''')
+        config_manager = ConfigManager(prefix=self.tmproot)
+        self.addCleanup(config_manager.cleanup)
+        config_manager.parse()
+        mock.return_value = {'eth0': ['enp1s0'], 'eth1': ['enp2s0', 'enp3s0']}
+        res = NetplanApply.process_link_changes(['enp1s0', 'enp2s0', 'enp3s0'], config_manager)
+        # matched against the configuration in the given root directory
+        mock.assert_called_once_with(['enp1s0', 'enp2s0', 'enp3s0'], self.tmproot)
+        self.assertEqual(res, {'enp1s0': {'name': 'lan0'}})
+
     def test_netplan_try_ready_stamp(self):
         stamp_file = os.path.join(self.tmproot, 'run', 'netplan', 'netplan-try.ready')
         cmd = NetplanTry()
@@ -158,6 +158,18 @@ class TestConfigManager(unittest.TestCase):
         self.assertIn('bond6', self.configmanager.virtual_interfaces)
         self.assertIn('he-ipv6', self.configmanager.virtual_interfaces)
 
+    def test_parse_unchanged(self):
+        self.configmanager.parse()
+        self.configmanager.network['ethernets'] = {}
+        # not parsed again, as nothing changed
+        self.configmanager.parse()
+        self.assertEqual({}, self.configmanager.ethernets)
+        with open(os.path.join(self.workdir.name, "etc/netplan/zz.yaml"), 'w') as fd:
+            print('network: {ethernets: {ethnew: {}}}', file=fd)
+        self.configmanager.parse()
+        self.assertIn('eth0', self.configmanager.ethernets)
+        self.assertIn('ethnew', self.configmanager.ethernets)
+
     def test_parse_merging(self):
         self.configmanager.parse(extra_config=[os.path.join(self.workdir.name, "newfile_merging.yaml")])
         self.assertIn('eth0', self.configmanager.ethernets)
@@ -53,7 +53,7 @@ class MockSRIOVOpen():
         self.open.return_value.write.side_effect = sriov_write
 
 
-def mock_set_counts(interfaces, config_manager, vf_counts, active_vfs, active_pfs):
+def mock_set_counts(interfaces, config_manager, vf_counts, active_vfs, active_pfs, mapping=None, inventory=None):
     counts = {'enp1': 2, 'enp2': 1}
     vfs = {'enp1s16f1': None, 'enp1s16f2': None, 'customvf1': None}
     pfs = {'enp1': 'enp1', 'enpx': 'enp2'}
@@ -258,6 +258,54 @@ class TestSRIOV(unittest.TestCase):
         self.assertIn('matched more than one interface for a PF device: enpx',
                       str(e.exception))
 
+    @patch('netplan.cli.utils.get_interface_driver_name')
+    @patch('netplan.cli.utils.get_interface_macaddress')
+    def test_get_vf_count_and_functions_mapping(self, gim, gidn):
+        with open(os.path.join(self.workdir.name, "etc/netplan/test.yaml"), 'w') as fd:
+            print('''network:
+  version: 2
+  renderer: networkd
+  ethernets:
+    enp1:
+      mtu: 9000
+    enp2:
+      match:
+        driver: foo
+    enpx:
+      match:
+        name: enp[4-5]
+    enpy:
+      match:
+        name: enp[6-7]
+      virtual-function-count: 4
+    enp1s16f1:
+      link: enp1
+    enp2s16f1:
+      link: enp2
+    enpxs16f1:
+      link: enpx
+''', file=fd)
+        self.configmanager.parse()
+        interfaces = ['enp1', 'enp2', 'enp5', 'enp6']
+        vf_counts = defaultdict(int)
+        vfs = {}
+        pfs = {}
+
+        # the matching is done by the match engine already
+        sriov.get_vf_count_and_functions(interfaces, self.configmanager, vf_counts, vfs, pfs,
+                                         mapping={'enp1': ['enp1'], 'enp2': ['enp2'], 'enpy': ['enp6']})
+        self.assertDictEqual(vf_counts, {'enp1': 1, 'enp2': 1, 'enp6': 4})
+        self.assertDictEqual(vfs, {'enp1s16f1': None, 'enp2s16f1': None})
+        self.assertDictEqual(pfs, {'enp1': 'enp1', 'enp2': 'enp2', 'enpy': 'enp6'})
+        gim.assert_not_called()
+        gidn.assert_not_called()
+
+        with self.assertRaises(ConfigurationError) as e:
+            sriov.get_vf_count_and_functions(interfaces, self.configmanager, defaultdict(int), {}, {},
+                                             mapping={'enp1': ['enp1'], 'enp2': ['enp2', 'enp6']})
+        self.assertIn('matched more than one interface for a PF device: enp2',
+                      str(e.exception))
+
     @patch('netplan.cli.utils.get_interface_driver_name')
     @patch('netplan.cli.utils.get_interface_macaddress')
     def test_get_vf_count_and_functions_not_enough_explicit(self, gim, gidn):
@@ -398,50 +446,65 @@ class TestSRIOV(unittest.TestCase):
                 self.assertIn('could not determine vendor and device ID of enp1',
                               str(e.exception))
 
-    @patch('subprocess.check_call')
-    def test_apply_vlan_filter_for_vf(self, check_call):
+    @patch('netplan.cli.utils.ip_batch')
+    def test_apply_vlan_filters_for_vfs(self, ip_batch):
         self._prepare_sysfs_dir_structure()
 
-        sriov.apply_vlan_filter_for_vf('enp2', 'enp2s16f1', 'vlan10', 10, prefix=self.workdir.name)
+        sriov.apply_vlan_filters_for_vfs([('enp2', 'enp2s16f1', 'vlan10', 10)], prefix=self.workdir.name)
 
-        self.assertEqual(check_call.call_count, 1)
-        self.assertListEqual(check_call.call_args[0][0],
-                             ['ip', 'link', 'set', 'dev', 'enp2',
-                              'vf', '3', 'vlan', '10'])
+        ip_batch.assert_called_once_with(['link set dev enp2 vf 3 vlan 10'], force=True)
 
-    @patch('subprocess.check_call')
-    def test_apply_vlan_filter_for_vf_failed_no_index(self, check_call):
+    @patch('netplan.cli.utils.ip_batch')
+    def test_apply_vlan_filters_for_vfs_failed_no_index(self, ip_batch):
         self._prepare_sysfs_dir_structure()
         # we remove the PF -> VF link, simulating a system error
         os.unlink(os.path.join(self.workdir.name, 'sys/class/net/enp2/device/virtfn3'))
 
         with self.assertRaises(RuntimeError) as e:
-            sriov.apply_vlan_filter_for_vf('enp2', 'enp2s16f1', 'vlan10', 10, prefix=self.workdir.name)
+            sriov.apply_vlan_filters_for_vfs([('enp2', 'enp2s16f1', 'vlan10', 10)], prefix=self.workdir.name)
 
         self.assertIn('could not determine the VF index for enp2s16f1 while configuring vlan vlan10',
                       str(e.exception))
-        self.assertEqual(check_call.call_count, 0)
+        self.assertEqual(ip_batch.call_count, 0)
 
-    @patch('subprocess.check_call')
-    def test_apply_vlan_filter_for_vf_failed_ip_link_set(self, check_call):
+    @patch('netplan.cli.utils.ip_batch')
+    def test_apply_vlan_filters_for_vfs_failed_ip_link_set(self, ip_batch):
         self._prepare_sysfs_dir_structure()
-        check_call.side_effect = CalledProcessError(-1, None)
+        ip_batch.side_effect = CalledProcessError(-1, None)
 
         with self.assertRaises(RuntimeError) as e:
-            sriov.apply_vlan_filter_for_vf('enp2', 'enp2s16f1', 'vlan10', 10, prefix=self.workdir.name)
+            sriov.apply_vlan_filters_for_vfs([('enp2', 'enp2s16f1', 'vlan10', 10)], prefix=self.workdir.name)
+
+        self.assertIn('failed setting SR-IOV VLAN filters for vlans vlan10',
+                      str(e.exception))
+
+    @patch('netplan.cli.utils.ip_batch')
+    def test_apply_vlan_filters_for_vfs_failed_ip_link_set_line(self, ip_batch):
+        self._prepare_sysfs_dir_structure()
+        ip_batch.side_effect = CalledProcessError(
+            1, None, stderr='RTNETLINK answers: Operation not supported\nCommand failed -:2\n')
 
-        self.assertIn('failed setting SR-IOV VLAN filter for vlan vlan10',
+        with self.assertRaises(RuntimeError) as e:
+            sriov.apply_vlan_filters_for_vfs([('enp2', 'enp2s16f1', 'vlan10', 10),
+                                              ('enp2', 'enp2s16f1', 'vlan20', 20)], prefix=self.workdir.name)
+
+        # all filters are attempted, only the failing one is reported
+        ip_batch.assert_called_once_with(['link set dev enp2 vf 3 vlan 10',
+                                          'link set dev enp2 vf 3 vlan 20'], force=True)
+        self.assertIn('failed setting SR-IOV VLAN filters for vlans vlan20 '
+                      '(ip link set command failed: RTNETLINK answers: Operation not supported',
                       str(e.exception))
 
+    @patch('subprocess.check_call')
     @patch('netifaces.interfaces')
     @patch('netplan.cli.sriov.get_vf_count_and_functions')
     @patch('netplan.cli.sriov.set_numvfs_for_pf')
     @patch('netplan.cli.sriov.perform_hardware_specific_quirks')
-    @patch('netplan.cli.sriov.apply_vlan_filter_for_vf')
+    @patch('netplan.cli.sriov.apply_vlan_filters_for_vfs')
     @patch('netplan.cli.utils.get_interface_driver_name')
     @patch('netplan.cli.utils.get_interface_macaddress')
     def test_apply_sriov_config(self, gim, gidn, apply_vlan, quirks,
-                                set_numvfs, get_counts, netifs):
+                                set_numvfs, get_counts, netifs, check_call):
         # set up the environment
         with open(os.path.join(self.workdir.name, "etc/netplan/test.yaml"), 'w') as fd:
             print('''network:
@@ -486,26 +549,30 @@ class TestSRIOV(unittest.TestCase):
         # make sure config_manager.parse() has been called
         self.assertTrue(self.configmanager.config)
         # check if the config got applied as expected
-        # we had 2 PFs, one having two VFs and the other only one
+        # we had 2 PFs, one having two VFs and the other only one, which
+        # are provisioned concurrently
         self.assertEqual(set_numvfs.call_count, 2)
-        self.assertListEqual(set_numvfs.call_args_list,
-                             [call('enp1', 2),
-                              call('enp2', 1)])
+        self.assertCountEqual(set_numvfs.call_args_list,
+                              [call('enp1', 2),
+                               call('enp2', 1)])
         # one of the pfs already had sufficient VFs allocated, so only enp1
         # changed the vf count and only that one should trigger quirks
         quirks.assert_called_once_with('enp1')
+        # udev is waited for only once
+        check_call.assert_called_once_with(['udevadm', 'settle'])
         # only one had a hardware vlan
-        apply_vlan.assert_called_once_with('enp2', 'enp2s16f1', 'vf1.15', 15)
+        apply_vlan.assert_called_once_with([('enp2', 'enp2s16f1', 'vf1.15', 15)])
 
+    @patch('subprocess.check_call')
     @patch('netifaces.interfaces')
     @patch('netplan.cli.sriov.get_vf_count_and_functions')
     @patch('netplan.cli.sriov.set_numvfs_for_pf')
     @patch('netplan.cli.sriov.perform_hardware_specific_quirks')
-    @patch('netplan.cli.sriov.apply_vlan_filter_for_vf')
+    @patch('netplan.cli.sriov.apply_vlan_filters_for_vfs')
     @patch('netplan.cli.utils.get_interface_driver_name')
     @patch('netplan.cli.utils.get_interface_macaddress')
     def test_apply_sriov_config_invalid_vlan(self, gim, gidn, apply_vlan, quirks,
-                                             set_numvfs, get_counts, netifs):
+                                             set_numvfs, get_counts, netifs, check_call):
         # set up the environment
         with open(os.path.join(self.workdir.name, "etc/netplan/test.yaml"), 'w') as fd:
             print('''network:
@@ -547,15 +614,16 @@ class TestSRIOV(unittest.TestCase):
                       str(e.exception))
         self.assertEqual(apply_vlan.call_count, 0)
 
+    @patch('subprocess.check_call')
     @patch('netifaces.interfaces')
     @patch('netplan.cli.sriov.get_vf_count_and_functions')
     @patch('netplan.cli.sriov.set_numvfs_for_pf')
     @patch('netplan.cli.sriov.perform_hardware_specific_quirks')
-    @patch('netplan.cli.sriov.apply_vlan_filter_for_vf')
+    @patch('netplan.cli.sriov.apply_vlan_filters_for_vfs')
     @patch('netplan.cli.utils.get_interface_driver_name')
     @patch('netplan.cli.utils.get_interface_macaddress')
     def test_apply_sriov_config_too_many_vlans(self, gim, gidn, apply_vlan, quirks,
-                                               set_numvfs, get_counts, netifs):
+                                               set_numvfs, get_counts, netifs, check_call):
         # set up the environment
         with open(os.path.join(self.workdir.name, "etc/netplan/test.yaml"), 'w') as fd:
             print('''network:
@@ -600,17 +668,19 @@ class TestSRIOV(unittest.TestCase):
 
         self.assertIn('interface enp2s16f1 for netplan device customvf1 (vf1.16) already has an SR-IOV vlan defined',
                       str(e.exception))
-        self.assertEqual(apply_vlan.call_count, 1)
+        # the VLAN filters are only applied once all of them are known
+        self.assertEqual(apply_vlan.call_count, 0)
 
+    @patch('subprocess.check_call')
     @patch('netifaces.interfaces')
     @patch('netplan.cli.sriov.get_vf_count_and_functions')
     @patch('netplan.cli.sriov.set_numvfs_for_pf')
     @patch('netplan.cli.sriov.perform_hardware_specific_quirks')
-    @patch('netplan.cli.sriov.apply_vlan_filter_for_vf')
+    @patch('netplan.cli.sriov.apply_vlan_filters_for_vfs')
     @patch('netplan.cli.utils.get_interface_driver_name')
     @patch('netplan.cli.utils.get_interface_macaddress')
     def test_apply_sriov_config_many_match(self, gim, gidn, apply_vlan, quirks,
-                                           set_numvfs, get_counts, netifs):
+                                           set_numvfs, get_counts, netifs, check_call):
         # set up the environment
         with open(os.path.join(self.workdir.name, "etc/netplan/test.yaml"), 'w') as fd:
             print('''network:
@@ -646,3 +716,89 @@ class TestSRIOV(unittest.TestCase):
 
         self.assertIn('matched more than one interface for a VF device: customvf1',
                       str(e.exception))
+
+    @patch('subprocess.check_call')
+    @patch('netplan.cli.utils.netplan_get_interface_mapping')
+    @patch('netplan.cli.sriov.set_numvfs_for_pf')
+    @patch('netplan.cli.sriov.perform_hardware_specific_quirks')
+    @patch('netplan.cli.sriov.apply_vlan_filters_for_vfs')
+    def test_apply_sriov_config_inventory(self, apply_vlan, quirks, set_numvfs, get_mapping, check_call):
+        with open(os.path.join(self.workdir.name, "etc/netplan/test.yaml"), 'w') as fd:
+            print('''network:
+  version: 2
+  renderer: networkd
+  ethernets:
+    pf1:
+      match:
+        driver: foo
+    pf2: {}
+    vf1:
+      link: pf1
+    vf2:
+      link: pf1
+    vf3:
+      link: pf2
+  vlans:
+    vlan1:
+      renderer: sriov
+      id: 10
+      link: vf1
+''', file=fd)
+
+        class MockInventory():
+            def __init__(self):
+                self.interfaces = ['enp1', 'pf2']
+                self.refreshed = 0
+
+            def refresh(self):
+                # the VFs appeared
+                self.interfaces = ['enp1', 'pf2', 'vf1', 'vf2', 'vf3']
+                self.refreshed += 1
+
+        inventory = MockInventory()
+        get_mapping.return_value = {'pf1': ['enp1'], 'pf2': ['pf2']}
+        set_numvfs.return_value = True
+
+        sriov.apply_sriov_config(self.configmanager, inventory)
+
+        # the PFs are matched by the match engine, against the inventory
+        get_mapping.assert_called_once_with(['enp1', 'pf2'], self.workdir.name)
+        self.assertCountEqual(set_numvfs.call_args_list, [call('enp1', 2), call('pf2', 1)])
+        self.assertCountEqual(quirks.call_args_list, [call('enp1'), call('pf2')])
+        check_call.assert_called_once_with(['udevadm', 'settle'])
+        self.assertEqual(inventory.refreshed, 1)
+        apply_vlan.assert_called_once_with([('enp1', 'vf1', 'vlan1', 10)])
+
+    @patch('subprocess.check_call')
+    @patch('netifaces.interfaces')
+    @patch('netplan.cli.sriov.set_numvfs_for_pf')
+    @patch('netplan.cli.sriov.perform_hardware_specific_quirks')
+    def test_apply_sriov_config_pf_failed(self, quirks, set_numvfs, netifs, check_call):
+        with open(os.path.join(self.workdir.name, "etc/netplan/test.yaml"), 'w') as fd:
+            print('''network:
+  version: 2
+  renderer: networkd
+  ethernets:
+    enp1: {}
+    enp2: {}
+    enp3: {}
+    enp1s16f1: {link: enp1}
+    enp2s16f1: {link: enp2}
+    enp3s16f1: {link: enp3}
+''', file=fd)
+        netifs.return_value = ['enp1', 'enp2', 'enp3']
+
+        def fail_numvfs(pf, _):
+            if pf != 'enp1':
+                raise RuntimeError('failed setting sriov_numvfs to 1 for %s' % pf)
+            return True
+        set_numvfs.side_effect = fail_numvfs
+
+        with self.assertRaises(RuntimeError) as e:
+            sriov.apply_sriov_config(self.configmanager)
+
+        # all PFs were attempted, the error of the first failed one is raised
+        self.assertEqual(set_numvfs.call_count, 3)
+        self.assertIn('failed setting sriov_numvfs to 1 for enp2', str(e.exception))
+        quirks.assert_called_once_with('enp1')
+        check_call.assert_not_called()
@@ -15,13 +15,18 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+import io
+import json
 import os
+import struct
+import subprocess
 import unittest
 import tempfile
 import glob
 import netifaces
 
 import netplan.cli.utils as utils
+from contextlib import redirect_stderr
 from unittest.mock import patch
 
 
@@ -162,6 +167,23 @@ class TestUtils(unittest.TestCase):
         iface = utils.find_matching_iface(DEVICES, match)
         self.assertEqual(iface, 'ens4')
 
+    @patch('netplan.cli.utils.get_interface_driver_name')
+    @patch('netplan.cli.utils.get_interface_macaddress')
+    def test_find_matching_iface_inventory(self, gim, gidn):
+        class MockInventory():
+            def macaddress(self, iface):
+                return '00:01:02:03:04:05' if iface in ['ens3', 'ens4'] else '00:00:00:00:00:00'
+
+            def driver_name(self, iface):
+                return 'foo' if iface == 'ens4' else None
+
+        match = {'name': 'e*', 'macaddress': '00:01:02:03:04:05', 'driver': 'f*'}
+        iface = utils.find_matching_iface(DEVICES, match, MockInventory())
+        self.assertEqual(iface, 'ens4')
+        # the devices are not looked at one by one
+        gim.assert_not_called()
+        gidn.assert_not_called()
+
     @patch('netifaces.ifaddresses')
     def test_interface_macaddress(self, ifaddr):
         ifaddr.side_effect = lambda _: {netifaces.AF_LINK: [{'addr': '00:01:02:03:04:05'}]}
@@ -219,6 +241,35 @@ class TestUtils(unittest.TestCase):
                 set(utils.netplan_get_ids_for_devtype("ethernets", self.workdir.name)),
                 set(["id_a", "id_b"]))
 
+    def test_netplan_get_ids_for_devtype_definition_order(self):
+        path = os.path.join(self.workdir.name, 'etc/netplan/a.yaml')
+        with open(path, 'w') as f:
+            f.write('''network:
+  ethernets:
+    id_c:
+      dhcp4: true
+    id_a:
+      dhcp4: true
+  bridges:
+    br0:
+      interfaces: [id_c]
+  vlans:
+    en-intra:
+      id: 3
+      link: id_a''')
+        path = os.path.join(self.workdir.name, 'etc/netplan/b.yaml')
+        with open(path, 'w') as f:
+            f.write('''network:
+  ethernets:
+    id_b:
+      dhcp4: true''')
+        self.assertListEqual(
+                utils.netplan_get_ids_for_devtype("ethernets", self.workdir.name),
+                ["id_c", "id_a", "id_b"])
+        self.assertListEqual(
+                utils.netplan_get_ids_for_devtype("bridges", self.workdir.name),
+                ["br0"])
+
     def test_netplan_get_ids_for_devtype_no_dev(self):
         path = os.path.join(self.workdir.name, 'etc/netplan/a.yaml')
         with open(path, 'w') as f:
@@ -230,6 +281,38 @@ class TestUtils(unittest.TestCase):
                 set(utils.netplan_get_ids_for_devtype("tunnels", self.workdir.name)),
                 set([]))
 
+    def test_netplan_get_interface_mapping(self):
+        path = os.path.join(self.workdir.name, 'etc/netplan/a.yaml')
+        with open(path, 'w') as f:
+            f.write('''network:
+  ethernets:
+    lan:
+      match:
+        macaddress: "00:01:02:03:04:0A"
+      set-name: lan0
+    wan:
+      match:
+        name: "ens*"
+        driver: "e1000*"
+    eth1:
+      dhcp4: true
+  bridges:
+    br0:
+      interfaces: [eth1]''')
+        sysfs = os.path.join(self.workdir.name, 'sys/class/net')
+        for iface, mac, driver in [('eth0', '00:01:02:03:04:0a', 'e1000e'),
+                                   ('eth1', '00:01:02:03:04:0b', 'e1000e'),
+                                   ('ens3', '00:01:02:03:04:0c', 'e1000e'),
+                                   ('ens4', '00:01:02:03:04:0d', 'virtio_net')]:
+            os.makedirs(os.path.join(sysfs, iface, 'device'))
+            with open(os.path.join(sysfs, iface, 'address'), 'w') as f:
+                f.write(mac + '\n')
+            os.symlink(os.path.join('..', '..', 'bus', 'pci', 'drivers', driver),
+                       os.path.join(sysfs, iface, 'device', 'driver'))
+        self.assertDictEqual(
+                utils.netplan_get_interface_mapping(DEVICES, self.workdir.name, sysfs),
+                {'lan': ['eth0'], 'eth1': ['eth1'], 'wan': ['ens3'], 'br0': ['br0']})
+
     def test_NetdefIdIterator_with_clear_netplan(self):
         utils.lib.netplan_clear_netdefs()
         self.assertSequenceEqual(list(utils._NetdefIdIterator("ethernets")), [])
@@ -265,6 +348,34 @@ class TestUtils(unittest.TestCase):
             ['networkctl', 'reconfigure', 'eth0', 'eth1']
         ])
 
+    def test_networkd_match_names(self):
+        path = os.path.join(self.workdir.name, '10-netplan-eth0.network')
+        with open(path, 'w') as f:
+            f.write('[Match]\nName=eth0 eth1\n\n[Network]\nName=ignored\n')
+        self.assertEqual(utils.networkd_match_names(path), {'eth0', 'eth1'})
+
+    def test_networkd_match_names_unknown(self):
+        path = os.path.join(self.workdir.name, '10-netplan-eth0.network')
+        with open(path, 'w') as f:
+            f.write('[Match]\nMACAddress=00:11:22:33:44:55\n')
+        self.assertIsNone(utils.networkd_match_names(path))
+        with open(path, 'w') as f:
+            f.write('[Match]\nName=eth*\n')
+        self.assertIsNone(utils.networkd_match_names(path))
+
+    def test_netplan_generate_changes(self):
+        os.makedirs(os.path.join(self.workdir.name, 'run', 'netplan'))
+        with open(os.path.join(self.workdir.name, utils.GENERATE_CHANGES), 'w') as f:
+            f.write('added eth0 /run/systemd/network/10-netplan-eth0.network\n'
+                    'removed - /run/systemd/system/netplan-ovs-cleanup.service\n')
+        self.assertEqual(utils.netplan_generate_changes(self.workdir.name), {
+            '/run/systemd/network/10-netplan-eth0.network': ('added', 'eth0'),
+            '/run/systemd/system/netplan-ovs-cleanup.service': ('removed', None)})
+        utils.netplan_clear_generate_changes(self.workdir.name)
+        self.assertIsNone(utils.netplan_generate_changes(self.workdir.name))
+        # clearing twice is fine
+        utils.netplan_clear_generate_changes(self.workdir.name)
+
     def test_is_nm_snap_enabled(self):
         self.mock_cmd = MockCmd('systemctl')
         path_env = os.environ['PATH']
@@ -322,6 +433,64 @@ class TestUtils(unittest.TestCase):
             ['systemctl', 'daemon-reload']
         ])
 
+    @patch('subprocess.run')
+    def test_ip_batch(self, mock):
+        utils.ip_batch(['link set dev eth0 down', 'link set dev eth0 name lan0'])
+        mock.assert_called_once()
+        self.assertEqual(mock.call_args[0][0], ['ip', '-batch', '-'])
+        self.assertEqual(mock.call_args[1]['input'], 'link set dev eth0 down\nlink set dev eth0 name lan0\n')
+
+    @patch('subprocess.run')
+    def test_ip_batch_empty(self, mock):
+        utils.ip_batch([])
+        mock.assert_not_called()
+
+    @patch('subprocess.run')
+    def test_ip_batch_force(self, mock):
+        utils.ip_batch(['addr flush eth0'], force=True)
+        self.assertEqual(mock.call_args[0][0], ['ip', '-force', '-batch', '-'])
+
+    def test_ip_batch_failed_commands(self):
+        commands = ['addr flush eth0', 'addr flush eth1', 'addr flush eth2']
+        err = subprocess.CalledProcessError(1, None, stderr='Device "eth0" does not exist.\nCommand failed -:1\n'
+                                                            'Device "eth2" does not exist.\nCommand failed -:3\n')
+        self.assertEqual(utils.ip_batch_failed_commands(commands, err), ['addr flush eth0', 'addr flush eth2'])
+        self.assertEqual(utils.ip_batch_failed_commands(commands, subprocess.CalledProcessError(1, None)), [])
+
+    def _nlmsg(self, msg_type, payload):
+        return struct.pack('=IHHII', 16 + len(payload), msg_type, 0, 1, 0) + payload
+
+    def _rtattr(self, rta_type, payload):
+        attr = struct.pack('=HH', 4 + len(payload), rta_type) + payload
+        return attr + b'\0' * (-len(attr) % 4)
+
+    def test_parse_netlink_links(self):
+        link = (struct.pack('=BxHiII', 0, 1, 42, 0, 0) +
+                self._rtattr(utils.IFLA_IFNAME, b'eth0\0') +
+                self._rtattr(utils.IFLA_ADDRESS, bytes([0, 1, 2, 3, 0xab, 0xcd])) +
+                self._rtattr(utils.IFLA_OPERSTATE, bytes([6])) +
+                self._rtattr(99, b'ignored'))
+        nameless = struct.pack('=BxHiII', 0, 1, 43, 0, 0) + struct.pack('=HH', 0, 0)
+        links = {}
+        self.assertFalse(utils._parse_netlink_links(self._nlmsg(utils.RTM_NEWLINK, link) +
+                                                    self._nlmsg(utils.RTM_NEWLINK, nameless), links))
+        self.assertDictEqual(links, {'eth0': {'index': 42, 'address': '00:01:02:03:ab:cd', 'operstate': 6}})
+        self.assertTrue(utils._parse_netlink_links(self._nlmsg(utils.NLMSG_DONE, b'\0' * 4), links))
+        self.assertFalse(utils._parse_netlink_links(struct.pack('=IHHII', 0, utils.NLMSG_DONE, 0, 1, 0), links))
+        with self.assertRaises(OSError):
+            utils._parse_netlink_links(self._nlmsg(utils.NLMSG_ERROR, struct.pack('=i', -1)), links)
+
+    def test_device_inventory(self):
+        sysfs = os.path.join(self.workdir.name, 'sys/class/net')
+        os.makedirs(os.path.join(sysfs, 'lo', 'device'))
+        os.symlink(os.path.join('..', '..', 'bus', 'drivers', 'foo'), os.path.join(sysfs, 'lo', 'device', 'driver'))
+        inventory = utils.DeviceInventory(sysfs)
+        self.assertIn('lo', inventory.interfaces)
+        self.assertEqual(inventory.macaddress('lo'), '00:00:00:00:00:00')
+        self.assertEqual(inventory.macaddress('nonexistent42'), '')
+        self.assertEqual(inventory.driver_name('lo'), 'foo')
+        self.assertIsNone(inventory.driver_name('nonexistent42'))
+
     def test_ip_addr_flush(self):
         self.mock_cmd = MockCmd('ip')
         path_env = os.environ['PATH']
@@ -330,3 +499,56 @@ class TestUtils(unittest.TestCase):
         self.assertEquals(self.mock_cmd.calls(), [
             ['ip', 'addr', 'flush', 'eth42']
         ])
+
+    @patch.dict(os.environ, {'NETPLAN_PROFILE': 'json', 'NETPLAN_TRACE_ID': 'parent'})
+    def test_profile(self):
+        profile = utils.Profile()
+        err = io.StringIO()
+        with redirect_stderr(err):
+            with profile.span('apply'):
+                with profile.span('generate'):
+                    pass
+                profile.count('devices', 2)
+                profile.count('devices')
+                # nothing is printed before the outermost span ended
+                self.assertEqual(err.getvalue(), '')
+        record = json.loads(err.getvalue())
+        self.assertEqual(record['process'], 'netplan')
+        self.assertEqual(record['pid'], os.getpid())
+        # the trace of the parent process is continued
+        self.assertEqual(record['trace'], 'parent')
+        self.assertEqual([span['name'] for span in record['spans']], ['apply', 'generate'])
+        for span in record['spans']:
+            self.assertGreaterEqual(span['wall_us'], 0)
+            self.assertGreaterEqual(span['cpu_us'], 0)
+        self.assertEqual(record['counters'], {'devices': 3})
+        self.assertEqual(os.environ['NETPLAN_TRACE_ID'], 'parent')
+
+    @patch.dict(os.environ, {'NETPLAN_PROFILE': 'json'})
+    def test_profile_new_trace(self):
+        traces = []
+
+        @utils.profiled('apply')
+        def apply():
+            traces.append(os.environ['NETPLAN_TRACE_ID'])
+
+        os.environ.pop('NETPLAN_TRACE_ID', None)
+        err = io.StringIO()
+        with redirect_stderr(err):
+            apply()
+            apply()
+        records = [json.loads(line) for line in err.getvalue().splitlines()]
+        self.assertEqual([r['trace'] for r in records], traces)
+        # each outermost span is a trace of its own
+        self.assertNotEqual(traces[0], traces[1])
+        self.assertNotIn('NETPLAN_TRACE_ID', os.environ)
+        self.assertEqual(records[0]['counters'], {})
+
+    @patch.dict(os.environ, {'NETPLAN_PROFILE': '1'})
+    def test_profile_disabled(self):
+        profile = utils.Profile()
+        err = io.StringIO()
+        with redirect_stderr(err):
+            with profile.span('apply'):
+                profile.count('devices')
+        self.assertEqual(err.getvalue(), '')